@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file AliasTable.cpp
+ * 
+ * Implementation of the AliasTable class for picking among weighted alternatives.
+ */
+
+#include "AliasTable.h"
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Builds the table using Vose's method. Weights that are negative or not finite count as zero, and
+ * if no weight is positive, every index is equally likely.
+ * 
+ * @param weights The weights of the indices.
+ */
+void AliasTable::Build(const std::vector<double>& weights)
+{
+    int n = int(weights.size());
+    bins.resize(n);
+    probabilities.resize(n);
+
+    double sum = 0;
+    for(auto w : weights)
+        sum += std::isfinite(w) && w > 0 ? w : 0;
+    for(int i = 0; i < n; i++)
+    {
+        double w = weights[i];
+        probabilities[i] = sum > 0 ? (std::isfinite(w) && w > 0 ? w/sum : 0) : 1.0/n;
+    }
+
+    // Bins that are underfull are topped up by overfull ones, which then become underfull or full
+    std::vector<double> scaled(n);
+    std::vector<int> small, large;
+    for(int i = 0; i < n; i++)
+    {
+        scaled[i] = probabilities[i]*n;
+        (scaled[i] < 1 ? small : large).push_back(i);
+    }
+    while(!small.empty() && !large.empty())
+    {
+        int s = small.back(), l = large.back();
+        small.pop_back();
+        bins[s] = { scaled[s], l };
+        scaled[l] -= 1 - scaled[s];
+        if(scaled[l] < 1)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // What is left is full, up to rounding errors
+    for(int i : large)
+        bins[i] = { 1, i };
+    for(int i : small)
+        bins[i] = { 1, i };
+}
+
+/**
+ * Picks an index.
+ * 
+ * @param r A uniformly random number in [0, 1).
+ * @returns A pair of the picked index and the probability of having picked it, or of -1 and 0 if
+ *          the table is empty.
+ */
+std::pair<int, double> AliasTable::Sample(double r) const
+{
+    int n = int(bins.size());
+    if(!n)
+        return { -1, 0 };
+    double u = r*n;
+    int i = std::min(int(u), n - 1);
+    int index = u - i < bins[i].threshold ? i : bins[i].alias;
+    return { index, probabilities[index] };
+}
+
+/**
+ * Returns the probability of picking an index.
+ * 
+ * @param index The index.
+ * @returns The probability of the index being picked by Sample.
+ */
+double AliasTable::GetProbability(int index) const
+{
+    return probabilities[index];
+}
+
+/**
+ * Returns true if there is nothing to pick from.
+ * 
+ * @returns True if the table was built from no weights.
+ */
+bool AliasTable::IsEmpty() const
+{
+    return bins.empty();
+}
@@ -0,0 +1,36 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file AliasTable.h
+ * 
+ * Declaration of the AliasTable class.
+ */
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+// Picks an index with probability proportional to its weight in constant time, using Walker's 
+// alias method. Each bin holds its own index with some probability and an alias otherwise
+class AliasTable
+{
+public:
+    void Build(const std::vector<double>& weights);
+
+    std::pair<int, double> Sample(double r) const;
+    double GetProbability(int index) const;
+    bool IsEmpty() const;
+
+private:
+    class Bin
+    {
+    public:
+        double threshold; // The probability of keeping the index of the bin rather than the alias
+        int alias;
+    };
+
+    std::vector<Bin> bins;
+    std::vector<double> probabilities;
+};
@@ -8,8 +8,8 @@
  */
 
 #include "AreaLight.h"
-#include "Windows.h"
 #include "EmissiveMaterial.h"
+#include "LightTree.h"
 #include "Renderer.h"
 #include "Triangle.h"
 #include "Utils.h"
@@ -78,10 +78,31 @@ void AreaLight::AddToScene(Scene* scn)
  */
 double AreaLight::GetArea() const
 {
-    auto area = abs((c1^c2).Length());
+    auto area = std::abs((c1^c2).Length());
     return area;
 }
 
+/**
+ * Gets the bounds of the light, which emits to the side its normal faces.
+ * 
+ * @param bounds The bounds of the light.
+ * @returns True, since the light can always be bounded.
+ */
+bool AreaLight::GetBounds(LightBounds& bounds) const
+{
+    BoundingBox box(pos, pos);
+    for(auto& corner : { pos + c1, pos + c2, pos + c1 + c2 })
+    {
+        for(int u = 0; u < 3; u++)
+        {
+            box.c1[u] = std::min(box.c1[u], corner[u] - eps);
+            box.c2[u] = std::max(box.c2[u], corner[u] + eps);
+        }
+    }
+    bounds = LightBounds(box, GetNormal(), 1, 0, (intensity*GetArea()).GetLuma());
+    return true;
+}
+
 /**
  * Checks if and where the given ray intersects the light.
  * 
@@ -203,7 +224,7 @@ std::tuple<Ray, Color, Normal, AreaPdf, AnglePdf> AreaLight::SampleRay(Randomize
     ray.direction = forward*cos(r1)*sqrt(r2) + right*sin(r1)*sqrt(r2) + normal*sqrt(1-r2);
 
     double areaPdf = 1.0f/GetArea();
-    double anglePdf = abs(ray.direction*normal)/pi;
+    double anglePdf = std::abs(ray.direction*normal)/pi;
     Color color = Color(1, 1, 1)*pi;
 
     return { ray, color, normal, areaPdf, anglePdf };
@@ -281,8 +302,8 @@ std::tuple<Color, Point> AreaLight::NextEventEstimation(const Renderer* renderer
 
         if(renderer->TraceShadowRay(lightRay, d*(1-eps)))
         {
-            double cosphi = abs(normal*toLight);
-            double costheta = abs(toLight*lightNormal);
+            double cosphi = std::abs(normal*toLight);
+            double costheta = std::abs(toLight*lightNormal);
             Color c(info.material->BRDF(info, toLight, component)*costheta*cosphi*intensity*GetArea()/(d*d));
             return { c, lightPoint };
         }
@@ -40,6 +40,7 @@ public:
     void Load(Bytestream& s);
 
     double GetArea() const;
+    bool GetBounds(LightBounds& bounds) const;
 protected:
     std::tuple<Point, Normal> SamplePoint(Randomizer& rnd) const;
 
@@ -101,9 +101,9 @@ Sample AshikhminShirley::GetSample(const IntersectionInfo& info, Randomizer& rnd
             return Sample(Color(0, 0, 0), outRay, 0, 0, false, 1);
 
         // TODO: the below is just the brdf, multiplied by pi, simplify
-        Color mod = (28.0/23.0)*Rd*(Color::Identity - Rs)*(1-pow(1-abs(N_s*w_i)/2.0, 5.0))*(1-pow(1-(N_s*w_o)/2.0, 5.0));
+        Color mod = (28.0/23.0)*Rd*(Color::Identity - Rs)*(1-pow(1-std::abs(N_s*w_i)/2.0, 5.0))*(1-pow(1-(N_s*w_o)/2.0, 5.0));
 
-        auto color = (adjoint ? abs(w_i*N_s)/abs(w_i*N_g) : 1.0)*mod/(df/(df+sp));
+        auto color = (adjoint ? std::abs(w_i*N_s)/std::abs(w_i*N_g) : 1.0)*mod/(df/(df+sp));
         double pdf = std::max(0.0, w_o*N/pi);
         double rpdf = std::max(0.0, w_i*adjN/pi);
         return Sample(color, outRay, pdf, rpdf, false, 1);
@@ -123,8 +123,8 @@ Sample AshikhminShirley::GetSample(const IntersectionInfo& info, Randomizer& rnd
             return Sample(Color(0, 0, 0), outRay, 0, 0, false, 2);
 
         Color fresnel = Rs + (Color::Identity - Rs)*(pow(1-w_o*hv, 5.0));
-        Color mod = abs(N*w_o)*fresnel/(max(N_s*w_i, N_s*w_o));
-        auto color = (adjoint ? abs(w_i*N_s)/abs(w_i*N_g) : 1.0f)*mod/(sp/(df+sp));
+        Color mod = std::abs(N*w_o)*fresnel/(max(N_s*w_i, N_s*w_o));
+        auto color = (adjoint ? std::abs(w_i*N_s)/std::abs(w_i*N_g) : 1.0f)*mod/(sp/(df+sp));
         double pdf = pow(N_s*hv, n)*(n + 1)/((w_i*hv)*8*pi);
         double rpdf = pdf;
         return Sample(color, outRay, pdf, rpdf, false, 2);
@@ -162,7 +162,7 @@ Color AshikhminShirley::BRDF(const IntersectionInfo& info, const Vector3d& out,
     h.Normalize();
 
     if(component == 1)
-        return Rd*(28.0/(23.0*pi))*(Color::Identity-Rs)*(1-pow(1-abs(N_s*out)/2, 5.0))*(1-pow(1-abs(N_s*wi)/2, 5.0))/(df/(df+sp));
+        return Rd*(28.0/(23.0*pi))*(Color::Identity-Rs)*(1-pow(1-std::abs(N_s*out)/2, 5.0))*(1-pow(1-std::abs(N_s*wi)/2, 5.0))/(df/(df+sp));
     else
         return (Rs + (Color::Identity - Rs)*pow(1-out*h, 5.0))*pow(N_s*h, double(n))*(double(n + 1)/(8*pi))/( (h*out)*max(N_s*wi, N_s*out) )/(sp/(df+sp));
 }
@@ -9,13 +9,14 @@
 
 #define NOMINMAX
 #include "BDPT.h"
+#include <algorithm>
+#include <cmath>
+#include <tuple>
 #include <vector>
 #include "Primitive.h"
 #include "Material.h"
+#include "SplatBuffer.h"
 #include "Utils.h"
-#include "Main.h"
-
-const int N = 20; // Number of samples per ray to be saved for optimized russian roulette
 
 /**
  * Constructor for the BDPSample class which is just a pair of numbers holding the number of light
@@ -28,72 +29,119 @@ BDSample::BDSample(int s, int t) : s(s), t(t)
 {
 }
 
+/**
+ * Constructor.
+ */
+BDPathStorage::BDPathStorage() : nVertices(0)
+{
+}
+
+/**
+ * Hands out a vertex, which stays valid until the storage is reset.
+ * 
+ * @returns A pointer to the vertex, zeroed as if newly allocated.
+ */
+BDVertex* BDPathStorage::NewVertex()
+{
+    if(nVertices == vertices.size())
+        vertices.emplace_back();
+    BDVertex& v = vertices[nVertices++];
+    v = BDVertex();
+    return &v;
+}
+
+/**
+ * Empties the paths and takes back all vertices handed out, keeping the memory for the next pixel
+ * sample.
+ */
+void BDPathStorage::Reset()
+{
+    nVertices = 0;
+    eyePath.clear();
+    lightPath.clear();
+    samples.clear();
+}
+
+thread_local BDPathStorage BDPT::storage;
+
 /**
  * Constructor of the BDPT renderer.
  * 
  * @param scene The scene to render.
  */
-BDPT::BDPT(std::shared_ptr<Scene> scene) : Renderer(scene)
+BDPT::BDPT(std::shared_ptr<Scene> scene) : Renderer(scene), efficientRoulette(false)
 {
-    roulette = new Roulette[XRES*YRES];
+    auto cam = scene->GetCamera();
+    roulette.resize(std::size_t(cam->GetXRes())*cam->GetYRes());
 }
 
 /**
- * Constructor of the efficiency-optimized Russian roulette threshold provider.
+ * Chooses between efficiency-optimized Russian roulette, which continues eye paths and traces
+ * connections in proportion to how much they are expected to contribute to the pixel, and 
+ * continuing every path with a fixed probability while tracing every connection.
+ * 
+ * @param efficient True for efficiency-optimized roulette, false for fixed roulette.
  */
-Roulette::Roulette() : sum(0), sumSq(0), sumRays(0)
+void BDPT::SetEfficientRoulette(bool efficient)
 {
-    m = new std::mutex();
+    efficientRoulette = efficient;
 }
 
 /**
- * Destructor.
+ * Constructor of the efficiency-optimized Russian roulette threshold provider.
  */
-Roulette::~Roulette()
+Roulette::Roulette() : mean(0), meanSq(0), meanRays(0), n(0)
 {
-    delete m;
 }
 
 /**
- * Adds a sample to calibrate the efficiency-optimized Russian roulette.
+ * Adds a sample to calibrate the efficiency-optimized Russian roulette. The first samples are
+ * averaged evenly, and once there are as many as the window, each new sample replaces a 
+ * fraction 1/window of the moments.
  * 
  * @param sample The estimator of the sample.
  * @param nrays The number of rays used to construct the sample.
  */
 void Roulette::AddSample(double sample, int nrays)
 {
-    std::lock_guard<std::mutex> lock(*m);
-
-    sum += sample;
-    sumSq += sample*sample;
-    sumRays += nrays;
-    samples.push_back(sample);
-    samplesSq.push_back(sample*sample);
-    rays.push_back(nrays);
-
-    if(samples.size() > N)
-    {
-        sum -= samples.front();
-        sumSq -= samplesSq.front();
-        sumRays -= rays.front();
+    if(n < window)
+        n++;
+    double w = 1.0/n;
+    mean += w*(sample - mean);
+    meanSq += w*(sample*sample - meanSq);
+    meanRays += w*(nrays - meanRays);
+}
 
-        samples.pop_front();
-        samplesSq.pop_front();
-        rays.pop_front();
-    }
+/**
+ * Returns the average of the latest samples of the pixel.
+ * 
+ * @returns The mean of the samples.
+ */
+double Roulette::GetMean() const
+{
+    return mean;
 }
 
 /**
- * Returns the threshhold of efficiency-optimized Russian roulette.
+ * Returns the threshhold of efficiency-optimized Russian roulette: the standard deviation of the
+ * samples per ray traced for them. A path contributing this much is worth a ray.
  * 
  * @returns The threshhold of efficiency-optimized Russian roulette.
  */
 double Roulette::GetThreshold() const
 {
-    std::lock_guard<std::mutex> lock(*m);
-    auto size = samples.size();
-    auto ret = std::sqrt((sumSq - (1/double(size))*sum*sum)/double(sumRays));
-    return std::isfinite(ret) ? std::abs(ret) : 1;
+    auto ret = std::sqrt(std::max(0.0, meanSq - mean*mean)/meanRays);
+    return std::isfinite(ret) ? ret : 1;
+}
+
+/**
+ * Returns true once the moments are based on enough samples to steer the roulette.
+ * 
+ * @returns True if a full window of samples has been added.
+ */
+bool Roulette::IsCalibrated() const
+{
+    return n == window;
 }
 
 /**
@@ -105,23 +153,26 @@ double Roulette::GetThreshold() const
  * @param samples A vector to push a (0, t) sample if a light was hit.
  * @param light The light that the light path is/was built from.
  * @param lightPath Specifies whether we are constructing the light path (as opposed to the eye path).
+ * @param pixelRoulette The roulette statistics of the pixel of an eye path, or null to continue
+ *                      the path with a fixed probability.
  * @returns The number of vertices on the light/eye portion of the path.
  */
-int BDPT::BuildPath(std::vector<BDVertex*>& path, std::vector<BDSample>& samples, Light* light, bool lightPath)
+int BDPT::BuildPath(std::vector<BDVertex*>& path, std::vector<BDSample>& samples, Light* light, 
+                    bool lightPath, const Roulette* pixelRoulette)
 {
-    double rr = 0.7;
+    double rr = fixedRr;
 
     while(path.size() < 3 || m_random.GetDouble(0.f, 1.f) < rr)
     {
         BDVertex* lastV = path.back();
 
-        auto [t, hitPrimitive, hitLight] = scene->Intersect(lastV->out);
-        if(t < 0)
+        auto [hit, hitLight] = scene->Intersect(lastV->out);
+        if(hit.t < 0)
             break;
 
         IntersectionInfo info;
-        if(hitPrimitive)
-            hitPrimitive->GenerateIntersectionInfo(lastV->out, info);
+        if(hit.primitive)
+            hit.primitive->GenerateIntersectionInfo(lastV->out, hit, info);
         else
             hitLight->GenerateIntersectionInfo(lastV->out, info);
 
@@ -129,46 +180,50 @@ int BDPT::BuildPath(std::vector<BDVertex*>& path, std::vector<BDSample>& samples
         double lSqr = v.Length2();
         v.Normalize();
 
-        BDVertex* newV = new BDVertex();
+        BDVertex* newV = storage.NewVertex();
         newV->info = info;
-        newV->pdf = lastV->sample.pdf*(abs(info.geometricnormal*info.direction))/(lSqr);
+        newV->pdf = lastV->sample.pdf*(std::abs(info.geometricnormal*info.direction))/(lSqr);
         newV->alpha = lastV->alpha*lastV->sample.color;
         newV->sample = info.material->GetSample(info, m_random, lightPath);
         newV->out = newV->sample.outRay;
         newV->specular = newV->sample.specular;
 
         newV->rr = path.size() < 3 ? 1 : lastV->rr*rr;
-        //rr = std::min(1.0, newV->alpha.GetLuminance()/roulette[x+y*XRES].GetThreshold());
-        rr = 0.7;
+        rr = fixedRr;
+        if(pixelRoulette && pixelRoulette->IsCalibrated())
+        {   // The throughput relative to that of the camera ray (which weighs the first vertex by 
+            // the inverse of its pdf) times the pixel mean is what the rest of the path should 
+            // bring to the pixel
+            double throughput = (newV->alpha*newV->sample.color).GetLuma()/path[0]->sample.color.GetLuma();
+            double expected = throughput*pixelRoulette->GetMean();
+            rr = expected > 0 ? std::clamp(expected/pixelRoulette->GetThreshold(), minRr, 1.0) : minRr;
+        }
 
         if(!lightPath)
         {
             if(!newV->alpha || hitLight && hitLight != light)
-            {
-                delete newV;
-                return (int) path.size();
-            }
+                return (int) path.size(); // The vertex is taken back along with the others
 
             path.push_back(newV);
 
             if(hitLight == light)
             {   // Direct light hit
-                lastV->rpdf = hitLight->Pdf(info, -v)*(abs(lastV->info.geometricnormal*v))/(lSqr);
+                lastV->rpdf = hitLight->Pdf(info, -v)*(std::abs(lastV->info.geometricnormal*v))/(lSqr);
                 samples.push_back(BDSample(0, (int) path.size()));
                 return (int) path.size() - 1;
             }
             else
-                lastV->rpdf = newV->sample.rpdf*abs(lastV->info.geometricnormal*v)/(lSqr);
+                lastV->rpdf = newV->sample.rpdf*std::abs(lastV->info.geometricnormal*v)/(lSqr);
         }
         else
         {
             if(!newV->sample.color)
             {
-                lastV->rpdf = newV->sample.rpdf*abs(lastV->info.geometricnormal*v)/(lSqr);
+                lastV->rpdf = newV->sample.rpdf*std::abs(lastV->info.geometricnormal*v)/(lSqr);
                 path.push_back(newV);
                 return (int) path.size();
             }
-            lastV->rpdf = newV->sample.rpdf*abs(lastV->info.geometricnormal*v)/(lSqr);
+            lastV->rpdf = newV->sample.rpdf*std::abs(lastV->info.geometricnormal*v)/(lSqr);
             path.push_back(newV);
         }
     }
@@ -191,7 +246,7 @@ int BDPT::BuildEyePath(int x, int y, std::vector<BDVertex*>& path,
                        const Camera& cam, std::vector<BDSample>& samples, 
                        Light* light)
 {
-    BDVertex* camPoint = new BDVertex();
+    BDVertex* camPoint = storage.NewVertex();
     camPoint->camU = m_random.GetDouble(0, 1), camPoint->camV = m_random.GetDouble(0, 1);
     camPoint->out = cam.GetRayFromPixel(x, y, m_random.GetDouble(0, 1), 
                                         m_random.GetDouble(0, 1), camPoint->camU,
@@ -201,7 +256,7 @@ int BDPT::BuildEyePath(int x, int y, std::vector<BDVertex*>& path,
     camPoint->info.normal = camPoint->info.geometricnormal = cam.dir;
     camPoint->info.position = camPoint->out.origin;
     camPoint->rpdf = 1;
-    double costheta = abs(camPoint->out.direction*cam.dir);
+    double costheta = std::abs(camPoint->out.direction*cam.dir);
     double lastPdf = 1/(cam.GetFilmArea()*costheta*costheta*costheta);
     camPoint->pdf = 1/(cam.GetFilmArea());
     Color lastSample = costheta*Color::Identity/lastPdf;
@@ -209,7 +264,8 @@ int BDPT::BuildEyePath(int x, int y, std::vector<BDVertex*>& path,
     camPoint->sample = Sample(lastSample, camPoint->out, lastPdf, camPoint->rpdf, false, 0);
 
     path.push_back(camPoint);
-    return BuildPath(path, samples, light, false);
+    return BuildPath(path, samples, light, false, 
+                     efficientRoulette ? &roulette[x + y*cam.GetXRes()] : nullptr);
 }
 
 /**
@@ -222,7 +278,7 @@ int BDPT::BuildEyePath(int x, int y, std::vector<BDVertex*>& path,
  */
 int BDPT::BuildLightPath(std::vector<BDVertex*>& path, Light* light)
 {
-    BDVertex* lightPoint = new BDVertex();
+    BDVertex* lightPoint = storage.NewVertex();
     auto [ray, color, normal, areaPdf, anglePdf] = light->SampleRay(m_random);
     lightPoint->out = ray;
     lightPoint->pdf = areaPdf;
@@ -234,9 +290,9 @@ int BDPT::BuildLightPath(std::vector<BDVertex*>& path, Light* light)
 
     lightPoint->sample = Sample(color, lightPoint->out, anglePdf, 0, false, 0);
     path.push_back(lightPoint);
-    std::vector<BDSample> dummy;
 
-    return BuildPath(path, dummy, light, true);
+    // Light paths never add any samples
+    return BuildPath(path, storage.samples, light, true, nullptr);
 }
 
 /**
@@ -284,11 +340,11 @@ Color BDPT::EvalPath(const std::vector<BDVertex*>& lightPath, const std::vector<
     double r = c.direction.Length();
     c.direction.Normalize();
 
-    result *= abs(lastL->info.geometricnormal*c.direction)*abs(lastE->info.normal*c.direction)/(r*r);
+    result *= std::abs(lastL->info.geometricnormal*c.direction)*std::abs(lastE->info.normal*c.direction)/(r*r);
     result *= lastL->alpha*lastE->alpha;
 
     // This BRDF is backwards so let's modify it 
-    double modifier = c.direction*lastL->info.geometricnormal > 0 ? abs(c.direction*lastL->info.normal)/abs(c.direction*lastL->info.geometricnormal) : 1;
+    double modifier = c.direction*lastL->info.geometricnormal > 0 ? std::abs(c.direction*lastL->info.normal)/std::abs(c.direction*lastL->info.geometricnormal) : 1;
 
     if(s > 1)
         result *= modifier*lastL->info.material->
@@ -366,12 +422,12 @@ double BDPT::PowerHeuristic(int s, int t, std::vector<BDVertex*>& lightPath,
                            std::vector<BDVertex*>& eyePath, Light* light, Camera* cam) const
 {
     double weight = 0;
-    std::vector<double> forwardProbs(s+t);
-    std::vector<double> backwardProbs(s+t);
-    std::vector<bool> specular(s+t);
-
-    for(int i = 0; i < s+t; i++)
-        specular[i] = false;
+    auto& forwardProbs = storage.forwardProbs;
+    auto& backwardProbs = storage.backwardProbs;
+    auto& specular = storage.specular;
+    forwardProbs.assign(s+t, 0);
+    backwardProbs.assign(s+t, 0);
+    specular.assign(s+t, false);
 
     // Tag specular vertices
     for(int i = 1; i < s+t-1; i++)
@@ -404,7 +460,7 @@ double BDPT::PowerHeuristic(int s, int t, std::vector<BDVertex*>& lightPath,
             newPdf = lastL->info.material->PDF(info, out, true, lastL->sample.component);
         else
             newPdf = light->Pdf(lastL->info, out);
-        forwardProbs[s] = newPdf*abs(lastE->info.geometricnormal*out)/(lSqr);
+        forwardProbs[s] = newPdf*std::abs(lastE->info.geometricnormal*out)/(lSqr);
 
         if(t > 2)
         {
@@ -415,7 +471,7 @@ double BDPT::PowerHeuristic(int s, int t, std::vector<BDVertex*>& lightPath,
             out.Normalize();
             newPdf = lastE->info.material->PDF(info, out, true, lastE->sample.component);
         
-            forwardProbs[s+1] = newPdf*abs(eyePath[t-2]->info.geometricnormal*out)/(lSqr);
+            forwardProbs[s+1] = newPdf*std::abs(eyePath[t-2]->info.geometricnormal*out)/(lSqr);
         }
     }
 
@@ -437,12 +493,12 @@ double BDPT::PowerHeuristic(int s, int t, std::vector<BDVertex*>& lightPath,
         double lSqr = out.Length2();
         out.Normalize();
         double newPdf;
-        double costheta = abs(lastE->info.geometricnormal*out);
+        double costheta = std::abs(lastE->info.geometricnormal*out);
         if(t == 1)
             newPdf = 1/(cam->GetFilmArea()*costheta*costheta*costheta);
         else
             newPdf = lastE->info.material->PDF(info, out, false, lastE->sample.component);
-        backwardProbs[s-1] = newPdf*abs(lastL->info.geometricnormal*out)/lSqr;
+        backwardProbs[s-1] = newPdf*std::abs(lastL->info.geometricnormal*out)/lSqr;
         if(s > 1)
         {
             info = lightPath[s-1]->info;
@@ -452,7 +508,7 @@ double BDPT::PowerHeuristic(int s, int t, std::vector<BDVertex*>& lightPath,
             out.Normalize();
             newPdf = lastL->info.material->PDF(info, out, false, lastL->sample.component);
 
-            backwardProbs[s-2] = newPdf*abs(lightPath[s-2]->info.geometricnormal*out)/(lSqr);
+            backwardProbs[s-2] = newPdf*std::abs(lightPath[s-2]->info.geometricnormal*out)/(lSqr);
         }
     }
     
@@ -501,17 +557,21 @@ double BDPT::WeighPath(int s, int t, std::vector<BDVertex*>& lightPath,
  * @param x The x coordinate of the pixel.
  * @param y The y coordinate of the pixel.
  * @param cam The camera used to capture the scene.
- * @param eyeImage The color buffer containing the evaluations of paths containing two or more
- *                 eye vertices.
- * @param lightImage The color buffer that holds the evaluations of paths with a single eye vertex.
+ * @param lightImage The splat buffer that holds the evaluations of paths with a single eye vertex.
+ * @returns The sum of the evaluations of paths containing two or more eye vertices.
  */
-void BDPT::RenderPixel(int x, int y, Camera& cam, 
-                       ColorBuffer& eyeImage, ColorBuffer& lightImage)
+Color BDPT::RenderPixel(int x, int y, Camera& cam, SplatBuffer& lightImage)
 {
-    std::vector<BDSample> samples;
-    std::vector<BDVertex*> eyePath, lightPath;
+    Color eyeResult = Color::Black;
+    storage.Reset();
+    auto& samples = storage.samples;
+    auto& eyePath = storage.eyePath;
+    auto& lightPath = storage.lightPath;
+    auto& pixelRoulette = roulette[x + y*cam.GetXRes()];
 
     auto [light, lightWeight] = scene->PickLight(m_random.GetDouble(0.0, 1.0));
+    if(!light)
+        return Color::Black;
 
     int lLength = BuildLightPath(lightPath, light);
     int eLength = BuildEyePath(x, y, eyePath, cam, samples, light);
@@ -532,6 +592,27 @@ void BDPT::RenderPixel(int x, int y, Camera& cam,
         eval *= weight;
 
         int s = sample.s, t = sample.t;
+
+        // Find the pixel the path ends up on, which for samples with a single eye vertex (which 
+        // end up on the light image) is not necessarily the one being rendered
+        int camx = x, camy = y;
+        double costheta;
+        if(t == 1)
+        {
+            Ray camRay(lightPath[s-1]->out.origin, cam.pos - lightPath[s-1]->out.origin);
+            camRay.direction.Normalize();
+
+            bool hitCam;
+            std::tie(hitCam, camx, camy) = cam.GetPixelFromRay(camRay, eyePath[0]->camU, eyePath[0]->camV);
+            if(!hitCam)
+                continue;
+            costheta = std::abs(cam.dir*camRay.direction);
+        }
+        else
+            costheta = std::abs(cam.dir*eyePath[0]->out.direction);
+        double mod = costheta*costheta*costheta*costheta*cam.GetFilmArea();
+        Color result = eval/mod/lightWeight;
+
         // Build the connecting vertex
         if(s > 0)
         {
@@ -542,11 +623,15 @@ void BDPT::RenderPixel(int x, int y, Camera& cam,
             double r = c.direction.Length();
             c.direction.Normalize();
 
-            /*auto q = std::min(1.0, eval.GetLuminance()/roulette[x+y*XRES].GetThreshold());
-
-            if(m_random.GetDouble(0, 1) > q)
-                continue;
-            eval /= q;*/
+            // Connections contributing less than the threshold are only traced some of the time,
+            // using the statistics of the pixel being rendered also for the light image
+            if(pixelRoulette.IsCalibrated() && efficientRoulette)
+            {
+                double q = std::min(1.0, result.GetLuma()/pixelRoulette.GetThreshold());
+                if(m_random.GetDouble(0, 1) >= q)
+                    continue;
+                result /= q;
+            }
 
             if(!TraceShadowRay(c, (1-eps)*r) || r < eps)
                 continue;
@@ -554,57 +639,42 @@ void BDPT::RenderPixel(int x, int y, Camera& cam,
 
         rays += 1;
 
-        if(sample.t == 1) // These samples end up on the light image
-        {
-            Ray camRay(lightPath[sample.s-1]->out.origin, 
-                       cam.pos - lightPath[sample.s-1]->out.origin);
-            camRay.direction.Normalize();
-
-            auto [hitCam, camx, camy] = cam.GetPixelFromRay(camRay, eyePath[0]->camU, eyePath[0]->camV);
-            if(!hitCam)
-                continue;
-            double costheta = abs(cam.dir*camRay.direction);
-            double mod = costheta*costheta*costheta*costheta*cam.GetFilmArea();
-            Color result = eval/mod/lightWeight;
-            if(result.IsValid())
-                lightImage.AddColor(camx, camy, result);
-        }
+        if(!result.IsValid())
+            continue;
+        if(t == 1)
+            lightImage.AddColor(camx, camy, result);
         else
-        {
-            double costheta = abs(cam.dir*eyePath[0]->out.direction);
-            double mod = costheta*costheta*costheta*costheta*(cam.GetFilmArea());
-            Color result = eval/mod/lightWeight;
-            if(result.IsValid())
-                eyeImage.AddColor(x, y, result);
-        }
+            eyeResult += result;
     }
 
-    roulette[x+y*XRES].AddSample((eyeImage.GetPixel(x, y) + lightImage.GetPixel(x, y)).GetLuma(), rays);
-
-    for(unsigned int s = 1; s < lightPath.size() + 1; s++)
-        delete lightPath[s-1];
-    for(unsigned int t = 1; t < eyePath.size() + 1; t++)
-        delete eyePath[t-1];
+    pixelRoulette.AddSample(eyeResult.GetLuma(), rays);
+    return eyeResult;
 }
 
 /**
- * Renders the scene to a color buffer.
+ * Renders a tile of the image. Paths with a single eye vertex can end up on any pixel, so they are
+ * splatted rather than added to the tile.
  * 
- * @param cam The camera used to capture the scene.
- * @param colBuf The color buffer to render to.
+ * @param cam The camera to render from.
+ * @param colBuf The color buffer of the tile to render to.
+ * @param splats The buffer to add the light image to.
+ * @param x0 The x coordinate of the upper left pixel of the tile in the image.
+ * @param y0 The y coordinate of the upper left pixel of the tile in the image.
+ * @param pass The number of passes over the tile before this one.
  */
-void BDPT::Render(Camera& cam, ColorBuffer& colBuf)
+void BDPT::RenderTile(Camera& cam, ColorBuffer& colBuf, SplatBuffer& splats, int x0, int y0, unsigned int pass)
 {
-    ColorBuffer lightImage(colBuf.GetXRes(), colBuf.GetYRes(), Color::Black);
-    ColorBuffer eyeImage(colBuf.GetXRes(), colBuf.GetYRes(), Color::Black);
-
+    int nPaths = 0;
     for(int x = 0; x < colBuf.GetXRes(); x++)
+    {
         for(int y = 0; y < colBuf.GetYRes() && !stopping; y++)
-            RenderPixel(x, y, cam, eyeImage, lightImage);
-
-    for(int x = 0; x < colBuf.GetXRes(); x++)
-        for(int y = 0; y < colBuf.GetYRes(); y++)
-            colBuf.AddColor(x, y, eyeImage.GetPixel(x, y) + lightImage.GetPixel(x, y));
+        {
+            m_random.Seed((y0 + y)*cam.GetXRes() + x0 + x, pass);
+            colBuf.AddColor(x, y, RenderPixel(x0 + x, y0 + y, cam, splats));
+            nPaths++;
+        }
+    }
+    splats.AddPaths(nPaths);
 }
 
 /**
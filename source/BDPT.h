@@ -13,27 +13,29 @@
 #include "Randomizer.h"
 #include "IntersectionInfo.h"
 #include "Sample.h"
-#include <mutex>
+#include <deque>
+#include <vector>
 
 class Ray;
 class Primitive;
 
+// Running statistics of the samples of a pixel for efficiency-optimized Russian roulette. The 
+// moments are averaged over roughly the latest window samples, without keeping the samples. The
+// tile scheduler never hands a pixel to two threads at once, so there is nothing to lock
 class Roulette
 {
 public:
     Roulette();
-    ~Roulette();
     void AddSample(double sample, int rays);
+    double GetMean() const;
     double GetThreshold() const;
-    
-private:
-    std::mutex* m;
-    std::list<double> samples;
-    std::list<double> samplesSq;
-    std::list<int> rays;
+    bool IsCalibrated() const;
 
-    double sum, sumSq;
-    int sumRays;
+    static const int window = 20;
+
+private:
+    double mean, meanSq, meanRays;
+    int n;
 };
 
 class BDSample
@@ -62,17 +64,39 @@ private:
     double camU, camV; // Only used by the eye point
 };
 
+// The vertices and scratch space of the paths of a pixel sample. They are kept from one sample to
+// the next and handed out again after a reset, so building and weighing paths does not allocate
+class BDPathStorage
+{
+public:
+    BDPathStorage();
+    BDVertex* NewVertex();
+    void Reset();
+
+    std::vector<BDVertex*> eyePath, lightPath;
+    std::vector<BDSample> samples;
+    std::vector<double> forwardProbs, backwardProbs;
+    std::vector<bool> specular;
+
+private:
+    std::deque<BDVertex> vertices; // A deque, since growing it must not move the vertices
+    std::size_t nVertices;
+};
+
 class BDPT : public Renderer
 {
 public:
     BDPT(std::shared_ptr<Scene> scene);
 
-    void Render(Camera& cam, ColorBuffer& colBuf);
+    void RenderTile(Camera& cam, ColorBuffer& colBuf, SplatBuffer& splats, int x0, int y0, unsigned int pass);
+
+    void SetEfficientRoulette(bool efficient);
 
 protected:
-    void RenderPixel(int x, int y, Camera& cam, ColorBuffer& eyeImage, ColorBuffer& lightImage);
+    Color RenderPixel(int x, int y, Camera& cam, SplatBuffer& lightImage);
 
-    int BuildPath(std::vector<BDVertex*>& path, std::vector<BDSample>& samples, Light* light, bool lightPath);
+    int BuildPath(std::vector<BDVertex*>& path, std::vector<BDSample>& samples, Light* light, 
+                  bool lightPath, const Roulette* pixelRoulette);
 
     int BuildEyePath(int x, int y, std::vector<BDVertex*>& path, const Camera& cam,
                      std::vector<BDSample>& samples, Light* light);
@@ -91,7 +115,11 @@ protected:
     void Save(Bytestream& stream) const;
     void Load(Bytestream& stream);
 
-    Roulette* roulette;
-    
-    Randomizer m_random;
+    std::vector<Roulette> roulette;
+    bool efficientRoulette;
+
+    static constexpr double fixedRr = 0.7; // The continuation probability of fixed roulette
+    static constexpr double minRr = 0.05; // The lowest continuation probability of eye paths
+
+    static thread_local BDPathStorage storage;
 };
@@ -0,0 +1,738 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file BVH.cpp
+ * 
+ * Implementation of the BVH class, a bounding volume hierarchy built with the binned
+ * surface-area heuristic.
+ */
+
+#include "BVH.h"
+#include "BoundingBox.h"
+#include "Bytestream.h"
+#include "Primitive.h"
+#include "Ray.h"
+#include "SceneCache.h"
+#include "Timer.h"
+#include "Utils.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+const double BVH::cost_trav = 0.125;
+
+/**
+ * Rounds a double to the closest float that is no greater.
+ * 
+ * @param d The double to round.
+ * @returns The rounded value.
+ */
+float RoundDown(double d)
+{
+    float f = (float) d;
+    return f > d ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+/**
+ * Rounds a double to the closest float that is no smaller.
+ * 
+ * @param d The double to round.
+ * @returns The rounded value.
+ */
+float RoundUp(double d)
+{
+    float f = (float) d;
+    return f < d ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+/**
+ * Constructor.
+ */
+BVH::BVH()
+{
+}
+
+/**
+ * Destructor.
+ */
+BVH::~BVH()
+{
+}
+
+/**
+ * Constructor, creating an empty box.
+ */
+BVH::BuildBox::BuildBox()
+{
+    for(int u = 0; u < 3; u++)
+        c1[u] = inf, c2[u] = -inf;
+}
+
+/**
+ * Grows the box to enclose another one.
+ * 
+ * @param p1 The minimal corner of the box to enclose.
+ * @param p2 The maximal corner of the box to enclose.
+ */
+void BVH::BuildBox::Enclose(const double* p1, const double* p2)
+{
+    for(int u = 0; u < 3; u++)
+    {
+        c1[u] = std::min(c1[u], p1[u]);
+        c2[u] = std::max(c2[u], p2[u]);
+    }
+}
+
+/**
+ * Calculates the surface area of the box.
+ * 
+ * @returns The surface area, or 0 if the box is empty.
+ */
+double BVH::BuildBox::GetArea() const
+{
+    double dx = c2[0] - c1[0], dy = c2[1] - c1[1], dz = c2[2] - c1[2];
+    return c1[0] <= c2[0] ? 2*(dx*dy + dx*dz + dy*dz) : 0;
+}
+
+/**
+ * Turns a node into a leaf holding the given primitives.
+ * 
+ * @param node The index of the node.
+ * @param prims The primitives being built.
+ * @param begin The first primitive of the leaf.
+ * @param end One past the last primitive of the leaf.
+ */
+void BVH::MakeLeaf(int node, const std::vector<BuildPrimitive>& prims, int begin, int end)
+{
+    nodes[node].offset = (int) primitiveIndices.size();
+    nodes[node].nPrimitives = (unsigned short) (end - begin);
+    for(int i = begin; i < end; i++)
+        primitiveIndices.push_back(prims[i].index);
+}
+
+/**
+ * Builds the subtree of a range of primitives by splitting it at the bin boundary with the
+ * smallest surface-area heuristic cost, or by count where the centroids can't be told apart.
+ * 
+ * @param prims The primitives being built, which get reordered so each subtree is contiguous.
+ * @param begin The first primitive of the subtree.
+ * @param end One past the last primitive of the subtree.
+ * @param depth The depth of the subtree.
+ * @param rootArea The surface area of the whole hierarchy.
+ * @returns The index of the root node of the subtree.
+ */
+int BVH::BuildNode(std::vector<BuildPrimitive>& prims, int begin, int end, int depth, double rootArea)
+{
+    int node = (int) nodes.size();
+    nodes.emplace_back();
+
+    BuildBox bbox, centroids;
+    for(int i = begin; i < end; i++)
+    {
+        bbox.Enclose(prims[i].c1, prims[i].c2);
+        centroids.Enclose(prims[i].centroid, prims[i].centroid);
+    }
+    for(int u = 0; u < 3; u++)
+    {
+        nodes[node].c1[u] = RoundDown(bbox.c1[u]);
+        nodes[node].c2[u] = RoundUp(bbox.c2[u]);
+    }
+
+    int n = end - begin;
+    double area = bbox.GetArea();
+    double relativeArea = std::isfinite(area) && rootArea > 0 ? area/rootArea : 1;
+
+    // Find the cheapest split along the bin boundaries of all axes
+    double bestcost = inf;
+    int bestaxis = -1, bestbin = 0;
+    for(int u = 0; u < 3 && n > 1; u++)
+    {
+        double extent = centroids.c2[u] - centroids.c1[u];
+        if(!(extent > 0) || !std::isfinite(extent))
+            continue;
+
+        int counts[nBins] = {};
+        BuildBox bins[nBins];
+        for(int i = begin; i < end; i++)
+        {
+            int b = min(nBins - 1, (int) (nBins*(prims[i].centroid[u] - centroids.c1[u])/extent));
+            counts[b]++;
+            bins[b].Enclose(prims[i].c1, prims[i].c2);
+        }
+
+        // Sweep from the right to get the cost of everything to the right of each boundary
+        double rightcost[nBins];
+        BuildBox rightbox;
+        int nRight = 0;
+        for(int b = nBins - 1; b > 0; b--)
+        {
+            rightbox.Enclose(bins[b].c1, bins[b].c2);
+            nRight += counts[b];
+            rightcost[b] = nRight ? nRight*rightbox.GetArea() : 0;
+        }
+
+        BuildBox leftbox;
+        int nLeft = 0;
+        for(int b = 1; b < nBins; b++)
+        {
+            leftbox.Enclose(bins[b - 1].c1, bins[b - 1].c2);
+            nLeft += counts[b - 1];
+            if(!nLeft || nLeft == n)
+                continue;
+            double cost = cost_trav + (nLeft*leftbox.GetArea() + rightcost[b])/area;
+            if(cost < bestcost)
+                bestcost = cost, bestaxis = u, bestbin = b;
+        }
+    }
+
+    if(n == 1 || (n <= maxLeafSize && !(bestcost < n)))
+    {
+        MakeLeaf(node, prims, begin, end);
+        statistics.AddLeaf(n, depth);
+        statistics.sahCost += relativeArea*n;
+        return node;
+    }
+
+    int mid;
+    if(bestaxis >= 0 && depth < maxDepth/2)
+    {
+        double extent = centroids.c2[bestaxis] - centroids.c1[bestaxis];
+        auto it = std::partition(prims.begin() + begin, prims.begin() + end, [&](const BuildPrimitive& p)
+        {
+            return min(nBins - 1, (int) (nBins*(p.centroid[bestaxis] - centroids.c1[bestaxis])/extent)) < bestbin;
+        });
+        mid = (int) (it - prims.begin());
+        nodes[node].axis = (unsigned char) bestaxis;
+    }
+    else
+    {
+        // Either the centroids can't be told apart or the tree is getting too deep, so halve the
+        // primitives along the longest axis to keep the depth within the traversal stack
+        int a = 0;
+        for(int u = 1; u < 3; u++)
+            if(centroids.c2[u] - centroids.c1[u] > centroids.c2[a] - centroids.c1[a])
+                a = u;
+        mid = (begin + end)/2;
+        std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end, [&](const BuildPrimitive& p, const BuildPrimitive& q)
+        {
+            return p.centroid[a] < q.centroid[a];
+        });
+        nodes[node].axis = (unsigned char) a;
+    }
+
+    statistics.nNodes++;
+    statistics.sahCost += relativeArea*cost_trav;
+
+    BuildNode(prims, begin, mid, depth + 1, rootArea);
+    int right = BuildNode(prims, mid, end, depth + 1, rootArea);
+    nodes[node].offset = right;
+    nodes[node].nPrimitives = 0;
+    return node;
+}
+
+/**
+ * Builds the hierarchy from a set of primitives.
+ * 
+ * @param shapes The primitives to build the partition structure for.
+ */
+void BVH::Build(const std::vector<const Primitive*>& shapes)
+{
+    Timer timer;
+    primitives = shapes;
+    nodes.clear();
+    primitiveIndices.clear();
+    statistics = PartitioningStatistics();
+
+    std::vector<BuildPrimitive> prims;
+    prims.reserve(primitives.size());
+    BuildBox bbox;
+    for(int i = 0; i < (int) primitives.size(); i++)
+    {
+        auto box = primitives[i]->GetBoundingBox();
+        BuildPrimitive p;
+        for(int u = 0; u < 3; u++)
+        {
+            p.c1[u] = box.c1[u];
+            p.c2[u] = box.c2[u];
+            p.centroid[u] = (box.c1[u] + box.c2[u])/2;
+        }
+        p.index = i;
+        prims.push_back(p);
+        bbox.Enclose(p.c1, p.c2);
+    }
+
+    if(!prims.empty())
+    {
+        double rootArea = bbox.GetArea();
+        BuildNode(prims, 0, (int) prims.size(), 0, std::isfinite(rootArea) ? rootArea : 0);
+    }
+    nodes.shrink_to_fit();
+    primitiveIndices.shrink_to_fit();
+
+    statistics.buildTime = timer.GetTime();
+    statistics.memory = nodes.size()*sizeof(BVHNode) + primitiveIndices.size()*sizeof(int) + primitives.size()*sizeof(const Primitive*);
+}
+
+/**
+ * Intersects the contents of the hierarchy with a ray.
+ * 
+ * @param ray The ray to intersect with.
+ * @param tmin The smallest distance along the ray to find intersections.
+ * @param tmax The greatest distance along the ray to find intersections.
+ * @returns The closest hit, with a distance of -inf if no intersection happened.
+ */
+HitRecord BVH::Intersect(const Ray& ray, double tmin, double tmax) const
+{
+    if(nodes.empty())
+        return HitRecord();
+
+    HitRecord minhit;
+    minhit.t = inf;
+    IntersectSubtree(0, ray, tmin, tmax, minhit);
+
+    if(minhit.primitive)
+        return minhit;
+    return HitRecord();
+}
+
+/**
+ * Intersects the contents of a subtree of the hierarchy with a ray, keeping the closest hit.
+ * 
+ * @param node The root of the subtree.
+ * @param ray The ray to intersect with.
+ * @param tmin The smallest distance along the ray to find intersections.
+ * @param tmax The greatest distance along the ray to find intersections.
+ * @param minhit The closest hit so far, with a distance of inf if there is none, replaced by any
+ *               closer hit in the subtree.
+ */
+void BVH::IntersectSubtree(int node, const Ray& ray, double tmin, double tmax, HitRecord& minhit) const
+{
+    Vector3d invDir(1/ray.direction.x, 1/ray.direction.y, 1/ray.direction.z);
+
+    int stack[maxDepth];
+    int stackSize = 0;
+
+    while(true)
+    {
+        const BVHNode& n = nodes[node];
+
+        // Clip the ray against the box of the node; a NaN from a ray running along a face of the
+        // box fails both comparisons and leaves the interval alone
+        double tnear = tmin, tfar = min(tmax, minhit.t);
+        for(int u = 0; u < 3 && tnear <= tfar; u++)
+        {
+            double t1 = (n.c1[u] - ray.origin[u])*invDir[u];
+            double t2 = (n.c2[u] - ray.origin[u])*invDir[u];
+            if(t1 > t2)
+                std::swap(t1, t2);
+            if(t1 > tnear)
+                tnear = t1;
+            if(t2 < tfar)
+                tfar = t2;
+        }
+
+        if(tnear <= tfar)
+        {
+            if(!n.IsLeaf())
+            {
+                // Visit the child on the near side of the split axis first
+                if(invDir[n.axis] < 0)
+                    stack[stackSize++] = node + 1, node = n.offset;
+                else
+                    stack[stackSize++] = n.offset, node = node + 1;
+                continue;
+            }
+
+            const int* indices = primitiveIndices.data() + n.offset;
+            for(int i = 0; i < n.nPrimitives; i++)
+            {
+                HitRecord hit = primitives[indices[i]]->IntersectHit(ray);
+                if(hit.t >= tmin && hit.t <= tmax && hit.t < minhit.t)
+                    minhit = hit;
+            }
+        }
+
+        if(!stackSize)
+            return;
+        node = stack[--stackSize];
+    }
+}
+
+/**
+ * Checks if anything blocks a ray between two distances along it, stopping at the first
+ * primitive found, in no particular order.
+ * 
+ * @param ray The ray to intersect with.
+ * @param tmin The smallest distance along the ray to find intersections.
+ * @param tmax The greatest distance along the ray to find intersections.
+ * @returns True if any primitive intersects the ray between tmin and tmax.
+ */
+bool BVH::Occluded(const Ray& ray, double tmin, double tmax) const
+{
+    if(nodes.empty())
+        return false;
+    return OccludedSubtree(0, ray, tmin, tmax);
+}
+
+/**
+ * Checks if anything in a subtree of the hierarchy blocks a ray between two distances along it.
+ * 
+ * @param node The root of the subtree.
+ * @param ray The ray to intersect with.
+ * @param tmin The smallest distance along the ray to find intersections.
+ * @param tmax The greatest distance along the ray to find intersections.
+ * @returns True if any primitive of the subtree intersects the ray between tmin and tmax.
+ */
+bool BVH::OccludedSubtree(int node, const Ray& ray, double tmin, double tmax) const
+{
+    Vector3d invDir(1/ray.direction.x, 1/ray.direction.y, 1/ray.direction.z);
+
+    int stack[maxDepth];
+    int stackSize = 0;
+
+    while(true)
+    {
+        const BVHNode& n = nodes[node];
+
+        double tnear = tmin, tfar = tmax;
+        for(int u = 0; u < 3 && tnear <= tfar; u++)
+        {
+            double t1 = (n.c1[u] - ray.origin[u])*invDir[u];
+            double t2 = (n.c2[u] - ray.origin[u])*invDir[u];
+            if(t1 > t2)
+                std::swap(t1, t2);
+            if(t1 > tnear)
+                tnear = t1;
+            if(t2 < tfar)
+                tfar = t2;
+        }
+
+        if(tnear <= tfar)
+        {
+            if(!n.IsLeaf())
+            {
+                stack[stackSize++] = n.offset;
+                node = node + 1;
+                continue;
+            }
+
+            const int* indices = primitiveIndices.data() + n.offset;
+            for(int i = 0; i < n.nPrimitives; i++)
+            {
+                double t = primitives[indices[i]]->Intersect(ray);
+                if(t >= tmin && t <= tmax)
+                    return true;
+            }
+        }
+
+        if(!stackSize)
+            return false;
+        node = stack[--stackSize];
+    }
+}
+
+/**
+ * Describes the hierarchy built by the last call to Build.
+ * 
+ * @returns A human readable summary of the hierarchy.
+ */
+std::string BVH::GetStatistics() const
+{
+    return "BVH of " + std::to_string(primitives.size()) + " primitives: " + statistics.ToString();
+}
+
+/**
+ * Saves the hierarchy to a cache.
+ * 
+ * @param writer The writer of the cache.
+ */
+void BVH::Save(CacheWriter& writer) const
+{
+    writer << ID_BVH << (unsigned long long) primitives.size() << nodes << primitiveIndices;
+    statistics.Save(writer);
+}
+
+/**
+ * Loads a hierarchy saved to a cache.
+ * 
+ * @param reader The reader of the section of the cache that the hierarchy was saved to.
+ * @param shapes The primitives that the hierarchy was built for.
+ * @returns True if the section held a BVH built for as many primitives.
+ */
+bool BVH::Load(CacheReader& reader, const std::vector<const Primitive*>& shapes)
+{
+    unsigned char id = 0;
+    unsigned long long nPrimitives = 0;
+    reader >> id >> nPrimitives;
+    if(id != ID_BVH || nPrimitives != shapes.size())
+        return false;
+
+    primitives = shapes;
+    reader >> nodes >> primitiveIndices;
+    statistics.Load(reader);
+    return reader.IsGood() && Validate();
+}
+
+/**
+ * Checks that the nodes of a loaded hierarchy only refer to nodes and primitives that exist, and
+ * that the hierarchy is no deeper than the traversal stack allows.
+ * 
+ * @returns True if the hierarchy can be traversed safely.
+ */
+bool BVH::Validate() const
+{
+    int nNodes = (int) nodes.size();
+    std::vector<int> depths(nNodes, 0);
+    for(int i = 0; i < nNodes; i++)
+    {
+        const BVHNode& n = nodes[i];
+        if(depths[i] >= maxDepth)
+            return false;
+        if(n.IsLeaf())
+        {
+            if(n.offset < 0 || (long long) n.offset + n.nPrimitives > (long long) primitiveIndices.size())
+                return false;
+            continue;
+        }
+        // The children come after their parent, so the depths are known before they are needed
+        if(n.offset <= i + 1 || n.offset >= nNodes || n.axis > 2)
+            return false;
+        depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+        depths[n.offset] = std::max(depths[n.offset], depths[i] + 1);
+    }
+    return std::all_of(primitiveIndices.begin(), primitiveIndices.end(), [this](int p) { return p >= 0 && p < (int) primitives.size(); });
+}
+
+/**
+ * Intersects a batch of rays with the hierarchy, each between zero and infinity. The rays are
+ * traced in packets of neighbouring rays, or one by one where a packet would not hold together.
+ * 
+ * @param rays The rays to intersect with.
+ * @param n The number of rays.
+ * @param hits The closest hit of each ray, with a distance of -inf if no intersection happened.
+ */
+void BVH::Intersect(const Ray* rays, int n, HitRecord* hits) const
+{
+    for(int i = 0; i < n; i += RayPacket::size)
+    {
+        int m = std::min(RayPacket::size, n - i);
+        if(m >= minPacketRays && IsCoherent(rays + i, m))
+            IntersectPacket(RayPacket(rays + i, m), hits + i);
+        else
+            for(int j = i; j < i + m; j++)
+                hits[j] = Intersect(rays[j], 0, inf);
+    }
+}
+
+/**
+ * Checks a batch of rays for anything blocking them, each between zero and its own distance. The
+ * rays are traced in packets of neighbouring rays, or one by one where a packet would not hold
+ * together.
+ * 
+ * @param rays The rays to check.
+ * @param tmax The greatest distance along each ray to find intersections.
+ * @param n The number of rays.
+ * @param occluded Whether each ray is blocked.
+ */
+void BVH::Occluded(const Ray* rays, const double* tmax, int n, bool* occluded) const
+{
+    for(int i = 0; i < n; i += RayPacket::size)
+    {
+        int m = std::min(RayPacket::size, n - i);
+        if(m >= minPacketRays && IsCoherent(rays + i, m))
+            OccludedPacket(RayPacket(rays + i, m), tmax + i, occluded + i);
+        else
+            for(int j = i; j < i + m; j++)
+                occluded[j] = Occluded(rays[j], 0, tmax[j]);
+    }
+}
+
+/**
+ * Clips the rays of a packet against the box of a node the same way as a single ray, but
+ * without stopping early, so that the rays can be clipped side by side.
+ * 
+ * @param n The node.
+ * @param packet The packet of rays.
+ * @param invDirs The reciprocals of the directions of the rays, by axis.
+ * @param tmax The greatest distance along each ray to find intersections.
+ * @returns The rays whose parts from zero to their greatest distances pass through the box, as
+ *          bits.
+ */
+unsigned int BVH::ClipPacket(const BVHNode& n, const RayPacket& packet, const double (*invDirs)[RayPacket::size], const double* tmax) const
+{
+    // The box is copied out so that the compiler knows that it stays the same for all the rays
+    const double c1[3] = { n.c1[0], n.c1[1], n.c1[2] }, c2[3] = { n.c2[0], n.c2[1], n.c2[2] };
+    double tnear[RayPacket::size], tfar[RayPacket::size];
+    for(int i = 0; i < RayPacket::size; i++)
+        tnear[i] = 0, tfar[i] = tmax[i];
+    for(int u = 0; u < 3; u++)
+    {
+        for(int i = 0; i < RayPacket::size; i++)
+        {
+            double t1 = (c1[u] - packet.origins[u][i])*invDirs[u][i];
+            double t2 = (c2[u] - packet.origins[u][i])*invDirs[u][i];
+            double tlow = t1 > t2 ? t2 : t1, thigh = t1 > t2 ? t1 : t2;
+            tnear[i] = tlow > tnear[i] ? tlow : tnear[i];
+            tfar[i] = thigh < tfar[i] ? thigh : tfar[i];
+        }
+    }
+
+    unsigned int hitMask = 0;
+    for(int i = 0; i < RayPacket::size; i++)
+        hitMask |= (unsigned int) (tnear[i] <= tfar[i]) << i;
+    return hitMask;
+}
+
+/**
+ * Intersects a packet of rays with the hierarchy, each between zero and infinity. The rays share
+ * the walk through the hierarchy and each only looks at the nodes that its ray passes through
+ * before its closest hit so far, so each finds the same hit as it would on its own. Where too few
+ * rays are left to share the walk, they finish the subtree one by one.
+ * 
+ * @param packet The rays to intersect with, whose directions have the same signs.
+ * @param hits The closest hit of each ray, with a distance of -inf if no intersection happened.
+ */
+void BVH::IntersectPacket(const RayPacket& packet, HitRecord* hits) const
+{
+    const int size = RayPacket::size;
+    int n = packet.n;
+    for(int i = 0; i < n; i++)
+        hits[i] = HitRecord();
+    if(nodes.empty())
+        return;
+
+    double invDirs[3][size], tmax[size];
+    HitRecord minhits[size], leafHits[size];
+    for(int i = 0; i < size; i++)
+    {
+        for(int u = 0; u < 3; u++)
+            invDirs[u][i] = 1/packet.directions[u][i];
+        minhits[i].t = tmax[i] = inf;
+    }
+
+    struct StackEntry
+    {
+        int node;
+        unsigned int mask;
+    } stack[maxDepth];
+    int stackSize = 0;
+    int node = 0;
+    unsigned int mask = (1u << n) - 1;
+
+    while(true)
+    {
+        const BVHNode& nd = nodes[node];
+        if(std::popcount(mask) < minPacketRays)
+        {
+            for(int i = 0; i < n; i++)
+                if(mask >> i & 1)
+                    IntersectSubtree(node, packet.rays[i], 0, inf, minhits[i]), tmax[i] = minhits[i].t;
+        }
+        else if(unsigned int hitMask = ClipPacket(nd, packet, invDirs, tmax) & mask)
+        {
+            if(!nd.IsLeaf())
+            {
+                // Visit the child on the near side of the split axis first
+                if(invDirs[nd.axis][0] < 0)
+                    stack[stackSize++] = { node + 1, hitMask }, node = nd.offset;
+                else
+                    stack[stackSize++] = { nd.offset, hitMask }, node = node + 1;
+                mask = hitMask;
+                continue;
+            }
+
+            const int* indices = primitiveIndices.data() + nd.offset;
+            for(int j = 0; j < nd.nPrimitives; j++)
+            {
+                primitives[indices[j]]->IntersectHit(packet, hitMask, leafHits);
+                for(int i = 0; i < n; i++)
+                {
+                    const HitRecord& hit = leafHits[i];
+                    if(hitMask >> i & 1 && hit.t >= 0 && hit.t < minhits[i].t)
+                        minhits[i] = hit, tmax[i] = hit.t;
+                }
+            }
+        }
+
+        if(!stackSize)
+            break;
+        auto& entry = stack[--stackSize];
+        node = entry.node, mask = entry.mask;
+    }
+
+    for(int i = 0; i < n; i++)
+        if(minhits[i].primitive)
+            hits[i] = minhits[i];
+}
+
+/**
+ * Checks a packet of rays for anything blocking them, each between zero and its own distance.
+ * The rays share the walk through the hierarchy, and each leaves it as soon as it is found blocked.
+ * Where too few rays are left to share the walk, they finish the subtree one by one.
+ * 
+ * @param packet The rays to check, whose directions have the same signs.
+ * @param rmax The greatest distance along each ray to find intersections.
+ * @param occluded Whether each ray is blocked.
+ */
+void BVH::OccludedPacket(const RayPacket& packet, const double* rmax, bool* occluded) const
+{
+    const int size = RayPacket::size;
+    int n = packet.n;
+    for(int i = 0; i < n; i++)
+        occluded[i] = false;
+    if(nodes.empty())
+        return;
+
+    double invDirs[3][size], tmax[size], ts[size];
+    for(int i = 0; i < size; i++)
+    {
+        for(int u = 0; u < 3; u++)
+            invDirs[u][i] = 1/packet.directions[u][i];
+        tmax[i] = i < n ? rmax[i] : 0;
+    }
+
+    struct StackEntry
+    {
+        int node;
+        unsigned int mask;
+    } stack[maxDepth];
+    int stackSize = 0;
+    int node = 0;
+    unsigned int mask = (1u << n) - 1, done = 0;
+
+    while(true)
+    {
+        const BVHNode& nd = nodes[node];
+        mask &= ~done;
+        if(std::popcount(mask) < minPacketRays)
+        {
+            for(int i = 0; i < n; i++)
+                if(mask >> i & 1 && OccludedSubtree(node, packet.rays[i], 0, rmax[i]))
+                    occluded[i] = true, done |= 1u << i;
+        }
+        else if(unsigned int hitMask = ClipPacket(nd, packet, invDirs, tmax) & mask)
+        {
+            if(!nd.IsLeaf())
+            {
+                stack[stackSize++] = { nd.offset, hitMask };
+                node = node + 1, mask = hitMask;
+                continue;
+            }
+
+            const int* indices = primitiveIndices.data() + nd.offset;
+            for(int j = 0; j < nd.nPrimitives && hitMask; j++)
+            {
+                primitives[indices[j]]->Intersect(packet, hitMask, ts);
+                for(int i = 0; i < n; i++)
+                    if(hitMask >> i & 1 && ts[i] >= 0 && ts[i] <= rmax[i])
+                        occluded[i] = true, done |= 1u << i, hitMask &= ~(1u << i);
+            }
+        }
+
+        if(!stackSize)
+            return;
+        auto& entry = stack[--stackSize];
+        node = entry.node, mask = entry.mask;
+    }
+}
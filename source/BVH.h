@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file BVH.h
+ * 
+ * Declaration of the BVH class and helpers.
+ */
+
+#pragma once
+
+#include "Ray.h"
+#include "SpatialPartitioning.h"
+#include <string>
+#include <vector>
+
+class Primitive;
+
+// A node of the flattened hierarchy, with its bounding box in single precision rounded outwards.
+// The left child of an interior node directly follows it, and a leaf refers to a range of the
+// primitive index array
+class BVHNode
+{
+public:
+    bool IsLeaf() const { return nPrimitives > 0; }
+
+    float c1[3], c2[3];
+    int offset; // The first primitive index of a leaf or the right child of an interior node
+    unsigned short nPrimitives;
+    unsigned char axis;
+};
+
+class BVH : public SpatialPartitioning
+{
+public:
+    BVH();
+    ~BVH();
+    void Build(const std::vector<const Primitive*>&);
+    HitRecord Intersect(const Ray& ray, double tmin, double tmax) const;
+    bool Occluded(const Ray& ray, double tmin, double tmax) const;
+    void Intersect(const Ray* rays, int n, HitRecord* hits) const;
+    void Occluded(const Ray* rays, const double* tmax, int n, bool* occluded) const;
+    std::string GetStatistics() const;
+
+    void Save(CacheWriter& writer) const;
+    bool Load(CacheReader& reader, const std::vector<const Primitive*>& primitives);
+
+    std::vector<const Primitive*> primitives;
+    std::vector<int> primitiveIndices;
+    std::vector<BVHNode> nodes;
+
+    PartitioningStatistics statistics;
+
+    static const int maxDepth = 64;
+    static const int maxLeafSize = 8;
+    static const int minPacketRays = 3; // The fewest rays of a packet that go on together
+    static const int nBins = 16;
+    static const double cost_trav; // Traversal cost relative to the cost of a primitive intersection
+
+private:
+    bool Validate() const;
+
+    // Plain arrays rather than boxes and vectors, since the build spends its time looking at these
+    class BuildPrimitive
+    {
+    public:
+        double c1[3], c2[3], centroid[3];
+        int index;
+    };
+
+    // A box to grow during the build
+    class BuildBox
+    {
+    public:
+        BuildBox();
+        void Enclose(const double* p1, const double* p2);
+        double GetArea() const;
+
+        double c1[3], c2[3];
+    };
+
+    void IntersectSubtree(int node, const Ray& ray, double tmin, double tmax, HitRecord& minhit) const;
+    bool OccludedSubtree(int node, const Ray& ray, double tmin, double tmax) const;
+    void IntersectPacket(const RayPacket& packet, HitRecord* hits) const;
+    void OccludedPacket(const RayPacket& packet, const double* rmax, bool* occluded) const;
+    unsigned int ClipPacket(const BVHNode& n, const RayPacket& packet, const double (*invDirs)[RayPacket::size], const double* tmax) const;
+
+    int BuildNode(std::vector<BuildPrimitive>& prims, int begin, int end, int depth, double rootArea);
+    void MakeLeaf(int node, const std::vector<BuildPrimitive>& prims, int begin, int end);
+};
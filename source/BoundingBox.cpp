@@ -35,6 +35,17 @@ BoundingBox::BoundingBox()
 {
 }
 
+/**
+ * Calculates the surface area of the bounding box.
+ * 
+ * @returns The surface area.
+ */
+double BoundingBox::GetArea() const
+{
+    auto d = c2 - c1;
+    return 2*(d.x*d.y + d.x*d.z + d.y*d.z);
+}
+
 /**
  * Checks if a ray intersects with the bounding box.
  * 
@@ -9,7 +9,7 @@
 
 #pragma once
 
-#include "Vector3D.h"
+#include "Vector3d.h"
 
 class Ray;
 
@@ -20,5 +20,6 @@ public:
     BoundingBox();
     ~BoundingBox();
     bool Intersect(const Ray& ray, double& tnear, double& tfar) const;
+    double GetArea() const;
     Vector3d c1, c2;
 };
@@ -29,32 +29,37 @@ void BrutePartitioning::Build(const std::vector<const Primitive*>& shapes)
  * @param primitive The intersected triangle.
  * @param tmin The smallest distance along the ray to find intersections.
  * @param tmax The greatest distance along the ray to find intersections.
- * @param returnPrimitive Whether to find the smallest distance along the ray that the
-                          primitive was intersected and return the primitive that was
-                          intersected, or just reporting any distance and returning no
-                          primitive.
- * @returns The distance along the ray that the intersection happened, or -inf if
- *          no intersection happened.
+ * @returns The closest hit, with a distance of -inf if no intersection happened.
  */
-std::tuple<double, const Primitive*> BrutePartitioning::Intersect(const Ray& ray, double tmin, double tmax, bool returnPrimitive = true) const
+HitRecord BrutePartitioning::Intersect(const Ray& ray, double tmin, double tmax) const
 {
-    bool found = false;
-    double mint = inf;
-    const Primitive* primitive;
+    HitRecord minhit;
 
+    for(auto p : primitives)
+    {
+        HitRecord hit = p->IntersectHit(ray);
+        if(hit.t > -inf && (!minhit.primitive || hit.t < minhit.t) && hit.t >= tmin && hit.t <= tmax)
+            minhit = hit;
+    }
+    return minhit;
+}
+
+/**
+ * Checks if anything blocks a ray between two distances along it, stopping at the first
+ * primitive found, in no particular order.
+ * 
+ * @param ray The ray to intersect with.
+ * @param tmin The smallest distance along the ray to find intersections.
+ * @param tmax The greatest distance along the ray to find intersections.
+ * @returns True if any primitive intersects the ray between tmin and tmax.
+ */
+bool BrutePartitioning::Occluded(const Ray& ray, double tmin, double tmax) const
+{
     for(auto p : primitives)
     {
         double t = p->Intersect(ray);
-        if(t > -inf && t < mint && t >= tmin && t <= tmax)
-        {
-            if(!returnPrimitive)
-                return { t, nullptr };
-            found = true;
-            primitive = p;
-            mint = t;
-        }
+        if(t >= tmin && t <= tmax)
+            return true;
     }
-    if(found)
-        return { mint, primitive };
-    return { -inf, nullptr };
+    return false;
 }
@@ -19,7 +19,8 @@ class BrutePartitioning : public SpatialPartitioning
 {
 public:
     void Build(const std::vector<const Primitive*>&);
-    std::tuple<double, const Primitive*> Intersect(const Ray& ray, double tmin, double tmax, bool returnPrimitive) const;
+    HitRecord Intersect(const Ray& ray, double tmin, double tmax) const;
+    bool Occluded(const Ray& ray, double tmin, double tmax) const;
 
 protected:
     std::vector<const Primitive*> primitives;
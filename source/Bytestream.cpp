@@ -41,12 +41,26 @@ void Bytestream::SaveToFile(std::string fileName)
  * Loads the contents of a file into the bytestream.
  * 
  * @param fileName The name of the file to read from.
+ * @returns False if the file couldn't be opened.
  */
-void Bytestream::LoadFromFile(std::string fileName)
+bool Bytestream::LoadFromFile(std::string fileName)
 {
     std::ifstream file;
     file.open(fileName, std::ios::in | std::ios::binary);
+    if(!file.is_open())
+        return false;
 
     for(char byte; !file.eof(); data.push_back(byte))
         file.read(&byte, sizeof(char));
+    return true;
+}
+
+/**
+ * Checks that everything extracted so far was actually in the stream.
+ * 
+ * @returns True if no extraction went past the end of the stream.
+ */
+bool Bytestream::IsGood() const
+{
+    return !fail;
 }
@@ -15,6 +15,9 @@
 #define ID_MONESTIMATOR ((unsigned char) 70)
 #define ID_MEANESTIMATOR ((unsigned char) 71)
 
+#define ID_NOSAMPLER ((unsigned char) 80)
+#define ID_SOBOLSAMPLER ((unsigned char) 81)
+
 #define ID_PREETHAMSKY ((unsigned char)50)
 
 #define ID_PINHOLECAMERA ((unsigned char)199)
@@ -38,10 +41,15 @@
 #define ID_TRIANGLE ((unsigned char)2)
 #define ID_SPHERE ((unsigned char)3)
 
+#define ID_KDTREE ((unsigned char)10)
+#define ID_BVH ((unsigned char)11)
+#define ID_QBVH ((unsigned char)12)
+
 #define ID_PATHTRACER ((char) 50)
 #define ID_LIGHTTRACER ((char) 51)
 #define ID_BDPT ((char) 52)
 #define ID_RAYTRACER ((char) 53)
+#define ID_WAVEFRONTPATHTRACER ((char) 54)
 
 class Bytestream
 {
@@ -94,7 +102,9 @@ public:
     }
 
     void SaveToFile(std::string fileName);
-    void LoadFromFile(std::string fileName);
+    bool LoadFromFile(std::string fileName);
+
+    bool IsGood() const;
 
 private:
     bool fail;
@@ -12,6 +12,7 @@
 #include "PinholeCamera.h"
 #include "Bytestream.h"
 #include <cassert>
+#include "Logger.h"
 
 /**
  * Constructor.
@@ -114,7 +115,7 @@ Camera* Camera::Create(unsigned char id)
         return new ThinLensCamera;
         break;
     default:
-        __debugbreak();
+        logger.Box("Unknown camera id " + std::to_string(id));
         return nullptr;
     }
 }
\ No newline at end of file
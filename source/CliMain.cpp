@@ -0,0 +1,328 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ *
+ * @file CliMain.cpp
+ *
+ * Entry point of the headless command line renderer.
+ */
+
+#include "Draw.h"
+#include "ColorBuffer.h"
+#include "Estimator.h"
+#include "MeanEstimator.h"
+#include "MonEstimator.h"
+#include "Rendering.h"
+#include "Renderer.h"
+#include "Sampler.h"
+#include "PathTracer.h"
+#include "WavefrontPathTracer.h"
+#include "LightTracer.h"
+#include "RayTracer.h"
+#include "BDPT.h"
+#include "Scene.h"
+#include "PinholeCamera.h"
+#include "KDTree.h"
+#include "BVH.h"
+#include "QBVH.h"
+#include "BrutePartitioning.h"
+#include "Timer.h"
+#include "Logger.h"
+#include "Utils.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+Logger logger(LOG_FILENAME);
+
+/**
+ * The options given on the command line.
+ */
+struct Options
+{
+    std::string scene;
+    std::string out = "render.bmp";
+    std::string save;
+    std::string renderer = "bdpt";
+    std::string estimator = "mean";
+    int buckets = MonEstimator::defaultBuckets;
+    bool compact = false;
+    std::string sampler = "random";
+    std::string roulette = "fixed";
+    std::string accel = "kd";
+    unsigned int spp = 0;
+    double time = 0;
+    double threshold = 0;
+    int xres = XRES, yres = YRES;
+    bool hasCamera = false;
+    Vector3d camPos, camTarget;
+    double fov = 75;
+    bool stats = false;
+};
+
+/**
+ * Prints the usage of the program.
+ *
+ * @param name The name of the executable.
+ */
+void PrintUsage(const char* name)
+{
+    std::cerr << "Usage: " << name << " [options] [scene]\n"
+              << "  scene                  An .obj file or a rendering saved with --save. If omitted,\n"
+              << "                         the scene from MakeScene is rendered.\n"
+              << "  -s, --spp N            Render N samples per pixel (default 16 unless --time is given)\n"
+              << "  -t, --time S           Stop rendering after S seconds\n"
+              << "      --threshold E      Stop sampling pixels once their relative error is below E\n"
+              << "  -o, --out FILE         The .bmp file to write the image to (default render.bmp)\n"
+              << "      --save FILE        Also save the rendering to FILE so it can be resumed\n"
+              << "  -r, --renderer NAME    pt, wpt, bdpt, lt or rt, for .obj scenes (default bdpt)\n"
+              << "  -e, --estimator NAME   mean or mon, for .obj scenes (default mean)\n"
+              << "      --buckets N        The number of buckets per pixel of the mon estimator, at most "
+              << MonEstimator::maxBuckets << " (default " << MonEstimator::defaultBuckets << ")\n"
+              << "      --compact          Keep the buckets of the mon estimator in single precision,\n"
+              << "                         halving their memory\n"
+              << "      --sampler NAME     random or sobol, where the numbers of the samples come from,\n"
+              << "                         for new renderings (default random)\n"
+              << "      --roulette NAME    efficient or fixed, the Russian roulette of bdpt for .obj\n"
+              << "                         scenes (default fixed)\n"
+              << "  -a, --accel NAME       kd, bvh, qbvh or brute, the acceleration structure for .obj\n"
+              << "                         scenes (default kd)\n"
+              << "      --res W H          The resolution, for .obj scenes (default "
+              << XRES << " " << YRES << ")\n"
+              << "      --camera X Y Z TX TY TZ FOV\n"
+              << "                         Camera position, target and field of view, for .obj scenes\n"
+              << "      --stats            Print statistics of the acceleration structure\n";
+}
+
+/**
+ * Parses the command line.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options The options to fill in.
+ * @returns True if the command line was well formed.
+ */
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        auto left = argc - i - 1;
+        if((arg == "-s" || arg == "--spp") && left >= 1)
+            options.spp = std::atoi(argv[++i]);
+        else if((arg == "-t" || arg == "--time") && left >= 1)
+            options.time = std::atof(argv[++i]);
+        else if(arg == "--threshold" && left >= 1)
+            options.threshold = std::atof(argv[++i]);
+        else if((arg == "-o" || arg == "--out") && left >= 1)
+            options.out = argv[++i];
+        else if(arg == "--save" && left >= 1)
+            options.save = argv[++i];
+        else if((arg == "-r" || arg == "--renderer") && left >= 1)
+            options.renderer = lower(argv[++i]);
+        else if((arg == "-e" || arg == "--estimator") && left >= 1)
+            options.estimator = lower(argv[++i]);
+        else if(arg == "--buckets" && left >= 1)
+            options.buckets = std::atoi(argv[++i]);
+        else if(arg == "--compact")
+            options.compact = true;
+        else if(arg == "--sampler" && left >= 1)
+            options.sampler = lower(argv[++i]);
+        else if(arg == "--roulette" && left >= 1)
+            options.roulette = lower(argv[++i]);
+        else if((arg == "-a" || arg == "--accel") && left >= 1)
+            options.accel = lower(argv[++i]);
+        else if(arg == "--res" && left >= 2)
+        {
+            options.xres = std::atoi(argv[++i]);
+            options.yres = std::atoi(argv[++i]);
+        }
+        else if(arg == "--camera" && left >= 7)
+        {
+            for(int u = 0; u < 3; u++)
+                options.camPos[u] = std::atof(argv[++i]);
+            for(int u = 0; u < 3; u++)
+                options.camTarget[u] = std::atof(argv[++i]);
+            options.fov = std::atof(argv[++i]);
+            options.hasCamera = true;
+        }
+        else if(arg == "--stats")
+            options.stats = true;
+        else if(arg[0] != '-' && options.scene.empty())
+            options.scene = arg;
+        else
+            return false;
+    }
+    if(!options.spp && options.time <= 0 && options.threshold <= 0)
+        options.spp = 16;
+    // The light tracer only splats, so its pixels have no samples to measure the error of
+    if(options.threshold > 0 && options.renderer == "lt")
+        return false;
+    if(options.sampler != "random" && options.sampler != "sobol")
+        return false;
+    if(options.roulette != "efficient" && options.roulette != "fixed")
+        return false;
+    return options.xres > 0 && options.yres > 0 && options.threshold >= 0 && 
+           options.buckets >= 1 && options.buckets <= MonEstimator::maxBuckets;
+}
+
+/**
+ * Creates a rendering of a scene read from an .obj file according to the given options.
+ *
+ * @param scene The scene.
+ * @param options The command line options.
+ * @returns The rendering, or null if the options were invalid.
+ */
+Rendering* MakeObjRendering(std::shared_ptr<Scene> scene, const Options& options)
+{
+    if(options.accel == "kd")
+        scene->SetPartitioning(new KDTree());
+    else if(options.accel == "bvh")
+        scene->SetPartitioning(new BVH());
+    else if(options.accel == "qbvh")
+        scene->SetPartitioning(new QBVH());
+    else if(options.accel == "brute")
+        scene->SetPartitioning(new BrutePartitioning());
+    else
+        return nullptr;
+
+    Vector3d camPos = options.camPos, target = options.camTarget;
+    if(!options.hasCamera)
+    {
+        // Look at the middle of the scene from far enough away along the z axis to see all of it
+        auto bbox = scene->GetBoundingBox();
+        target = (bbox.c1 + bbox.c2)/2;
+        camPos = target + Vector3d(0, 0, (bbox.c2 - bbox.c1).Length());
+    }
+    Vector3d camDir = (target - camPos).Normalized();
+    scene->SetCamera(new PinholeCamera(Vector3d(0, 1, 0), camPos, camDir, options.xres, options.yres, options.fov));
+
+    std::shared_ptr<Renderer> renderer;
+    if(options.renderer == "pt")
+        renderer = std::shared_ptr<Renderer>(new PathTracer(scene));
+    else if(options.renderer == "wpt")
+        renderer = std::shared_ptr<Renderer>(new WavefrontPathTracer(scene));
+    else if(options.renderer == "bdpt")
+    {
+        auto bdpt = new BDPT(scene);
+        bdpt->SetEfficientRoulette(options.roulette == "efficient");
+        renderer = std::shared_ptr<Renderer>(bdpt);
+    }
+    else if(options.renderer == "lt")
+        renderer = std::shared_ptr<Renderer>(new LightTracer(scene));
+    else if(options.renderer == "rt")
+        renderer = std::shared_ptr<Renderer>(new RayTracer(scene));
+    else
+        return nullptr;
+
+    std::shared_ptr<Estimator> estimator;
+    if(options.estimator == "mean")
+        estimator = std::shared_ptr<Estimator>(new MeanEstimator(options.xres, options.yres));
+    else if(options.estimator == "mon")
+        estimator = std::shared_ptr<Estimator>(new MonEstimator(options.xres, options.yres, options.buckets, options.compact));
+    else
+        return nullptr;
+
+    return new Rendering(renderer, estimator);
+}
+
+/**
+ * Entry point.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @returns The result of the program, 0 for success.
+ */
+int main(int argc, char* argv[])
+{
+    Options options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    Rendering* rendering;
+    if(options.scene.empty())
+    {
+        std::shared_ptr<Renderer> renderer;
+        std::shared_ptr<Estimator> estimator;
+        MakeScene(renderer, estimator);
+        rendering = new Rendering(renderer, estimator);
+    }
+    else if(lower(options.scene).ends_with(".obj"))
+    {
+        auto scene = std::shared_ptr<Scene>(new Scene(options.scene));
+        if(!scene->IsLoaded())
+        {
+            std::cerr << "Couldn't load the scene in " << options.scene << std::endl;
+            return 1;
+        }
+        if(scene->IsEmpty())
+        {
+            std::cerr << "The scene in " << options.scene << " has nothing to render" << std::endl;
+            return 1;
+        }
+        rendering = MakeObjRendering(scene, options);
+    }
+    else
+    {
+        rendering = new Rendering(options.scene);
+        if(!rendering->IsLoaded())
+        {
+            std::cerr << "Couldn't resume the rendering saved in " << options.scene << std::endl;
+            return 1;
+        }
+    }
+
+    if(!rendering)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // A resumed rendering keeps the sampler it was saved with
+    bool resumed = !options.scene.empty() && !lower(options.scene).ends_with(".obj");
+    if(options.sampler == "sobol" && !resumed)
+        rendering->renderer->SetSampler(std::make_shared<SobolSampler>());
+
+    auto partitioning = rendering->renderer->GetScene()->GetPartitioning();
+    if(options.stats && partitioning)
+        std::cout << partitioning->GetStatistics() << std::endl;
+
+    std::cout << "Estimator memory: " << rendering->estimator->GetMemoryUsage()/1e6 << " MB" << std::endl;
+
+    Timer timer;
+    rendering->Start(options.spp, options.threshold);
+    if(options.time > 0)
+    {
+        while(timer.GetTime() < options.time && !rendering->IsDone())
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        rendering->Stop();
+    }
+    else
+        rendering->Wait();
+
+    auto seconds = timer.GetTime();
+    if(options.threshold > 0)
+    {
+        if(rendering->IsConverged())
+            std::cout << "Reached a relative error of " << options.threshold << " in " << seconds << " s";
+        else
+            std::cout << "Stopped before reaching a relative error of " << options.threshold << " after " << seconds << " s";
+        std::cout << " (" << rendering->GetAverageSamples() << " samples per pixel on average, at least "
+                  << rendering->GetSamples() << ")" << std::endl;
+    }
+    else
+    {
+        auto samples = rendering->GetSamples();
+        std::cout << samples << " samples per pixel in " << seconds << " s ("
+                  << (seconds > 0 ? samples/seconds : 0) << " samples per pixel per second)" << std::endl;
+    }
+
+    rendering->GetImage().Dump(options.out);
+    if(!options.save.empty())
+        rendering->SaveRendering(options.save);
+    return 0;
+}
@@ -10,9 +10,6 @@
 #pragma once
 
 #include "Color.h"
-#define WIN32_MEAN_AND_LEAN
-#define NOMINMAX
-#include <Windows.h>
 #include <string>
 
 class Bytestream;
@@ -72,6 +72,7 @@ std::vector<CsgHit> CsgCuboid::AllIntersects(const Ray& ray) const
 
     intersects.push_back(nearI);
     intersects.push_back(farI);
+    LabelHits(intersects);
     return intersects;
 }
 
@@ -135,44 +136,11 @@ double CsgCuboid::Intersect(const Ray& inRay) const
         return -inf;
 }
 
-bool CsgCuboid::GenerateIntersectionInfo(const Ray& inRay, 
-                                         IntersectionInfo& info) const
-{
-    double t, tnear, tfar;
-    int axisNear, axisFar, sideNear, sideFar, axis, Side;
-    
-    SlabsTest(inRay, tnear, tfar, axisNear, axisFar, sideNear, sideFar);
-    
-    if(tnear > 0)
-    {
-        t = tnear;
-        axis = axisNear;
-        Side = sideNear;
-    }
-    else if(tfar > 0)
-    {
-        t = tfar;
-        axis = axisFar;
-        Side = sideFar;
-    }
-    else
-        return false;
-
-    Vector3d normal(0, 0, 0);
-    normal[axis] = Side;
-    info.normal = info.geometricnormal 
-                = Multiply(x_, y_, z_, normal);
-    info.direction = inRay.direction;
-    info.position = inRay.origin + inRay.direction*t + info.normal*eps;
-    info.material = material;
-    return true;
-}
-
 BoundingBox CsgCuboid::GetBoundingBox() const
 {
-    double X = a_*abs(x_.x) + b_*abs(y_.x) + c_*abs(z_.x);
-    double Y = a_*abs(x_.y) + b_*abs(y_.y) + c_*abs(z_.y);
-    double Z = a_*abs(x_.z) + b_*abs(y_.z) + c_*abs(z_.z);
+    double X = a_*std::abs(x_.x) + b_*std::abs(y_.x) + c_*std::abs(z_.x);
+    double Y = a_*std::abs(x_.y) + b_*std::abs(y_.y) + c_*std::abs(z_.y);
+    double Z = a_*std::abs(x_.z) + b_*std::abs(y_.z) + c_*std::abs(z_.z);
     return BoundingBox(pos_ - Vector3d(X, Y, Z), pos_ + Vector3d(X, Y, Z));
 }
 
@@ -25,7 +25,6 @@ public:
     virtual std::tuple<bool, BoundingBox> GetClippedBoundingBox(const BoundingBox& clipbox) const;
 
     virtual double Intersect(const Ray& ray) const;
-    virtual bool GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const;
 
     void Translate(const Vector3d& direction);
     void Rotate(const Vector3d& axis, double angle);
@@ -140,6 +140,7 @@ std::vector<CsgHit> CsgCylinder::AllIntersects(const Ray& inRay) const
 
     intersects.push_back(nearI);
     intersects.push_back(farI);
+    LabelHits(intersects);
     return intersects;
 }
 
@@ -156,12 +157,12 @@ BoundingBox CsgCylinder::GetBoundingBox() const
     Vector3d w = v^z_;
     w.Normalize();
     w *= radius_;
-    Vector3d c1(-abs(z_.x) - abs(v.x) - abs(w.x), 
-                -abs(z_.y) - abs(v.y) - abs(w.y), 
-                -abs(z_.z) - abs(v.z) - abs(w.z));
-    Vector3d c2(abs(z_.x) + abs(v.x) + abs(w.x), 
-                abs(z_.y) + abs(v.y) + abs(w.y), 
-                abs(z_.z) + abs(v.z) + abs(w.z));
+    Vector3d c1(-std::abs(z_.x) - std::abs(v.x) - std::abs(w.x), 
+                -std::abs(z_.y) - std::abs(v.y) - std::abs(w.y), 
+                -std::abs(z_.z) - std::abs(v.z) - std::abs(w.z));
+    Vector3d c2(std::abs(z_.x) + std::abs(v.x) + std::abs(w.x), 
+                std::abs(z_.y) + std::abs(v.y) + std::abs(w.y), 
+                std::abs(z_.z) + std::abs(v.z) + std::abs(w.z));
     return BoundingBox(pos_ + c1, pos_ + c2);
 }
 
@@ -235,29 +236,6 @@ double CsgCylinder::Intersect(const Ray& inRay) const
     return -inf;
 }
 
-bool CsgCylinder::GenerateIntersectionInfo(const Ray& inRay, IntersectionInfo& info) const
-{
-    auto infos = AllIntersects(inRay);
-    if(!infos.empty())
-    {
-        CsgHit isec = infos.front();
-        if(isec.t > 0)
-        {
-            info = isec.info;
-            return true;
-        }
-
-        isec = infos.back();
-        if(isec.t > 0)
-        {
-            info = isec.info;
-            return true;
-        }
-    }
-    return false;
-}
-
-
 void CsgCylinder::AddToScene(Scene& scene)
 {
     Scene::PrimitiveAdder::AddPrimitive(scene, this);
@@ -64,20 +64,6 @@ double CsgIntersection::Intersect(const Ray& ray) const
     return firstHit != hits.end() ? (*firstHit).t : -inf;
 }
 
-bool CsgIntersection::GenerateIntersectionInfo(const Ray& ray, 
-                                               IntersectionInfo& info) const
-{
-    auto hits = AllIntersects(ray);
-    if(hits.empty())
-        return false;
-    auto firstHit = std::find_if(hits.begin(), hits.end(), 
-                    [] (CsgHit& a) { return (a.t > 0); });
-    if(firstHit == hits.end())
-        return false;
-    info = (*firstHit).info;
-    return true;
-}
-
 void CsgIntersection::Translate(const Vector3d& direction)
 {
     objA_->Translate(direction);
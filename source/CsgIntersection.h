@@ -24,7 +24,6 @@ public:
     virtual std::tuple<bool, BoundingBox> GetClippedBoundingBox(const BoundingBox& clipbox) const;
 
     virtual double Intersect(const Ray& ray) const;
-    virtual bool GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const;
 
     void SetMaterial(Material* material);
     Material* GetMaterial() const;
@@ -10,6 +10,31 @@
 #include "CsgObject.h"
 #include "Vector3d.h"
 
+#include <algorithm>
+
+// The hit record refers to the basic object whose surface is the first one crossed by the ray, so
+// that only that object needs to be intersected again for the intersection info
+HitRecord CsgObject::IntersectHit(const Ray& ray) const
+{
+    auto hits = AllIntersects(ray);
+    auto firstHit = std::find_if(hits.begin(), hits.end(), 
+                    [] (CsgHit& a) { return (a.t > 0); });
+    if(firstHit == hits.end())
+        return HitRecord();
+    return { firstHit->t, 0, 0, firstHit->surface, firstHit->part };
+}
+
+void CsgObject::GenerateIntersectionInfo(const Ray& ray, const HitRecord& hit, IntersectionInfo& info) const
+{
+    info = AllIntersects(ray)[hit.part].info;
+}
+
+void CsgObject::LabelHits(hits& intersects) const
+{
+    for(int i = 0; i < (int) intersects.size(); i++)
+        intersects[i].surface = this, intersects[i].part = i;
+}
+
 Vector3d CsgObject::Multiply(const Vector3d& u, const Vector3d& v, 
                              const Vector3d& w, const Vector3d& x)
 {
@@ -27,6 +27,8 @@ public:
     double t;
     HitType type;
     const CsgObject* object;
+    const CsgObject* surface; // The basic object whose surface was crossed
+    int part; // The index of the crossing among the intersections of that object
 };
 
 class CsgObject : public Model, public Primitive
@@ -41,13 +43,15 @@ public:
     virtual std::tuple<bool, BoundingBox> GetClippedBoundingBox(const BoundingBox& clipbox) const = 0;
 
     virtual double Intersect(const Ray& ray) const = 0;
-    virtual bool GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const = 0;
+    HitRecord IntersectHit(const Ray& ray) const;
+    void GenerateIntersectionInfo(const Ray& ray, const HitRecord& hit, IntersectionInfo& info) const;
 
     virtual void Translate(const Vector3d& direction) = 0;
     virtual void Rotate(const Vector3d& axis, double angle) = 0;
 
     virtual std::unique_ptr<CsgObject> Clone() = 0;
 protected:
+    void LabelHits(hits& intersects) const;
     static Vector3d Multiply(const Vector3d& u, const Vector3d& v, 
                              const Vector3d& w, const Vector3d& x);
 };
@@ -62,6 +62,7 @@ std::vector<CsgHit> CsgSphere::AllIntersects(const Ray& ray) const
 
     intersects.push_back(nearI);
     intersects.push_back(farI);
+    LabelHits(intersects);
     return intersects;
 }
 
@@ -81,28 +82,6 @@ double CsgSphere::Intersect(const Ray& ray) const
     return IntersectSphere(pos_, radius_, ray);
 }
 
-bool CsgSphere::GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const
-{
-    std::vector<CsgHit> infos = AllIntersects(ray);
-    if(!infos.empty())
-    {
-        CsgHit isec = infos.front();
-        if(isec.t >= 0)
-        {
-            info = isec.info;
-            return true;
-        }
-
-        isec = infos.back();
-        if(isec.t >= 0)
-        {
-            info = isec.info;
-            return true;
-        }
-    }
-    return false;
-}
-
 void CsgSphere::Translate(const Vector3d& direction)
 {
     pos_ += direction;
@@ -73,20 +73,6 @@ double CsgUnion::Intersect(const Ray& ray) const
     return firstHit != hits.end() ? (*firstHit).t : -inf;
 }
 
-bool CsgUnion::GenerateIntersectionInfo(const Ray& ray, 
-                                               IntersectionInfo& info) const
-{
-    auto hits = AllIntersects(ray);
-    if(hits.empty())
-        return false;
-    auto firstHit = std::find_if(hits.begin(), hits.end(), 
-                    [] (CsgHit& a) { return (a.t > 0); });
-    if(firstHit == hits.end())
-        return false;
-    info = (*firstHit).info;
-    return true;
-}
-
 void CsgUnion::Translate(const Vector3d& direction)
 {
     objA_->Translate(direction);
@@ -76,7 +76,7 @@ Sample DielectricMaterial::GetSample(const IntersectionInfo& info, Randomizer& r
         out.direction.Normalize();
         auto wo = out.direction;
         out.origin = info.position;
-        auto color = adjoint ? abs((1/(wi*Ng))*(wo*Ng/(1))) * Color::Identity : Color::Identity;
+        auto color = adjoint ? std::abs((1/(wi*Ng))*(wo*Ng/(1))) * Color::Identity : Color::Identity;
         return Sample(color, out, pdf, rpdf, true, 1);
     }
     Vector3d refraction = wi*(n1/n2) + Ns*(cosi*(n1/n2) - sqrt(d));
@@ -93,7 +93,7 @@ Sample DielectricMaterial::GetSample(const IntersectionInfo& info, Randomizer& r
         out.direction = refraction.Normalized();
         auto wo = out.direction;
         out.origin = info.position + 2*eps*(wo*Ng > 0 ? Ng : -Ng);
-        auto color = adjoint ? abs((wi*Ns/(wi*Ng))*(wo*Ng/(wo*Ns))) * Color::Identity : (n1/n2)*(n1/n2)*Color::Identity;
+        auto color = adjoint ? std::abs((wi*Ns/(wi*Ng))*(wo*Ng/(wo*Ns))) * Color::Identity : (n1/n2)*(n1/n2)*Color::Identity;
         return Sample(color, out, pdf, rpdf, true, 1);
     }
     else // Reflected
@@ -102,7 +102,7 @@ Sample DielectricMaterial::GetSample(const IntersectionInfo& info, Randomizer& r
         out.direction = Reflect(info.direction, Ns).Normalized();
         auto wo = out.direction;
         out.origin = info.position;
-        auto color = adjoint ? abs((1/(wi*Ng))*(wo*Ng/(1))) * Color::Identity : Color::Identity;
+        auto color = adjoint ? std::abs((1/(wi*Ng))*(wo*Ng/(1))) * Color::Identity : Color::Identity;
         return Sample(color, out, pdf, rpdf, true, 1);
     }
 }
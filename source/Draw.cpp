@@ -16,18 +16,17 @@
 #include "LightTracer.h"
 #include "LightPortal.h"
 #include "Color.h"
-#include "draw.h"
-#include "main.h"
+#include "Draw.h"
 #include "Vector3d.h"
 #include "Ray.h"
-#include "logger.h"
+#include "Logger.h"
 #include <cmath>
-#include "timer.h"
-#include "sphere.h"
+#include "Timer.h"
+#include "Sphere.h"
 #include <vector>
-#include "triangle.h"
-#include "kdtree.h"
-#include "trianglemesh.h"
+#include "Triangle.h"
+#include "KDTree.h"
+#include "TriangleMesh.h"
 #include "Scene.h"
 #include "MeanEstimator.h"
 #include "MonEstimator.h"
@@ -11,6 +11,10 @@
 
 #define NOMINMAX
 #include <memory>
+
+#define XRES 640
+#define YRES 480
+
 class Renderer;
 class Estimator;
 class Gfx;
@@ -11,12 +11,18 @@
 #include "MonEstimator.h"
 #include "MeanEstimator.h"
 #include "Bytestream.h"
+#include "Logger.h"
+#include "SplatBuffer.h"
+
+// Keeps the relative error of pixels that are (nearly) black from blowing up, letting them converge
+const double Estimator::minLuma = 0.01;
 
 /**
  * Destructor.
  */
 Estimator::~Estimator()
 {
+    delete splats;
 }
 
 /**
@@ -35,7 +41,7 @@ Estimator* Estimator::Create(unsigned char id)
         return new MeanEstimator;
         break;
     default:
-        __debugbreak();
+        logger.Box("Unknown estimator id " + std::to_string(id));
         return nullptr;
     }
 }
@@ -58,4 +64,16 @@ int Estimator::GetWidth() const
 int Estimator::GetHeight() const
 {
     return height;
+}
+
+/**
+ * Returns the buffer that light path contributions are splatted into. Unlike AddSample, which 
+ * must not be called for the same pixel from several threads at once, the splat buffer can be 
+ * added to by any thread at any time.
+ * 
+ * @returns The splat buffer.
+ */
+SplatBuffer& Estimator::GetSplats() const
+{
+    return *splats;
 }
\ No newline at end of file
@@ -9,8 +9,11 @@
 
 #pragma once
 
+#include <cstddef>
+
 class Bytestream;
 class Color;
+class SplatBuffer;
 
 class Estimator
 {
@@ -19,15 +22,23 @@ public:
 
     virtual void AddSample(int, int, const Color& c) = 0;
     virtual Color GetEstimate(int, int) const = 0;
+    virtual double GetRelativeError(int, int) const = 0;
+    virtual unsigned int GetSampleCount(int, int) const = 0;
+    virtual std::size_t GetMemoryUsage() const = 0;
 
     static Estimator* Create(unsigned char n);
 
     int GetWidth() const;
     int GetHeight() const;
 
+    SplatBuffer& GetSplats() const;
+
     virtual void Save(Bytestream& stream) const = 0;
-    virtual void Load(Bytestream& stream) = 0;
+    virtual bool Load(Bytestream& stream) = 0;
 
 protected:
     int height, width;
+    SplatBuffer* splats = nullptr;
+
+    static const double minLuma; // The luma below which errors are relative to this luma instead
 };
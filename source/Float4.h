@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file Float4.h
+ * 
+ * Declaration and definition of the Float4 class, four floats processed in parallel.
+ */
+
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define POLRAY_SSE
+#include <immintrin.h>
+#else
+#include <cstring>
+#endif
+
+// Four floats operated on at once with SSE where available, or one at a time otherwise. The
+// comparisons give masks with all bits of the lanes set where they hold, like SSE does, and
+// Min and Max return the second argument where either is NaN
+class Float4
+{
+public:
+    Float4() {}
+    Float4(float f);
+
+    static Float4 Load(const float* p);
+    static Float4 Difference(double a, const double* b);
+    void Store(float* p) const;
+    int Mask() const;
+
+    friend Float4 operator+(const Float4& a, const Float4& b);
+    friend Float4 operator-(const Float4& a, const Float4& b);
+    friend Float4 operator*(const Float4& a, const Float4& b);
+    friend Float4 operator/(const Float4& a, const Float4& b);
+    friend Float4 operator&(const Float4& a, const Float4& b);
+    friend Float4 operator|(const Float4& a, const Float4& b);
+    friend Float4 operator^(const Float4& a, const Float4& b);
+    friend Float4 operator<(const Float4& a, const Float4& b);
+    friend Float4 operator<=(const Float4& a, const Float4& b);
+    friend Float4 operator!=(const Float4& a, const Float4& b);
+    friend Float4 Min(const Float4& a, const Float4& b);
+    friend Float4 Max(const Float4& a, const Float4& b);
+    friend Float4 Abs(const Float4& a);
+
+#ifdef POLRAY_SSE
+    Float4(__m128 v) : v(v) {}
+    __m128 v;
+#else
+    float v[4];
+#endif
+};
+
+#ifdef POLRAY_SSE
+
+inline Float4::Float4(float f) : v(_mm_set1_ps(f)) {}
+inline Float4 Float4::Load(const float* p) { return _mm_load_ps(p); }
+inline Float4 Float4::Difference(double a, const double* b)
+{
+    __m128d lo = _mm_sub_pd(_mm_set1_pd(a), _mm_load_pd(b)), hi = _mm_sub_pd(_mm_set1_pd(a), _mm_load_pd(b + 2));
+    return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+}
+inline void Float4::Store(float* p) const { _mm_storeu_ps(p, v); }
+inline int Float4::Mask() const { return _mm_movemask_ps(v); }
+
+inline Float4 operator+(const Float4& a, const Float4& b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(const Float4& a, const Float4& b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(const Float4& a, const Float4& b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(const Float4& a, const Float4& b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 operator&(const Float4& a, const Float4& b) { return _mm_and_ps(a.v, b.v); }
+inline Float4 operator|(const Float4& a, const Float4& b) { return _mm_or_ps(a.v, b.v); }
+inline Float4 operator^(const Float4& a, const Float4& b) { return _mm_xor_ps(a.v, b.v); }
+inline Float4 operator<(const Float4& a, const Float4& b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 operator<=(const Float4& a, const Float4& b) { return _mm_cmple_ps(a.v, b.v); }
+inline Float4 operator!=(const Float4& a, const Float4& b) { return _mm_cmpneq_ps(a.v, b.v); }
+inline Float4 Min(const Float4& a, const Float4& b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 Max(const Float4& a, const Float4& b) { return _mm_max_ps(a.v, b.v); }
+inline Float4 Abs(const Float4& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+
+#else
+
+/**
+ * Applies an operation to each lane of two Float4s.
+ * 
+ * @param a The first operand.
+ * @param b The second operand.
+ * @param op The operation.
+ * @returns The results of the operation.
+ */
+template<typename T> Float4 PerLane(const Float4& a, const Float4& b, T op)
+{
+    Float4 r;
+    for(int i = 0; i < 4; i++)
+        r.v[i] = op(a.v[i], b.v[i]);
+    return r;
+}
+
+/**
+ * Turns a truth value into a lane mask.
+ * 
+ * @param b The truth value.
+ * @returns A float with all bits set if b is true, or zero otherwise.
+ */
+inline float LaneMask(bool b)
+{
+    unsigned int bits = b ? 0xffffffff : 0;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/**
+ * Applies a bitwise operation to each lane of two Float4s.
+ * 
+ * @param a The first operand.
+ * @param b The second operand.
+ * @param op The operation on the bits.
+ * @returns The results of the operation.
+ */
+template<typename T> Float4 PerLaneBits(const Float4& a, const Float4& b, T op)
+{
+    return PerLane(a, b, [op](float x, float y)
+    {
+        unsigned int i, j;
+        std::memcpy(&i, &x, sizeof(i));
+        std::memcpy(&j, &y, sizeof(j));
+        unsigned int bits = op(i, j);
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    });
+}
+
+inline Float4::Float4(float f) : v{ f, f, f, f } {}
+inline Float4 Float4::Load(const float* p) { Float4 r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+inline Float4 Float4::Difference(double a, const double* b) { Float4 r; for(int i = 0; i < 4; i++) r.v[i] = (float) (a - b[i]); return r; }
+inline void Float4::Store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+
+inline int Float4::Mask() const
+{
+    int mask = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        unsigned int bits;
+        std::memcpy(&bits, &v[i], sizeof(bits));
+        mask |= (bits >> 31) << i;
+    }
+    return mask;
+}
+
+inline Float4 operator+(const Float4& a, const Float4& b) { return PerLane(a, b, [](float x, float y) { return x + y; }); }
+inline Float4 operator-(const Float4& a, const Float4& b) { return PerLane(a, b, [](float x, float y) { return x - y; }); }
+inline Float4 operator*(const Float4& a, const Float4& b) { return PerLane(a, b, [](float x, float y) { return x*y; }); }
+inline Float4 operator/(const Float4& a, const Float4& b) { return PerLane(a, b, [](float x, float y) { return x/y; }); }
+inline Float4 operator&(const Float4& a, const Float4& b) { return PerLaneBits(a, b, [](unsigned int x, unsigned int y) { return x & y; }); }
+inline Float4 operator|(const Float4& a, const Float4& b) { return PerLaneBits(a, b, [](unsigned int x, unsigned int y) { return x | y; }); }
+inline Float4 operator^(const Float4& a, const Float4& b) { return PerLaneBits(a, b, [](unsigned int x, unsigned int y) { return x ^ y; }); }
+inline Float4 operator<(const Float4& a, const Float4& b) { return PerLane(a, b, [](float x, float y) { return LaneMask(x < y); }); }
+inline Float4 operator<=(const Float4& a, const Float4& b) { return PerLane(a, b, [](float x, float y) { return LaneMask(x <= y); }); }
+inline Float4 operator!=(const Float4& a, const Float4& b) { return PerLane(a, b, [](float x, float y) { return LaneMask(x != y); }); }
+inline Float4 Min(const Float4& a, const Float4& b) { return PerLane(a, b, [](float x, float y) { return x < y ? x : y; }); }
+inline Float4 Max(const Float4& a, const Float4& b) { return PerLane(a, b, [](float x, float y) { return x > y ? x : y; }); }
+inline Float4 Abs(const Float4& a) { return a ^ (a & Float4(-0.0f)); }
+
+#endif
@@ -7,7 +7,7 @@
  * Some routines used for computational geometry.
  */
 
-#include "geometricroutines.h"
+#include "GeometricRoutines.h"
 #include "Ray.h"
 #include "Utils.h"
 #include <cmath>
@@ -170,11 +170,27 @@ double IntersectSphere(const Vector3d& position, double radius, const Ray& ray)
  *          If there is no intersection, t = -inf.
  */
 std::tuple<double, double, double> IntersectTriangle(const Vector3d& v0, const Vector3d& v1, const Vector3d& v2, const Ray& ray)
+{
+    return IntersectTriangleEdges(v0, v1-v0, v2-v0, ray);
+}
+
+/**
+ * Returns the parameters of the intersection of a ray with a triangle given by a corner and
+ * the edges going out from it.
+ * 
+ * @param v0 A vertex of the triangle.
+ * @param E1 The edge from v0 to the second vertex.
+ * @param E2 The edge from v0 to the third vertex.
+ * @param ray The ray to intersect the triangle with.
+ * @returns A tuple of { t, u, v } where t is the distance along the ray, and u and v
+ *          are the parameters of the intersection in the triangle as v0 + u*E1 + v*E2.
+ *          If there is no intersection, t = -inf.
+ */
+std::tuple<double, double, double> IntersectTriangleEdges(const Vector3d& v0, const Vector3d& E1, const Vector3d& E2, const Ray& ray)
 {
     double u, v, t;
     const Vector3d& D = ray.direction;
 
-    Vector3d E1 = v1-v0, E2 = v2-v0;
     Vector3d T = ray.origin - v0;
 
     Vector3d P = E2^T, Q = E1^D;
@@ -197,6 +213,44 @@ std::tuple<double, double, double> IntersectTriangle(const Vector3d& v0, const V
     return { t <= 0 ? -inf : t, u, v };
 }
 
+/**
+ * Intersects all the rays of a packet with a triangle given by a corner and the edges going out
+ * from it. Every ray goes through all the steps of the test of a single ray, without stopping
+ * early, so that the rays can be tested side by side, and each gets the same result as on its own.
+ * 
+ * @param v0 A vertex of the triangle.
+ * @param E1 The edge from v0 to the second vertex.
+ * @param E2 The edge from v0 to the third vertex.
+ * @param packet The packet of rays to intersect the triangle with.
+ * @param t The distance along each ray of the packet to the intersection, or -inf if none.
+ * @param u The parameter of the intersection along E1, or -inf if none.
+ * @param v The parameter of the intersection along E2, or -inf if none.
+ */
+void IntersectTriangleEdges(const Vector3d& v0, const Vector3d& E1, const Vector3d& E2, const RayPacket& packet, double* t, double* u, double* v)
+{
+    // The triangle is copied out so that the compiler knows that the results don't overwrite it
+    const Vector3d V0 = v0, e1 = E1, e2 = E2;
+    const double* Ox = packet.origins[0], *Oy = packet.origins[1], *Oz = packet.origins[2];
+    const double* Dx = packet.directions[0], *Dy = packet.directions[1], *Dz = packet.directions[2];
+    for(int i = 0; i < RayPacket::size; i++)
+    {
+        double Tx = Ox[i] - V0.x, Ty = Oy[i] - V0.y, Tz = Oz[i] - V0.z;
+
+        double Px = e2.y*Tz - e2.z*Ty, Py = e2.z*Tx - e2.x*Tz, Pz = e2.x*Ty - e2.y*Tx;
+        double Qx = e1.y*Dz[i] - e1.z*Dy[i], Qy = e1.z*Dx[i] - e1.x*Dz[i], Qz = e1.x*Dy[i] - e1.y*Dx[i];
+
+        double det = e2.x*Qx + e2.y*Qy + e2.z*Qz;
+        double ui = (Dx[i]*Px + Dy[i]*Py + Dz[i]*Pz)/det;
+        double vi = (Tx*Qx + Ty*Qy + Tz*Qz)/det;
+        double ti = (e1.x*Px + e1.y*Py + e1.z*Pz)/det;
+
+        bool miss = (det == 0) | (ui > 1) | (ui < 0) | (ui + vi > 1) | (vi < 0);
+        t[i] = miss | (ti <= 0) ? -inf : ti;
+        u[i] = miss ? -inf : ui;
+        v[i] = miss ? -inf : vi;
+    }
+}
+
 /**
  * Returns the convex hull of a set of points.
  * 
@@ -10,11 +10,13 @@
 #pragma once
 
 #define NOMINMAX
+#include <tuple>
 #include <vector>
 
 class Vector3d;
 class Vector2d;
 class Ray;
+class RayPacket;
 
 std::vector<Vector2d> ConvexHull(std::vector<Vector2d> v);
 std::vector<Vector3d> ClipPolygonToAAP(int axis, bool side, double position, std::vector<Vector3d>& input);
@@ -29,3 +31,5 @@ Vector3d SampleSphereUniform(double r1, double r2);
 
 double IntersectSphere(const Vector3d& position, double radius, const Ray& ray);
 std::tuple<double, double, double> IntersectTriangle(const Vector3d& v0, const Vector3d& v1, const Vector3d& v2, const Ray& ray);
+std::tuple<double, double, double> IntersectTriangleEdges(const Vector3d& v0, const Vector3d& e1, const Vector3d& e2, const Ray& ray);
+void IntersectTriangleEdges(const Vector3d& v0, const Vector3d& e1, const Vector3d& e2, const RayPacket& packet, double* t, double* u, double* v);
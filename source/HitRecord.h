@@ -0,0 +1,27 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file HitRecord.h
+ * 
+ * Declaration of the HitRecord class.
+ */
+
+#pragma once
+
+#include "Utils.h"
+
+class Primitive;
+
+// Where a ray hit a primitive, as found during traversal: the distance along the ray and
+// whatever the primitive needs to generate the intersection info later without intersecting
+// the ray again, such as the barycentric coordinates of a triangle. A default constructed record
+// is a miss
+class HitRecord
+{
+public:
+    double t = -inf;
+    double u = 0, v = 0;
+    const Primitive* primitive = nullptr;
+    int part = -1; // The part of the primitive that was hit, for primitives made of several
+};
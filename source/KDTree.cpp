@@ -7,11 +7,16 @@
  * Declaration of the KDTree class used for spatial partitioning.
  */
 
-#pragma once
-
 #include <algorithm>
+#include <bit>
+#include <cassert>
+#include <future>
+#include <thread>
+#include "Bytestream.h"
 #include "KDTree.h"
 #include "Primitive.h"
+#include "Ray.h"
+#include "SceneCache.h"
 #include "Triangle.h"
 #include "Utils.h"
 #include "Timer.h"
@@ -22,17 +27,6 @@ double KDTree::cost_trav;
 double KDTree::cost_boxint;
 double KDTree::mint;
 
-/**
- * Creates an event from a primitive, position and type.
- * 
- * @param m The primitive to form the event from.
- * @param p The position to form the event from.
- * @param t The type (start, end, planar) to form the event from.
- */
-SAHEvent::SAHEvent(KDPrimitive* m, double p, int t) : primitive(m), position(p), type(t)
-{
-}
-
 /**
  * The sorting function for events; sorts by position first and then by type
  * 
@@ -40,9 +34,9 @@ SAHEvent::SAHEvent(KDPrimitive* m, double p, int t) : primitive(m), position(p),
  * @param b Another event.
  * @returns True if a precedes b.
  */
-bool sortFn(const SAHEvent* a, const SAHEvent* b)
+bool sortFn(const SAHEvent& a, const SAHEvent& b)
 {
-    return a->position == b->position ? a->type < b->type : a->position < b->position;
+    return a.position == b.position ? a.type < b.type : a.position < b.position;
 }
 
 /**
@@ -55,7 +49,7 @@ bool sortFn(const SAHEvent* a, const SAHEvent* b)
  * @param nPlanar The number of planar primitives perfectly straddling the nodes.
  * @param side The side to assign the planar primitives to.
  */
-double KDNode::SAHCost(int, double, int nLeft, double leftarea, int nRight, double rightarea, int nPlanar, int side)
+double KDBuildNode::SAHCost(int, double, int nLeft, double leftarea, int nRight, double rightarea, int nPlanar, int side)
 {
     double cost;
     if(side == KDTree::leftNode)
@@ -74,7 +68,7 @@ double KDNode::SAHCost(int, double, int nLeft, double leftarea, int nRight, doub
     }
     else
     {
-        __debugbreak();
+        assert(false);
         return 0; // To appease the compiler
     }
     return cost;
@@ -121,7 +115,6 @@ KDTree::KDTree()
     KDTree::cost_triint = CalculateCost(0, 1000);
     KDTree::cost_boxint = CalculateCost(1, 1000);
     KDTree::cost_trav = KDTree::cost_boxint / 2;
-    m_root = 0;
 }
 
 /**
@@ -129,13 +122,12 @@ KDTree::KDTree()
  */
 KDTree::~KDTree()
 {
-    delete m_root;
 }
 
 /**
  * Constructor.
  */
-KDNode::KDNode()
+KDBuildNode::KDBuildNode()
 {
     leftNode = nullptr;
     rightNode = nullptr;
@@ -144,7 +136,7 @@ KDNode::KDNode()
 /**
  * Destructor.
  */
-KDNode::~KDNode()
+KDBuildNode::~KDBuildNode()
 {
     if(leftNode)
         delete leftNode;
@@ -152,12 +144,29 @@ KDNode::~KDNode()
         delete rightNode;
 }
 
-//------------------------------------------------------------------------------
-// Recursively build a Kd-Tree from this node (Currently uses an O(n(logn)^2) 
-// algorithm).
-//------------------------------------------------------------------------------
-void KDNode::Build()
+/**
+ * Turns the node into a leaf.
+ * 
+ * @param offset The index of the first primitive of the leaf in the primitive index array.
+ * @param n The number of primitives in the leaf.
+ */
+void KDNode::MakeLeaf(int offset, int n)
+{
+    primitiveOffset = offset;
+    nPrimitives = (n << 2) | 3;
+}
+
+/**
+ * Turns the node into an interior node.
+ * 
+ * @param axis The axis of the splitting plane.
+ * @param right The index of the right child node in the node array.
+ * @param splitPos The position of the splitting plane along the axis.
+ */
+void KDNode::MakeInterior(int axis, int right, float splitPos)
 {
+    split = splitPos;
+    rightChild = (right << 2) | axis;
 }
 
 /**
@@ -190,64 +199,50 @@ BoundingBox KDTree::CalculateExtents(const std::vector<const Primitive*>& shapes
  * 
  * @returns True if the node is a leaf.
  */
-bool KDNode::IsLeaf() const
+bool KDBuildNode::IsLeaf() const
 {
     return !(leftNode || rightNode);
 }
 
 /**
- * Merges two lists of events, of which one is unsorted.
- * 
- * @param events The sorted event list.
- * @param add The unsorted event list.
- * @param primitive The primitive that caused the event.
- * @param add The event list to add to.
- * @param merge The merged list.
- */
-std::vector<SAHEvent*> MergeEvents(std::vector<SAHEvent*>& events, std::vector<SAHEvent*>& add)
-{
-    std::vector<SAHEvent*> merged;
-    sort(add.begin(), add.end(), sortFn);
-    std::merge(events.begin(), events.end(), add.begin(), add.end(), std::back_inserter(merged), sortFn);
-    return merged;
-}
-
-/**
- * Adds an event into an event list.
+ * Adds the events of a primitive into an event list.
  * 
  * @param minpoint The minimum point of the primitive along the axis.
  * @param maxpoint The maximum point of the primitive along the axis.
- * @param primitive The primitive that caused the event.
+ * @param primitive The index of the primitive that caused the event.
  * @param add The event list to add to.
  */
-void AddEvent(double& minpoint, double& maxpoint, KDPrimitive*& primitive, std::vector<SAHEvent*>& add)
+void AddEvent(double minpoint, double maxpoint, int primitive, std::vector<SAHEvent>& add)
 {
     // Planar primitive - insert a planar event into the queue
     if(minpoint == maxpoint)
-        add.push_back(new SAHEvent(primitive, minpoint, SAHEvent::planar));
+        add.push_back({ minpoint, primitive, SAHEvent::planar });
     else
     {
-        add.push_back(new SAHEvent(primitive, minpoint, SAHEvent::start));
-        add.push_back(new SAHEvent(primitive, maxpoint, SAHEvent::end));
+        add.push_back({ minpoint, primitive, SAHEvent::start });
+        add.push_back({ maxpoint, primitive, SAHEvent::end });
     }
 }
 
 /**
- * Builds a node of the K-d tree given an event list and a set of primitives that are part of the
- * node, using the surface-area heuristic.
+ * Builds a node of the K-d tree given the sorted event lists and the primitives that are part of
+ * the node, using the surface-area heuristic. The event lists stay sorted through the splits, so
+ * only the events of the primitives straddling the split plane need sorting, giving O(nlogn)
+ * overall. The children of the nodes near the root are built in parallel.
  * 
  * @param bbox The bounding box of the node.
- * @param events The events for each dimension.
- * @param shapes The primitives to build the partition structure for.
+ * @param events The events for each dimension, which are consumed by the call.
+ * @param shapes The indices of the primitives of the node, which are consumed by the call.
+ * @param primitives All primitives of the tree.
  * @param depth The depth of the node.
  * @param badsplits The number of bad split attempts allowed.
+ * @param parallelDepth The number of levels below the node whose children are built in parallel.
  */
-void KDNode::Build(BoundingBox& bbox, std::vector<SAHEvent*>* events, const std::vector<KDPrimitive*>& shapes, int depth, int badsplits)
+void KDBuildNode::Build(const BoundingBox& bbox, std::vector<SAHEvent>* events, std::vector<int>& shapes, const std::vector<const Primitive*>& primitives, int depth, int badsplits, int parallelDepth)
 {
     if(depth > 20 || shapes.size() < 4) // TODO: fix
     {
-        for(auto& s : shapes)
-            m_primitives.push_back(s->p);
+        m_primitives = std::move(shapes);
         return;
     }
 
@@ -255,7 +250,7 @@ void KDNode::Build(BoundingBox& bbox, std::vector<SAHEvent*>* events, const std:
     int bestsplitdir = 0;
     char bestside = 0;
     double bestcost = inf;
-    double boxarea = 2*(bbox.c2.z-bbox.c1.z)*(bbox.c2.y-bbox.c1.y) + 2*(bbox.c2.x-bbox.c1.x)*(bbox.c2.z-bbox.c1.z) + 2*(bbox.c2.x-bbox.c1.x)*(bbox.c2.y-bbox.c1.y);
+    double boxarea = bbox.GetArea();
 
     for(int u = 0; u < 3; u++)
     {
@@ -272,16 +267,16 @@ void KDNode::Build(BoundingBox& bbox, std::vector<SAHEvent*>* events, const std:
         // Sweep through all events
         for(auto it = events[u].begin(); it < events[u].end(); )
         {
-            double sweeppos = (*it)->position;
+            double sweeppos = it->position;
 
             leftarea = 2*sidearea + 2*(sweeppos-bbox.c1[u])*(vLength + wLength);
             rightarea = 2*sidearea + 2*(bbox.c2[u]-sweeppos)*(vLength + wLength);
 
             // Go through all events on this position
-            for(ps = pp = pe = 0; it < events[u].end() && (*it)->position == sweeppos; it++)
-                if((*it)->type == SAHEvent::end)
+            for(ps = pp = pe = 0; it < events[u].end() && it->position == sweeppos; it++)
+                if(it->type == SAHEvent::end)
                     pe++;
-                else if((*it)->type == SAHEvent::start)
+                else if(it->type == SAHEvent::start)
                     ps++;
                 else
                     pp++;
@@ -289,10 +284,10 @@ void KDNode::Build(BoundingBox& bbox, std::vector<SAHEvent*>* events, const std:
             nRight -= pp + pe;
 
             // Calculate the costs for a split at this location
-            double leftcost = KDNode::SAHCost((int) shapes.size(), boxarea, nLeft, leftarea, nRight, rightarea, pp, KDTree::leftNode);
-            double rightcost = KDNode::SAHCost((int) shapes.size(), boxarea, nLeft, leftarea, nRight, rightarea, pp, KDTree::rightNode);
+            double leftcost = KDBuildNode::SAHCost((int) shapes.size(), boxarea, nLeft, leftarea, nRight, rightarea, pp, KDTree::leftNode);
+            double rightcost = KDBuildNode::SAHCost((int) shapes.size(), boxarea, nLeft, leftarea, nRight, rightarea, pp, KDTree::rightNode);
 
-            if(bestcost > min(leftcost, rightcost)) 
+            if(bestcost > min(leftcost, rightcost))
             {
                 bestcost = min(leftcost, rightcost);
                 bestsplitdir = u;
@@ -309,8 +304,7 @@ void KDNode::Build(BoundingBox& bbox, std::vector<SAHEvent*>* events, const std:
     {
         if(badsplits <= 0 || bestcost == inf)
         {
-            for(auto& s : shapes)
-                m_primitives.push_back(s->p);
+            m_primitives = std::move(shapes);
             return;
         }
         else
@@ -320,100 +314,133 @@ void KDNode::Build(BoundingBox& bbox, std::vector<SAHEvent*>* events, const std:
     // Ok, now we've found the best split location, it's time to split and prepare for recursion
     int a = bestsplitdir;
 
-    std::vector<Primitive*> nodeprimitives;
+    // The flattened tree stores the split in single precision, so partition by that value
+    bestsplit = (float) bestsplit;
 
-    leftNode = new KDNode();
-    rightNode = new KDNode();
+    leftNode = new KDBuildNode();
+    rightNode = new KDBuildNode();
 
     m_splitpos = bestsplit;
     splitdir = bestsplitdir;
 
-    std::vector<KDPrimitive*> leftprimitives, rightprimitives;
-    std::vector<SAHEvent*> leftevents[3], rightevents[3], addleft[3], addright[3];
+    const char left = 0, both = 1, right = 2;
 
-    const int left = 0, both = 1, right = 2;
+    // The side of each primitive, indexed by the primitive. Subtrees built at the same time may
+    // share primitives, so every thread classifies into its own array
+    thread_local std::vector<char> sides;
+    if(sides.size() < primitives.size())
+        sides.resize(primitives.size());
 
     // Mark all primitives as straddling for now
-    for(auto& s : shapes)
-        s->side = both;
+    for(auto s : shapes)
+        sides[s] = both;
 
     for(auto& e : events[a])
     {
-        if(e->position <= bestsplit && e->type == SAHEvent::end)
-            e->primitive->side = left;
-        else if(e->position >= bestsplit && e->type == SAHEvent::start)
-            e->primitive->side = right;
-        else if(e->position == bestsplit && e->type == SAHEvent::planar)
-        {
-            if(bestside == KDTree::leftNode)
-                e->primitive->side = left;
-            else
-                e->primitive->side = right;
-        }
+        if(e.position <= bestsplit && e.type == SAHEvent::end)
+            sides[e.primitive] = left;
+        else if(e.position >= bestsplit && e.type == SAHEvent::start)
+            sides[e.primitive] = right;
+        else if(e.position == bestsplit && e.type == SAHEvent::planar)
+            sides[e.primitive] = bestside == KDTree::leftNode ? left : right;
     }
 
+    // The events of the primitives that end up on one side only are still sorted
+    std::vector<SAHEvent> leftevents[3], rightevents[3];
+    size_t nLeftSorted[3], nRightSorted[3];
     for(int u = 0; u < 3; u++)
+    {
         for(auto& e : events[u])
-            if(e->primitive->side == left)
+            if(sides[e.primitive] == left)
                 leftevents[u].push_back(e);
-            else if(e->primitive->side == right)
+            else if(sides[e.primitive] == right)
                 rightevents[u].push_back(e);
+        nLeftSorted[u] = leftevents[u].size();
+        nRightSorted[u] = rightevents[u].size();
+        std::vector<SAHEvent>().swap(events[u]);
+    }
 
     BoundingBox leftbbox = bbox, rightbbox = bbox;
     leftbbox.c2[a] = bestsplit;
     rightbbox.c1[a] = bestsplit;
 
+    std::vector<int> leftprimitives, rightprimitives;
     for(auto s : shapes)
     {
-        if(s->side == left)
+        if(sides[s] == left)
             leftprimitives.push_back(s);
-        if(s->side == right)
+        if(sides[s] == right)
             rightprimitives.push_back(s);
 
-        if(s->side == both)
+        if(sides[s] == both)
         {
             // Get the bounding boxes clipped to the box halves
-            auto [isinleft, leftclippedbox] = s->p->GetClippedBoundingBox(leftbbox);
+            auto [isinleft, leftclippedbox] = primitives[s]->GetClippedBoundingBox(leftbbox);
             if(isinleft)
                 leftprimitives.push_back(s);
 
-            auto [isinright, rightclippedbox] = s->p->GetClippedBoundingBox(rightbbox);
+            auto [isinright, rightclippedbox] = primitives[s]->GetClippedBoundingBox(rightbbox);
             if(isinright)
                 rightprimitives.push_back(s);
-            
+
             for(int u = 0; u < 3; u++)
             {
                 if(isinleft)
-                    AddEvent(leftclippedbox.c1[u], leftclippedbox.c2[u], s, addleft[u]);
+                    AddEvent(leftclippedbox.c1[u], leftclippedbox.c2[u], s, leftevents[u]);
 
                 if(isinright)
-                    AddEvent(rightclippedbox.c1[u], rightclippedbox.c2[u], s, addright[u]);
+                    AddEvent(rightclippedbox.c1[u], rightclippedbox.c2[u], s, rightevents[u]);
             }
         }
     }
-    std::vector<SAHEvent*> mergedLeft[3], mergedRight[3];
-
-    // Merge the events of the clipped triangles to the respective event lists
-    for(int u = 0; u < 3; u++)   
-        mergedLeft[u] = MergeEvents(leftevents[u], addleft[u]);
+    std::vector<int>().swap(shapes);
 
+    // Sort the events of the clipped primitives and merge them into the respective event lists
     for(int u = 0; u < 3; u++)
-        mergedRight[u] = MergeEvents(rightevents[u], addright[u]);
+    {
+        std::sort(leftevents[u].begin() + nLeftSorted[u], leftevents[u].end(), sortFn);
+        std::inplace_merge(leftevents[u].begin(), leftevents[u].begin() + nLeftSorted[u], leftevents[u].end(), sortFn);
+        std::sort(rightevents[u].begin() + nRightSorted[u], rightevents[u].end(), sortFn);
+        std::inplace_merge(rightevents[u].begin(), rightevents[u].begin() + nRightSorted[u], rightevents[u].end(), sortFn);
+    }
 
-    leftNode->Build(leftbbox, mergedLeft, leftprimitives, depth + 1, badsplits);
-    leftprimitives.clear();
-    for(int u = 0; u < 3; u++)
+    // Hand the left subtree to another thread while this one builds the right one, unless the
+    // subtrees are too small to be worth it
+    if(parallelDepth > 0 && leftprimitives.size() + rightprimitives.size() > 4096)
+    {
+        auto leftTask = std::async(std::launch::async, [&]()
+        {
+            leftNode->Build(leftbbox, leftevents, leftprimitives, primitives, depth + 1, badsplits, parallelDepth - 1);
+        });
+        rightNode->Build(rightbbox, rightevents, rightprimitives, primitives, depth + 1, badsplits, parallelDepth - 1);
+        leftTask.get();
+    }
+    else
     {
-        for(auto& e : addleft[u])
-            delete e;
-        addleft[u].clear();
-        mergedLeft[u].clear();
+        leftNode->Build(leftbbox, leftevents, leftprimitives, primitives, depth + 1, badsplits, 0);
+        rightNode->Build(rightbbox, rightevents, rightprimitives, primitives, depth + 1, badsplits, 0);
     }
+}
 
-    rightNode->Build(rightbbox, mergedRight, rightprimitives, depth+1, badsplits);
-    for(int u = 0; u < 3; u++)
-        for(auto& e : addright[u])
-            delete e;
+/**
+ * Appends a built subtree to the flattened node array, depth first, so that the left child of
+ * every interior node directly follows it.
+ * 
+ * @param node The root of the subtree to flatten.
+ */
+void KDTree::Flatten(const KDBuildNode* node)
+{
+    int index = (int) nodes.size();
+    nodes.emplace_back();
+    if(node->IsLeaf())
+    {
+        nodes[index].MakeLeaf((int) primitiveIndices.size(), (int) node->m_primitives.size());
+        primitiveIndices.insert(primitiveIndices.end(), node->m_primitives.begin(), node->m_primitives.end());
+        return;
+    }
+    Flatten(node->leftNode);
+    nodes[index].MakeInterior(node->splitdir, (int) nodes.size(), (float) node->m_splitpos);
+    Flatten(node->rightNode);
 }
 
 /**
@@ -423,38 +450,240 @@ void KDNode::Build(BoundingBox& bbox, std::vector<SAHEvent*>* events, const std:
  */
 void KDTree::Build(const std::vector<const Primitive*>& shapes)
 {
-    m_root = new KDNode();
+    Timer timer;
+    KDBuildNode root;
+    primitives = shapes;
     m_bbox = CalculateExtents(shapes);
-    std::vector<SAHEvent*> eventlist[3];
 
-    std::vector<KDPrimitive*> primitives;
-    for(auto& s : shapes)
-        primitives.push_back(new KDPrimitive{s, 0});
+    std::vector<SAHEvent> eventlist[3];
+    std::vector<int> indices;
+
+    // Create event lists from the objects
+    for(int i = 0; i < (int) primitives.size(); i++)
+    {
+        // Get the bounding box of the primitive culled by the bounding box
+        auto [hasBox, clippedbox] = primitives[i]->GetClippedBoundingBox(m_bbox);
+        if(!hasBox)
+            continue;
+        indices.push_back(i);
+        for(int u = 0; u < 3; u++)
+            AddEvent(clippedbox.c1[u], clippedbox.c2[u], i, eventlist[u]);
+    }
 
-    // Loop through each axis - u is the primary axis
+    // Sort the event lists, once and for all
     for(int u = 0; u < 3; u++)
+        std::sort(eventlist[u].begin(), eventlist[u].end(), sortFn);
+
+    // Split the top levels between the threads, with a few more subtrees than threads to even out
+    // the load
+    int nThreads = (int) std::thread::hardware_concurrency();
+    int parallelDepth = 0;
+    while(nThreads > 1 && (1 << parallelDepth) < 2*nThreads)
+        parallelDepth++;
+
+    root.Build(m_bbox, eventlist, indices, primitives, 0, 3, parallelDepth);
+
+    nodes.clear();
+    primitiveIndices.clear();
+    Flatten(&root);
+    nodes.shrink_to_fit();
+    primitiveIndices.shrink_to_fit();
+
+    statistics = PartitioningStatistics();
+    statistics.buildTime = timer.GetTime();
+    statistics.memory = nodes.size()*sizeof(KDNode) + primitiveIndices.size()*sizeof(int) + primitives.size()*sizeof(const Primitive*);
+    CalculateStatistics(0, m_bbox, 0);
+}
+
+/**
+ * Gathers the statistics of a subtree of the flattened tree. The SAH cost is expressed in
+ * ray/primitive intersections per ray hitting the tree.
+ * 
+ * @param node The index of the root of the subtree.
+ * @param bbox The bounding box of the subtree.
+ * @param depth The depth of the subtree.
+ */
+void KDTree::CalculateStatistics(int node, const BoundingBox& bbox, int depth)
+{
+    double rootArea = m_bbox.GetArea();
+    double area = std::isfinite(rootArea) && rootArea > 0 ? bbox.GetArea()/rootArea : 1;
+
+    const KDNode& n = nodes[node];
+    if(n.IsLeaf())
+    {
+        statistics.AddLeaf(n.GetPrimitiveCount(), depth);
+        statistics.sahCost += area*n.GetPrimitiveCount();
+        return;
+    }
+
+    statistics.nNodes++;
+    statistics.sahCost += area*cost_trav/cost_triint;
+
+    BoundingBox leftbbox = bbox, rightbbox = bbox;
+    leftbbox.c2[n.GetAxis()] = n.split;
+    rightbbox.c1[n.GetAxis()] = n.split;
+    CalculateStatistics(node + 1, leftbbox, depth + 1);
+    CalculateStatistics(n.GetRightChild(), rightbbox, depth + 1);
+}
+
+/**
+ * Checks if anything blocks a ray between two distances along it, stopping at the first
+ * primitive found, in no particular order.
+ * 
+ * @param ray The ray to intersect with.
+ * @param tmin The smallest distance along the ray to find intersections.
+ * @param tmax The greatest distance along the ray to find intersections.
+ * @returns True if any primitive intersects the ray between tmin and tmax.
+ */
+bool KDTree::Occluded(const Ray& ray, double tmin, double tmax) const
+{
+    if(nodes.empty())
+        return false;
+    return OccludedSubtree(nodes.data(), ray, tmin, tmax, tmin, tmax);
+}
+
+/**
+ * Checks if anything in a subtree of the K-d tree blocks a ray between two distances along it.
+ * 
+ * @param node The root of the subtree.
+ * @param ray The ray to intersect with.
+ * @param tmin The smallest distance along the ray inside the subtree.
+ * @param tmax The greatest distance along the ray inside the subtree.
+ * @param rmin The smallest distance along the ray to find intersections.
+ * @param rmax The greatest distance along the ray to find intersections.
+ * @returns True if any primitive of the subtree intersects the ray between rmin and rmax.
+ */
+bool KDTree::OccludedSubtree(const KDNode* node, const Ray& ray, double tmin, double tmax, double rmin, double rmax) const
+{
+    struct StackEntry
     {
-        // Create event lists from the objects
-        for(auto& s : primitives)
+        const KDNode* node;
+        double tmin, tmax;
+    } stack[maxDepth];
+
+    // Any hit within the range of the ray will do, so the primitives are tested against the
+    // whole range rather than the part of the ray inside the leaf
+    int stackSize = 0;
+
+    while(true)
+    {
+        if(tmin <= tmax)
         {
-            // Get the bounding box of the primitive culled by the bounding box
-            auto [hasBox, clippedbox] = s->p->GetClippedBoundingBox(m_bbox);
-            if(hasBox)
-                AddEvent(clippedbox.c1[u], clippedbox.c2[u], s, eventlist[u]);
+            if(!node->IsLeaf())
+            {
+                int a = node->GetAxis();
+                double tint = (node->split - ray.origin[a])/ray.direction[a];
+
+                const KDNode* leftNode = node + 1, *rightNode = &nodes[node->GetRightChild()];
+                const KDNode* nearNode = ray.direction[a] > 0 ? leftNode : rightNode;
+                const KDNode* farNode = nearNode == leftNode ? rightNode : leftNode;
+
+                if(tint <= tmin)
+                {
+                    node = farNode;
+                    tmin = std::max(tmin, tint - eps);
+                }
+                else if(tint >= tmax)
+                {
+                    node = nearNode;
+                    tmax = std::min(tint + eps, tmax);
+                }
+                else
+                {
+                    stack[stackSize++] = { farNode, std::max(tmin, tint - eps), tmax };
+                    node = nearNode;
+                    tmax = std::min(tint + eps, tmax);
+                }
+                continue;
+            }
+
+            const int* indices = primitiveIndices.data() + node->primitiveOffset;
+            for(int i = 0; i < node->GetPrimitiveCount(); i++)
+            {
+                double t = primitives[indices[i]]->Intersect(ray);
+                if(t >= rmin && t <= rmax)
+                    return true;
+            }
         }
 
-        // Sort the event list
-        std::sort(eventlist[u].begin(), eventlist[u].end(), sortFn);
+        if(!stackSize)
+            return false;
+        auto& entry = stack[--stackSize];
+        node = entry.node, tmin = entry.tmin, tmax = entry.tmax;
     }
+}
 
-    m_root->Build(m_bbox, eventlist, primitives, 0, 3);
+/**
+ * Describes the tree built by the last call to Build.
+ * 
+ * @returns A human readable summary of the tree.
+ */
+std::string KDTree::GetStatistics() const
+{
+    return "K-d tree of " + std::to_string(primitives.size()) + " primitives: " + statistics.ToString();
+}
 
-    for(int u = 0; u < 3; u++)
-        for(auto& e : eventlist[u])
-            delete e;
+/**
+ * Saves the tree to a cache.
+ * 
+ * @param writer The writer of the cache.
+ */
+void KDTree::Save(CacheWriter& writer) const
+{
+    writer << ID_KDTREE << (unsigned long long) primitives.size() << m_bbox.c1 << m_bbox.c2 << nodes << primitiveIndices;
+    statistics.Save(writer);
+}
+
+/**
+ * Loads a tree saved to a cache.
+ * 
+ * @param reader The reader of the section of the cache that the tree was saved to.
+ * @param shapes The primitives that the tree was built for.
+ * @returns True if the section held a K-d tree built for as many primitives.
+ */
+bool KDTree::Load(CacheReader& reader, const std::vector<const Primitive*>& shapes)
+{
+    unsigned char id = 0;
+    unsigned long long nPrimitives = 0;
+    reader >> id >> nPrimitives;
+    if(id != ID_KDTREE || nPrimitives != shapes.size())
+        return false;
+
+    primitives = shapes;
+    reader >> m_bbox.c1 >> m_bbox.c2 >> nodes >> primitiveIndices;
+    statistics.Load(reader);
+    return reader.IsGood() && Validate();
+}
 
-    for(auto p : primitives)
-        delete p;
+/**
+ * Checks that the nodes of a loaded tree only refer to nodes and primitives that exist, and that
+ * the tree is no deeper than the traversal stack allows.
+ * 
+ * @returns True if the tree can be traversed safely.
+ */
+bool KDTree::Validate() const
+{
+    int nNodes = (int) nodes.size();
+    std::vector<int> depths(nNodes, 0);
+    for(int i = 0; i < nNodes; i++)
+    {
+        const KDNode& n = nodes[i];
+        if(depths[i] >= maxDepth)
+            return false;
+        if(n.IsLeaf())
+        {
+            if(n.primitiveOffset < 0 || n.GetPrimitiveCount() < 0 || (long long) n.primitiveOffset + n.GetPrimitiveCount() > (long long) primitiveIndices.size())
+                return false;
+            continue;
+        }
+        // The children come after their parent, so the depths are known before they are needed
+        int right = n.GetRightChild();
+        if(right <= i + 1 || right >= nNodes)
+            return false;
+        depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+        depths[right] = std::max(depths[right], depths[i] + 1);
+    }
+    return std::all_of(primitiveIndices.begin(), primitiveIndices.end(), [this](int p) { return p >= 0 && p < (int) primitives.size(); });
 }
 
 /**
@@ -463,78 +692,339 @@ void KDTree::Build(const std::vector<const Primitive*>& shapes)
  * @param ray The ray to intersect with.
  * @param tmin The smallest distance along the ray to find intersections.
  * @param tmax The greatest distance along the ray to find intersections.
- * @param returnPrimitive Whether to find the smallest t and return the primitive that was intersected.
- * @returns The distance along the ray that the intersection happened, or -inf if
- *          no intersection happened, along with the primitive that was intersected.
+ * @returns The closest hit, with a distance of -inf if no intersection happened.
+ */
+HitRecord KDTree::Intersect(const Ray& ray, double tmin, double tmax) const
+{
+    if(nodes.empty())
+        return HitRecord();
+    return IntersectSubtree(nodes.data(), ray, tmin, tmax);
+}
+
+/**
+ * Intersects the contents of a subtree of the K-d tree with a ray.
+ * 
+ * @param node The root of the subtree.
+ * @param ray The ray to intersect with.
+ * @param tmin The smallest distance along the ray inside the subtree.
+ * @param tmax The greatest distance along the ray inside the subtree.
+ * @returns The closest hit, with a distance of -inf if no intersection happened.
  */
-std::pair<double, const Primitive*> KDNode::IntersectRec(const Ray& ray, double tmin, double tmax, bool returnPrimitive=false) const
+HitRecord KDTree::IntersectSubtree(const KDNode* node, const Ray& ray, double tmin, double tmax) const
 {
-    if(tmin > tmax)
-        return { -inf, nullptr };
+    struct StackEntry
+    {
+        const KDNode* node;
+        double tmin, tmax;
+    } stack[maxDepth];
+
+    int stackSize = 0;
 
-    int a = splitdir;
-    double locmint = inf;
-    const Primitive* minprimitive = nullptr;
-    if(IsLeaf())
+    // Visits the nodes front to back; the first leaf to record a hit within its own part of the
+    // ray holds the closest hit
+    while(true)
     {
-        for(auto& s : m_primitives)
+        if(tmin <= tmax)
         {
-            double t = s->Intersect(ray);
-            if(t >= tmin && t <= tmax)
+            if(!node->IsLeaf())
+            {
+                int a = node->GetAxis();
+                double tint = (node->split - ray.origin[a])/ray.direction[a];
+
+                const KDNode* leftNode = node + 1, *rightNode = &nodes[node->GetRightChild()];
+                const KDNode* nearNode = ray.direction[a] > 0 ? leftNode : rightNode;
+                const KDNode* farNode = nearNode == leftNode ? rightNode : leftNode;
+
+                if(tint <= tmin)
+                {
+                    node = farNode;
+                    tmin = std::max(tmin, tint - eps);
+                }
+                else
+                {
+                    stack[stackSize++] = { farNode, std::max(tmin, tint - eps), tmax };
+                    node = nearNode;
+                    tmax = std::min(tint + eps, tmax);
+                }
+                continue;
+            }
+
+            HitRecord minhit;
+            const int* indices = primitiveIndices.data() + node->primitiveOffset;
+            for(int i = 0; i < node->GetPrimitiveCount(); i++)
             {
-                if(!returnPrimitive)
-                    return { t, nullptr };
-                if(t < locmint)
-                    minprimitive = s, locmint = t;
+                HitRecord hit = primitives[indices[i]]->IntersectHit(ray);
+                if(hit.t >= tmin && hit.t <= tmax && (!minhit.primitive || hit.t < minhit.t))
+                    minhit = hit;
             }
-        }        
-        if(minprimitive)
-            return { locmint, minprimitive };
-        return { -inf, nullptr };
-    }
+            if(minhit.primitive)
+                return minhit;
+        }
 
-    double tint = (m_splitpos - ray.origin[a])/ray.direction[a];
+        if(!stackSize)
+            return HitRecord();
+        auto& entry = stack[--stackSize];
+        node = entry.node, tmin = entry.tmin, tmax = entry.tmax;
+    }
+}
 
-    KDNode* nearnode = ray.direction[a] > 0 ? leftNode : rightNode;
-    KDNode* farnode = nearnode == leftNode ? rightNode : leftNode;
+/**
+ * Intersects a batch of rays with the K-d tree, each between zero and infinity. The rays are
+ * traced in packets of neighbouring rays, or one by one where a packet would not hold together.
+ * 
+ * @param rays The rays to intersect with.
+ * @param n The number of rays.
+ * @param hits The closest hit of each ray, with a distance of -inf if no intersection happened.
+ */
+void KDTree::Intersect(const Ray* rays, int n, HitRecord* hits) const
+{
+    for(int i = 0; i < n; i += RayPacket::size)
+    {
+        int m = std::min(RayPacket::size, n - i);
+        if(m >= minPacketRays && IsCoherent(rays + i, m))
+            IntersectPacket(RayPacket(rays + i, m), hits + i);
+        else
+            for(int j = i; j < i + m; j++)
+                hits[j] = Intersect(rays[j], 0, inf);
+    }
+}
 
-    if(tint <= tmin)
+/**
+ * Checks a batch of rays for anything blocking them, each between zero and its own distance. The
+ * rays are traced in packets of neighbouring rays, or one by one where a packet would not hold
+ * together.
+ * 
+ * @param rays The rays to check.
+ * @param tmax The greatest distance along each ray to find intersections.
+ * @param n The number of rays.
+ * @param occluded Whether each ray is blocked.
+ */
+void KDTree::Occluded(const Ray* rays, const double* tmax, int n, bool* occluded) const
+{
+    for(int i = 0; i < n; i += RayPacket::size)
     {
-        auto [t, primitive] = farnode->IntersectRec(ray, std::max(tmin, tint - eps), tmax, returnPrimitive);
-        if(t != -inf)
-            return { t, primitive };
+        int m = std::min(RayPacket::size, n - i);
+        if(m >= minPacketRays && IsCoherent(rays + i, m))
+            OccludedPacket(RayPacket(rays + i, m), tmax + i, occluded + i);
+        else
+            for(int j = i; j < i + m; j++)
+                occluded[j] = Occluded(rays[j], 0, tmax[j]);
     }
-    else
+}
+
+/**
+ * Intersects a packet of rays with the K-d tree, each between zero and infinity. The rays share
+ * the walk through the tree, and each keeps its own part of the ray in the current node, so each
+ * ray visits its leaves in the same order and finds the same hit as it would on its own. Where
+ * too few rays are left to share the walk, they finish the subtree one by one.
+ * 
+ * @param packet The rays to intersect with, whose directions have the same signs.
+ * @param hits The closest hit of each ray, with a distance of -inf if no intersection happened.
+ */
+void KDTree::IntersectPacket(const RayPacket& packet, HitRecord* hits) const
+{
+    const int size = RayPacket::size;
+    struct StackEntry
+    {
+        const KDNode* node;
+        unsigned int mask;
+        double tmin[size], tmax[size];
+    } stack[maxDepth];
+
+    int n = packet.n;
+    for(int i = 0; i < n; i++)
+        hits[i] = HitRecord();
+    if(nodes.empty())
+        return;
+
+    double tmin[size], tmax[size];
+    for(int i = 0; i < size; i++)
+        tmin[i] = 0, tmax[i] = inf;
+
+    // The rays that still take part in the current node, and those that already found their hit
+    unsigned int mask = (1u << n) - 1, done = 0;
+    int stackSize = 0;
+    const KDNode* node = nodes.data();
+
+    while(true)
     {
-        auto [t1, primitive1] = nearnode->IntersectRec(ray, tmin, std::min(tint + eps, tmax), returnPrimitive);
-        if(t1 != -inf)
-            return { t1, primitive1 };
+        for(int i = 0; i < size; i++)
+            mask &= ~((unsigned int) !(tmin[i] <= tmax[i]) << i);
+
+        if(std::popcount(mask) < minPacketRays)
+        {
+            for(int i = 0; i < n; i++)
+            {
+                if(!(mask >> i & 1))
+                    continue;
+                HitRecord hit = IntersectSubtree(node, packet.rays[i], tmin[i], tmax[i]);
+                if(hit.primitive)
+                    hits[i] = hit, done |= 1u << i;
+            }
+        }
+        else if(!node->IsLeaf())
+        {
+            int a = node->GetAxis();
+            const KDNode* leftNode = node + 1, *rightNode = &nodes[node->GetRightChild()];
+            const KDNode* nearNode = packet.directions[a][0] > 0 ? leftNode : rightNode;
+            const KDNode* farNode = nearNode == leftNode ? rightNode : leftNode;
+
+            // Every ray goes on to the far side, and those that cross the plane after the start of
+            // their part of the ray first go to the near side. The rays that are not taking part
+            // are split too, and left to the masks to ignore
+            StackEntry& far = stack[stackSize++];
+            far.node = farNode, far.mask = mask;
+            unsigned int nearMask = 0;
+            for(int i = 0; i < size; i++)
+            {
+                double tint = (node->split - packet.origins[a][i])/packet.directions[a][i];
+                far.tmin[i] = std::max(tmin[i], tint - eps);
+                far.tmax[i] = tmax[i];
+                bool near = !(tint <= tmin[i]);
+                nearMask |= (unsigned int) near << i;
+                tmax[i] = near ? std::min(tint + eps, tmax[i]) : tmax[i];
+            }
+            nearMask &= mask;
+
+            if(nearMask)
+            {
+                node = nearNode, mask = nearMask;
+                continue;
+            }
+        }
+        else
+        {
+            HitRecord minhits[size], leafHits[size];
+            const int* indices = primitiveIndices.data() + node->primitiveOffset;
+            for(int j = 0; j < node->GetPrimitiveCount(); j++)
+            {
+                primitives[indices[j]]->IntersectHit(packet, mask, leafHits);
+                for(int i = 0; i < n; i++)
+                {
+                    const HitRecord& hit = leafHits[i];
+                    if(mask >> i & 1 && hit.t >= tmin[i] && hit.t <= tmax[i] && (!minhits[i].primitive || hit.t < minhits[i].t))
+                        minhits[i] = hit;
+                }
+            }
+            for(int i = 0; i < n; i++)
+                if(minhits[i].primitive)
+                    hits[i] = minhits[i], done |= 1u << i;
+        }
 
-        auto [t2, primitive2] = farnode->IntersectRec(ray, std::max(tmin, tint - eps), tmax, returnPrimitive);
-        if(t2 != -inf)
-            return { t2, primitive2 };
+        do
+        {
+            if(!stackSize)
+                return;
+            auto& entry = stack[--stackSize];
+            node = entry.node, mask = entry.mask & ~done;
+            std::copy(entry.tmin, entry.tmin + size, tmin);
+            std::copy(entry.tmax, entry.tmax + size, tmax);
+        } while(!mask);
     }
-    return { -inf, nullptr };
 }
 
 /**
- * Intersects the contents of the K-d tree with a ray.
+ * Checks a packet of rays for anything blocking them, each between zero and its own distance.
+ * The rays share the walk through the tree, and each leaves it as soon as it is found blocked.
+ * Where too few rays are left to share the walk, they finish the subtree one by one.
  * 
- * @param ray The ray to intersect with.
- * @param primitive The intersected triangle.
- * @param tmin The smallest distance along the ray to find intersections.
- * @param tmax The greatest distance along the ray to find intersections.
- * @param returnPrimitive Whether to find the smallest distance along the ray that the
-                          primitive was intersected and return the primitive that was
-                          intersected, or just reporting any distance and returning no
-                          primitive.
- * @returns The distance along the ray that the intersection happened, or -inf if
- *          no intersection happened.
+ * @param packet The rays to check, whose directions have the same signs.
+ * @param rmax The greatest distance along each ray to find intersections.
+ * @param occluded Whether each ray is blocked.
  */
-std::tuple<double, const Primitive*> KDTree::Intersect(const Ray& ray, double tmin, double tmax, bool returnPrimitive = true) const
+void KDTree::OccludedPacket(const RayPacket& packet, const double* rmax, bool* occluded) const
 {
-    auto [t, prim] = m_root->IntersectRec(ray, tmin, tmax, returnPrimitive);
-    if(t != -inf)
-        return { t, prim };
-    return { -inf, nullptr };
+    const int size = RayPacket::size;
+    struct StackEntry
+    {
+        const KDNode* node;
+        unsigned int mask;
+        double tmin[size], tmax[size];
+    } stack[maxDepth];
+
+    int n = packet.n;
+    for(int i = 0; i < n; i++)
+        occluded[i] = false;
+    if(nodes.empty())
+        return;
+
+    double tmin[size], tmax[size];
+    for(int i = 0; i < size; i++)
+        tmin[i] = 0, tmax[i] = i < n ? rmax[i] : 0;
+
+    unsigned int mask = (1u << n) - 1, done = 0;
+    int stackSize = 0;
+    const KDNode* node = nodes.data();
+
+    while(true)
+    {
+        for(int i = 0; i < size; i++)
+            mask &= ~((unsigned int) !(tmin[i] <= tmax[i]) << i);
+
+        if(std::popcount(mask) < minPacketRays)
+        {
+            for(int i = 0; i < n; i++)
+                if(mask >> i & 1 && OccludedSubtree(node, packet.rays[i], tmin[i], tmax[i], 0, rmax[i]))
+                    occluded[i] = true, done |= 1u << i;
+        }
+        else if(!node->IsLeaf())
+        {
+            int a = node->GetAxis();
+            const KDNode* leftNode = node + 1, *rightNode = &nodes[node->GetRightChild()];
+            const KDNode* nearNode = packet.directions[a][0] > 0 ? leftNode : rightNode;
+            const KDNode* farNode = nearNode == leftNode ? rightNode : leftNode;
+
+            // Like a single ray, a ray skips the far side if its part of the ray ends before the
+            // plane
+            StackEntry& far = stack[stackSize];
+            far.node = farNode;
+            unsigned int nearMask = 0, farMask = 0;
+            for(int i = 0; i < size; i++)
+            {
+                double tint = (node->split - packet.origins[a][i])/packet.directions[a][i];
+                far.tmin[i] = std::max(tmin[i], tint - eps);
+                far.tmax[i] = tmax[i];
+                bool near = !(tint <= tmin[i]);
+                farMask |= (unsigned int) (!near || !(tint >= tmax[i])) << i;
+                nearMask |= (unsigned int) near << i;
+                tmax[i] = near ? std::min(tint + eps, tmax[i]) : tmax[i];
+            }
+            far.mask = farMask & mask;
+            nearMask &= mask;
+
+            if(far.mask)
+                stackSize++;
+            if(nearMask)
+            {
+                node = nearNode, mask = nearMask;
+                continue;
+            }
+        }
+        else
+        {
+            // Any hit within the range of a ray will do, like for a single ray
+            double ts[size];
+            const int* indices = primitiveIndices.data() + node->primitiveOffset;
+            for(int j = 0; j < node->GetPrimitiveCount() && mask; j++)
+            {
+                primitives[indices[j]]->Intersect(packet, mask, ts);
+                for(int i = 0; i < n; i++)
+                {
+                    double t = ts[i];
+                    if(mask >> i & 1 && t >= 0 && t <= rmax[i])
+                        occluded[i] = true, done |= 1u << i, mask &= ~(1u << i);
+                }
+            }
+        }
+
+        do
+        {
+            if(!stackSize)
+                return;
+            auto& entry = stack[--stackSize];
+            node = entry.node, mask = entry.mask & ~done;
+            std::copy(entry.tmin, entry.tmin + size, tmin);
+            std::copy(entry.tmax, entry.tmax + size, tmax);
+        } while(!mask);
+    }
 }
@@ -15,34 +15,53 @@ class SpatialPartitioning;
 #include "BoundingBox.h"
 #include "SpatialPartitioning.h"
 #include <cmath>
+#include <string>
 #include <vector>
 
+class RayPacket;
 class SAHEvent;
 
-class KDPrimitive
+class KDBuildNode
 {
 public:
-    const Primitive* p;
-    int side;
+    KDBuildNode();
+    ~KDBuildNode();
+    std::vector<int> m_primitives;
+    static double SAHCost(int nPrimitives, double area, int nLeft, double leftarea, int nRight, double rightarea, int nPlanar, int side);
+
+    void Build(const BoundingBox& bbox, std::vector<SAHEvent>* events, std::vector<int>& shapes, const std::vector<const Primitive*>& primitives, int depth, int badsplits, int parallelDepth);
+    bool IsLeaf() const;
+
+    KDBuildNode *leftNode, *rightNode;
+    double m_splitpos;
+    int splitdir;
 };
 
+// A node of the flattened tree. The lower two bits of the second word hold the split axis,
+// or 3 for leaves, and the rest holds either the number of primitives of a leaf or the index
+// of the right child; the left child of an interior node always directly follows it
 class KDNode
 {
 public:
-    KDNode();
-    ~KDNode();
-    void Build();
-    std::vector<const Primitive*> m_primitives;
-    static double SAHCost(int nPrimitives, double area, int nLeft, double leftarea, int nRight, double rightarea, int nPlanar, int side);
-
-    std::pair<double, const Primitive*> IntersectRec(const Ray& ray, double tmin, double tmax, bool returnPrimitive) const;
+    void MakeLeaf(int primitiveOffset, int nPrimitives);
+    void MakeInterior(int axis, int rightChild, float split);
 
-    void Build(BoundingBox& bbox, std::vector<SAHEvent*>* events, const std::vector<KDPrimitive*>& primitives, int depth, int badsplits);
-    bool IsLeaf() const;
+    bool IsLeaf() const { return (flags & 3) == 3; }
+    int GetAxis() const { return flags & 3; }
+    int GetPrimitiveCount() const { return nPrimitives >> 2; }
+    int GetRightChild() const { return rightChild >> 2; }
 
-    KDNode *leftNode, *rightNode;
-    double m_splitpos;
-    int splitdir;
+    union
+    {
+        float split;
+        int primitiveOffset;
+    };
+    union
+    {
+        int flags;
+        int nPrimitives;
+        int rightChild;
+    };
 };
 
 class KDTree : public SpatialPartitioning
@@ -50,27 +69,47 @@ class KDTree : public SpatialPartitioning
 public:
     static double CalculateCost(int type, int samples);
     std::vector<const Primitive*> primitives;
-    KDNode* m_root;
+    std::vector<int> primitiveIndices;
+    std::vector<KDNode> nodes;
     KDTree();
     ~KDTree();
     void Build(const std::vector<const Primitive*>&);
-    std::tuple<double, const Primitive*> Intersect(const Ray& ray, double tmin, double tmax, bool returnPrimitive) const;
+    HitRecord Intersect(const Ray& ray, double tmin, double tmax) const;
+    bool Occluded(const Ray& ray, double tmin, double tmax) const;
+    void Intersect(const Ray* rays, int n, HitRecord* hits) const;
+    void Occluded(const Ray* rays, const double* tmax, int n, bool* occluded) const;
     BoundingBox CalculateExtents(const std::vector<const Primitive*>& primitives);
+    void Flatten(const KDBuildNode* node);
+    void CalculateStatistics(int node, const BoundingBox& bbox, int depth);
+    std::string GetStatistics() const;
+
+    void Save(CacheWriter& writer) const;
+    bool Load(CacheReader& reader, const std::vector<const Primitive*>& primitives);
 
     BoundingBox m_bbox;
 
+    PartitioningStatistics statistics;
+
+    static const int maxDepth = 64;
+    static const int minPacketRays = 3; // The fewest rays of a packet that go on together
+
     static double mint;
     static double cost_triint, cost_trav, cost_boxint;
     static const int leftNode = 0, rightNode = 1;
+
+private:
+    bool Validate() const;
+    HitRecord IntersectSubtree(const KDNode* node, const Ray& ray, double tmin, double tmax) const;
+    bool OccludedSubtree(const KDNode* node, const Ray& ray, double tmin, double tmax, double rmin, double rmax) const;
+    void IntersectPacket(const RayPacket& packet, HitRecord* hits) const;
+    void OccludedPacket(const RayPacket& packet, const double* rmax, bool* occluded) const;
 };
 
 class SAHEvent
 {
 public:
-    SAHEvent(KDPrimitive*, double, int);
-
-    KDPrimitive* primitive;
     double position;
+    int primitive;
     int type;
     static const char end = 0, planar = 1, start = 2;
 };
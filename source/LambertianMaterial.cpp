@@ -74,7 +74,7 @@ Sample LambertianMaterial::GetSample(const IntersectionInfo& info, Randomizer& r
     if(w_i*N_g < 0 || w_o*N_g < 0 || w_i*N_s < 0 || w_o*N_s < 0)
         return Sample(Color(0, 0, 0), out, pdf, rpdf, false, 1);
 
-    auto color = adjoint ? Kd*abs(w_i*N_s)/abs(w_i*N_g) : Kd;
+    auto color = adjoint ? Kd*std::abs(w_i*N_s)/std::abs(w_i*N_g) : Kd;
     return Sample(color, out, pdf, rpdf, false, 1);
 }
 
@@ -14,6 +14,7 @@
 #include "UniformEnvironmentLight.h"
 #include "MeshLight.h"
 #include "Bytestream.h"
+#include "Logger.h"
 
 /**
  * Constructor.
@@ -51,7 +52,7 @@ Light* Light::Create(unsigned char c)
         return new MeshLight;
     else
     {
-        __debugbreak();
+        logger.Box("Unknown light id " + std::to_string(c));
         return new AreaLight; // To satisfy the compiler who thinks the function otherwise might return null
     }
 }
@@ -64,4 +65,16 @@ Light* Light::Create(unsigned char c)
 Color Light::GetIntensity() const
 {
     return intensity;
+}
+
+/**
+ * Gets the bounds of the light for the light tree. Lights that are not local to some part of the
+ * scene, like environment lights, have no bounds.
+ * 
+ * @param bounds The bounds of the light.
+ * @returns Whether the light could be bounded.
+ */
+bool Light::GetBounds(LightBounds& bounds) const
+{
+    return false;
 }
\ No newline at end of file
@@ -21,6 +21,7 @@ class Scene;
 class Ray;
 class Color;
 class Renderer;
+class LightBounds;
 
 class Light
 {
@@ -39,6 +40,7 @@ public:
     virtual std::tuple<Color, Point> NextEventEstimation(const Renderer* renderer, const IntersectionInfo& info, Randomizer& rnd, int component) const = 0;
 
     virtual double GetArea() const = 0;
+    virtual bool GetBounds(LightBounds& bounds) const;
     virtual void AddToScene(Scene* scene) = 0;
 
     virtual void Save(Bytestream& s) const = 0;
@@ -9,6 +9,7 @@
 
 #include "LightTracer.h"
 #include "Sample.h"
+#include "SplatBuffer.h"
 
 /**
  * Constructor.
@@ -27,23 +28,33 @@ LightTracer::~LightTracer()
 }
 
 /**
- * Adds a number of estimates of the importance transport equation.
+ * Adds a number of estimates of the importance transport equation, tracing as many light paths
+ * as there are pixels in the tile. The paths end up anywhere in the image, so the tile itself is
+ * left black and all contributions go to the splat buffer.
  * 
- * @param cam The horizontal component of the pixel coordinate.
- * @param culBuf The color buffer to add sample estimates to.
+ * @param cam The camera to render from.
+ * @param colBuf The color buffer of the tile.
+ * @param splats The buffer to add sample estimates to.
+ * @param x0 The x coordinate of the upper left pixel of the tile in the image.
+ * @param y0 The y coordinate of the upper left pixel of the tile in the image.
+ * @param pass The number of passes over the tile before this one.
  */
-void LightTracer::Render(Camera& cam, ColorBuffer& colBuf)
+void LightTracer::RenderTile(Camera& cam, ColorBuffer& colBuf, SplatBuffer& splats, int x0, int y0, unsigned int pass)
 {
-    const double xres = (double)colBuf.GetXRes();
-    const double yres = (double)colBuf.GetYRes();
+    const double xres = (double)cam.GetXRes();
+    const double yres = (double)cam.GetYRes();
 
-    Vector3d dummyVector;
-
-    colBuf.Clear(Color::Black);
-
-    for(int samples = 0; samples < xres*yres && ! stopping; samples++)
+    int nPaths = colBuf.GetXRes()*colBuf.GetYRes();
+    int samples;
+    for(samples = 0; samples < nPaths && !stopping; samples++)
     {
+        // Each path is seeded by a pixel of the tile, although it may land anywhere
+        int x = x0 + samples%colBuf.GetXRes(), y = y0 + samples/colBuf.GetXRes();
+        m_random.Seed(y*cam.GetXRes() + x, pass);
+
         auto [light, lightWeight] = scene->PickLight(m_random.GetDouble(0.0, 1.0));
+        if(!light)
+            continue;
         auto [ray, pathColor, lightNormal, _, __] = light->SampleRay(m_random);
 
         pathColor *= light->GetArea()*light->GetIntensity(); // First direction is from the light source
@@ -57,25 +68,25 @@ void LightTracer::Render(Camera& cam, ColorBuffer& colBuf)
         double camRayLength = lightToCam.Length();
         lightToCamRay.direction.Normalize();
 
-        double camcos = abs(-lightToCamRay.direction*cam.dir);
+        double camcos = std::abs(-lightToCamRay.direction*cam.dir);
         double pixelArea = (double)cam.GetPixelArea();
-        double surfcos = abs(lightNormal*lightToCamRay.direction);
-        surfcos = abs(surfcos);
+        double surfcos = std::abs(lightNormal*lightToCamRay.direction);
+        surfcos = std::abs(surfcos);
 
         auto [firstHitCam, firstXPixel, firstYPixel] = cam.GetPixelFromRay(lightToCamRay, firstU, firstV);
         if(firstHitCam && TraceShadowRay(lightToCamRay, camRayLength))
-            colBuf.AddColor(firstXPixel, firstYPixel, light->GetIntensity()*light->GetArea()*surfcos/(camcos*camcos*camcos*camRayLength*camRayLength*pixelArea*xres*yres)/lightWeight);
+            splats.AddColor(firstXPixel, firstYPixel, light->GetIntensity()*light->GetArea()*surfcos/(camcos*camcos*camcos*camRayLength*camRayLength*pixelArea*xres*yres)/lightWeight);
         do
         {
             IntersectionInfo info;
             Ray bounceRay;
 
             // Figure out if and where the current ray segment hits something
-            auto [t, minprimitive, minlight] = scene->Intersect(ray);
-            if(t < 0.0)
+            auto [hit, minlight] = scene->Intersect(ray);
+            if(hit.t < 0.0)
                 break;
-            if(minprimitive)
-                minprimitive->GenerateIntersectionInfo(ray, info);
+            if(hit.primitive)
+                hit.primitive->GenerateIntersectionInfo(ray, hit, info);
             else
                 minlight->GenerateIntersectionInfo(ray, info);
             
@@ -94,15 +105,15 @@ void LightTracer::Render(Camera& cam, ColorBuffer& colBuf)
             auto [hitCam, xPixel, yPixel] = cam.GetPixelFromRay(camRay, u, v);
             if(hitCam && TraceShadowRay(camRay, camRayLength))
             {
-                camcos = abs(-camRay.direction*cam.dir);
+                camcos = std::abs(-camRay.direction*cam.dir);
                 pixelArea = (double)cam.GetPixelArea();
-                surfcos = abs(info.geometricnormal*camRay.direction);
+                surfcos = std::abs(info.geometricnormal*camRay.direction);
 
                 Color brdf = info.material->BRDF(info, camRay.direction, sample.component);
                 // Flux to radiance and stuff involving probability and sampling of the camera
                 Color pixelColor = pathColor*surfcos*brdf/(camcos*camcos*camcos*camRayLength*camRayLength*pixelArea*xres*yres)/lightWeight;
-                pixelColor*=abs(info.direction*info.normal)/abs(info.direction*info.geometricnormal);
-                colBuf.AddColor(xPixel, yPixel, pixelColor);
+                pixelColor*=std::abs(info.direction*info.normal)/std::abs(info.direction*info.geometricnormal);
+                splats.AddColor(xPixel, yPixel, pixelColor);
             }
             
             // Bounce a new ray
@@ -111,6 +122,7 @@ void LightTracer::Render(Camera& cam, ColorBuffer& colBuf)
 
         } while(m_random.GetDouble(0.f, 1.f) < 0.7);
     }
+    splats.AddPaths(samples);
 }
 
 /**
@@ -22,10 +22,8 @@ public:
     LightTracer(std::shared_ptr<Scene> scene);
     ~LightTracer();
 
-    void Render(Camera& cam, ColorBuffer& colBuf);
+    void RenderTile(Camera& cam, ColorBuffer& colBuf, SplatBuffer& splats, int x0, int y0, unsigned int pass);
     
     void Save(Bytestream& stream) const;
     void Load(Bytestream& stream);
-private:
-    Randomizer m_random;
 };
@@ -1,106 +1,402 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file LightTree.cpp
+ * 
+ * Implementation of the LightTree class that picks lights by how much they light up a point.
+ */
+
 #include "LightTree.h"
+#include "IntersectionInfo.h"
+#include "Light.h"
+#include "Utils.h"
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Returns the cosine of the difference of two angles, or 1 if the difference is negative.
+ * 
+ * @param sinA The sine of the first angle.
+ * @param cosA The cosine of the first angle.
+ * @param sinB The sine of the angle to subtract.
+ * @param cosB The cosine of the angle to subtract.
+ * @returns The cosine of max(0, a - b).
+ */
+static double CosSubClamped(double sinA, double cosA, double sinB, double cosB)
+{
+    return cosA > cosB ? 1 : cosA*cosB + sinA*sinB;
+}
 
-LightStruct::LightStruct(Light* light, double weight) : light(light), weight(weight)
+/**
+ * Returns the sine of the difference of two angles, or 0 if the difference is negative.
+ * 
+ * @param sinA The sine of the first angle.
+ * @param cosA The cosine of the first angle.
+ * @param sinB The sine of the angle to subtract.
+ * @param cosB The cosine of the angle to subtract.
+ * @returns The sine of max(0, a - b).
+ */
+static double SinSubClamped(double sinA, double cosA, double sinB, double cosB)
 {
+    return cosA > cosB ? 0 : sinA*cosB - cosA*sinB;
 }
 
-LightStruct::~LightStruct()
+/**
+ * Returns the sine of an angle given its cosine.
+ * 
+ * @param cosA The cosine of an angle between 0 and pi.
+ * @returns The sine of the angle.
+ */
+static double SinFromCos(double cosA)
 {
+    return std::sqrt(std::max(0.0, 1 - cosA*cosA));
 }
 
-LightNode::LightNode(vector<Light*> lights)
+/**
+ * Constructor. Creates empty bounds.
+ */
+LightBounds::LightBounds() : box(Vector3d(inf, inf, inf), Vector3d(-inf, -inf, -inf)),
+    axis(0, 0, 1), cosNormals(1), cosEmission(1), power(0)
 {
-    vector<LightStruct*> lsLeft;
-    vector<LightStruct*> lsRight;
-    double total = 0.0f;
+}
+
+/**
+ * Constructor.
+ * 
+ * @param box The box around the light.
+ * @param axis The axis of the cone of the normals of the light.
+ * @param cosNormals The cosine of the half angle of the cone of normals.
+ * @param cosEmission The cosine of the largest angle to the normal that light leaves at.
+ * @param power The power of the light.
+ */
+LightBounds::LightBounds(const BoundingBox& box, const Vector3d& axis, double cosNormals,
+                         double cosEmission, double power) : box(box), axis(axis),
+    cosNormals(cosNormals), cosEmission(cosEmission), power(power)
+{
+}
 
-    // First, calculate the total sum of weights
-    for(auto it = lights.begin(); it < lights.end(); it++)
+/**
+ * Grows the bounds to also enclose other bounds. The cone of normals becomes the smallest cone
+ * around both cones.
+ * 
+ * @param b The bounds to enclose.
+ */
+void LightBounds::Enclose(const LightBounds& b)
+{
+    if(b.power <= 0)
+        return;
+    if(power <= 0)
     {
-        Light* light = *it;
-        total += 1;
+        *this = b;
+        return;
     }
 
-    // Create the lightstructs, and fill them with the normalized weights
-    auto it = lights.begin();
-    double rightWeight = 0.0f;
-    int index = 0;
-    for(; it < lights.end(); it++)
+    box.c1 = Vector3d(std::min(box.c1.x, b.box.c1.x), std::min(box.c1.y, b.box.c1.y), std::min(box.c1.z, b.box.c1.z));
+    box.c2 = Vector3d(std::max(box.c2.x, b.box.c2.x), std::max(box.c2.y, b.box.c2.y), std::max(box.c2.z, b.box.c2.z));
+    cosEmission = std::min(cosEmission, b.cosEmission);
+    power += b.power;
+
+    double thetaA = std::acos(std::clamp(cosNormals, -1.0, 1.0));
+    double thetaB = std::acos(std::clamp(b.cosNormals, -1.0, 1.0));
+    double thetaD = std::acos(std::clamp(axis*b.axis, -1.0, 1.0));
+    if(std::min(thetaD + thetaB, pi) <= thetaA) // The other cone is inside this one
+        return;
+    if(std::min(thetaD + thetaA, pi) <= thetaB) // This cone is inside the other one
     {
-        Light* light = *it;
-        LightStruct* s = new LightStruct(light, 1);
-        lsLeft.push_back(s);
-        rightWeight += s->weight;
-        if(++index >= lights.size()/2)
-            break;
+        axis = b.axis, cosNormals = b.cosNormals;
+        return;
     }
-    if(it < lights.end()) // This was commented out earlier but doesn't work with 0 lights - if single lights or multiple lights doesn't work as it should, comment this out again
-       it++;
-    if(lsLeft.size() > 0)
-        left = new LightNode(0, lsLeft);
-    else
-        left = 0;
-    for(; it < lights.end(); it++)
+
+    // The new cone spans from the far side of this cone to the far side of the other, so its
+    // axis is this axis turned towards the other one
+    double theta = (thetaA + thetaD + thetaB)/2;
+    Vector3d rotationAxis = axis^b.axis;
+    if(theta >= pi || !rotationAxis.Length2())
     {
-        Light* light = *it;
-        LightStruct* s = new LightStruct(light, 1);
-        lsRight.push_back(s);
+        cosNormals = -1;
+        return;
     }
-    if(lsRight.size() > 0)
-        right = new LightNode(rightWeight, lsRight);
-    else
-        right = 0;
-    val = rightWeight;
+    rotationAxis.Normalize();
+    double thetaR = theta - thetaA;
+    axis = axis*std::cos(thetaR) + (rotationAxis^axis)*std::sin(thetaR);
+    axis.Normalize();
+    cosNormals = std::cos(theta);
 }
 
-LightNode::LightNode(double weight, vector<LightStruct*> lightStructs)
+/**
+ * Returns a conservative estimate of how much light a point receives from the light, which is
+ * zero only if the point cannot receive any. The estimate uses the smallest possible angles
+ * between the normals of the light and the point, and the light, given the box and the cone.
+ * 
+ * @param point The point that receives light.
+ * @param normal The normal of the surface at the point.
+ * @returns The importance of the light to the point.
+ */
+double LightBounds::Importance(const Vector3d& point, const Vector3d& normal) const
 {
-    if(lightStructs.size() == 1)
+    if(power <= 0)
+        return 0;
+
+    Vector3d center = (box.c1 + box.c2)/2;
+    double radius = (box.c2 - box.c1).Length()/2;
+    Vector3d toPoint = point - center;
+    double d2 = toPoint.Length2();
+
+    // Inside the sphere around the box, the light can be in any direction
+    if(d2 <= radius*radius)
+        return power/std::max(d2, radius);
+
+    // The directions to the box from the point lie within an angle of the direction to its center
+    double sinB = radius/std::sqrt(d2), cosB = SinFromCos(sinB);
+    Vector3d wi = toPoint/std::sqrt(d2);
+
+    double cosW = axis*wi, sinW = SinFromCos(cosW);
+    double sinO = SinFromCos(cosNormals);
+    double cosX = CosSubClamped(sinW, cosW, sinO, cosNormals);
+    double sinX = SinSubClamped(sinW, cosW, sinO, cosNormals);
+    double cosP = CosSubClamped(sinX, cosX, sinB, cosB);
+    if(cosP <= cosEmission)
+        return 0;
+
+    double cosI = std::abs(wi*normal), sinI = SinFromCos(cosI);
+    double importance = power*cosP*CosSubClamped(sinI, cosI, sinB, cosB)/std::max(d2, radius);
+    return std::max(importance, 0.0);
+}
+
+/**
+ * Returns the solid angle of the directions that light can leave in, weighted by the cosine to
+ * the closest normal. Used for the cost of splitting the lights.
+ * 
+ * @returns The orientation measure of the bounds.
+ */
+double LightBounds::GetOrientationMeasure() const
+{
+    double thetaO = std::acos(std::clamp(cosNormals, -1.0, 1.0));
+    double thetaE = std::acos(std::clamp(cosEmission, -1.0, 1.0));
+    double thetaW = std::min(thetaO + thetaE, pi);
+    double sinO = SinFromCos(cosNormals);
+    return 2*pi*(1 - cosNormals) +
+           pi/2*(2*thetaW*sinO - std::cos(thetaO - 2*thetaW) - 2*thetaO*sinO + cosNormals);
+}
+
+/**
+ * Builds the tree over the lights that can be bounded. Lights that emit nothing are left out,
+ * since they are never worth picking.
+ * 
+ * @param lights The lights of the scene.
+ */
+void LightTree::Build(const std::vector<Light*>& lights)
+{
+    nodes.clear();
+    boundedLights.clear();
+    unboundedLights.clear();
+    leaves.clear();
+
+    std::vector<std::pair<Light*, LightBounds>> bounded;
+    for(auto light : lights)
     {
-        right = 0;
-        left = 0;
-        light = lightStructs[0]->light;
-        val = lightStructs[0]->weight;
-        return;
+        LightBounds bounds;
+        if(!light->GetBounds(bounds))
+            unboundedLights.push_back(light);
+        else if(bounds.power > 0)
+            bounded.push_back({ light, bounds });
     }
- 
-    vector<LightStruct*> lsLeft;
-    vector<LightStruct*> lsRight;
-    auto it = lightStructs.begin();
-    double rightWeight = weight;
-    int index = 0;
-    for(; it < lightStructs.end(); it++)
+
+    if(!bounded.empty())
+        BuildNode(bounded, 0, (int) bounded.size(), -1);
+}
+
+/**
+ * Builds a node and the nodes below it, splitting the lights where the sum of the power times the
+ * area times the orientation measure of the two halves is the smallest.
+ * 
+ * @param lights The lights with their bounds.
+ * @param begin The first light of the node.
+ * @param end The light after the last light of the node.
+ * @param parent The index of the parent node, or -1 for the root.
+ * @returns The index of the node.
+ */
+int LightTree::BuildNode(std::vector<std::pair<Light*, LightBounds>>& lights, int begin, int end, int parent)
+{
+    int node = (int) nodes.size();
+    nodes.emplace_back();
+    nodes[node].parent = parent;
+
+    LightBounds bounds;
+    BoundingBox centroids(Vector3d(inf, inf, inf), Vector3d(-inf, -inf, -inf));
+    for(int i = begin; i < end; i++)
+    {
+        bounds.Enclose(lights[i].second);
+        Vector3d c = (lights[i].second.box.c1 + lights[i].second.box.c2)/2;
+        for(int u = 0; u < 3; u++)
+        {
+            centroids.c1[u] = std::min(centroids.c1[u], c[u]);
+            centroids.c2[u] = std::max(centroids.c2[u], c[u]);
+        }
+    }
+    nodes[node].bounds = bounds;
+
+    if(end - begin == 1)
+    {
+        nodes[node].leaf = true;
+        nodes[node].child = (int) boundedLights.size();
+        boundedLights.push_back(lights[begin].first);
+        leaves[lights[begin].first] = node;
+        return node;
+    }
+
+    auto centroid = [&](const LightBounds& b, int u) { return (b.box.c1[u] + b.box.c2[u])/2; };
+    auto bin = [&](const LightBounds& b, int u)
+    {
+        double extent = centroids.c2[u] - centroids.c1[u];
+        return std::min(nBins - 1, (int) (nBins*(centroid(b, u) - centroids.c1[u])/extent));
+    };
+    auto cost = [](const LightBounds& b) { return b.power > 0 ? b.power*b.box.GetArea()*b.GetOrientationMeasure() : 0; };
+
+    // Find the cheapest split along the bin boundaries of all axes. Splits across the thin axes of
+    // the box are penalized, so that flat groups of lights are not cut into slivers
+    double bestCost = inf;
+    int bestAxis = -1, bestBin = 0;
+    Vector3d diagonal = bounds.box.c2 - bounds.box.c1;
+    double maxExtent = std::max({ diagonal.x, diagonal.y, diagonal.z });
+    for(int u = 0; u < 3; u++)
+    {
+        double extent = centroids.c2[u] - centroids.c1[u];
+        if(!(extent > 0) || !std::isfinite(extent))
+            continue;
+
+        LightBounds bins[nBins];
+        for(int i = begin; i < end; i++)
+            bins[bin(lights[i].second, u)].Enclose(lights[i].second);
+
+        double rightCost[nBins];
+        LightBounds right;
+        for(int b = nBins - 1; b > 0; b--)
+        {
+            right.Enclose(bins[b]);
+            rightCost[b] = cost(right);
+        }
+
+        LightBounds left;
+        for(int b = 1; b < nBins; b++)
+        {
+            left.Enclose(bins[b - 1]);
+            double c = (cost(left) + rightCost[b])*maxExtent/diagonal[u];
+            if(c < bestCost)
+                bestCost = c, bestAxis = u, bestBin = b;
+        }
+    }
+
+    int mid = (begin + end)/2;
+    if(bestAxis >= 0)
     {
-        LightStruct* s = *it;
-        rightWeight += s->weight;
-        lsLeft.push_back(s);
-        if(++index >= lightStructs.size()/2)
-            break;
+        auto it = std::partition(lights.begin() + begin, lights.begin() + end, [&](const std::pair<Light*, LightBounds>& l)
+        {
+            return bin(l.second, bestAxis) < bestBin;
+        });
+        mid = (int) (it - lights.begin());
+        if(mid == begin || mid == end) // Every light ended up on one side, so just halve them
+            mid = (begin + end)/2;
     }
-    for(; it < lightStructs.end(); it++)
-        lsRight.push_back(*it);
-
-    left = new LightNode(weight, lsLeft);
-    if(lsRight.size() > 0)
-        right = new LightNode(weight + rightWeight, lsRight);
-    else
-        right = 0;
-    val = weight + rightWeight;
+
+    nodes[node].leaf = false;
+    BuildNode(lights, begin, mid, node);
+    int second = BuildNode(lights, mid, end, node);
+    nodes[node].child = second;
+    return node;
 }
 
-LightNode::~LightNode()
+/**
+ * Returns the probability of picking among the lights that cannot be bounded rather than
+ * descending the tree, which is the share of those lights among them and the tree.
+ * 
+ * @returns The probability of picking one of the unbounded lights.
+ */
+double LightTree::GetUnboundedProbability() const
 {
+    if(unboundedLights.empty())
+        return 0;
+    return nodes.empty() ? 1 : unboundedLights.size()/(unboundedLights.size() + 1.0);
 }
 
-Light* LightNode::PickLight(double r, double& weight) const
+/**
+ * Picks a light for a point.
+ * 
+ * @param info The intersection info of the point to light up.
+ * @param r A uniformly random number in [0, 1).
+ * @returns A pair of the picked light and the probability of having picked it, or of null and 0
+ *          if no light can light up the point.
+ */
+std::pair<Light*, double> LightTree::PickLight(const IntersectionInfo& info, double r) const
 {
-    if(!left)
+    double pUnbounded = GetUnboundedProbability();
+    if(r < pUnbounded)
+    {
+        int n = (int) unboundedLights.size();
+        int i = std::min(n - 1, (int) (r/pUnbounded*n));
+        return { unboundedLights[i], pUnbounded/n };
+    }
+    if(nodes.empty())
+        return { nullptr, 0 };
+
+    // Reuse the random number for each choice by rescaling what is left of it
+    r = (r - pUnbounded)/(1 - pUnbounded);
+    double p = 1 - pUnbounded;
+    int node = 0;
+    while(!nodes[node].leaf)
     {
-        weight = val;
-        return light;
+        double left = nodes[node + 1].bounds.Importance(info.position, info.normal);
+        double right = nodes[nodes[node].child].bounds.Importance(info.position, info.normal);
+        if(!(left + right > 0))
+            return { nullptr, 0 };
+
+        double pLeft = left/(left + right);
+        if(r < pLeft)
+        {
+            r = std::min(r/pLeft, 1 - 0x1p-53);
+            p *= pLeft;
+            node = node + 1;
+        }
+        else
+        {
+            r = std::min((r - pLeft)/(1 - pLeft), 1 - 0x1p-53);
+            p *= 1 - pLeft;
+            node = nodes[node].child;
+        }
     }
-    if(!right || r <= val)
-        return left->PickLight(r, weight);
-    else
-        return right->PickLight(r, weight);
-}
\ No newline at end of file
+    return { boundedLights[nodes[node].child], p };
+}
+
+/**
+ * Returns the probability of PickLight picking a light for a point, for weighing the estimates of
+ * different sampling techniques against each other.
+ * 
+ * @param info The intersection info of the point to light up.
+ * @param light The light.
+ * @returns The probability of the light being picked.
+ */
+double LightTree::GetProbability(const IntersectionInfo& info, const Light* light) const
+{
+    double pUnbounded = GetUnboundedProbability();
+    if(std::find(unboundedLights.begin(), unboundedLights.end(), light) != unboundedLights.end())
+        return pUnbounded/unboundedLights.size();
+
+    auto it = leaves.find(light);
+    if(it == leaves.end())
+        return 0;
+
+    // Walk up from the leaf, multiplying by the probability of picking each node over its sibling
+    double p = 1 - pUnbounded;
+    for(int node = it->second; nodes[node].parent >= 0; node = nodes[node].parent)
+    {
+        int parent = nodes[node].parent;
+        int sibling = node == parent + 1 ? nodes[parent].child : parent + 1;
+        double importance = nodes[node].bounds.Importance(info.position, info.normal);
+        double other = nodes[sibling].bounds.Importance(info.position, info.normal);
+        if(!(importance > 0))
+            return 0;
+        p *= importance/(importance + other);
+    }
+    return p;
+}
@@ -1,34 +1,73 @@
-#ifndef LIGHTTREE_H
-#define LIGHTTREE_H
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file LightTree.h
+ * 
+ * Declaration of the LightTree class and helpers.
+ */
+
+#pragma once
+
+#include "BoundingBox.h"
+#include "Vector3d.h"
+#include <unordered_map>
+#include <utility>
 #include <vector>
-#include "Light.h"
-#include "Random.h"
 
-using namespace std;
+class IntersectionInfo;
+class Light;
 
-class LightStruct
+// The bounds of the light that a light (or a group of lights) emits: a box around it, a cone
+// around the normals of its surface, the largest angle to its normal that light leaves at and its
+// power. Bounds with no power are empty
+class LightBounds
 {
 public:
-    LightStruct(Light* light, double weight);
-    ~LightStruct();
-    Light* light;
-    double weight;
+    LightBounds();
+    LightBounds(const BoundingBox& box, const Vector3d& axis, double cosNormals, double cosEmission,
+                double power);
+
+    void Enclose(const LightBounds& bounds);
+    double Importance(const Vector3d& point, const Vector3d& normal) const;
+    double GetOrientationMeasure() const;
+
+    BoundingBox box;
+    Vector3d axis;
+    double cosNormals; // The cosine of the half angle of the cone of normals around the axis
+    double cosEmission; // The cosine of the largest angle to the normal that light leaves at
+    double power;
 };
 
-class LightNode
+// A bounding volume hierarchy over the lights of a scene that picks a light for a point in
+// proportion to how much light the point can be expected to get from it, by descending the tree
+// and picking each child by its importance. Lights that cannot be bounded, like the environment,
+// are picked uniformly with a fixed probability instead
+class LightTree
 {
 public:
-    LightNode(vector<Light*> lights);
-    ~LightNode();
-    
-    Light* PickLight(double r, double& weight) const;
+    void Build(const std::vector<Light*>& lights);
+
+    std::pair<Light*, double> PickLight(const IntersectionInfo& info, double r) const;
+    double GetProbability(const IntersectionInfo& info, const Light* light) const;
+
+    static const int nBins = 12;
 
 private:
-    LightNode(double weight, vector<LightStruct*> lightStructs);
+    // A node of the flattened tree. The first child of an interior node directly follows it
+    class Node
+    {
+    public:
+        LightBounds bounds;
+        int parent;
+        int child; // The second child of an interior node, or the index of the light of a leaf
+        bool leaf;
+    };
 
-    LightNode *left, *right;
-    Light* light;
-    double val;
-};
+    int BuildNode(std::vector<std::pair<Light*, LightBounds>>& lights, int begin, int end, int parent);
+    double GetUnboundedProbability() const;
 
-#endif
\ No newline at end of file
+    std::vector<Node> nodes;
+    std::vector<Light*> boundedLights, unboundedLights;
+    std::unordered_map<const Light*, int> leaves;
+};
@@ -9,8 +9,14 @@
  */
 
 #include "Logger.h"
+#ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
+#else
+#include <iostream>
+#endif
+#include <cstring>
+#include <ctime>
 #include <fstream>
 
 /**
@@ -37,13 +43,17 @@ Logger::~Logger()
 }
 
 /**
- * Shows a message box with a text message.
+ * Shows a message box with a text message, or prints it to stderr on platforms without one.
  * @param msg The string to show
  */
 void Logger::Box(const std::string& msg)
 {
+#ifdef _WIN32
     std::wstring ws(msg.begin(), msg.end());
     MessageBox(0, ws.c_str(), (LPCWSTR) L"Error", MB_OK | MB_ICONERROR);
+#else
+    std::cerr << msg << std::endl;
+#endif
 }
 
 /**
@@ -10,7 +10,7 @@
 #include "Main.h"
 #include "Draw.h"
 #include <sstream>
-#include "boundingbox.h"
+#include "BoundingBox.h"
 #include "ColorBuffer.h"
 #include <process.h>
 #include <string>
@@ -103,8 +103,9 @@ int __stdcall WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)
     std::ifstream ifile("btstrout");
     if(ifile.good())
         rendering = new Rendering("btstrout");
-    else
+    if(!rendering || !rendering->IsLoaded())
     {
+        delete rendering;
         MakeScene(renderer, estimator);
         rendering = new Rendering(renderer, estimator);
     }
@@ -22,8 +22,6 @@ extern DDSURFACEDESC2 ddsd;
 
 extern HANDLE bufferMutex;
 
-#define XRES 640
-#define YRES 480
 //#define DETERMINISTIC
 
 LRESULT WINAPI WndProc(HWND, UINT, WPARAM, LPARAM);
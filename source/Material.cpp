@@ -7,7 +7,7 @@
  * Implementation of the Material class.
  */
 
-#include "material.h"
+#include "Material.h"
 #include "AshikhminShirley.h"
 #include "DielectricMaterial.h"
 #include "EmissiveMaterial.h"
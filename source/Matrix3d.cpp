@@ -8,7 +8,7 @@
  */
 
 #include "Matrix3d.h"
-#include "assert.h"
+#include <cassert>
 
 /**
  * Constructor.
@@ -114,4 +114,15 @@ Matrix3d Matrix3d::operator*(const Matrix3d& m) const
         }
     }
     return result;
-}
\ No newline at end of file
+}
+/**
+ * Multiplies a vector by the matrix, for the vector class which cannot see the matrix class.
+ * 
+ * @param m The matrix to multiply the vector with.
+ * @returns The resulting vector.
+ */
+Vector3d Vector3d::operator*=(const Matrix3d& m)
+{
+    *this = m**this;
+    return *this;
+}
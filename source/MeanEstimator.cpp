@@ -8,9 +8,11 @@
  */
 
 #include <algorithm>
+#include <cmath>
 #include "MeanEstimator.h"
 #include "Bytestream.h"
-#include "Main.h"
+#include "SplatBuffer.h"
+#include "Utils.h"
 
 
 MeanEstimator::MeanEstimator()
@@ -27,10 +29,13 @@ MeanEstimator::MeanEstimator(int xres, int yres)
 {
     nSamples = new int[xres*yres];
     samples = new Color[xres*yres];
+    lumaM2 = new double[xres*yres];
     width = xres;
     height = yres;
     std::fill(nSamples, nSamples + xres*yres, 0);
     std::fill(samples, samples + xres*yres, Color::Black);
+    std::fill(lumaM2, lumaM2 + xres*yres, 0.0);
+    splats = new SplatBuffer(xres, yres);
 }
 
 /**
@@ -45,7 +50,10 @@ void MeanEstimator::AddSample(int x, int y, const Color& c)
     int& ns = nSamples[y*width+x];
     Color& k = samples[y*width+x];
 
+    // Welford's method, on the luma since that is what the error is measured in
+    double oldLuma = k.GetLuma();
     k += (c - k)/(++ns);
+    lumaM2[y*width+x] += (c.GetLuma() - oldLuma)*(c.GetLuma() - k.GetLuma());
 }
 
 /**
@@ -56,7 +64,47 @@ void MeanEstimator::AddSample(int x, int y, const Color& c)
  */
 Color MeanEstimator::GetEstimate(int x, int y) const
 {
-    return samples[y*width+x];
+    return samples[y*width+x] + splats->GetEstimate(x, y);
+}
+
+/**
+ * Returns the number of samples that have been added to a pixel.
+ * 
+ * @param x The x-coordinate of the pixel.
+ * @param y The y-coordinate of the pixel.
+ * @returns The number of samples of the pixel.
+ */
+unsigned int MeanEstimator::GetSampleCount(int x, int y) const
+{
+    return nSamples[y*width+x];
+}
+
+/**
+ * Returns the standard error of the estimate at a pixel relative to the estimate.
+ * 
+ * @param x The x-coordinate of the pixel.
+ * @param y The y-coordinate of the pixel.
+ * @returns The relative error, or infinity if there are too few samples to tell.
+ */
+double MeanEstimator::GetRelativeError(int x, int y) const
+{
+    int ns = nSamples[y*width+x];
+    if(ns < 2)
+        return inf;
+
+    double variance = lumaM2[y*width+x]/(ns - 1);
+    return std::sqrt(variance/ns)/std::max(samples[y*width+x].GetLuma(), minLuma);
+}
+
+/**
+ * Returns the memory taken up by the estimator.
+ * 
+ * @returns The size of the samples, sample counts, variances and splats in bytes.
+ */
+std::size_t MeanEstimator::GetMemoryUsage() const
+{
+    std::size_t nPixels = std::size_t(width)*height;
+    return nPixels*(sizeof(int) + sizeof(Color) + sizeof(double)) + splats->GetMemoryUsage();
 }
 
 /**
@@ -74,16 +122,27 @@ void MeanEstimator::Save(Bytestream& stream) const
     for(int y = 0; y < height; y++)
         for(int x = 0; x < width; x++)
             stream << samples[y*width+x];
+
+    for(int y = 0; y < height; y++)
+        for(int x = 0; x < width; x++)
+            stream << lumaM2[y*width+x];
+
+    splats->Save(stream);
 }
 
 /**
  * Loads the estimator from a bytestream.
  * 
  * @param stream The bytestream to deserialize from.
+ * @returns False if the stream ended early or held an estimator of no size.
  */
-void MeanEstimator::Load(Bytestream& stream)
+bool MeanEstimator::Load(Bytestream& stream)
 {
+    height = width = 0;
     stream >> height >> width;
+    if(!stream.IsGood() || width <= 0 || height <= 0)
+        return false;
+
     nSamples = new int[width*height];
     for(int y = 0; y < height; y++)
         for(int x = 0; x < width; x++)
@@ -93,4 +152,12 @@ void MeanEstimator::Load(Bytestream& stream)
     for(int y = 0; y < height; y++)
         for(int x = 0; x < width; x++)
             stream >> samples[y*width+x];
+
+    lumaM2 = new double[width*height];
+    for(int y = 0; y < height; y++)
+        for(int x = 0; x < width; x++)
+            stream >> lumaM2[y*width+x];
+
+    splats = new SplatBuffer(stream);
+    return stream.IsGood() && splats->GetWidth() == width && splats->GetHeight() == height;
 }
\ No newline at end of file
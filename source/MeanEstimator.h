@@ -19,10 +19,14 @@ public:
     MeanEstimator(int xres, int yres);
     void AddSample(int x, int y, const Color& c);
     Color GetEstimate(int x, int y) const;
+    double GetRelativeError(int x, int y) const;
+    unsigned int GetSampleCount(int x, int y) const;
+    std::size_t GetMemoryUsage() const;
 
     void Save(Bytestream& stream) const;
-    void Load(Bytestream& stream);
+    bool Load(Bytestream& stream);
 private:
     int* nSamples;
     Color* samples;
+    double* lumaM2; // The sum of squared deviations of the lumas of the samples from their mean
 };
@@ -9,6 +9,7 @@
 
 #include "Color.h"
 #include "EmissiveMaterial.h"
+#include "LightTree.h"
 #include "MeshLight.h"
 #include "Renderer.h"
 #include "TriangleMesh.h"
@@ -29,14 +30,10 @@ MeshLight::MeshLight(Color intensity, std::string fileName)
 
     area_ = 0;
     for(auto it = mesh->triangles.cbegin(); it < mesh->triangles.cend(); it++)
-        area_ += (*it)->GetArea();
+        area_ += it->GetArea();
 
     triangleTree_ = BuildTree(0, (int) mesh->triangles.size() - 1, area_, 0);
-    std::vector<const Primitive*> v;
-    for(auto t : mesh->triangles)
-        v.push_back(t);
     mesh->materials.push_back(material);
-    tree.Build(v);
     builtTree = true;
 }
 
@@ -71,18 +68,14 @@ MeshLight::MeshLight()
  * 
  * @param rnd The randomizer used to generate random numbers.
  */
-MeshTriangle* MeshLight::PickRandomTriangle(Randomizer& rnd) const
+const MeshTriangle* MeshLight::PickRandomTriangle(Randomizer& rnd) const
 {
     if(!builtTree)
     {
         area_ = 0;
         for(auto it = mesh->triangles.cbegin(); it < mesh->triangles.cend(); it++)
-            area_ += (*it)->GetArea();
+            area_ += it->GetArea();
         triangleTree_ = BuildTree(0, (int) mesh->triangles.size() - 1, area_, 0);
-        std::vector<const Primitive*> v;
-        for(auto t : mesh->triangles)
-            v.push_back(t);
-        tree.Build(v);
         builtTree = true;
     }
     double f = rnd.GetDouble(0, area_);
@@ -109,11 +102,11 @@ MeshTriangle* MeshLight::PickRandomTriangle(Randomizer& rnd) const
  */
 TriangleNode* MeshLight::BuildTree(int from, int to, double area, double areaStart) const
 {
-    std::vector<MeshTriangle*>& triangles = mesh->triangles;
+    const std::vector<MeshTriangle>& triangles = mesh->triangles;
     if(from == to)
     {
         TriangleNode* n = new TriangleNode;
-        n->triangle = triangles[from];
+        n->triangle = &triangles[from];
         return n;
     }
 
@@ -122,8 +115,7 @@ TriangleNode* MeshLight::BuildTree(int from, int to, double area, double areaSta
     // First, find out where the halfway area mark is
     for(int i = from; i < to; i++)
     {
-        MeshTriangle* t = triangles[i];
-        areaSum += t->GetArea();
+        areaSum += triangles[i].GetArea();
         halfIndex = i;
         if(areaSum > area/2)
             break;
@@ -156,7 +148,7 @@ std::tuple<Ray, Color, Normal, AreaPdf, AnglePdf> MeshLight::SampleRay(Randomize
     double r1 = rnd.GetDouble(0, 1), r2 = rnd.GetDouble(0, 1);
     ray.direction = SampleHemisphereCos(r1, r2, normal);
 
-    anglePdf = abs(ray.direction*normal)/pi;
+    anglePdf = std::abs(ray.direction*normal)/pi;
     areaPdf = 1.0/GetArea();
 
     return { ray, Color::Identity*pi, normal, areaPdf, anglePdf };
@@ -176,22 +168,9 @@ MeshLight::~MeshLight()
  * @returns The distance along the ray that the light source was hit.
  */
 double MeshLight::Intersect(const Ray&) const
-{    
-    /*if(!builtTree) {
-        area_ = 0;
-        for(auto it = mesh->triangles.cbegin(); it < mesh->triangles.cend(); it++)
-            area_ += (*it)->GetArea();
-        triangleTree_ = BuildTree(0, mesh->triangles.size() - 1, area_, 0);
-        std::vector<const Primitive*> v;
-        for(auto t : mesh->triangles)
-            v.push_back(t);
-        tree.Build(v);
-        builtTree = true;
-    }
-    const Primitive* prim;
-    return tree.Intersect(ray, prim, 0, inf, false);*/
-
-    // Intersecting against lights might need a rethink
+{
+    // The triangles of the light are primitives of the scene, so rays find them through its
+    // partitioning instead
     return -inf;
 }
 
@@ -204,22 +183,7 @@ double MeshLight::Intersect(const Ray&) const
  */
 bool MeshLight::GenerateIntersectionInfo(const Ray&, IntersectionInfo&) const
 {
-    /*if(!builtTree) {
-        area_ = 0;
-        for(auto it = mesh->triangles.cbegin(); it < mesh->triangles.cend(); it++)
-            area_ += (*it)->GetArea();
-        triangleTree_ = BuildTree(0, mesh->triangles.size() - 1, area_, 0);
-        std::vector<const Primitive*> v;
-        for(auto t : mesh->triangles)
-            v.push_back(t);
-        tree.Build(v);
-        builtTree = true;
-    }
-
-    const Primitive* prim;
-    tree.Intersect(ray, prim, 0, inf, true);
-    return prim->GenerateIntersectionInfo(ray, info);*/
-    return false;
+    return false; // Never hit by itself, see Intersect
 }
 
 /**
@@ -242,16 +206,14 @@ double MeshLight::Pdf(const IntersectionInfo& info, const Vector3d& out) const
  */
 std::tuple<Point, Normal> MeshLight::SamplePoint(Randomizer& rnd) const
 {
-    MeshTriangle* t = PickRandomTriangle(rnd);
+    const MeshTriangle* t = PickRandomTriangle(rnd);
+    const TriangleRecord& r = mesh->records[t->index];
 
     double u = sqrt(rnd.GetDouble(0, 1));
     double v = rnd.GetDouble(0, 1);
 
-    Vector3d e1 = t->v1->pos - t->v0->pos;
-    Vector3d e2 = t->v2->pos - t->v0->pos;
-
     auto normal = t->GetNormal();
-    auto point = t->v0->pos + u*(e1 + v*(e2-e1)) + eps*normal;
+    auto point = r.v0 + u*(r.e1 + v*(r.e2-r.e1)) + eps*normal;
 
     return { point, normal };
 }
@@ -303,7 +265,7 @@ double MeshLight::GetArea() const
     if(!builtTree) {
         area_ = 0;
         for(auto it = mesh->triangles.cbegin(); it < mesh->triangles.cend(); it++)
-            area_ += (*it)->GetArea();
+            area_ += it->GetArea();
 
         triangleTree_ = BuildTree(0, (int) mesh->triangles.size() - 1, area_, 0);
         builtTree = true;
@@ -311,6 +273,35 @@ double MeshLight::GetArea() const
     return area_;
 }
 
+/**
+ * Gets the bounds of the light from the corners and normals of its triangles.
+ * 
+ * @param bounds The bounds of the light.
+ * @returns True, since the light can always be bounded.
+ */
+bool MeshLight::GetBounds(LightBounds& bounds) const
+{
+    bounds = LightBounds();
+    double power = (intensity*GetArea()).GetLuma();
+    for(auto& t : mesh->triangles)
+    {
+        const TriangleRecord& r = mesh->records[t.index];
+        BoundingBox box(r.v0, r.v0);
+        for(auto& corner : { r.v0 + r.e1, r.v0 + r.e2 })
+        {
+            for(int u = 0; u < 3; u++)
+            {
+                box.c1[u] = std::min(box.c1[u], corner[u]);
+                box.c2[u] = std::max(box.c2[u], corner[u]);
+            }
+        }
+        box.c1 -= Vector3d(eps, eps, eps)*2;
+        box.c2 += Vector3d(eps, eps, eps)*2;
+        bounds.Enclose(LightBounds(box, t.GetNormal(), 1, 0, power*t.GetArea()/GetArea()));
+    }
+    return true;
+}
+
 /**
  * Adds the light to a scene.
  * 
@@ -319,7 +310,7 @@ double MeshLight::GetArea() const
 void MeshLight::AddToScene(Scene* scn)
 {
     for(auto& t : mesh->triangles)
-        Scene::PrimitiveAdder::AddPrimitive(*scn, t);
+        Scene::PrimitiveAdder::AddPrimitive(*scn, &t);
     Scene::LightAdder::AddLight(*scn, this);
 }
 
@@ -348,8 +339,8 @@ std::tuple<Color, Point> MeshLight::NextEventEstimation(const Renderer* renderer
 
         if(renderer->TraceShadowRay(lightRay, (1-eps)*d))
         {
-            double cosphi = abs(normal*toLight);
-            double costheta = abs(toLight*lightNormal);
+            double cosphi = std::abs(normal*toLight);
+            double costheta = std::abs(toLight*lightNormal);
             Color c;
             c = info.material->BRDF(info, toLight, component)
                 *costheta*cosphi*intensity*GetArea()/(d*d);
@@ -10,7 +10,6 @@
 #pragma once
 
 #include "Light.h"
-#include "KDTree.h"
 
 class TriangleMesh;
 class MeshTriangle;
@@ -26,7 +25,7 @@ struct TriangleNode
 {
     double cutoff;
     TriangleNode* leftChild, *rightChild;
-    MeshTriangle* triangle;
+    const MeshTriangle* triangle;
 };
 
 class MeshLight : public Light
@@ -46,6 +45,7 @@ public:
     std::tuple<Color, Point> NextEventEstimation(const Renderer* renderer, const IntersectionInfo& info, Randomizer&, int component) const;
 
     virtual double GetArea() const;
+    virtual bool GetBounds(LightBounds& bounds) const;
 
     virtual void Save(Bytestream& s) const;
     virtual void Load(Bytestream& s);
@@ -58,12 +58,11 @@ protected:
     std::tuple<Point, Normal> SamplePoint(Randomizer&) const;
 
     mutable bool builtTree;
-    mutable KDTree tree;
     friend class Scene;
     virtual void AddToScene(Scene*);
 
     TriangleNode* BuildTree(int from, int to, double area, double cutoff) const;
-    MeshTriangle* PickRandomTriangle(Randomizer& rnd) const;
+    const MeshTriangle* PickRandomTriangle(Randomizer& rnd) const;
     mutable double area_;
     mutable TriangleNode* triangleTree_;
 };
@@ -61,7 +61,7 @@ Sample MirrorMaterial::GetSample(const IntersectionInfo& info, Randomizer&, bool
     out.origin = info.position + normal*eps;
     out.direction.Normalize();
 
-    return Sample((adjoint ? abs(out.direction*Ng)/abs(in*Ng) : 1.0)*Color(1, 1, 1), out, 1, 1, true, 1);
+    return Sample((adjoint ? std::abs(out.direction*Ng)/std::abs(in*Ng) : 1.0)*Color(1, 1, 1), out, 1, 1, true, 1);
 }
 
 /**
@@ -8,62 +8,116 @@
  */
 
 #include <algorithm>
+#include <cmath>
+#include <numeric>
 #include "MonEstimator.h"
 #include "Bytestream.h"
+#include "SplatBuffer.h"
 #include "Utils.h"
 
 /**
- * Saves a bucket to a bytestream.
- * 
- * @param stream The bytestream to serialize to.
+ * Constructor.
  */
-void Bucket::Save(Bytestream& stream) const
+MonEstimator::MonEstimator() : nBuckets(defaultBuckets), compact(false)
 {
-    stream << avg << nSamples;
 }
 
 /**
- * Loads a bucket from a bytestream.
+ * Constructor.
  * 
- * @param stream The stream to deserialize from.
+ * @param x The horizontal size of the buffer.
+ * @param y The vertical size of the buffer.
+ * @param nBuckets The number of buckets per pixel, at most maxBuckets.
+ * @param compact Whether to keep the averages of the buckets in single precision, which halves
+ *                their memory. The running averages then drift from the double precision ones
+ *                by up to a few times 1e-7 relative over thousands of samples per bucket.
  */
-void Bucket::Load(Bytestream& stream) 
+MonEstimator::MonEstimator(int xres, int yres, int nBuckets, bool compact) : nBuckets(std::clamp(nBuckets, 1, maxBuckets)), compact(compact)
 {
-    stream >> avg >> nSamples;
+    width = xres;
+    height = yres;
+    ResizePlanes();
+    nSamples.assign(std::size_t(xres)*yres, 0);
+    order.resize(std::size_t(xres)*yres*this->nBuckets);
+    for(int i = 0; i < xres*yres; i++)
+        std::iota(&order[i*this->nBuckets], &order[i*this->nBuckets] + this->nBuckets, 0);
+    splats = new SplatBuffer(xres, yres);
 }
 
 /**
- * Constructor.
+ * Sizes the planes of the precision that the estimator uses to hold all buckets, with averages
+ * of zero, and empties the others.
  */
-MonEstimator::MonEstimator()
+void MonEstimator::ResizePlanes()
 {
+    auto size = std::size_t(width)*height*nBuckets;
+    for(int u = 0; u < 3; u++)
+    {
+        planes[u].assign(compact ? 0 : size, 0.0);
+        compactPlanes[u].assign(compact ? size : 0, 0.0f);
+    }
 }
 
 /**
- * Constructor.
+ * Returns the average of a bucket.
  * 
- * @param x The horizontal size of the buffer.
- * @param y The vertical size of the buffer.
+ * @param x The horizontal component of the bucket.
+ * @param y The vertical component of the bucket.
+ * @param m The number of the bucket.
  */
-MonEstimator::MonEstimator(int xres, int yres)
+Color MonEstimator::GetBucket(int x, int y, int m) const
 {
-    buckets = new Bucket[xres*yres*M];
-    width = xres;
-    height = yres;
-    nSamples = new int[xres*yres];
-    std::fill(nSamples, nSamples + xres*yres, 0);
+    auto i = std::size_t(y*width + x)*nBuckets + m;
+    if(compact)
+        return Color(compactPlanes[0][i], compactPlanes[1][i], compactPlanes[2][i]);
+    return Color(planes[0][i], planes[1][i], planes[2][i]);
 }
 
 /**
- * Returns a bucket.
+ * Returns the luma of the average of a bucket.
  * 
  * @param x The horizontal component of the bucket.
  * @param y The vertical component of the bucket.
  * @param m The number of the bucket.
  */
-Bucket& MonEstimator::GetBucket(int x, int y, int m) const
+double MonEstimator::GetBucketLuma(int x, int y, int m) const
+{
+    return GetBucket(x, y, m).GetLuma();
+}
+
+/**
+ * Returns the lumas of the averages of all buckets of a pixel. Since the channels are stored in
+ * planes, this is a straight loop over each of them.
+ * 
+ * @param x The horizontal component of the pixel coordinate.
+ * @param y The vertical component of the pixel coordinate.
+ * @param lumas The array to store the lumas in, by bucket number.
+ */
+void MonEstimator::GetBucketLumas(int x, int y, double* lumas) const
 {
-    return buckets[y*(width*M) + x*M + m];
+    auto i = std::size_t(y*width + x)*nBuckets;
+    if(compact)
+    {
+        const float* r = &compactPlanes[0][i], * g = &compactPlanes[1][i], * b = &compactPlanes[2][i];
+        for(int m = 0; m < nBuckets; m++)
+            lumas[m] = Color(r[m], g[m], b[m]).GetLuma();
+        return;
+    }
+    const double* r = &planes[0][i], * g = &planes[1][i], * b = &planes[2][i];
+    for(int m = 0; m < nBuckets; m++)
+        lumas[m] = Color(r[m], g[m], b[m]).GetLuma();
+}
+
+/**
+ * Returns the memory taken up by the estimator.
+ * 
+ * @returns The size of the buckets, sample counts, bucket orders and splats in bytes.
+ */
+std::size_t MonEstimator::GetMemoryUsage() const
+{
+    std::size_t nPixels = std::size_t(width)*height;
+    return 3*(planes[0].size()*sizeof(double) + compactPlanes[0].size()*sizeof(float)) + 
+           nPixels*(sizeof(int) + nBuckets) + splats->GetMemoryUsage();
 }
 
 /**
@@ -74,52 +128,134 @@ Bucket& MonEstimator::GetBucket(int x, int y, int m) const
  */
 void MonEstimator::AddSample(int x, int y, const Color& c)
 {
-    int ns = nSamples[y*width+x];
-    auto& bucket = GetBucket(x, y, ns%M);
+    int ns = nSamples[y*width+x]++;
+    int m = ns%nBuckets;
+    int n = ns/nBuckets + 1; // The number of samples in the bucket, counting this one
+    auto i = std::size_t(y*width + x)*nBuckets + m;
 
-    bucket.avg = bucket.avg + (c - bucket.avg)/(++bucket.nSamples);
-    nSamples[y*width+x]++;
+    double channels[3] = { c.r, c.g, c.b };
+    for(int u = 0; u < 3; u++)
+    {
+        if(compact)
+            compactPlanes[u][i] += float((channels[u] - compactPlanes[u][i])/n);
+        else
+            planes[u][i] += (channels[u] - planes[u][i])/n;
+    }
+    Reorder(x, y, m);
 }
 
 /**
- * Returns the current estimate of a pixel color.
+ * Moves a bucket whose average has changed to its place in the luma order of the buckets of its
+ * pixel. Since only one bucket changes at a time, this takes a single pass of insertion sort.
+ * 
+ * @param x The horizontal component of the pixel coordinate.
+ * @param y The vertical component of the pixel coordinate.
+ * @param m The number of the bucket.
+ */
+void MonEstimator::Reorder(int x, int y, int m)
+{
+    auto o = &order[(y*width+x)*nBuckets];
+    int i = int(std::find(o, o + nBuckets, m) - o);
+    double luma = GetBucketLuma(x, y, m);
+
+    for(; i > 0 && GetBucketLuma(x, y, o[i-1]) > luma; i--)
+        o[i] = o[i-1];
+    for(; i < nBuckets-1 && GetBucketLuma(x, y, o[i+1]) < luma; i++)
+        o[i] = o[i+1];
+    o[i] = m;
+}
+
+/**
+ * Returns the current estimate of a pixel color. Light path contributions are splatted rather
+ * than added as samples of the pixel, so they are simply averaged and added to the median of 
+ * means of the samples.
  * 
  * @param x The horizontal component of the pixel coordinate.
  * @param y The vertical component of the pixel coordinate.
  */
 Color MonEstimator::GetEstimate(int x, int y) const
 {
+    return GetMedianOfMeans(x, y) + splats->GetEstimate(x, y);
+}
+
+/**
+ * Returns the number of samples that have been added to a pixel.
+ * 
+ * @param x The x-coordinate of the pixel.
+ * @param y The y-coordinate of the pixel.
+ * @returns The number of samples of the pixel.
+ */
+unsigned int MonEstimator::GetSampleCount(int x, int y) const
+{
+    return nSamples[y*width+x];
+}
+
+/**
+ * Returns the standard error of the estimate of a pixel relative to the estimate, judged by the
+ * spread of the bucket averages, each of which is an independent estimate of the pixel.
+ * 
+ * @param x The horizontal component of the pixel coordinate.
+ * @param y The vertical component of the pixel coordinate.
+ * @returns The relative error, or infinity if not every bucket has received a sample yet.
+ */
+double MonEstimator::GetRelativeError(int x, int y) const
+{
+    if(nSamples[y*width+x] < nBuckets || nBuckets < 2)
+        return inf;
+
+    double lumas[maxBuckets];
+    GetBucketLumas(x, y, lumas);
+
+    double sum = 0, sumSq = 0;
+    for(int i = 0; i < nBuckets; i++)
+    {
+        sum += lumas[i];
+        sumSq += lumas[i]*lumas[i];
+    }
+    double mean = sum/nBuckets;
+    double variance = std::max(0.0, (sumSq - sum*mean)/(nBuckets - 1));
+    return std::sqrt(variance/nBuckets)/std::max(mean, minLuma);
+}
+
+/**
+ * Returns the median-of-means estimate of the samples of a pixel.
+ * 
+ * @param x The horizontal component of the pixel coordinate.
+ * @param y The vertical component of the pixel coordinate.
+ */
+Color MonEstimator::GetMedianOfMeans(int x, int y) const
+{
+    const int M = nBuckets;
     int ns = nSamples[y*width+x];
     if(ns < M)
     {
         // If we haven't filled all the buckets yet, just do an average of the samples that we have
         auto avg = Color::Black;
         for(int i = 0; i < ns; i++)
-            avg += GetBucket(x, y, i).avg/ns;
+            avg += GetBucket(x, y, i)/ns;
         return avg;
     }
     else
     {
-        // Order the buckets by the average estimator (as pBuckets)
-        Bucket* pBuckets[M];
+        // The lumas of the buckets in order of their average estimator
+        const unsigned char* o = &order[(y*width+x)*M];
+        double bucketLumas[maxBuckets], lumas[maxBuckets];
+        GetBucketLumas(x, y, bucketLumas);
         for(int i = 0; i < M; i++)
-            pBuckets[i] = &GetBucket(x, y, i);
-
-        auto fn = [] (Bucket* a, Bucket* b) { return a->avg.GetLuma() < b->avg.GetLuma(); };
-        std::sort(pBuckets, pBuckets+M, fn);
+            lumas[i] = bucketLumas[o[i]];
 
         // Calculate the Gini coefficent
         double nom = 0, denom = 0;
         for(int i = 0; i < M; i++)
-            nom += 2*(i+1)*pBuckets[i]->avg.GetLuma();  
+            nom += 2*(i+1)*lumas[i];
         for(int i = 0; i < M; i++)
-            denom += M*pBuckets[i]->avg.GetLuma();
+            denom += M*lumas[i];
 
         auto G = nom/denom - double(M+1)/M;
         if(!nom)
             return Color::Black;
         if(std::abs(G) < eps)
-            return pBuckets[0]->avg;
+            return GetBucket(x, y, o[0]);
         if(G <= 0 || G > 1)
             return Color::Black;
 
@@ -127,7 +263,7 @@ Color MonEstimator::GetEstimate(int x, int y) const
         int c = int(G*(M/2));
         Color MoN = Color::Black;
         for(int i = c; i < M-c; i++)
-            MoN += pBuckets[i]->avg/(M-2*c);
+            MoN += GetBucket(x, y, o[i])/(M-2*c);
         return MoN;
     }
 }
@@ -139,33 +275,62 @@ Color MonEstimator::GetEstimate(int x, int y) const
  */
 void MonEstimator::Save(Bytestream& stream) const
 {
-    stream << ID_MONESTIMATOR << height << width;
+    stream << ID_MONESTIMATOR << height << width << nBuckets << (unsigned char) compact;
     for(int y = 0; y < height; y++)
         for(int x = 0; x < width; x++)
             stream << nSamples[y*width+x];
 
-    for(int y = 0; y < height; y++)
-        for(int x = 0; x < width; x++)
-            for(int m = 0; m < M; m++)
-                GetBucket(x, y, m).Save(stream);
+    for(auto& plane : planes)
+        for(double d : plane)
+            stream << d;
+    for(auto& plane : compactPlanes)
+        for(float f : plane)
+            stream << f;
+
+    splats->Save(stream);
 }
 
 /**
  * Loads the estimator from a bytestream.
  * 
  * @param stream The bytestream to deserialize from.
+ * @returns False if the stream ended early, held an estimator of no size, more buckets than
+ *          the estimates have room for or an unknown precision.
  */
-void MonEstimator::Load(Bytestream& stream)
+bool MonEstimator::Load(Bytestream& stream)
 {
-    stream >> height >> width;
-    nSamples = new int[width*height];
+    unsigned char precision = 0;
+    height = width = nBuckets = 0;
+    stream >> height >> width >> nBuckets >> precision;
+    if(!stream.IsGood() || width <= 0 || height <= 0 || nBuckets < 1 || nBuckets > maxBuckets || precision > 1)
+        return false;
+    compact = precision == 1;
+
+    nSamples.resize(std::size_t(width)*height);
     for(int y = 0; y < height; y++)
         for(int x = 0; x < width; x++)
             stream >> nSamples[y*width+x];
 
-    buckets = new Bucket[width*height*M];
+    ResizePlanes();
+    for(auto& plane : planes)
+        for(double& d : plane)
+            stream >> d;
+    for(auto& plane : compactPlanes)
+        for(float& f : plane)
+            stream >> f;
+
+    order.resize(std::size_t(width)*height*nBuckets);
     for(int y = 0; y < height; y++)
+    {
         for(int x = 0; x < width; x++)
-            for(int m = 0; m < M; m++)
-                GetBucket(x, y, m).Load(stream);
+        {
+            auto o = &order[(y*width+x)*nBuckets];
+            std::iota(o, o + nBuckets, 0);
+            std::sort(o, o + nBuckets, [&] (int a, int b) 
+                { return GetBucketLuma(x, y, a) < GetBucketLuma(x, y, b); });
+        }
+    }
+
+    splats = new SplatBuffer(stream);
+    return stream.IsGood() && splats->GetWidth() == width && splats->GetHeight() == height;
 }
\ No newline at end of file
@@ -11,36 +11,40 @@
 
 #include "Color.h"
 #include "Estimator.h"
-
-const int M = 21;
-
-class MonEstimator;
-
-class Bucket
-{
-public:
-    Bucket() : avg(Color::Black), nSamples(0) { }
-    void Save(Bytestream& stream) const;
-    void Load(Bytestream& stream);
-
-    friend class MonEstimator;
-private:
-    Color avg;
-    int nSamples;
-};
+#include <cstddef>
+#include <vector>
 
 class MonEstimator : public Estimator
 {
 public:
     MonEstimator();
-    MonEstimator(int xres, int yres);
+    MonEstimator(int xres, int yres, int nBuckets = defaultBuckets, bool compact = false);
     void AddSample(int x, int y, const Color& c);
     Color GetEstimate(int x, int y) const;
-    Bucket& GetBucket(int x, int y, int m) const;
+    double GetRelativeError(int x, int y) const;
+    unsigned int GetSampleCount(int x, int y) const;
+    Color GetBucket(int x, int y, int m) const;
+    std::size_t GetMemoryUsage() const;
 
     void Save(Bytestream& stream) const;
-    void Load(Bytestream& stream);
+    bool Load(Bytestream& stream);
+
+    static const int defaultBuckets = 21;
+    static constexpr int maxBuckets = 64;
 private:
-    Bucket* buckets;
-    int* nSamples;
+    Color GetMedianOfMeans(int x, int y) const;
+    double GetBucketLuma(int x, int y, int m) const;
+    void GetBucketLumas(int x, int y, double* lumas) const;
+    void Reorder(int x, int y, int m);
+    void ResizePlanes();
+
+    int nBuckets;
+    bool compact; // Whether the averages of the buckets are kept in single precision
+    // The averages of the buckets, one plane per color channel, in double precision or, for a
+    // compact estimator, in single precision. The samples are dealt out to the buckets in turn, so
+    // the number of samples in each follows from the number of samples of the pixel
+    std::vector<double> planes[3];
+    std::vector<float> compactPlanes[3];
+    std::vector<int> nSamples;
+    std::vector<unsigned char> order; // The buckets of each pixel ordered by luma, kept up to date as samples come in
 };
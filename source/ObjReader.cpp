@@ -18,12 +18,19 @@
 #include "AshikhminShirley.h"
 #include "Utils.h"
 #include "Logger.h"
-#include <stack>
+#include "SceneCache.h"
+#include "Bytestream.h"
+#include <algorithm>
+#include <map>
+#include <numeric>
 #include <tuple>
 #include <set>
-#include <unordered_map>
 #include "Timer.h"
 #include <charconv>
+#include <future>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 
 /**
  * Represents a token in the input string, meaning, a substring of the input string that is
@@ -313,24 +320,6 @@ int expectInt(Parser& parser)
     return d;
 }
 
-/**
- * Optionally parses an integer.
- * 
- * @param parser The parser object.
- * @returns The integer.
- */
-std::tuple<bool, int> acceptInt(Parser& parser)
-{
-    if(parser.peek().type != Token::Number)
-        return { false, 0 };
-
-    int d = 0;
-    const auto& st = parser.next().str;
-    auto res = std::from_chars(st.data(), st.data() + st.size(), d);
-
-    return { true, d };
-}
-
 /**
  * Unconditionally parses a floating point number.
  * 
@@ -350,55 +339,6 @@ double expectReal(Parser& parser)
     return d;
 }
 
-/**
- * Attempts to parse a floating point number.
- * 
- * @param parser The parser object.
- * @returns A tuple of { success, real } where success is if the parsing was successful and
- *          along with the real number parsed.
- */
-std::tuple<bool, double> acceptReal(Parser& parser)
-{
-    if(parser.peek().type != Token::Number)
-        return { false, 0 };
-
-    double d = 0;
-    const auto& st = parser.next().str;
-    auto res = std::from_chars(st.data(), st.data() + st.size(), d);
-
-    return { true, d };
-}
-
-/**
- * Attempts to parse a v/t/n face element.
- * 
- * @throws ParseException If an element was encountered but it contained badly formed data.
- * @param parser The parser object.
- * @returns A tuple of success/v/t/n indices. Success is true if the parsing succeeded, and the
- *          remaining entires are the vertex, texture and normal indices, which can be zero if
- *          it was not supplied.
- */
-std::tuple<bool, int, int, int> acceptVertex(Parser& parser)
-{
-    auto [success, n1] = acceptInt(parser);
-    if(!success)
-        return { false, 0, 0, 0 };
-    
-    if(!parser.accept("/")) // Format is x
-        return { true, n1, 0, 0 };
-
-    if(parser.accept("/")) // Format is x//y
-        return { true, n1, 0, expectInt(parser) };
-
-    int n2 = expectInt(parser); // Format is x/y..
-
-    if(!parser.accept("/"))
-        return { true, n1, n2, 0 };
-
-    // Format is x/y/z
-    return { true, n1, n2, expectInt(parser) };
-}
-
 /**
  * Parses a 3d vector consisting of floating point numbers.
  * 
@@ -414,32 +354,6 @@ Vector3d expectVector3d(Parser& parser)
     return Vector3d(arr[0], arr[1], arr[2]);
 }
 
-/**
- * Parses a texture coordinate.
- * 
- * @throws ParseException if a texture coordinate was unable to be parsed.
- * @param parser The parser object.
- * @returns A 3d vector of the coordinates. Depending on the dimensionality of the coordinate
- *          one or several of the trailing entries could be zero.
- */
-Vector3d expectVtCoordinate(Parser& parser)
-{
-    double arr[3] = { 0, 0, 0 };
-    bool hadSuccess = false;
-    for(int i = 0; i < 3; i++)
-    {
-        auto [success, d] = acceptReal(parser);
-        if(success)
-        {
-            arr[i] = d;
-            hadSuccess = true;
-        }
-    }
-    if(!hadSuccess)
-        throw ParseException("Bad texture coordinate");
-    return Vector3d(arr[0], arr[1], arr[2]);
-}
-
 /**
  * Turns the contents of a text file into a vector of Tokens.
  * 
@@ -716,295 +630,628 @@ std::map<std::string, Material*> ReadMaterialFile(const std::string& matfilestr)
     return materials;
 }
 
+/**
+ * Saves the meshes read from an .obj file to its cache. The materials are saved as the material
+ * file they came from and their name, since the material files are read again when the cache is
+ * loaded.
+ * 
+ * @param file The name of the obj file.
+ * @param materialFiles The names of the material files, in the order they were read.
+ * @param libraries The materials of each of the material files by name.
+ * @param mesh The mesh of the file.
+ * @param meshLights The lights of the file.
+ */
+static void WriteCache(const std::string& file, const std::vector<std::string>& materialFiles, const std::vector<std::map<std::string, Material*>>& libraries,
+                       const TriangleMesh* mesh, const std::vector<MeshLight*>& meshLights)
+{
+    std::map<const Material*, int> materialIds;
+    std::vector<std::string> sources = { file };
+    sources.insert(sources.end(), materialFiles.begin(), materialFiles.end());
+
+    CacheWriter writer;
+    WriteCacheHeader(writer, sources);
+    writer.BeginSection();
+    writer << ID_TRIANGLEMESH << (unsigned int) materialFiles.size();
+    for(auto& name : materialFiles)
+        writer << name;
+
+    writer << (unsigned int) std::accumulate(libraries.begin(), libraries.end(), (size_t) 0, [](size_t n, auto& l) { return n + l.size(); });
+    for(unsigned int i = 0; i < libraries.size(); i++)
+    {
+        for(auto& [name, material] : libraries[i])
+        {
+            int id = (int) materialIds.size();
+            materialIds[material] = id;
+            writer << i << name;
+        }
+    }
+
+    // Triangles without a material of the material files get the default material
+    auto writeMesh = [&](const TriangleMesh* m, int lightMaterial)
+    {
+        std::vector<int> triangleMaterials(m->triangles.size());
+        for(int i = 0; i < (int) m->triangles.size(); i++)
+        {
+            auto it = materialIds.find(m->triangles[i].GetMaterial());
+            triangleMaterials[i] = it == materialIds.end() ? -1 : it->second;
+        }
+        writer << lightMaterial << m->vertices << m->indices << triangleMaterials;
+    };
+
+    writer << (unsigned int) meshLights.size() + 1;
+    writeMesh(mesh, -1);
+    for(auto light : meshLights)
+    {
+        auto it = materialIds.find(light->material);
+        if(it == materialIds.end())
+            return;
+        writeMesh(light->mesh, it->second);
+    }
+    writer.EndSection();
+    writer.SaveToFile(GetCacheFileName(file), false);
+}
+
+/**
+ * Loads the meshes of an .obj file from its cache, if the cache is up to date with the file and
+ * its material files.
+ * 
+ * @param file The name of the obj file.
+ * @returns A tuple of whether the meshes were loaded, the mesh of the file and its lights.
+ */
+static std::tuple<bool, TriangleMesh*, std::vector<MeshLight*>> ReadCache(const std::string& file)
+{
+    MappedFile cache(GetCacheFileName(file));
+    CacheReader reader(cache.GetData(), cache.GetData() + cache.GetSize()), section(nullptr, nullptr);
+    if(!ReadCacheHeader(reader) || !reader.NextSection(section))
+        return { false, nullptr, {} };
+
+    unsigned char id = 0;
+    unsigned int nLibraries = 0, nMaterials = 0, nMeshes = 0;
+    section >> id >> nLibraries;
+    if(!section.IsGood() || id != ID_TRIANGLEMESH)
+        return { false, nullptr, {} };
+
+    std::vector<std::map<std::string, Material*>> libraries;
+    for(unsigned int i = 0; i < nLibraries; i++)
+    {
+        std::string name;
+        section >> name;
+        try {
+            libraries.push_back(ReadMaterialFile(name));
+        }
+        catch(const ParseException&)
+        {
+            return { false, nullptr, {} };
+        }
+    }
+
+    std::vector<Material*> materials;
+    section >> nMaterials;
+    for(unsigned int i = 0; i < nMaterials && section.IsGood(); i++)
+    {
+        unsigned int library = 0;
+        std::string name;
+        section >> library >> name;
+        if(library >= libraries.size() || !libraries[library].count(name))
+            return { false, nullptr, {} };
+        materials.push_back(libraries[library][name]);
+    }
+
+    TriangleMesh* mesh = new TriangleMesh();
+    std::vector<MeshLight*> meshLights;
+    Material* defaultMaterial = nullptr;
+
+    section >> nMeshes;
+    for(unsigned int i = 0; i < nMeshes && section.IsGood(); i++)
+    {
+        int lightMaterial = 0;
+        std::vector<int> indices, triangleMaterials;
+        TriangleMesh* m = mesh;
+
+        section >> lightMaterial;
+        if(lightMaterial >= 0)
+        {
+            if(lightMaterial >= (int) materials.size() || !materials[lightMaterial]->light)
+                return { false, nullptr, {} };
+            auto light = static_cast<MeshLight*>(materials[lightMaterial]->light);
+            meshLights.push_back(light);
+            m = light->mesh;
+        }
+        section >> m->vertices >> indices >> triangleMaterials;
+        if(!section.IsGood() || indices.size() != 3*triangleMaterials.size())
+            return { false, nullptr, {} };
+
+        m->indices.reserve(indices.size());
+        m->records.reserve(triangleMaterials.size());
+        m->triangles.reserve(triangleMaterials.size());
+        for(int t = 0; t < (int) triangleMaterials.size(); t++)
+        {
+            int material = triangleMaterials[t];
+            for(int c = 0; c < 3; c++)
+                if(indices[3*t + c] < 0 || indices[3*t + c] >= (int) m->vertices.size())
+                    return { false, nullptr, {} };
+            if(material >= (int) materials.size())
+                return { false, nullptr, {} };
+            if(material < 0 && !defaultMaterial)
+            {
+                LambertianMaterial* mat = new LambertianMaterial();
+                mat->Kd = Color(0.7, 0.7, 0.7);
+                m->materials.push_back(mat);
+                defaultMaterial = mat;
+            }
+            m->AddTriangle(indices[3*t], indices[3*t + 1], indices[3*t + 2], material < 0 ? defaultMaterial : materials[material]);
+        }
+    }
+    if(!section.IsGood())
+        return { false, nullptr, {} };
+
+    if(!libraries.empty())
+        for(auto& [name, material] : libraries.back())
+            mesh->materials.push_back(material);
+    return { true, mesh, meshLights };
+}
+
+// The number of bytes of an .obj file that are parsed by a thread at a time
+static const size_t objChunkSize = 1 << 22;
+
+// Hashes a vertex of a mesh, given as the mesh and the index of the vertex
+class MeshVertexHash
+{
+public:
+    size_t operator()(const std::pair<TriangleMesh*, int>& v) const
+    {
+        return std::hash<TriangleMesh*>()(v.first) ^ std::hash<int>()(v.second)*0x9e3779b97f4a7c15ull;
+    }
+};
+
+/**
+ * Checks if a character separates the fields of a line.
+ * 
+ * @param c The character.
+ * @returns True for spaces, tabs and carriage returns.
+ */
+static bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * Skips to the next field of a line.
+ * 
+ * @param p The current position in the line.
+ * @param end The end of the line.
+ * @returns The start of the next field, or the end of the line.
+ */
+static const char* SkipSpace(const char* p, const char* end)
+{
+    while(p < end && IsSpace(*p))
+        p++;
+    return p;
+}
+
+/**
+ * A statement of an .obj file that can't be carried out until the statements before it have
+ * been, since it depends on the current group and material, along with where in its chunk it was
+ * found. Faces refer to a range of the vertex indices of their chunk.
+ */
+class ObjStatement
+{
+public:
+    enum Type { Face, Group, MaterialLibrary, UseMaterial };
+
+    Type type = Face;
+    int line = 0; // The line of the statement in its chunk
+    int first = 0, count = 0; // The vertices of a face in the index array of the chunk
+    int nPositions = 0, nNormals = 0; // The positions and normals of the chunk before the statement
+    std::string_view name = {}; // The name of the material or the material file
+};
+
+/**
+ * A part of an .obj file that ends at a line break, parsed on its own thread. The vertex
+ * positions and normals are gathered in arrays, while the statements that depend on the
+ * statements before them are kept in order to be carried out once the chunks before it are done.
+ */
+class ObjChunk
+{
+public:
+    void Parse(const char* begin, const char* end);
+
+    std::vector<Vector3d> positions, normals;
+    std::vector<int> indices; // The position and normal index of each vertex of the faces
+    std::vector<ObjStatement> statements;
+    int nLines; // The number of lines parsed
+
+    bool failed; // Whether a line couldn't be parsed, which ends the chunk
+    std::string error;
+    int errorLine, errorColumn; // The line in the chunk and the column of the error
+
+private:
+    bool ParseLine(const char* p, const char* end);
+    bool Fail(const std::string& message, const char* lineStart, const char* p);
+};
+
+/**
+ * Parses the lines of the chunk, stopping at the first line that can't be parsed.
+ * 
+ * @param begin The start of the chunk.
+ * @param end The end of the chunk, right after a line break or at the end of the file.
+ */
+void ObjChunk::Parse(const char* begin, const char* end)
+{
+    positions.clear();
+    normals.clear();
+    indices.clear();
+    statements.clear();
+    nLines = 0;
+    failed = false;
+
+    for(const char* p = begin; p < end; nLines++)
+    {
+        const char* lineEnd = std::find(p, end, '\n');
+        if(!ParseLine(p, std::find(p, lineEnd, '#')))
+            return;
+        p = lineEnd + 1;
+    }
+}
+
+/**
+ * Records an error of the current line.
+ * 
+ * @param message The description of the error.
+ * @param lineStart The start of the line.
+ * @param p Where in the line the error is.
+ * @returns False, so that the line parsing can return it.
+ */
+bool ObjChunk::Fail(const std::string& message, const char* lineStart, const char* p)
+{
+    failed = true;
+    error = message;
+    errorLine = nLines;
+    errorColumn = (int) (p - lineStart) + 1;
+    return false;
+}
+
+/**
+ * Parses a line of the chunk.
+ * 
+ * @param p The start of the line.
+ * @param end The end of the line, before any comment.
+ * @returns False if the line couldn't be parsed.
+ */
+bool ObjChunk::ParseLine(const char* p, const char* end)
+{
+    const char* lineStart = p;
+
+    // Reads a field that starts like a number and parses it, leaving p after it
+    auto real = [&p, end](double& d)
+    {
+        p = SkipSpace(p, end);
+        const char* q = p;
+        if(q == end || !(std::isdigit((unsigned char) *q) || *q == '-' || *q == '.'))
+            return false;
+        while(q < end && (std::isdigit((unsigned char) *q) || *q == '.' || *q == 'e' || *q == 'E' || *q == '+' || *q == '-'))
+            q++;
+        if(q < end && !IsSpace(*q))
+            return false;
+        if(std::from_chars(p, q, d).ec == std::errc::invalid_argument)
+            return false;
+        p = q;
+        return true;
+    };
+
+    // Reads an integer of a face vertex, leaving p after it
+    auto integer = [&p, end](int& i)
+    {
+        auto res = std::from_chars(p, end, i);
+        if(res.ec != std::errc())
+            return false;
+        p = res.ptr;
+        return true;
+    };
+
+    // Reads the rest of the field as a name
+    auto name = [&p, end]()
+    {
+        p = SkipSpace(p, end);
+        const char* q = p;
+        while(q < end && !IsSpace(*q))
+            q++;
+        std::string_view str(p, q - p);
+        p = q;
+        return str;
+    };
+
+    p = SkipSpace(p, end);
+    const char* keywordStart = p;
+    auto keyword = name();
+    if(keyword.empty())
+        return true;
+
+    if(keyword == "v" || keyword == "vn")
+    {
+        double c[3];
+        for(int i = 0; i < 3; i++)
+            if(!real(c[i]))
+                return Fail("Floating point expected", lineStart, p);
+        (keyword == "v" ? positions : normals).emplace_back(c[0], c[1], c[2]);
+    }
+    else if(keyword == "f")
+    {
+        ObjStatement face = { ObjStatement::Face, nLines, (int) indices.size()/2 };
+        face.nPositions = (int) positions.size();
+        face.nNormals = (int) normals.size();
+        // The vertices are given as v, v/t, v//n or v/t/n
+        for(p = SkipSpace(p, end); p < end; p = SkipSpace(p, end))
+        {
+            int v, t = 0, n = 0;
+            if(!integer(v))
+                return Fail("Integer expected", lineStart, p);
+            if(p < end && *p == '/' && ++p < end && *p != '/' && !integer(t))
+                return Fail("Integer expected", lineStart, p);
+            if(p < end && *p == '/' && (++p == end || !integer(n)))
+                return Fail("Integer expected", lineStart, p);
+            if(p < end && !IsSpace(*p))
+                return Fail("Unexpected character in face", lineStart, p);
+            indices.insert(indices.end(), { v, n });
+        }
+        face.count = (int) indices.size()/2 - face.first;
+        statements.push_back(face);
+    }
+    else if(keyword == "vt")
+    {
+        // We don't care about the texture coordinates, though there should be one to three
+        double d;
+        int n = 0;
+        while(n < 3 && real(d))
+            n++;
+        if(!n)
+            return Fail("Bad texture coordinate", lineStart, p);
+    }
+    else if(keyword == "g") // We don't care about the name of the group
+        statements.push_back({ ObjStatement::Group, nLines });
+    else if(keyword == "usemtl" || keyword == "mtllib")
+    {
+        auto type = keyword == "usemtl" ? ObjStatement::UseMaterial : ObjStatement::MaterialLibrary;
+        auto str = name();
+        if(str.empty())
+            return Fail("Alphanumeric string expected", lineStart, p);
+        statements.push_back({ type, nLines });
+        statements.back().name = str;
+    }
+    else if(keyword == "o" || keyword == "s") // Object names and smoothing groups
+    {
+        if(name().empty())
+            return Fail("Alphanumeric string expected", lineStart, p);
+    }
+    else if(keyword == "l");
+    else
+        return Fail("Unknown token \"" + std::string(keyword) + "\"", lineStart, keywordStart);
+    return true;
+}
+
 /**
  * Parses a Wavefront .obj file and returns the resulting triangle mesh and vector of light meshes.
- *
- * @throws ParseException if something didn't parse correctly. 
+ * The file is split into chunks at line breaks that are parsed in parallel, a few at a time, and
+ * the faces and groups of each chunk are then added to the meshes in the order of the file.
+ * 
+ * If something doesn't parse correctly, the error is logged and the meshes hold what was read
+ * before it.
+ * 
  * @param file The name of the obj file.
  * @param meshMat An alternate material to be used for the entire mesh, or null.
- * @returns A pair of the resulting TriangleMesh and a vector of MeshLights.
+ * @returns A tuple of whether the file was read without errors, the resulting TriangleMesh and a
+ *          vector of MeshLights.
  */
-std::pair<TriangleMesh*, std::vector<MeshLight*>> ReadFromFile(const std::string& file, Material* meshMat)
+std::tuple<bool, TriangleMesh*, std::vector<MeshLight*>> ReadFromFile(const std::string& file, Material* meshMat)
 {
+    // The cache only knows the materials of the material files, so it can't be used with another
+    if(!meshMat)
+        if(auto [cached, mesh, meshLights] = ReadCache(file); cached)
+            return { true, mesh, meshLights };
+
     Material* curmat = nullptr;
-    std::ifstream myfile;
-    myfile.open(file.c_str(), std::ios::out);
+    MappedFile objFile(file);
 
     std::map<std::string, Material*> materials;
     std::set<MeshLight*> meshLights;
+    std::vector<std::string> materialFiles;
+    std::vector<std::map<std::string, Material*>> libraries; // The materials of each material file
+    bool failed = false;
 
     TriangleMesh* mesh = new TriangleMesh();
-    bool normalInterp;
-    std::string str;
 
-    std::vector<MeshVertex*> vectors;
+    std::vector<Vector3d> vectors;
     std::vector<Vector3d> normals;
-    std::map<int, MeshVertex*> groupVertices; // The vertices that have been added to the current group so far
+    // The vertices that have been added to the current group so far, as their index in the mesh
+    // they were added to, and the triangles that use them
+    std::unordered_map<std::pair<TriangleMesh*, int>, int, MeshVertexHash> groupVertices;
+    std::unordered_map<std::pair<TriangleMesh*, int>, std::vector<int>, MeshVertexHash> vertexTriangles;
 
     TriangleMesh* currentMesh = mesh;
 
-    std::unordered_map<MeshVertex*, Vertex3d*> replacement;
+    // Ends the current group. Vertices that are part of triangles that are above a certain angle
+    // threshold to each other get the geometric normal of one of those triangles
+    std::vector<Vector3d> triangleNormals; // The normals of the triangles of a vertex
+    auto endGroup = [&]()
+    {
+        for(auto& [key, vertex] : groupVertices)
+        {
+            TriangleMesh* m = key.first;
+            triangleNormals.clear();
+            for(auto t : vertexTriangles[{ m, vertex }])
+                triangleNormals.push_back(m->triangles[t].GetNormal());
 
-    try {
+            auto sharp = [&](const Vector3d& n1)
+            {
+                for(auto& n2 : triangleNormals)
+                    if(n1*n2 < 0.7)
+                        return true;
+                return false;
+            };
+            auto it = std::find_if(triangleNormals.begin(), triangleNormals.end(), sharp);
+            if(it != triangleNormals.end())
+                m->vertices[vertex].normal = *it;
+        }
 
-        if(myfile.fail())
+        groupVertices.clear();
+        vertexTriangles.clear();
+    };
+
+    // Adds a face of a chunk to the current mesh
+    auto addFace = [&](const ObjChunk& chunk, const ObjStatement& face, int line)
+    {
+        std::vector<int> faceVertices;
+
+        for(int i = 0; i < face.count; i++)
         {
-            myfile.close();
-            throw ParseException("Can't open the given .obj file \"" + file + "\"");
+            int v = chunk.indices[2*(face.first + i)], n = chunk.indices[2*(face.first + i) + 1];
+
+            // Relative indices count back from the statement, which the chunk only knows the
+            // position of among its own vertices
+            if(v < 0)
+                v = (int) (vectors.size() - chunk.positions.size()) + face.nPositions + v + 1;
+            if(n < 0)
+                n = (int) (normals.size() - chunk.normals.size()) + face.nNormals + n + 1;
+            if(v < 1 || v > (int) vectors.size() || n < 0 || n > (int) normals.size())
+                throw ParseException("Vertex index out of range", line, 1);
+
+            auto& vertices = currentMesh->vertices;
+            int mv;
+
+            auto it = groupVertices.find({ currentMesh, v-1 });
+            if(it == groupVertices.end())
+            { // We have not seen this vertex before in this group so create a new one
+                mv = groupVertices[{ currentMesh, v-1 }] = currentMesh->AddVertex(Vertex3d(vectors[v-1]));
+                if(n) // A normal was submitted so let's trust that one in accordance with .obj standards
+                    vertices[mv].normal = normals[n-1];
+            }
+            else
+            { // This vertex is already among the parsed vertices in this group so use that particular one
+                mv = it->second;
+                if(n)
+                {
+                    if(vertices[mv].normal != normals[n-1]) // A different normal was given though, so we still need
+                    {                                       // to create an entirely new vertex
+                        Vertex3d copy = vertices[mv];
+                        mv = currentMesh->AddVertex(copy);
+                    }
+                    vertices[mv].normal = normals[n-1];
+                }  
+            }
+            faceVertices.push_back(mv);
         }
 
-        Parser parser(tokenize(myfile, str));
-
-        while(!parser.accept(Token::Eof))
+        for(int i = 0; i < (int) faceVertices.size()-2; i++)
         {
-            if(parser.accept(Token::Newline))
-                while(parser.accept(Token::Newline));
+            auto pv0 = faceVertices[0], pv1 = faceVertices[i+1], pv2 = faceVertices[i+2];
 
-            if(parser.accept("f"))
+            Material* triMat = meshMat ? meshMat : curmat;
+            // No material defined, set to diffuse
+            if(!curmat)
             {
-                std::vector<MeshVertex*> faceVertices;
-
-                while(true)
-                {
-                    auto [success, v, t, n] = acceptVertex(parser);
-                    if(!success)
-                        break;
-
-                    if(v < 0)
-                        v = (int) vectors.size() + v + 1;
+                LambertianMaterial* mat = new LambertianMaterial();
+                mat->Kd = Color(0.7, 0.7, 0.7);
+                currentMesh->materials.push_back(mat);
+                if(!meshMat)
+                    triMat = mat;
+            }
 
-                    MeshVertex* mv;
+            int tri = currentMesh->AddTriangle(pv0, pv1, pv2, triMat);
+            for(auto& p : { pv0, pv1, pv2 })
+                vertexTriangles[{ currentMesh, p }].push_back(tri);
 
-                    auto it = groupVertices.find(v-1);
-                    if(it == groupVertices.end())
-                    { // We have not seen this vertex before in this group so create a new one
-                        mv = groupVertices[v-1] = new MeshVertex(*vectors[v-1]);
-                        if(n)
-                        {
-                            normalInterp = false; // A normal was submitted so let's trust that one in accordance with .obj standards
-                            mv->normal = normals[n-1];
-                        }
-                        currentMesh->points.push_back(mv);
-                    }
-                    else
-                    { // This vertex is already among the parsed vertices in this group so use that particular one
-                        mv = it->second;
-                        if(n)
-                        {
-                            normalInterp = false;
-                            if(mv->normal != normals[n-1])  // A different normal was given though, so we still need
-                            {                               // to create an entirely new vertex
-                                mv = new MeshVertex(*mv); 
-                                currentMesh->points.push_back(mv);
-                            }
-                            mv->normal = normals[n-1];
-                        }  
-                    }
-                    faceVertices.push_back(mv);
-                }
+            auto& vertices = currentMesh->vertices;
+            if(!vertices[pv0].normal)
+                for(auto& p : { pv0, pv1, pv2 })
+                    vertices[p].normal = currentMesh->triangles[tri].GetNormal();
+        }
+    };
 
-                for(int i = 0; i < (int) faceVertices.size()-2; i++)
-                {
-                    auto pv0 = faceVertices[0], pv1 = faceVertices[i+1], pv2 = faceVertices[i+2];
+    try {
 
-                    MeshTriangle* tri = new MeshTriangle(pv0, pv1, pv2);
-                    currentMesh->triangles.push_back(tri);
-                    for(auto& p : { pv0, pv1, pv2 })
-                        p->triangles.push_back(tri);
+        if(!objFile.IsOpen())
+            throw ParseException("Can't open the given .obj file \"" + file + "\"");
 
-                    if(!pv0->normal)
-                        for(auto& v : { tri->v0, tri->v1, tri->v2 })
-                            v->normal = tri->GetNormal();
+        int nThreads = std::max(1, (int) std::thread::hardware_concurrency());
+        std::vector<ObjChunk> chunks(nThreads);
+        const char* p = objFile.GetData(), *fileEnd = p + objFile.GetSize();
+        int line = 1; // The line that the next chunk starts at
 
-                    // No material defined, set to diffuse
-                    if(!curmat)
-                    {
-                        LambertianMaterial* mat = new LambertianMaterial();
-                        mat->Kd = Color(0.7, 0.7, 0.7);
-                        tri->SetMaterial(mat);
-                        currentMesh->materials.push_back(mat);
-                    }
-                    if(curmat && !meshMat)
-                        tri->SetMaterial(curmat);
-                    else if(meshMat)
-                        tri->SetMaterial(meshMat);
-                }
+        while(p < fileEnd)
+        {
+            // Parse the next chunks on a thread each
+            std::vector<std::future<void>> tasks;
+            int nChunks = 0;
+            for(; nChunks < nThreads && p < fileEnd; nChunks++)
+            {
+                const char* end = std::find(p + std::min(objChunkSize, (size_t) (fileEnd - p - 1)), fileEnd, '\n');
+                end = std::min(end + 1, fileEnd);
+                tasks.push_back(std::async(std::launch::async, &ObjChunk::Parse, &chunks[nChunks], p, end));
+                p = end;
             }
-            else if(parser.accept("g") || parser.peek() == Token::Eof)
-            {   
-                // We don't care about the name of the group
-                for(auto p = acceptStr(parser); std::get<0>(p); p = acceptStr(parser));
+            for(auto& task : tasks)
+                task.get();
 
-                std::stack<MeshVertex*> vs;
-
-                for(auto& v : groupVertices)
-                    vs.push(v.second);
+            for(int c = 0; c < nChunks; c++)
+            {
+                const ObjChunk& chunk = chunks[c];
+                vectors.insert(vectors.end(), chunk.positions.begin(), chunk.positions.end());
+                normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
 
-                // Create duplicate vertices for every vertex that is part of 
-                // triangles that are above a certain angle threshold to each other
-                if(true)
+                for(auto& statement : chunk.statements)
                 {
-                    while(!vs.empty())
+                    if(statement.type == ObjStatement::Face)
+                        addFace(chunk, statement, line + statement.line);
+                    else if(statement.type == ObjStatement::Group)
+                        endGroup();
+                    else if(statement.type == ObjStatement::MaterialLibrary)
+                    {
+                        // Check if there's an associated materials file, and parse it
+                        if(!meshMat)
+                        {
+                            materials = ReadMaterialFile(std::string(statement.name));
+                            materialFiles.push_back(std::string(statement.name));
+                            libraries.push_back(materials);
+                        }
+                    }
+                    else if(statement.type == ObjStatement::UseMaterial)
                     {
-                        MeshVertex* v = vs.top();
-                        vs.pop();
-        
-                        // Check if we have two triangles at a large angle sharing this vertex
-                        for(auto& t1 : v->triangles)
+                        auto mtl = std::string(statement.name);
+                        auto it = materials.find(mtl);
+                        if(it == materials.end())
+                            curmat = 0;
+                        else
                         {
-                            for(auto& t2 : v->triangles)
+                            if(materials[mtl]->light)
                             {
-                                if(t1->GetNormal() * t2->GetNormal() < 0.7)
-                                {
-                                    // Create two new vertices
-                                    MeshVertex*& v1 = v;
-
-                                    v1->triangles.clear();
-                                    MeshVertex* v2 = new MeshVertex(*v);
-                                    currentMesh->points.push_back(v2);
-                                    v2->triangles.clear();
-                                    v1->normal = t1->GetNormal(); // Just the geometric normal for now, maybe averaged is better
-                                    v2->normal = t2->GetNormal();
-                                    // Reassign the triangles that belonged to v to either v1 or v2 depending on their normal
-                                    for(auto& t3 : v->triangles)
-                                    {
-                                        if(t3->GetNormal() * v1->normal >= 0.7)
-                                        {
-                                            // First reassign the correct vector in the triangle
-                                            for(auto vv : { &t3->v0, &t3->v1, &t3->v2 })
-                                                if(*vv == v)
-                                                    *vv = v1;
-                                            // Then reassign the triangle in the vector's triangle list
-                                            v1->triangles.push_back(t3);
-                                        }
-                                        else
-                                        {
-                                            for(auto vv : { &t3->v0, &t3->v1, &t3->v2 })
-                                                if(*vv == v)
-                                                    *vv = v2;
-                                            v2->triangles.push_back(t3);
-                                        }
-                                    }
-                                    vs.push(v1);
-                                    vs.push(v2);
-                                    goto nextwhile; // Yes, it's goto, since nested continues don't exist
-                                }
+                                meshLights.emplace(static_cast<MeshLight*>(materials[mtl]->light));
+                                currentMesh = (static_cast<MeshLight*>(materials[mtl]->light)->mesh);
                             }
+                            else
+                                currentMesh = mesh;
+                            curmat = materials[mtl];
                         }
-                nextwhile:;
-                    } // while(!vs.empty() ..
-                } // if(normalInterp ..
-
-                normalInterp = true;
-                groupVertices.clear();
-            } // if(a == "g" ..
-            else if(parser.accept("mtllib"))
-            {
-                // Check if there's an associated materials file, and parse it
-                auto matfilestr = expectStr(parser);
-                if(!meshMat)
-                    materials = ReadMaterialFile(std::string(matfilestr));
-                continue;
-            }
-            else if(parser.accept("vn"))
-                normals.push_back(expectVector3d(parser));
-            else if(parser.accept("o"))
-                auto str = expectStr(parser);
-            else if(parser.accept("vt"))
-                auto texturecoords = expectVtCoordinate(parser);
-            else if(parser.accept("s")) // Smoothing group ending or starting
-            {
-                auto [success, s1] = acceptStr(parser);
-                if(success)
-                    normalInterp = s1 != "off";
-                else
-                    normalInterp = expectInt(parser) != 0;
-            }
-            else if(parser.accept("v"))
-                vectors.push_back(new MeshVertex(expectVector3d(parser)));
-            else if(parser.accept("usemtl"))
-            {
-                auto mtl = std::string(expectStr(parser));
-                auto it = materials.find(mtl);
-                if(it == materials.end())
-                    curmat = 0;
-                else
-                {
-                    if(materials[mtl]->light)
-                    {
-                        meshLights.emplace(static_cast<MeshLight*>(materials[mtl]->light));
-                        currentMesh = (static_cast<MeshLight*>(materials[mtl]->light)->mesh);
                     }
-                    else
-                        currentMesh = mesh;
-                    curmat = materials[mtl];
                 }
-            }
-            else if(parser.accept(Token::Newline));
-            else if(parser.accept("l"))
-                while(parser.next().type != Token::Newline);
-            else
-            {
-                auto token = parser.peek();
-                throw ParseException("Unknown token \"" + std::string(token.str) + "\"", token.line, token.column);
+
+                if(chunk.failed)
+                    throw ParseException(chunk.error, line + chunk.errorLine, chunk.errorColumn);
+                line += chunk.nLines;
             }
         }
+        endGroup();
     }
     catch(const ParseException& p)
     {
         logger.Box(p.message);
-        __debugbreak();
-    }
-
-    for(auto& t : mesh->triangles)
-    {
-        for(auto vv : { &t->v0, &t->v1, &t->v2 })
-        {
-            auto& v = (*(reinterpret_cast<MeshVertex**>(vv)));
-            if(replacement.find(v) == replacement.end())
-            {
-                auto oldv = v;
-                v = static_cast<MeshVertex*>(new Vertex3d(v->pos, v->normal, v->texpos));
-                replacement[oldv] = (Vertex3d*) v;
-                mesh->points.push_back(v);
-                replacement[v] = v;
-            }
-            else
-                v = static_cast<MeshVertex*>(replacement[v]);
-        }
-    }
-    for(auto& p : mesh->points)
-        if(replacement.find(static_cast<MeshVertex*>(p)) != replacement.end())
-            p = replacement[static_cast<MeshVertex*>(p)];
-
-    for(auto& m : meshLights)
-    {
-        for(auto& t : m->mesh->triangles)
-        {
-            for(auto vv : { &t->v0, &t->v1, &t->v2 })
-            {
-                auto& v = (*((MeshVertex**) vv));
-                if(replacement.find(v) == replacement.end())
-                {
-                    auto oldv = v;
-                    v = static_cast<MeshVertex*>(new Vertex3d(v->pos, v->normal, v->texpos));
-                    replacement[oldv] = static_cast<Vertex3d*>(v);
-                    m->mesh->points.push_back(v);
-                    replacement[v] = v;
-                }
-                else
-                    v = static_cast<MeshVertex*>(replacement[v]);
-            }
-        }
-        for(auto& p : m->mesh->points)
-            if(replacement.find(static_cast<MeshVertex*>(p)) != replacement.end())
-                p = replacement[static_cast<MeshVertex*>(p)];
+        failed = true;
     }
 
     for(auto it = materials.begin(); it != materials.end(); it++)
         mesh->materials.push_back((*it).second);
 
-    myfile.close();
     auto meshLightVector = std::vector<MeshLight*>(meshLights.begin(), meshLights.end());
-    return { mesh, meshLightVector };
+    if(!meshMat && !failed)
+        WriteCache(file, materialFiles, libraries, mesh, meshLightVector);
+    return { !failed, mesh, meshLightVector };
 }
@@ -19,5 +19,5 @@ class Material;
 class TriangleMesh;
 class MeshLight;
 
-std::pair<TriangleMesh*, std::vector<MeshLight*>> ReadFromFile(const std::string& file, Material* meshMat);
+std::tuple<bool, TriangleMesh*, std::vector<MeshLight*>> ReadFromFile(const std::string& file, Material* meshMat);
 std::map<std::string, Material*> ReadMaterialFile(const std::string& matfilestr);
@@ -28,27 +28,43 @@ PathTracer::~PathTracer()
 }
 
 /**
- * Calculates one sample per pixel using path tracing from the given camera, into the given
- * color buffer.
+ * Calculates one sample per pixel for a tile of the image.
  * 
  * @param cam The camera from whose perspective we render.
- * @param colBuf The color buffer that we dump pixel contributions into.
+ * @param colBuf The color buffer of the size of the tile that we dump pixel contributions into.
+ * @param splats The buffer for light path contributions, which the path tracer has none of.
+ * @param x0 The x coordinate of the upper left pixel of the tile in the image.
+ * @param y0 The y coordinate of the upper left pixel of the tile in the image.
+ * @param pass The number of passes over the tile before this one.
  */
-void PathTracer::Render(Camera& cam, ColorBuffer& colBuf)
+void PathTracer::RenderTile(Camera& cam, ColorBuffer& colBuf, SplatBuffer& splats, int x0, int y0, unsigned int pass)
 {
     int xres = colBuf.GetXRes();
     int yres = colBuf.GetYRes();
 
-    for(int y = 0; y < yres; y++)
+    // The camera rays of a row are intersected together, so that the scene can trace them as
+    // packets. Each pixel then goes on from where its randomizer was after its camera ray
+    std::vector<Ray> rays(xres);
+    std::vector<HitRecord> hits(xres);
+    std::vector<const Light*> lights(xres);
+    std::vector<RandomizerState> states(xres);
+    for(int y = 0; y < yres && !stopping; y++)
     {
-        for(int x = 0; x < xres && !stopping; x++)
+        for(int x = 0; x < xres; x++)
         {
-            double q = m_random.GetDouble(0, 1), p = m_random.GetDouble(0, 1);
-            auto u = m_random.GetDouble(0, 1), v = m_random.GetDouble(0, 1);
+            m_random.Seed((y0 + y)*cam.GetXRes() + x0 + x, pass);
 
-            Ray outRay = cam.GetRayFromPixel(x, y, q, p, u, v);
+            double r[4];
+            m_random.GetDoubles(r, 4, 0, 1);
+            rays[x] = cam.GetRayFromPixel(x0 + x, y0 + y, r[0], r[1], r[2], r[3]);
+            states[x] = m_random.GetState();
+        }
+        scene->Intersect(rays.data(), xres, hits.data(), lights.data());
 
-            Color result = TracePath(outRay);
+        for(int x = 0; x < xres; x++)
+        {
+            m_random.SetState(states[x]);
+            Color result = TracePath(rays[x], hits[x], lights[x]);
             colBuf.SetPixel(x, y, result);
         }
     }
@@ -80,50 +96,68 @@ void PathTracer::Load(Bytestream& stream)
  * @returns The contribution of the sample.
  */
 Color PathTracer::TracePath(const Ray& ray)
+{
+    auto [hit, minlight] = scene->Intersect(ray);
+    return TracePath(ray, hit, minlight);
+}
+
+/**
+ * Calculates the contribution of one sample of the path tracing algorithm, given where its first
+ * ray hits the scene.
+ * 
+ * @param ray The ray to trace.
+ * @param hit The closest hit of the ray.
+ * @param minlight The light that the ray hit, if any.
+ * @returns The contribution of the sample.
+ */
+Color PathTracer::TracePath(const Ray& ray, HitRecord hit, const Light* minlight)
 {
     IntersectionInfo info;
     Ray outRay, inRay = ray;
     Color pathColor = Color::Identity, finalColor = Color::Black;
     bool sampledLight = false;
 
-    double r = m_random.GetDouble(0.0, 1.0);
-    auto [light, lightWeight] = scene->PickLight(r);
-
-    do
+    while(true)
     {
-        auto [t, minprimitive, minlight] = scene->Intersect(inRay);
-        if(t < 0)
+        if(hit.t < 0)
             break;
 
-        if(minprimitive)
-            minprimitive->GenerateIntersectionInfo(inRay, info);
+        if(hit.primitive)
+            hit.primitive->GenerateIntersectionInfo(inRay, hit, info);
         else
             minlight->GenerateIntersectionInfo(inRay, info);
        
         // Randomly interesected a light source
-        if(info.material->GetLight() == light)
+        if(auto hitLight = info.material->GetLight())
         {
-            if(sampledLight) // We already sampled with next event estimation
-                return finalColor/lightWeight;
-            else return pathColor*( info.normal*info.direction < 0
-                        ? light->GetIntensity()/lightWeight : Color::Black );
+            // Unless we already sampled the lights with next event estimation
+            if(!sampledLight && info.normal*info.direction < 0)
+                finalColor += pathColor*hitLight->GetIntensity();
+            break;
         }
-        else if(info.material->GetLight())
-            return finalColor/lightWeight;
 
         auto sample = info.material->GetSample(info, m_random, false);
         if(sample.specular) // Next event estimation would be zero since BRDF is an impulse function
             sampledLight = false;
         else
         {
-            auto [color, lightPoint] = light->NextEventEstimation(this, info, m_random, sample.component);
-            finalColor += pathColor*color;
+            // Pick a light for this point in particular, since the lights that matter change
+            // along the path
+            auto [light, lightWeight] = scene->PickLight(info, m_random.GetDouble(0.0, 1.0));
+            if(light)
+            {
+                auto [color, lightPoint] = light->NextEventEstimation(this, info, m_random, sample.component);
+                finalColor += pathColor*color/lightWeight;
+            }
             sampledLight = true;
         }
         pathColor *= sample.color/0.7;
         inRay = sample.outRay;
-    }   
-    while(m_random.GetDouble(0, 1) < 0.7);
-    
-    return finalColor/lightWeight;
+
+        if(m_random.GetDouble(0, 1) >= 0.7)
+            break;
+        std::tie(hit, minlight) = scene->Intersect(inRay);
+    }
+
+    return finalColor;
 }
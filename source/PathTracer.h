@@ -18,14 +18,12 @@ public:
     PathTracer(std::shared_ptr<Scene> scene);
     ~PathTracer();
 
-    void Render(Camera& cam, ColorBuffer& colBuf);
+    void RenderTile(Camera& cam, ColorBuffer& colBuf, SplatBuffer& splats, int x0, int y0, unsigned int pass);
 
     Color TracePath(const Ray& ray);
+    Color TracePath(const Ray& ray, HitRecord hit, const Light* minlight);
     Color TracePathPrimitive(const Ray& ray);
 
     void Save(Bytestream& stream) const;
     void Load(Bytestream& stream);
-
-private:
-    Randomizer m_random;
 };
@@ -85,7 +85,7 @@ Sample PhongMaterial::GetSample(const IntersectionInfo& info, Randomizer& rnd, b
         if(w_i*N_g < 0 || w_o*N_g < 0 || w_i*N_s < 0 || w_o*N_s < 0)
             return Sample(Color(0, 0, 0), out, 0, 0, false, 1);
 
-        Color ret = adjoint ? Kd*abs(w_i*N_s)/abs(w_i*N_g) : Kd;
+        Color ret = adjoint ? Kd*std::abs(w_i*N_s)/std::abs(w_i*N_g) : Kd;
         return Sample(ret/(df/(df+sp)), out, pdf, rpdf, false, 1);
     }
     else // Specular bounce
@@ -120,8 +120,8 @@ Sample PhongMaterial::GetSample(const IntersectionInfo& info, Randomizer& rnd, b
         if(w_i*N_g < 0 || w_o*N_g < 0 || w_i*N_s < 0 || w_o*N_s < 0)
             return Sample(Color(0, 0, 0), out, 0, 0, false, 2);
 
-        Color mod = abs(out.direction*N)*Ks*float(alpha + 2)/float(alpha + 1);
-        return Sample((adjoint ? abs((N_s*w_i)/(N_g*w_i)) : 1)*mod/(sp/(df+sp)), out, pdf, rpdf, false, 2);
+        Color mod = std::abs(out.direction*N)*Ks*float(alpha + 2)/float(alpha + 1);
+        return Sample((adjoint ? std::abs((N_s*w_i)/(N_g*w_i)) : 1)*mod/(sp/(df+sp)), out, pdf, rpdf, false, 2);
     }
 }
 
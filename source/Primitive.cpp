@@ -8,6 +8,7 @@
  */
 
 #include "Primitive.h"
+#include "Ray.h"
 
 /**
  * Constructor.
@@ -39,3 +40,62 @@ Material* Primitive::GetMaterial() const
 {
     return material;
 }
+
+/**
+ * Intersects the primitive with a ray, recording what is needed to generate the intersection
+ * info afterwards. Primitives that have nothing more to record than the distance can rely on
+ * this.
+ * 
+ * @param ray The ray to intersect with.
+ * @returns The hit, with a distance of -inf if the primitive wasn't hit.
+ */
+HitRecord Primitive::IntersectHit(const Ray& ray) const
+{
+    return { Intersect(ray), 0, 0, this, -1 };
+}
+
+/**
+ * Intersects the primitive with some of the rays of a packet. Primitives that have a test of
+ * whole packets override this, the rest intersect the rays one by one.
+ * 
+ * @param packet The packet of rays.
+ * @param mask The rays of the packet to intersect with, as bits.
+ * @param t The distance along each of the rays that the primitive was hit, as from Intersect,
+ *          left alone for the other rays.
+ */
+void Primitive::Intersect(const RayPacket& packet, unsigned int mask, double* t) const
+{
+    for(int i = 0; i < packet.n; i++)
+        if(mask >> i & 1)
+            t[i] = Intersect(packet.rays[i]);
+}
+
+/**
+ * Intersects the primitive with some of the rays of a packet, recording what is needed to
+ * generate the intersection infos afterwards. Primitives that have a test of
+ * whole packets override this, the rest intersect the rays one by one.
+ * 
+ * @param packet The packet of rays.
+ * @param mask The rays of the packet to intersect with, as bits.
+ * @param hits The hit of each of the rays, as from IntersectHit, left alone for the other rays.
+ */
+void Primitive::IntersectHit(const RayPacket& packet, unsigned int mask, HitRecord* hits) const
+{
+    for(int i = 0; i < packet.n; i++)
+        if(mask >> i & 1)
+            hits[i] = IntersectHit(packet.rays[i]);
+}
+
+/**
+ * Returns the corners of the primitive if it is a triangle, so that it can be intersected
+ * without going through Intersect.
+ * 
+ * @param v0 The first corner.
+ * @param v1 The second corner.
+ * @param v2 The third corner.
+ * @returns True if the primitive is a triangle, in which case the corners were returned.
+ */
+bool Primitive::GetVertices(Vector3d&, Vector3d&, Vector3d&) const
+{
+    return false;
+}
@@ -9,13 +9,16 @@
 
 #pragma once
 
+#include "HitRecord.h"
 #include <tuple>
 
 class Vector3d;
 class Ray;
+class RayPacket;
 class Material;
 class BoundingBox;
 class IntersectionInfo;
+class Vector3d;
 
 class Primitive
 {
@@ -27,7 +30,12 @@ public:
     virtual std::tuple<bool, BoundingBox> GetClippedBoundingBox(const BoundingBox& clipbox) const = 0;
 
     virtual double Intersect(const Ray& ray) const = 0;
-    virtual bool GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const = 0;
+    virtual void Intersect(const RayPacket& packet, unsigned int mask, double* t) const;
+    virtual HitRecord IntersectHit(const Ray& ray) const;
+    virtual void IntersectHit(const RayPacket& packet, unsigned int mask, HitRecord* hits) const;
+    virtual void GenerateIntersectionInfo(const Ray& ray, const HitRecord& hit, IntersectionInfo& info) const = 0;
+
+    virtual bool GetVertices(Vector3d& v0, Vector3d& v1, Vector3d& v2) const;
 
     void SetMaterial(Material* material);
     Material* GetMaterial() const;
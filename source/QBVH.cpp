@@ -0,0 +1,604 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file QBVH.cpp
+ * 
+ * Implementation of the QBVH class, a bounding volume hierarchy with four children per node
+ * whose boxes and triangles are intersected four at a time.
+ */
+
+#include "QBVH.h"
+#include "BVH.h"
+#include "Bytestream.h"
+#include "Float4.h"
+#include "Primitive.h"
+#include "Ray.h"
+#include "SceneCache.h"
+#include "Timer.h"
+#include "Utils.h"
+#include "Vector3d.h"
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Calculates the surface area of the box of a binary node.
+ * 
+ * @param node The node.
+ * @returns The surface area.
+ */
+double GetArea(const BVHNode& node)
+{
+    double dx = node.c2[0] - node.c1[0], dy = node.c2[1] - node.c1[1], dz = node.c2[2] - node.c1[2];
+    return 2*(dx*dy + dx*dz + dy*dz);
+}
+
+/**
+ * Constructor.
+ */
+QBVH::QBVH() : extent(0)
+{
+}
+
+/**
+ * Destructor.
+ */
+QBVH::~QBVH()
+{
+}
+
+/**
+ * Creates a leaf from a range of primitives of the binary hierarchy, putting the triangles in
+ * blocks of four.
+ * 
+ * @param bvh The binary hierarchy.
+ * @param range The range of the primitive index array of the binary hierarchy.
+ * @param depth The depth of the leaf.
+ * @param area The surface area of the leaf relative to that of the whole hierarchy.
+ * @returns The index of the leaf.
+ */
+int QBVH::MakeLeaf(const BVH& bvh, std::pair<int, int> range, int depth, double area)
+{
+    QBVHLeaf leaf{ (int) blocks.size(), 0, (int) primitiveIndices.size(), 0 };
+
+    int lane = 4;
+    for(int i = range.first; i < range.second; i++)
+    {
+        int index = bvh.primitiveIndices[i];
+        Vector3d v0, v1, v2;
+        if(!primitives[index]->GetVertices(v0, v1, v2))
+        {
+            primitiveIndices.push_back(index);
+            leaf.nPrimitives++;
+            continue;
+        }
+
+        if(lane == 4)
+        {
+            blocks.emplace_back();
+            auto& block = blocks.back();
+            std::fill(&block.v0[0][0], &block.v0[0][0] + 3*4, 0.0);
+            std::fill(&block.e1[0][0], &block.e1[0][0] + 2*3*4, 0.0f);
+            std::fill(block.primitives, block.primitives + 4, -1);
+            leaf.nBlocks++;
+            lane = 0;
+        }
+
+        auto& block = blocks.back();
+        Vector3d e1 = v1 - v0, e2 = v2 - v0;
+        for(int u = 0; u < 3; u++)
+        {
+            block.v0[u][lane] = v0[u];
+            block.e1[u][lane] = (float) e1[u];
+            block.e2[u][lane] = (float) e2[u];
+        }
+        block.primitives[lane++] = index;
+    }
+
+    statistics.AddLeaf(range.second - range.first, depth);
+    statistics.sahCost += area*(leaf.nBlocks + leaf.nPrimitives);
+
+    leaves.push_back(leaf);
+    return (int) leaves.size() - 1;
+}
+
+/**
+ * Builds a node from a subtree of the binary hierarchy by repeatedly opening the largest of its
+ * children until there are four of them.
+ * 
+ * @param bvh The binary hierarchy.
+ * @param node The index of the root of the binary subtree.
+ * @param ranges The range of the primitive index array that each binary subtree covers.
+ * @param depth The depth of the node.
+ * @param rootArea The surface area of the whole hierarchy.
+ * @returns The index of the node.
+ */
+int QBVH::Collapse(const BVH& bvh, int node, const std::vector<std::pair<int, int>>& ranges, int depth, double rootArea)
+{
+    auto isLeaf = [&](int n)
+    {
+        return bvh.nodes[n].IsLeaf() || ranges[n].second - ranges[n].first <= maxLeafSize;
+    };
+
+    int children[4], nChildren = 1;
+    children[0] = node;
+    while(nChildren < 4)
+    {
+        int best = -1;
+        double bestArea = -1;
+        for(int i = 0; i < nChildren; i++)
+        {
+            if(!isLeaf(children[i]) && GetArea(bvh.nodes[children[i]]) > bestArea)
+                best = i, bestArea = GetArea(bvh.nodes[children[i]]);
+        }
+        if(best < 0)
+            break;
+        int opened = children[best];
+        children[best] = opened + 1;
+        children[nChildren++] = bvh.nodes[opened].offset;
+    }
+
+    int index = (int) nodes.size();
+    nodes.emplace_back();
+    for(int i = 0; i < 4; i++)
+    {
+        for(int u = 0; u < 3; u++)
+        {
+            nodes[index].bounds[0][u][i] = std::numeric_limits<float>::infinity();
+            nodes[index].bounds[1][u][i] = -std::numeric_limits<float>::infinity();
+        }
+        nodes[index].children[i] = 0;
+    }
+
+    statistics.nNodes++;
+    statistics.sahCost += (rootArea > 0 ? GetArea(bvh.nodes[node])/rootArea : 1)*BVH::cost_trav;
+
+    for(int i = 0; i < nChildren; i++)
+    {
+        int c = children[i];
+        for(int u = 0; u < 3; u++)
+        {
+            nodes[index].bounds[0][u][i] = bvh.nodes[c].c1[u];
+            nodes[index].bounds[1][u][i] = bvh.nodes[c].c2[u];
+        }
+        double area = rootArea > 0 ? GetArea(bvh.nodes[c])/rootArea : 1;
+        int child = isLeaf(c) ? ~MakeLeaf(bvh, ranges[c], depth + 1, area) : Collapse(bvh, c, ranges, depth + 1, rootArea);
+        nodes[index].children[i] = child;
+    }
+    return index;
+}
+
+/**
+ * Builds the hierarchy from a set of primitives, by building a binary hierarchy and collapsing
+ * it.
+ * 
+ * @param shapes The primitives to build the partition structure for.
+ */
+void QBVH::Build(const std::vector<const Primitive*>& shapes)
+{
+    Timer timer;
+    primitives = shapes;
+    nodes.clear();
+    leaves.clear();
+    blocks.clear();
+    primitiveIndices.clear();
+    statistics = PartitioningStatistics();
+
+    BVH bvh;
+    bvh.Build(shapes);
+
+    if(!bvh.nodes.empty())
+    {
+        // The leaves are laid out in the order of the nodes, so every subtree covers a range of
+        // the primitive indices, and the children of a node come after it
+        std::vector<std::pair<int, int>> ranges(bvh.nodes.size());
+        for(int i = (int) bvh.nodes.size() - 1; i >= 0; i--)
+        {
+            const auto& n = bvh.nodes[i];
+            if(n.IsLeaf())
+                ranges[i] = { n.offset, n.offset + n.nPrimitives };
+            else
+                ranges[i] = { ranges[i + 1].first, ranges[n.offset].second };
+        }
+        Collapse(bvh, 0, ranges, 0, GetArea(bvh.nodes[0]));
+    }
+    FindExtent();
+
+    nodes.shrink_to_fit();
+    leaves.shrink_to_fit();
+    blocks.shrink_to_fit();
+    primitiveIndices.shrink_to_fit();
+
+    statistics.buildTime = timer.GetTime();
+    statistics.memory = nodes.size()*sizeof(QBVHNode) + leaves.size()*sizeof(QBVHLeaf) + blocks.size()*sizeof(TriangleBlock)
+                      + primitiveIndices.size()*sizeof(int) + primitives.size()*sizeof(const Primitive*);
+}
+
+/**
+ * Finds the greatest magnitude of any coordinate of the boxes, which bounds the rounding errors
+ * of the single precision tests. The boxes of the children of the root hold all others.
+ */
+void QBVH::FindExtent()
+{
+    extent = 0;
+    if(nodes.empty())
+        return;
+    for(int m = 0; m < 2; m++)
+        for(int u = 0; u < 3; u++)
+            for(int i = 0; i < 4; i++)
+                if(std::isfinite(nodes[0].bounds[m][u][i]))
+                    extent = std::max(extent, std::abs(nodes[0].bounds[m][u][i]));
+}
+
+/**
+ * Rounds a distance along a ray to single precision, towards negative infinity.
+ * 
+ * @param t The distance.
+ * @returns The greatest float that is at most t.
+ */
+static float RoundDown(double t)
+{
+    float f = (float) t;
+    return f > t ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+/**
+ * Rounds a distance along a ray to single precision, towards positive infinity.
+ * 
+ * @param t The distance.
+ * @returns The smallest float that is at least t.
+ */
+static float RoundUp(double t)
+{
+    float f = (float) t;
+    return f < t ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+// The factor that the sums of the magnitudes of the terms of the single precision calculations are
+// multiplied by to bound their rounding errors. The calculations take a handful of roundings, so
+// this leaves a wide margin
+const float errorFactor = 1.0f/(1 << 19);
+
+// A ray in the form the single precision tests need it, with every component in all lanes. The box
+// tests use origins that are moved back and forth along each axis by more than the rounding errors
+// of the tests can amount to, so that the boxes are never missed
+class QBVHRay
+{
+public:
+    QBVHRay(const Ray& ray, float extent);
+
+    double origin[3];
+    Float4 d[3], absD[3], invDir[3];
+    Float4 nearOrigin[3], farOrigin[3];
+    int sign[3];
+};
+
+/**
+ * Constructor.
+ * 
+ * @param ray The ray to prepare for the tests.
+ * @param extent The greatest magnitude of any coordinate of the boxes to be tested.
+ */
+QBVHRay::QBVHRay(const Ray& ray, float extent)
+{
+    float magnitude = extent;
+    for(int u = 0; u < 3; u++)
+        magnitude = std::max(magnitude, (float) std::abs(ray.origin[u]));
+    float slack = magnitude*errorFactor;
+
+    for(int u = 0; u < 3; u++)
+    {
+        origin[u] = ray.origin[u];
+        d[u] = Float4((float) ray.direction[u]);
+        absD[u] = Abs(d[u]);
+        invDir[u] = Float4(1/(float) ray.direction[u]);
+        sign[u] = ray.direction[u] < 0;
+        float o = (float) ray.origin[u], shift = sign[u] ? -slack : slack;
+        nearOrigin[u] = Float4(o + shift);
+        farOrigin[u] = Float4(o - shift);
+    }
+}
+
+/**
+ * Intersects the four child boxes of a node with a ray, widened by the slack of the ray. A ray
+ * running along a face of a box gives a NaN, which Min and Max ignore.
+ * 
+ * @param node The node.
+ * @param ray The ray.
+ * @param tmin The smallest distance along the ray to find intersections.
+ * @param tmax The greatest distance along the ray to find intersections.
+ * @param distances The distances along the ray that it enters the boxes.
+ * @returns A mask with the bits of the children whose boxes the ray may intersect set.
+ */
+int IntersectBoxes(const QBVHNode& node, const QBVHRay& ray, float tmin, float tmax, float* distances)
+{
+    Float4 tnear(tmin), tfar(tmax);
+    for(int u = 0; u < 3; u++)
+    {
+        Float4 t1 = (Float4::Load(node.bounds[ray.sign[u]][u]) - ray.nearOrigin[u])*ray.invDir[u];
+        Float4 t2 = (Float4::Load(node.bounds[1 - ray.sign[u]][u]) - ray.farOrigin[u])*ray.invDir[u];
+        tnear = Max(t1, tnear);
+        tfar = Min(t2, tfar);
+    }
+    tnear.Store(distances);
+    return (tnear <= tfar).Mask();
+}
+
+/**
+ * Intersects the four triangles of a block with a ray using Möller-Trumbore. The barycentric
+ * coordinates and the distance are compared as the numerators and the determinant of their
+ * quotients, each with a bound of its rounding errors taken from the magnitudes of its terms. A
+ * triangle is only left out when the comparisons fail by more than that, and triangles whose
+ * determinant is too small to tell its sign are kept.
+ * 
+ * @param block The triangles.
+ * @param ray The ray.
+ * @param tmax The greatest distance along the ray to find intersections.
+ * @returns A mask with the bits of the triangles that the ray may intersect set.
+ */
+int IntersectTriangles(const TriangleBlock& block, const QBVHRay& ray, float tmax)
+{
+    const Float4* d = ray.d, *absD = ray.absD;
+    Float4 e1[3], e2[3], t[3], absE1[3], absE2[3], absT[3];
+    for(int u = 0; u < 3; u++)
+    {
+        e1[u] = Float4::Load(block.e1[u]);
+        e2[u] = Float4::Load(block.e2[u]);
+        t[u] = Float4::Difference(ray.origin[u], block.v0[u]);
+        absE1[u] = Abs(e1[u]);
+        absE2[u] = Abs(e2[u]);
+        absT[u] = Abs(t[u]);
+    }
+    Float4 p[3] = { d[1]*e2[2] - d[2]*e2[1], d[2]*e2[0] - d[0]*e2[2], d[0]*e2[1] - d[1]*e2[0] };
+    Float4 q[3] = { t[1]*e1[2] - t[2]*e1[1], t[2]*e1[0] - t[0]*e1[2], t[0]*e1[1] - t[1]*e1[0] };
+    Float4 absP[3] = { absD[1]*absE2[2] + absD[2]*absE2[1], absD[2]*absE2[0] + absD[0]*absE2[2], absD[0]*absE2[1] + absD[1]*absE2[0] };
+    Float4 absQ[3] = { absT[1]*absE1[2] + absT[2]*absE1[1], absT[2]*absE1[0] + absT[0]*absE1[2], absT[0]*absE1[1] + absT[1]*absE1[0] };
+
+    Float4 det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+    Float4 u = t[0]*p[0] + t[1]*p[1] + t[2]*p[2];
+    Float4 v = d[0]*q[0] + d[1]*q[1] + d[2]*q[2];
+    Float4 tHit = e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2];
+
+    Float4 factor(errorFactor);
+    Float4 detError = (absE1[0]*absP[0] + absE1[1]*absP[1] + absE1[2]*absP[2])*factor;
+    Float4 uError = (absT[0]*absP[0] + absT[1]*absP[1] + absT[2]*absP[2])*factor;
+    Float4 vError = (absD[0]*absQ[0] + absD[1]*absQ[1] + absD[2]*absQ[2])*factor;
+    Float4 tError = (absE2[0]*absQ[0] + absE2[1]*absQ[1] + absE2[2]*absQ[2])*factor;
+
+    // Flipping the signs of the numerators along with that of the determinant leaves it positive
+    Float4 sign = det & Float4(-0.0f), absDet = Abs(det);
+    u = u ^ sign, v = v ^ sign, tHit = tHit ^ sign;
+
+    Float4 zero(0.0f);
+    Float4 hit = (zero - uError <= u) & (zero - vError <= v) & (u + v - absDet <= uError + vError + detError)
+               & (zero - tError <= tHit) & (tHit - tError <= Float4(tmax)*(absDet + detError));
+    int unknown = (absDet <= detError).Mask(), used = 0;
+    for(int i = 0; i < 4; i++)
+        used |= (block.primitives[i] >= 0) << i;
+    return (hit.Mask() | unknown) & used;
+}
+
+/**
+ * Intersects the contents of the hierarchy with a ray. The boxes and triangles are tested in
+ * single precision with slack that covers the rounding errors of the tests, and the triangles
+ * found that way are then intersected exactly through IntersectHit, so the results are the same
+ * as those of the other partitionings.
+ * 
+ * @param ray The ray to intersect with.
+ * @param tmin The smallest distance along the ray to find intersections.
+ * @param tmax The greatest distance along the ray to find intersections.
+ * @returns The closest hit, with a distance of -inf if no intersection happened.
+ */
+HitRecord QBVH::Intersect(const Ray& ray, double tmin, double tmax) const
+{
+    if(nodes.empty())
+        return HitRecord();
+
+    QBVHRay r(ray, extent);
+
+    struct StackEntry
+    {
+        int child;
+        float tnear;
+    } stack[stackSize];
+    int nStack = 0;
+    stack[nStack++] = { 0, -std::numeric_limits<float>::infinity() };
+
+    double mint = tmax;
+    HitRecord minhit;
+
+    // Records a hit if it's the closest so far
+    auto test = [&](const Primitive* s)
+    {
+        HitRecord hit = s->IntersectHit(ray);
+        if(hit.t >= tmin && hit.t <= tmax && (!minhit.primitive || hit.t < mint))
+            mint = hit.t, minhit = hit;
+    };
+
+    while(nStack)
+    {
+        auto entry = stack[--nStack];
+        if(entry.tnear > mint)
+            continue;
+
+        if(entry.child >= 0)
+        {
+            const QBVHNode& node = nodes[entry.child];
+            float distances[4];
+            int mask = IntersectBoxes(node, r, RoundDown(tmin), RoundUp(mint), distances);
+
+            // Push the children that were hit farthest first, so that the nearest is visited next
+            int hits[4], nHits = 0;
+            for(int i = 0; i < 4; i++)
+            {
+                if(!(mask & (1 << i)) || !node.children[i])
+                    continue;
+                int j = nHits++;
+                for(; j > 0 && distances[hits[j - 1]] < distances[i]; j--)
+                    hits[j] = hits[j - 1];
+                hits[j] = i;
+            }
+            for(int i = 0; i < nHits; i++)
+                stack[nStack++] = { node.children[hits[i]], distances[hits[i]] };
+            continue;
+        }
+
+        const QBVHLeaf& leaf = leaves[~entry.child];
+        for(int b = leaf.firstBlock; b < leaf.firstBlock + leaf.nBlocks; b++)
+        {
+            int mask = IntersectTriangles(blocks[b], r, RoundUp(mint));
+            for(int i = 0; mask; i++, mask >>= 1)
+                if(mask & 1)
+                    test(primitives[blocks[b].primitives[i]]);
+        }
+
+        const int* indices = primitiveIndices.data() + leaf.firstPrimitive;
+        for(int i = 0; i < leaf.nPrimitives; i++)
+            test(primitives[indices[i]]);
+    }
+
+    return minhit;
+}
+
+/**
+ * Checks if anything blocks a ray between two distances along it, stopping at the first
+ * primitive found, in no particular order.
+ * 
+ * @param ray The ray to intersect with.
+ * @param tmin The smallest distance along the ray to find intersections.
+ * @param tmax The greatest distance along the ray to find intersections.
+ * @returns True if any primitive intersects the ray between tmin and tmax.
+ */
+bool QBVH::Occluded(const Ray& ray, double tmin, double tmax) const
+{
+    if(nodes.empty())
+        return false;
+
+    QBVHRay r(ray, extent);
+
+    int stack[stackSize];
+    int nStack = 0;
+    stack[nStack++] = 0;
+
+    auto hit = [&](const Primitive* s)
+    {
+        double t = s->Intersect(ray);
+        return t >= tmin && t <= tmax;
+    };
+
+    while(nStack)
+    {
+        int child = stack[--nStack];
+        if(child >= 0)
+        {
+            const QBVHNode& node = nodes[child];
+            float distances[4];
+            int mask = IntersectBoxes(node, r, RoundDown(tmin), RoundUp(tmax), distances);
+            for(int i = 0; mask; i++, mask >>= 1)
+                if((mask & 1) && node.children[i])
+                    stack[nStack++] = node.children[i];
+            continue;
+        }
+
+        const QBVHLeaf& leaf = leaves[~child];
+        for(int b = leaf.firstBlock; b < leaf.firstBlock + leaf.nBlocks; b++)
+        {
+            int mask = IntersectTriangles(blocks[b], r, RoundUp(tmax));
+            for(int i = 0; mask; i++, mask >>= 1)
+                if((mask & 1) && hit(primitives[blocks[b].primitives[i]]))
+                    return true;
+        }
+
+        const int* indices = primitiveIndices.data() + leaf.firstPrimitive;
+        for(int i = 0; i < leaf.nPrimitives; i++)
+            if(hit(primitives[indices[i]]))
+                return true;
+    }
+    return false;
+}
+
+/**
+ * Describes the hierarchy built by the last call to Build.
+ * 
+ * @returns A human readable summary of the hierarchy.
+ */
+std::string QBVH::GetStatistics() const
+{
+    return "QBVH of " + std::to_string(primitives.size()) + " primitives: " + statistics.ToString();
+}
+
+/**
+ * Saves the hierarchy to a cache.
+ * 
+ * @param writer The writer of the cache.
+ */
+void QBVH::Save(CacheWriter& writer) const
+{
+    writer << ID_QBVH << (unsigned long long) primitives.size() << nodes << leaves << blocks << primitiveIndices;
+    statistics.Save(writer);
+}
+
+/**
+ * Loads a hierarchy saved to a cache.
+ * 
+ * @param reader The reader of the section of the cache that the hierarchy was saved to.
+ * @param shapes The primitives that the hierarchy was built for.
+ * @returns True if the section held a QBVH built for as many primitives.
+ */
+bool QBVH::Load(CacheReader& reader, const std::vector<const Primitive*>& shapes)
+{
+    unsigned char id = 0;
+    unsigned long long nPrimitives = 0;
+    reader >> id >> nPrimitives;
+    if(id != ID_QBVH || nPrimitives != shapes.size())
+        return false;
+
+    primitives = shapes;
+    reader >> nodes >> leaves >> blocks >> primitiveIndices;
+    statistics.Load(reader);
+    FindExtent();
+    return reader.IsGood() && Validate();
+}
+
+/**
+ * Checks that the nodes, leaves and blocks of a loaded hierarchy only refer to nodes, leaves,
+ * blocks and primitives that exist, and that the hierarchy is no deeper than the traversal stack
+ * allows.
+ * 
+ * @returns True if the hierarchy can be traversed safely.
+ */
+bool QBVH::Validate() const
+{
+    auto inRange = [](int first, int n, size_t size)
+    {
+        return first >= 0 && n >= 0 && (long long) first + n <= (long long) size;
+    };
+    auto isPrimitive = [this](int p) { return p >= 0 && p < (int) primitives.size(); };
+
+    int nNodes = (int) nodes.size();
+    std::vector<int> depths(nNodes, 0);
+    for(int i = 0; i < nNodes; i++)
+    {
+        // Each level can leave three more children on the stack
+        if(3*depths[i] + 4 > stackSize)
+            return false;
+        for(int c = 0; c < 4; c++)
+        {
+            int child = nodes[i].children[c];
+            if(child < 0 ? ~child >= (int) leaves.size() : child && (child <= i || child >= nNodes))
+                return false;
+            // The children come after their parent, so the depths are known before they are needed
+            if(child > i)
+                depths[child] = std::max(depths[child], depths[i] + 1);
+        }
+    }
+
+    for(auto& leaf : leaves)
+        if(!inRange(leaf.firstBlock, leaf.nBlocks, blocks.size()) || !inRange(leaf.firstPrimitive, leaf.nPrimitives, primitiveIndices.size()))
+            return false;
+    for(auto& block : blocks)
+        for(int p : block.primitives)
+            if(p != -1 && !isPrimitive(p))
+                return false;
+    return std::all_of(primitiveIndices.begin(), primitiveIndices.end(), isPrimitive);
+}
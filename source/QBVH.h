@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file QBVH.h
+ * 
+ * Declaration of the QBVH class and helpers.
+ */
+
+#pragma once
+
+#include "SpatialPartitioning.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+class BVH;
+class Primitive;
+
+// A node with four children, whose boxes are stored lane by lane so that they are tested
+// together. The bounds are indexed by minimum/maximum, axis and child. A child is either a node,
+// given by its index, or a leaf, given by the complement of its index. Unused children have
+// empty boxes and are given as node 0, the root, which is never the child of another node
+class alignas(16) QBVHNode
+{
+public:
+    float bounds[2][3][4];
+    int children[4];
+};
+
+// Four triangles stored lane by lane, as a corner and the two edges from it. The corners are kept
+// in double precision, so that the distance from the ray origin to them is exact however far from
+// the scene origin they are. Unused lanes have no primitive and degenerate geometry
+class alignas(16) TriangleBlock
+{
+public:
+    double v0[3][4];
+    float e1[3][4], e2[3][4];
+    int primitives[4];
+};
+
+// The contents of a leaf: its triangles in blocks of four and the other primitives as a range
+// of the primitive index array
+class QBVHLeaf
+{
+public:
+    int firstBlock, nBlocks;
+    int firstPrimitive, nPrimitives;
+};
+
+class QBVH : public SpatialPartitioning
+{
+public:
+    QBVH();
+    ~QBVH();
+    void Build(const std::vector<const Primitive*>&);
+    HitRecord Intersect(const Ray& ray, double tmin, double tmax) const;
+    bool Occluded(const Ray& ray, double tmin, double tmax) const;
+    std::string GetStatistics() const;
+
+    void Save(CacheWriter& writer) const;
+    bool Load(CacheReader& reader, const std::vector<const Primitive*>& primitives);
+
+    std::vector<const Primitive*> primitives;
+    std::vector<int> primitiveIndices;
+    std::vector<QBVHNode> nodes;
+    std::vector<QBVHLeaf> leaves;
+    std::vector<TriangleBlock> blocks;
+
+    PartitioningStatistics statistics;
+    float extent; // The greatest magnitude of any coordinate of the boxes
+
+    static const int maxLeafSize = 4;
+    static const int stackSize = 256;
+
+private:
+    int Collapse(const BVH& bvh, int node, const std::vector<std::pair<int, int>>& ranges, int depth, double rootArea);
+    int MakeLeaf(const BVH& bvh, std::pair<int, int> range, int depth, double area);
+    void FindExtent();
+    bool Validate() const;
+};
@@ -8,17 +8,63 @@
  */
 
 #include "Randomizer.h"
+#include "Sampler.h"
+#include <algorithm>
+#include <random>
+
+/**
+ * Scrambles the bits of a number (the finalizer of SplitMix64), so that nearby seeds end up far
+ * apart.
+ * 
+ * @param x The number to scramble.
+ * @returns The scrambled number.
+ */
+static std::uint64_t Mix(std::uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30))*0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27))*0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Seeds the generator.
+ * 
+ * @param seed The starting point of the sequence.
+ * @param stream The sequence to pick, out of 2^63 different ones.
+ */
+void Pcg32::Seed(std::uint64_t seed, std::uint64_t stream)
+{
+    state = 0;
+    increment = (stream << 1) | 1;
+    Next();
+    state += seed;
+    Next();
+}
+
+/**
+ * Returns the next number of the sequence.
+ * 
+ * @returns A uniformly distributed 32-bit number.
+ */
+std::uint32_t Pcg32::Next()
+{
+    std::uint64_t old = state;
+    state = old*6364136223846793005ull + increment;
+    auto xorShifted = std::uint32_t(((old >> 18) ^ old) >> 27);
+    auto rot = std::uint32_t(old >> 59);
+    return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+}
 
 /**
  * Constructor.
  */
 Randomizer::Randomizer()
 {
-    std::random_device rd;
 }
 
 /**
- * Constructor.
+ * Destructor.
  */
 Randomizer::~Randomizer()
 {
@@ -31,7 +77,7 @@ Randomizer::~Randomizer()
  */
 Randomizer::Randomizer(unsigned int seed)
 {
-    generator.seed(seed);
+    Seed(seed);
 }
 
 /**
@@ -42,8 +88,12 @@ Randomizer::Randomizer(unsigned int seed)
  */
 int Randomizer::GetInt(int a, int b)
 {
-    std::uniform_int_distribution<int> ngen(a, b);
-    return ngen(generator);
+    if(sampler)
+        return std::min(a + int(Next()*(double(b) - a + 1)), b);
+
+    // Scales the 32-bit number to the range by a multiplication rather than a division
+    auto range = std::uint64_t(std::int64_t(b) - a + 1);
+    return int(a + std::int64_t((generator.Next()*range) >> 32));
 }
 
 /**
@@ -54,8 +104,61 @@ int Randomizer::GetInt(int a, int b)
  */
 double Randomizer::GetDouble(double a, double b)
 {
-    std::uniform_real_distribution<double> ngen(a, b);
-    return ngen(generator);
+    return a + (b - a)*Next();
+}
+
+/**
+ * Fills an array with real numbers between a and b.
+ * 
+ * @param values The array to fill.
+ * @param n The number of values to generate.
+ * @param a The lower limit of the range to pick from.
+ * @param b The upper limit of the range to pick from.
+ */
+void Randomizer::GetDoubles(double* values, int n, double a, double b)
+{
+    if(sampler)
+    {
+        for(int i = 0; i < n; i++)
+            values[i] = a + (b - a)*sampler->Get(pixel, sample, dimension++);
+        return;
+    }
+    auto& g = generator;
+    for(int i = 0; i < n; i++)
+        values[i] = a + (b - a)*(g.Next()*0x1p-32);
+}
+
+/**
+ * Returns the next number, from the sampler if there is one and otherwise from the generator.
+ * 
+ * @returns A number between 0 and 1, not including 1.
+ */
+double Randomizer::Next()
+{
+    if(sampler)
+        return sampler->Get(pixel, sample, dimension++);
+    return generator.Next()*0x1p-32;
+}
+
+/**
+ * Sets the sampler to draw the numbers from. The randomizer needs to be seeded for a sample of a
+ * pixel before drawing numbers from a sampler.
+ * 
+ * @param aSampler The sampler, or null to use the random number generator.
+ */
+void Randomizer::SetSampler(const Sampler* aSampler)
+{
+    sampler = aSampler;
+}
+
+/**
+ * Returns the sampler the numbers are drawn from.
+ * 
+ * @returns The sampler, or null if the numbers are drawn from the random number generator.
+ */
+const Sampler* Randomizer::GetSampler() const
+{
+    return sampler;
 }
 
 /**
@@ -65,7 +168,46 @@ double Randomizer::GetDouble(double a, double b)
  */
 void Randomizer::Seed(unsigned int aSeed)
 {
-    generator.seed(aSeed);
+    generator.Seed(Mix(aSeed), 0);
+}
+
+/**
+ * Seeds the randomizer for a given sample of a given pixel. The numbers drawn after this depend 
+ * only on the pixel and the sample, so a rendering comes out the same no matter which thread 
+ * renders what.
+ * 
+ * @param aPixel The index of the pixel.
+ * @param aSample The index of the sample of the pixel.
+ */
+void Randomizer::Seed(unsigned int aPixel, unsigned int aSample)
+{
+    generator.Seed(Mix((std::uint64_t(aPixel) << 32) | aSample), 0);
+    pixel = aPixel;
+    sample = aSample;
+    dimension = 0;
+}
+
+/**
+ * Returns where the numbers of the thread are at, to continue drawing them later.
+ * 
+ * @returns The state of the generator and the sample of the thread.
+ */
+RandomizerState Randomizer::GetState() const
+{
+    return { generator, pixel, sample, dimension };
+}
+
+/**
+ * Continues drawing numbers from where they were at when the state was taken.
+ * 
+ * @param state The state returned by GetState.
+ */
+void Randomizer::SetState(const RandomizerState& state)
+{
+    generator = state.generator;
+    pixel = state.pixel;
+    sample = state.sample;
+    dimension = state.dimension;
 }
 
 /**
@@ -73,7 +215,10 @@ void Randomizer::Seed(unsigned int aSeed)
  */
 void Randomizer::Seed()
 {
-    generator.seed(std::random_device()());
+    generator.Seed(Mix((std::uint64_t(std::random_device()()) << 32) | std::random_device()()), 0);
 }
 
-std::default_random_engine thread_local Randomizer::generator = std::default_random_engine(std::random_device()());
+thread_local unsigned int Randomizer::pixel = 0;
+thread_local unsigned int Randomizer::sample = 0;
+thread_local unsigned int Randomizer::dimension = 0;
+thread_local Pcg32 Randomizer::generator = [] { Pcg32 g; g.Seed(Mix(std::random_device()()), 0); return g; }();
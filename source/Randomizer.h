@@ -9,8 +9,34 @@
 
 #pragma once
 
-#include <random>
+#include <cstdint>
 
+// The PCG32 generator (the XSH RR variant of permuted congruential generators), which is small
+// and fast and passes the usual statistical test suites
+class Pcg32
+{
+public:
+    void Seed(std::uint64_t seed, std::uint64_t stream);
+    std::uint32_t Next();
+
+private:
+    std::uint64_t state, increment;
+};
+
+class Sampler;
+
+// Where the numbers drawn on a thread are at, so that the thread can take turns drawing numbers
+// for the samples of several paths
+class RandomizerState
+{
+public:
+    Pcg32 generator;
+    unsigned int pixel, sample, dimension;
+};
+
+// Draws the numbers used by the renderers, materials and lights. The numbers come from the PCG32
+// generator of the thread, or from a sampler if one is set, in which case the numbers drawn after 
+// seeding for a sample of a pixel are the dimensions of that sample in order
 class Randomizer
 {
 public:
@@ -18,13 +44,29 @@ public:
     Randomizer(unsigned int seed);
 
     void Seed(unsigned int seed);
+    void Seed(unsigned int pixel, unsigned int sample);
     void Seed();
 
     double GetDouble(double a, double b);
+    void GetDoubles(double* values, int n, double a, double b);
     int GetInt(int a, int b);
 
+    void SetSampler(const Sampler* sampler);
+    const Sampler* GetSampler() const;
+
+    RandomizerState GetState() const;
+    void SetState(const RandomizerState& state);
+
     ~Randomizer();
 
-    static thread_local std::default_random_engine generator;
+    static thread_local Pcg32 generator;
     unsigned int seed;
+
+private:
+    double Next();
+
+    const Sampler* sampler = nullptr;
+
+    // The sample that a sampler draws its numbers from, per thread like the generator
+    static thread_local unsigned int pixel, sample, dimension;
 };
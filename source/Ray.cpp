@@ -27,6 +27,22 @@ Ray::Ray()
 {
 }
 
+/**
+ * Constructor.
+ * 
+ * @param rays The rays of the packet.
+ * @param n The number of rays, at most size.
+ */
+RayPacket::RayPacket(const Ray* rays, int n) : rays(rays), n(n)
+{
+    for(int i = 0; i < size; i++)
+    {
+        const Ray& ray = rays[i < n ? i : 0];
+        for(int u = 0; u < 3; u++)
+            origins[u][i] = ray.origin[u], directions[u][i] = ray.direction[u];
+    }
+}
+
 /**
  * Destructor.
  */
@@ -23,3 +23,18 @@ public:
     Vector3d origin;
     Vector3d direction;
 };
+
+// A packet of neighbouring rays that are traced together. The origins and directions are laid out
+// by axis so that a test of all the rays of the packet can be vectorized, and the lanes past the
+// last ray repeat the first ray so that they hold sane numbers
+class RayPacket
+{
+public:
+    static constexpr int size = 8;
+
+    RayPacket(const Ray* rays, int n);
+
+    const Ray* rays;
+    int n;
+    double origins[3][size], directions[3][size];
+};
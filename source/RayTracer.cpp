@@ -11,7 +11,6 @@
 #include "TriangleMesh.h"
 #include "Logger.h"
 #include "Utils.h"
-#include "Main.h"
 
 /**
  * Constructor.
@@ -43,24 +42,34 @@ Color RayTracer::TraceRay(const Ray& ray) const
 }
 
 /**
- * Renders the scene.
+ * Renders a tile of the image.
  * 
  * @param cam The camera to render the scene from.
- * @param colBuf The color buffer to render to.
+ * @param colBuf The color buffer of the size of the tile to render to.
+ * @param splats The buffer for light path contributions, unused by the ray tracer.
+ * @param x0 The x coordinate of the upper left pixel of the tile in the image.
+ * @param y0 The y coordinate of the upper left pixel of the tile in the image.
+ * @param pass The number of passes over the tile before this one.
  */
-void RayTracer::Render(Camera& cam, ColorBuffer& colBuf)
+void RayTracer::RenderTile(Camera& cam, ColorBuffer& colBuf, SplatBuffer& splats, int x0, int y0, unsigned int pass)
 {
     int xres = colBuf.GetXRes();
     int yres = colBuf.GetYRes();
-    
-    for(int y = 0; y < yres; y++)
+
+    // The camera rays of a row are intersected together, so that the scene can trace them as
+    // packets
+    std::vector<Ray> rays(xres);
+    std::vector<HitRecord> hits(xres);
+    std::vector<const Light*> lights(xres);
+    for(int y = 0; y < yres && !stopping; y++)
     {
         for(int x = 0; x < xres; x++)
-        {
-            if(g_quitting)
-                colBuf.SetPixel(x, y, Color(0, 0, 0));
+            rays[x] = cam.GetRayFromPixel(x0 + x, y0 + y, 0, 0, 0, 0);
+        scene->Intersect(rays.data(), xres, hits.data(), lights.data());
 
-            Color c = TraceRay(cam.GetRayFromPixel(x, y, 0, 0, 0, 0));
+        for(int x = 0; x < xres; x++)
+        {
+            Color c = Shade(rays[x], hits[x], lights[x]);
             if(!c.IsValid())
                 c = Color(0, 0, 0);
             colBuf.SetPixel(x, y, c);
@@ -83,24 +92,34 @@ Color RayTracer::TraceRayRecursive(Ray ray, int bounces, Primitive*, double cont
     if(contribution < eps)
         return Color(0, 0, 0);
         
-    Vector3d dir = ray.direction;
-    dir.Normalize();
-    
-    bool objecthit = false;
-
     if(bounces < 1)
         return Color(1, 0, 0);
 
-    auto [t, minprimitive, minlight] = scene->Intersect(ray);
+    auto [hit, minlight] = scene->Intersect(ray);
+    return Shade(ray, hit, minlight);
+}
+
+/**
+ * Shades the closest hit of a ray. Like TraceRayRecursive, what it shows is whatever debug
+ * information is currently useful.
+ * 
+ * @param ray The ray that was traced.
+ * @param hit The closest hit of the ray.
+ * @param minlight The light that the ray hit, if any.
+ * @returns Whatever we're currently using as debug info.
+ */
+Color RayTracer::Shade(const Ray& ray, const HitRecord& hit, const Light* minlight) const
+{
+    bool objecthit = false;
 
-    if(t > eps)
+    if(hit.t > eps)
         objecthit = true;
 
     if(objecthit)
     {
         IntersectionInfo info;
-        if(minprimitive)
-            minprimitive->GenerateIntersectionInfo(ray, info);
+        if(hit.primitive)
+            hit.primitive->GenerateIntersectionInfo(ray, hit, info);
         else
             minlight->GenerateIntersectionInfo(ray, info);
 
@@ -135,8 +154,8 @@ bool RayTracer::TraceShadowRay(const Ray& ray, double tmax) const
 {
     const Primitive* dummy = nullptr;
     const Light* dummy2 = nullptr;
-    auto [t, minprimitive, minlight] = scene->Intersect(ray);
-    if(t < tmax*(1-eps))
+    auto [hit, minlight] = scene->Intersect(ray);
+    if(hit.t < tmax*(1-eps))
         return false;
     return true;
 }
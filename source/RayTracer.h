@@ -21,7 +21,7 @@ public:
     Color TraceRay(const Ray& ray) const;
     bool TraceShadowRay(const Ray& ray, double tmax) const;
 
-    void Render(Camera&, ColorBuffer&);
+    void RenderTile(Camera&, ColorBuffer&, SplatBuffer&, int x0, int y0, unsigned int pass);
 
     void Save(Bytestream& stream) const;
     void Load(Bytestream& stream);
@@ -29,6 +29,7 @@ public:
 //private:
 
     Color TraceRayRecursive(Ray ray, int bounces, Primitive* ignore, double contribution) const;
+    Color Shade(const Ray& ray, const HitRecord& hit, const Light* light) const;
 
     std::vector<Light*> m_lights;
     std::vector<Primitive*> m_primitives;
@@ -14,6 +14,9 @@
 #include "BDPT.h"
 #include "RayTracer.h"
 #include "LightTracer.h"
+#include "WavefrontPathTracer.h"
+#include "Sampler.h"
+#include "SceneCache.h"
 #include "Timer.h"
 #include "Logger.h"
 
@@ -30,7 +33,14 @@ Renderer::Renderer(std::shared_ptr<Scene> scene)
         scene->partitioning = new KDTree();
 
     Timer timer;
-    scene->partitioning->Build(scene->primitives);
+    // The partitioning of a scene read from a file can be found in the cache of the file
+    if(scene->file.empty() || !ReadPartitioningCache(scene->file, *scene->partitioning, scene->primitives))
+    {
+        scene->partitioning->Build(scene->primitives);
+        if(!scene->file.empty())
+            WritePartitioningCache(scene->file, *scene->partitioning);
+    }
+    scene->UpdateLights();
     //logger.Box(std::to_string(timer.GetTime()));
 }
 
@@ -63,6 +73,27 @@ std::shared_ptr<Scene> Renderer::GetScene() const
     return scene;
 }
 
+/**
+ * Sets the sampler that the renderer draws the numbers of its samples from.
+ * 
+ * @param aSampler The sampler, or null to use independent random numbers.
+ */
+void Renderer::SetSampler(std::shared_ptr<Sampler> aSampler)
+{
+    sampler = aSampler;
+    m_random.SetSampler(sampler.get());
+}
+
+/**
+ * Returns the sampler that the renderer draws the numbers of its samples from.
+ * 
+ * @returns The sampler, or null if the renderer uses independent random numbers.
+ */
+std::shared_ptr<Sampler> Renderer::GetSampler() const
+{
+    return sampler;
+}
+
 /**
  * Stops rendering.
  */
@@ -92,8 +123,11 @@ Renderer* Renderer::Create(unsigned char id, std::shared_ptr<Scene> scn)
     case ID_BDPT:
         return new BDPT(scn);
         break;
+    case ID_WAVEFRONTPATHTRACER:
+        return new WavefrontPathTracer(scn);
+        break;
     default:
-        __debugbreak();
+        logger.Box("Unknown renderer id " + std::to_string(id));
         return nullptr;
     }
 }
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <memory>
 #include <vector>
 #include "KDTree.h"
 #include "ColorBuffer.h"
@@ -20,6 +21,8 @@ class Ray;
 class Primitive;
 class Light;
 class Scene;
+class SplatBuffer;
+class Sampler;
 
 class Renderer
 {
@@ -27,11 +30,14 @@ public:
     Renderer(std::shared_ptr<Scene> scene);
     virtual ~Renderer();
 
-    virtual void Render(Camera& cam, ColorBuffer& colBuf) = 0;
+    virtual void RenderTile(Camera& cam, ColorBuffer& colBuf, SplatBuffer& splats, int x0, int y0, unsigned int pass) = 0;
     virtual bool TraceShadowRay(const Ray& ray, double tmax) const;
 
     std::shared_ptr<Scene> GetScene() const;
 
+    void SetSampler(std::shared_ptr<Sampler> sampler);
+    std::shared_ptr<Sampler> GetSampler() const;
+
     void Stop();
     
     virtual void Save(Bytestream& stream) const = 0;
@@ -44,5 +50,6 @@ protected:
     bool stopping;
 
     mutable Randomizer m_random;
+    std::shared_ptr<Sampler> sampler;
     std::vector<Light*> m_lights;
 };
@@ -11,7 +11,17 @@
 #include "Estimator.h"
 #include "Scene.h"
 #include "ColorBuffer.h"
-#include <thread>
+#include "Sampler.h"
+#include "TileScheduler.h"
+#include "Bytestream.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cassert>
+
+// Tells saved renderings apart from other files, and renderings saved in older layouts from the
+// current one
+static const unsigned long long renderingMagic = 0x52444e45524c4f50ull; // "POLRENDR"
+static const unsigned int renderingVersion = 2;
 
 /**
  * Constructor.
@@ -20,40 +30,71 @@
  * @param e The estimator to use.
  */
 Rendering::Rendering(std::shared_ptr<Renderer> r, std::shared_ptr<Estimator> e) : 
-    renderer(r), estimator(e), running(false), updated(true), stopping(false), nSamples(0)
+    renderer(r), estimator(e), running(false), updated(true), stopping(false), nSamples(0),
+    maxSamples(0), threshold(0)
 {
     int xres = r->GetScene()->GetCamera()->GetXRes();
     int yres = r->GetScene()->GetCamera()->GetYRes();
     image = new ColorBuffer(xres, yres);
     image->Clear(Color::Black);
-    bufferMutex = CreateMutex(0, false, 0);
 }
 
 /**
- * Constructor. Resumes a rendering from a file.
+ * Constructor. Resumes a rendering from a file. If the file can't be read, or was saved in
+ * another layout, the rendering is left without a renderer and estimator; see IsLoaded.
  * 
  * @param fileName The name of the file to use.
  */
-Rendering::Rendering(std::string fileName) : running(false), updated(true), stopping(false)
+Rendering::Rendering(std::string fileName) : image(nullptr), running(false), updated(true),
+    stopping(false), nSamples(0), maxSamples(0), threshold(0)
 {
     Bytestream b;
 
-    b.LoadFromFile(fileName);
+    unsigned long long magic = 0;
+    unsigned int version = 0;
+    if(!b.LoadFromFile(fileName) || !(b >> magic >> version).IsGood() || magic != renderingMagic || version != renderingVersion)
+    {
+        logger.Box("\"" + fileName + "\" is not a rendering saved by this version");
+        return;
+    }
+
     std::shared_ptr<Scene> scene(new Scene());
-    scene->Load(b);
+    if(!scene->Load(b))
+    {
+        logger.Box("The scene of the rendering in \"" + fileName + "\" is incomplete");
+        return;
+    }
 
-    unsigned char rendererType, estimatorType;
+    unsigned char rendererType = 0, estimatorType = 0;
 
     b >> rendererType;
     renderer = std::shared_ptr<Renderer>(Renderer::Create(rendererType, scene));
 
     b >> estimatorType;
     estimator = std::shared_ptr<Estimator>(Estimator::Create(estimatorType));
-    estimator->Load(b);
+
+    unsigned char samplerType = ID_NOSAMPLER;
+    if(!renderer || !estimator || !estimator->Load(b) || !(b >> samplerType).IsGood())
+    {
+        logger.Box("The rendering in \"" + fileName + "\" is incomplete");
+        renderer.reset();
+        estimator.reset();
+        return;
+    }
+    if(samplerType != ID_NOSAMPLER)
+        renderer->SetSampler(std::shared_ptr<Sampler>(Sampler::Create(samplerType)));
 
     image = new ColorBuffer(estimator->GetWidth(), estimator->GetHeight());
     image->Clear(Color::Black);
 }
+
+/**
+ * Destructor.
+ */
+Rendering::~Rendering()
+{
+    delete image;
+}
  
 /**
  * Saves the rendering to a file.
@@ -63,12 +104,26 @@ Rendering::Rendering(std::string fileName) : running(false), updated(true), stop
 void Rendering::SaveRendering(std::string fileName)
 {
     Bytestream b;
+    b << renderingMagic << renderingVersion;
     renderer->GetScene()->Save(b);
     renderer->Save(b);
     estimator->Save(b);
+    auto sampler = renderer->GetSampler();
+    b << (sampler ? sampler->GetId() : ID_NOSAMPLER);
     b.SaveToFile(fileName);
 }
 
+/**
+ * Checks if the rendering could be resumed from its file. Renderings made from a renderer and an
+ * estimator always are.
+ * 
+ * @returns False if the file of the rendering couldn't be loaded.
+ */
+bool Rendering::IsLoaded() const
+{
+    return renderer && estimator;
+}
+
 /**
  * Returns true if the current buffer has been updated since the last time it was requested by GetImage.
  * 
@@ -84,71 +139,183 @@ bool Rendering::WasBufferRedrawn() const
  */
 ColorBuffer Rendering::GetImage()
 {
-    WaitForSingleObject(bufferMutex, INFINITE);
+    std::lock_guard<std::mutex> lock(bufferMutex);
     updated = false;
-    ColorBuffer tmp = *image;
-    ReleaseMutex(bufferMutex);
-    return tmp;
+    return *image;
+}
+
+/**
+ * Returns the number of samples per pixel that have been added to the estimator so far.
+ * 
+ * @returns The number of completed passes over the image.
+ */
+unsigned int Rendering::GetSamples() const
+{
+    return nSamples;
+}
+
+/**
+ * Returns the number of samples per pixel that have been added so far on average, which differs
+ * from GetSamples when sampling is adaptive.
+ * 
+ * @returns The average number of passes over a pixel.
+ */
+double Rendering::GetAverageSamples() const
+{
+    return scheduler ? scheduler->GetAveragePasses() : nSamples.load();
+}
+
+/**
+ * Returns true if the threads have nothing left to render, either since every pixel has
+ * received the number of samples given to Start or since every pixel has converged.
+ * 
+ * @returns True if the rendering is done.
+ */
+bool Rendering::IsDone() const
+{
+    return scheduler && scheduler->IsDone();
 }
 
 /**
- * The entry point of each rendering thread.
+ * Returns true if every pixel has reached the error threshold given to Start.
+ * 
+ * @returns True if the rendering has converged.
  */
-void Rendering::Thread()
+bool Rendering::IsConverged() const
 {
-    while(true)
+    return scheduler && scheduler->IsConverged();
+}
+
+/**
+ * Maps an estimate of the radiance of a pixel to a displayable color.
+ * 
+ * @param c The estimate.
+ * @returns The exposed color.
+ */
+static Color Expose(Color c)
+{
+    double exposure = 0.75;
+    c.r = 1 - exp(-exposure*c.r);
+    c.g = 1 - exp(-exposure*c.g);
+    c.b = 1 - exp(-exposure*c.b);
+    return c;
+}
+
+/**
+ * The entry point of each rendering thread. Renders one tile at a time, as handed out by the 
+ * scheduler. Since no two threads ever work on the same tile, the samples of a tile are added to
+ * the estimator without holding the buffer lock, which is only taken to copy the exposed tile 
+ * into the image. Contributions to other pixels go to the splat buffer of the estimator.
+ * 
+ * @param worker The index of the thread.
+ */
+void Rendering::Thread(int worker)
+{
+    while(!stopping && !scheduler->IsDone())
     {
-        ColorBuffer temp(image->GetXRes(), image->GetYRes(), Color::Black);
-        renderer->Render(*(renderer->GetScene()->GetCamera()), temp);
-
-        if(stopping) // If we were asked to stop rendering, the latest frame 
-            break;   // was not rendered entirely and should be discarded
-        WaitForSingleObject(bufferMutex, INFINITE);
-        for(int y = 0; y < image->GetYRes(); y++)
-            for(int x = 0; x < image->GetXRes(); x++)			
-                estimator->AddSample(x, y, temp.GetPixel(x, y));
-        for(int y = 0; y < image->GetYRes(); y++)
+        int index = scheduler->Next(worker);
+        if(index < 0)
+            break;
+
+        const Tile& tile = scheduler->tiles[index];
+        ColorBuffer temp(tile.x1 - tile.x0, tile.y1 - tile.y0, Color::Black);
+        renderer->RenderTile(*(renderer->GetScene()->GetCamera()), temp, estimator->GetSplats(), 
+                             tile.x0, tile.y0, scheduler->GetPasses(index));
+
+        if(stopping) // If we were asked to stop rendering, the latest tile was not 
+            break;   // rendered entirely and should be discarded
+
+        // The tile has converged once the error of each of its pixels is below the threshold
+        bool converged = threshold > 0 && scheduler->GetPasses(index) + 1 >= minAdaptivePasses;
+        for(int y = tile.y0; y < tile.y1; y++)
         {
-            for(int x = 0; x < image->GetXRes(); x++)
+            for(int x = tile.x0; x < tile.x1; x++)
             {
-                Color c = estimator->GetEstimate(x, y);
-                
-                double exposure = 0.75;
-                c.r = 1 - exp(-exposure*c.r);
-                c.g = 1 - exp(-exposure*c.g);
-                c.b = 1 - exp(-exposure*c.b);
-
-                image->SetPixel(x, y, c);
+                estimator->AddSample(x, y, temp.GetPixel(x - tile.x0, y - tile.y0));
+                temp.SetPixel(x - tile.x0, y - tile.y0, Expose(estimator->GetEstimate(x, y)));
+                if(converged && estimator->GetRelativeError(x, y) > threshold)
+                    converged = false;
             }
         }
+        {
+            std::lock_guard<std::mutex> lock(bufferMutex);
+            for(int y = tile.y0; y < tile.y1; y++)
+                for(int x = tile.x0; x < tile.x1; x++)
+                    image->SetPixel(x, y, temp.GetPixel(x - tile.x0, y - tile.y0));
+        }
+        scheduler->Finish(worker, index, converged);
+
+        unsigned int passes = scheduler->GetCompletedPasses();
+        unsigned int n = nSamples;
+        while(n < passes && !nSamples.compare_exchange_weak(n, passes));
         updated = true;
-        nSamples++;
-        ReleaseMutex(bufferMutex);
     }
 }
 
 /**
  * Starts the renderer; loads up all the threads the CPU can muster.
+ * 
+ * @param maxSamples The number of samples per pixel after which the threads finish, or 0 to
+ *                   keep rendering until stopped.
+ * @param threshold The relative error below which a pixel needs no more samples, or 0 to give
+ *                  every pixel the same number of samples. Since errors are measured on the
+ *                  samples of the pixels, this has no effect on light path contributions.
  */
-void Rendering::Start()
+void Rendering::Start(unsigned int maxSamples, double threshold)
 {
     assert(!running);
     running = true;
     stopping = false;
-    auto processorCount = std::thread::hardware_concurrency();
+    this->maxSamples = maxSamples;
+    this->threshold = threshold;
+    auto processorCount = std::max(1u, std::thread::hardware_concurrency());
 #ifdef _DEBUG
     processorCount = 1;
 #endif
 
+    // The passes continue from the samples the estimator already has, so that no sample index 
+    // (and with it no sequence of random numbers) is used twice for a pixel, also when resuming
+    auto completedPasses = [this] (const Tile& tile) { return estimator->GetSampleCount(tile.x0, tile.y0); };
+    scheduler = std::make_unique<TileScheduler>(image->GetXRes(), image->GetYRes(), tileSize, 
+                                                processorCount, completedPasses, maxSamples);
+    nSamples = scheduler->GetCompletedPasses();
+
     for(unsigned int i = 0; i < processorCount; i++)
-        _beginthread([] (auto r) { ((Rendering*) r)->Thread(); }, 0, (void*)this);
+        threads.emplace_back([this, i] () { Thread(i); });
 }
 
 /**
- * Stops the rendering process and lets all threads die.
+ * Stops the rendering process and waits for all threads to die.
  */
 void Rendering::Stop()
 {
     stopping = true;
     renderer->Stop();
+    if(scheduler)
+        scheduler->Cancel();
+    Wait();
+}
+
+/**
+ * Waits for all rendering threads to finish, which happens once the sample limit given to
+ * Start has been reached or the rendering has been stopped. The image is then redrawn in full, 
+ * since tiles rendered early may since have received splats from the others.
+ */
+void Rendering::Wait()
+{
+    for(auto& thread : threads)
+        thread.join();
+    threads.clear();
+    running = false;
+
+    ColorBuffer temp(image->GetXRes(), image->GetYRes());
+    for(int y = 0; y < image->GetYRes(); y++)
+        for(int x = 0; x < image->GetXRes(); x++)
+            temp.SetPixel(x, y, Expose(estimator->GetEstimate(x, y)));
+
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    for(int y = 0; y < image->GetYRes(); y++)
+        for(int x = 0; x < image->GetXRes(); x++)
+            image->SetPixel(x, y, temp.GetPixel(x, y));
+    updated = true;
 }
\ No newline at end of file
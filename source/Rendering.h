@@ -10,39 +10,57 @@
 #pragma once
 
 #define NOMINMAX
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
-#include <Windows.h>
+#include <thread>
+#include <vector>
 
 class ColorBuffer;
 class Estimator;
 class Renderer;
+class TileScheduler;
 
 class Rendering
 {
 public:
     Rendering(std::shared_ptr<Renderer> renderer, std::shared_ptr<Estimator> estimator);
     Rendering(std::string fileName);
+    ~Rendering();
 
-    void Start();
+    void Start(unsigned int maxSamples = 0, double threshold = 0);
     void Stop();
+    void Wait();
 
     void SaveRendering(std::string fileName);
+    bool IsLoaded() const;
 
     bool WasBufferRedrawn() const;
     ColorBuffer GetImage();
+    unsigned int GetSamples() const;
+    double GetAverageSamples() const;
+    bool IsDone() const;
+    bool IsConverged() const;
 //private:
-    void Thread();
+    void Thread(int worker);
 
     std::shared_ptr<Renderer> renderer;
     std::shared_ptr<Estimator> estimator;
     ColorBuffer* image;
+    std::unique_ptr<TileScheduler> scheduler;
 
-    unsigned int nSamples;
+    std::atomic<unsigned int> nSamples;
+    unsigned int maxSamples;
+    double threshold;
 
-    HANDLE bufferMutex;
+    std::mutex bufferMutex;
+    std::vector<std::thread> threads;
 
-    bool updated;
-    bool stopping;
+    std::atomic<bool> updated;
+    std::atomic<bool> stopping;
     bool running;
+
+    static constexpr int tileSize = 32;
+    static const int minAdaptivePasses = 16; // Passes over a tile before its error is trusted
 };
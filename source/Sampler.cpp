@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file Sampler.cpp
+ * 
+ * Implementation of the samplers that provide low-discrepancy numbers to the renderers.
+ */
+
+#include "Sampler.h"
+#include "Bytestream.h"
+#include "Logger.h"
+#include <string>
+
+/**
+ * Destructor.
+ */
+Sampler::~Sampler()
+{
+}
+
+/**
+ * Creates a sampler given an id (see Bytestream.h).
+ * 
+ * @param id The id of the sampler.
+ * @returns The created sampler, or null if the id is unknown.
+ */
+Sampler* Sampler::Create(unsigned char id)
+{
+    switch(id)
+    {
+    case ID_SOBOLSAMPLER:
+        return new SobolSampler;
+    default:
+        logger.Box("Unknown sampler id " + std::to_string(id));
+        return nullptr;
+    }
+}
+
+/**
+ * Reverses the order of the bits of a number.
+ * 
+ * @param x The number to reverse.
+ * @returns The reversed number.
+ */
+static std::uint32_t ReverseBits(std::uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+/**
+ * Owen scrambles a number, treating its bits as the digits of a fraction: each bit is flipped
+ * depending on the seed and the bits above it. Uses the hash-based permutation of Laine and Karras
+ * as improved by Burley, on the reversed bits.
+ * 
+ * @param x The number to scramble.
+ * @param seed The seed of the scramble.
+ * @returns The scrambled number.
+ */
+std::uint32_t SobolSampler::NestedUniformScramble(std::uint32_t x, std::uint32_t seed)
+{
+    x = ReverseBits(x);
+    x += seed;
+    x ^= x*0x6c50b47cu;
+    x ^= x*0xb82f1e52u;
+    x ^= x*0xc7afe638u;
+    x ^= x*0x8d22f6e6u;
+    return ReverseBits(x);
+}
+
+/**
+ * Hashes two numbers together.
+ * 
+ * @param a The first number.
+ * @param b The second number.
+ * @returns The hash.
+ */
+std::uint32_t SobolSampler::Hash(std::uint32_t a, std::uint32_t b)
+{
+    std::uint64_t x = (std::uint64_t(a) << 32) | b;
+    x = (x ^ (x >> 30))*0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27))*0x94d049bb133111ebull;
+    return std::uint32_t((x ^ (x >> 31)) >> 32);
+}
+
+/**
+ * Returns a number of a sample.
+ * 
+ * @param pixel The index of the pixel.
+ * @param sample The index of the sample of the pixel.
+ * @param dimension The dimension of the number.
+ * @returns The number, between 0 and 1.
+ */
+double SobolSampler::Get(unsigned int pixel, unsigned int sample, unsigned int dimension) const
+{
+    std::uint32_t pixelSeed = Hash(pixel, 0x5eed);
+    std::uint32_t index = NestedUniformScramble(sample, Hash(pixelSeed, dimension/2));
+
+    std::uint32_t x;
+    if(dimension%2 == 0)
+        x = ReverseBits(index); // The van der Corput sequence
+    else
+    {
+        // The second Sobol dimension, whose generator matrix is the Pascal matrix modulo 2
+        x = 0;
+        for(std::uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+            if(index & 1)
+                x ^= v;
+    }
+
+    x = NestedUniformScramble(x, Hash(pixelSeed, dimension | 0x80000000u));
+    return (x >> 8)*0x1p-24; // 24 bits keep the result below 1 once it is scaled to a range
+}
+
+/**
+ * Returns the id of the sampler.
+ * 
+ * @returns The id used to save and create the sampler.
+ */
+unsigned char SobolSampler::GetId() const
+{
+    return ID_SOBOLSAMPLER;
+}
@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file Sampler.h
+ * 
+ * Declaration of the Sampler base class and the SobolSampler class.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Provides the numbers of the samples of the pixels, in place of independent random numbers. A
+// number is a function of the pixel, the index of the sample and its dimension, which is its 
+// position among the numbers drawn for the sample
+class Sampler
+{
+public:
+    virtual ~Sampler();
+
+    virtual double Get(unsigned int pixel, unsigned int sample, unsigned int dimension) const = 0;
+    virtual unsigned char GetId() const = 0;
+
+    static Sampler* Create(unsigned char id);
+};
+
+// The Sobol (0,2)-sequence with Owen scrambling, padded to any number of dimensions. The 
+// dimensions are taken two at a time, and each pair gets the first two Sobol dimensions with the
+// sample indices shuffled by a pair-specific scramble, so that the pairs are decorrelated. The
+// values are then Owen scrambled per pixel and dimension
+class SobolSampler : public Sampler
+{
+public:
+    double Get(unsigned int pixel, unsigned int sample, unsigned int dimension) const;
+    unsigned char GetId() const;
+
+private:
+    static std::uint32_t NestedUniformScramble(std::uint32_t x, std::uint32_t seed);
+    static std::uint32_t Hash(std::uint32_t a, std::uint32_t b);
+};
@@ -9,8 +9,8 @@
  */
 
 #define NOMINMAX
-#include "scene.h"
-#include "triangle.h"
+#include "Scene.h"
+#include "Triangle.h"
 #include "Randomizer.h"
 #include "Utils.h"
 #include "ObjReader.h"
@@ -18,9 +18,8 @@
 /**
  * Constructor.
  */
-Scene::Scene()
+Scene::Scene() : camera(nullptr), calculatedBoundingBox(false), loaded(true), partitioning(nullptr)
 {
-    calculatedBoundingBox = false;
 }
 
 /**
@@ -28,12 +27,14 @@ Scene::Scene()
  * 
  * @param file The name of the .obj file from which to read the scene.
  */
-Scene::Scene(std::string file)
+Scene::Scene(std::string file) : camera(nullptr), calculatedBoundingBox(false), partitioning(nullptr)
 {
-	auto [mesh, lghts] = ReadFromFile(file, 0);
+	auto [read, mesh, lghts] = ReadFromFile(file, 0);
+    loaded = read;
 	AddModel(mesh);
     for(auto light : lghts)
         AddLight(light);
+    this->file = file;
 }
 
 /**
@@ -82,6 +83,7 @@ void Scene::AddModel(Model* model)
 	// for example adds its individual triangles to the scene array to facilitate kd tree building
     models.push_back(model);
 	model->AddToScene(*this);
+    file.clear();
 }
 
 /**
@@ -94,6 +96,7 @@ void Scene::AddModel(Model* model)
 void Scene::AddLight(Light* l)
 {
     l->AddToScene(this);
+    file.clear();
 }
 
 /**
@@ -116,6 +119,36 @@ void Scene::SetPartitioning(SpatialPartitioning* partitioning)
     this->partitioning = partitioning;
 }
 
+/**
+ * Checks if the file that the scene was read from, if any, was read without errors.
+ * 
+ * @returns True if the scene was loaded.
+ */
+bool Scene::IsLoaded() const
+{
+    return loaded;
+}
+
+/**
+ * Checks if the scene has no primitives to render.
+ * 
+ * @returns True if the scene is empty.
+ */
+bool Scene::IsEmpty() const
+{
+    return primitives.empty();
+}
+
+/**
+ * Returns the spatial partitioning that the scene uses to calculate ray intersections with.
+ * 
+ * @returns The partitioning, or null if none has been set or built yet.
+ */
+const SpatialPartitioning* Scene::GetPartitioning() const
+{
+    return partitioning;
+}
+
 /**
  * Returns the camera using which we render the scene.
  * 
@@ -126,10 +159,16 @@ Camera* Scene::GetCamera() const
     return camera;
 }
 
-void Scene::Load(Bytestream& b)
+/**
+ * Loads the scene from a bytestream.
+ * 
+ * @param b The bytestream to deserialize from.
+ * @returns False if the stream ended early or held an object of an unknown kind.
+ */
+bool Scene::Load(Bytestream& b)
 {
-    size_t nLights;
-    size_t nModels;
+    size_t nLights = 0;
+    size_t nModels = 0;
 
     // Theoretically, all the base classes implementing Save/Load/Create could
     // implement some common interface called Streamable or something, and I
@@ -137,27 +176,39 @@ void Scene::Load(Bytestream& b)
     // interface
     b >> nLights >> nModels;
 
-    unsigned char id;
+    unsigned char id = 0;
     b >> id;
-    camera = Camera::Create(id);
+    camera = b.IsGood() ? Camera::Create(id) : nullptr;
+    if(!camera)
+        return false;
     camera->Load(b);
 
-    for(unsigned int i = 0; i < nLights; i++)
+    for(unsigned int i = 0; i < nLights && b.IsGood(); i++)
     {
         b >> id;
-        Light* l = Light::Create(id);
+        Light* l = b.IsGood() ? Light::Create(id) : nullptr;
+        if(!l)
+            return false;
         l->Load(b);
         AddLight(l);
     }
-    for(unsigned int i = 0; i < nModels; i++)
+    for(unsigned int i = 0; i < nModels && b.IsGood(); i++)
     {
         b >> id;
-        Model* m = Model::Create(id);
+        Model* m = b.IsGood() ? Model::Create(id) : nullptr;
+        if(!m)
+            return false;
         m->Load(b);
         AddModel(m);
     }
+    return b.IsGood();
 }
 
+/**
+ * Saves the scene to a bytestream.
+ * 
+ * @param b The bytestream to serialize to.
+ */
 void Scene::Save(Bytestream& b) const
 {  
     b << lights.size() << models.size();
@@ -180,71 +231,142 @@ void Scene::Save(Bytestream& b) const
  */
 bool Scene::Intersect(const Ray& ray, double tmax) const
 {
-    return std::get<0>(partitioning->Intersect(ray, 0, tmax, false)) > 0;
+    return partitioning->Occluded(ray, 0, tmax);
 };
 
 /**
  * Intersects all the objects in the scene with a ray.
  * 
  * @param ray The ray to intersect the scene with.
- * @param p The primitive that was hit, if any.
- * @param l The light that was hit, if any.
- * @returns The distance along the ray that the entity was hit.
+ * @returns A tuple of the closest hit and the light that was hit, if any. If a light that is not
+ *          made of primitives was hit, the hit has no primitive, and if nothing was hit, its
+ *          distance is -inf.
  */
-std::tuple<double, const Primitive*, const Light*> Scene::Intersect(const Ray& ray) const
+std::tuple<HitRecord, const Light*> Scene::Intersect(const Ray& ray) const
 {
-    const Primitive* p = nullptr;
-    const Light* l = nullptr;
-    auto [primT, prim] = partitioning->Intersect(ray, 0, inf, true);
-    p = prim;
-    double lightT = -inf;
-    double minLightT = inf;
+    HitRecord hit = partitioning->Intersect(ray, 0, inf);
+    const Light* light = FindLight(ray, hit);
+    return { hit, light };
+};
 
-    for(auto& light : lights)
-    {
-        auto t = light->Intersect(ray);
+/**
+ * Checks a batch of rays for anything blocking them, tracing them together where the
+ * partitioning can.
+ * 
+ * @param rays The rays to check.
+ * @param tmax The maximum distance along each ray that we're allowed to record a hit within.
+ * @param n The number of rays.
+ * @param occluded Whether some object in the scene was intersected by each ray.
+ */
+void Scene::Intersect(const Ray* rays, const double* tmax, int n, bool* occluded) const
+{
+    partitioning->Occluded(rays, tmax, n, occluded);
+}
 
-        if(t != -inf && t < minLightT)
-        {
-            minLightT = t;
-            l = light;
-        }
-    }
+/**
+ * Intersects all the objects in the scene with a batch of rays, tracing them together where the
+ * partitioning can.
+ * 
+ * @param rays The rays to intersect the scene with.
+ * @param n The number of rays.
+ * @param hits The closest hit of each ray, as for a single ray.
+ * @param lights The light that each ray hit, if any, as for a single ray.
+ */
+void Scene::Intersect(const Ray* rays, int n, HitRecord* hits, const Light** lights) const
+{
+    partitioning->Intersect(rays, n, hits);
+    for(int i = 0; i < n; i++)
+        lights[i] = FindLight(rays[i], hits[i]);
+}
 
-    if(minLightT != inf)
-        lightT = minLightT;
+/**
+ * Finds the light that a ray hit, either through the material of the primitive it hit or among the
+ * lights outside the partitioning.
+ * 
+ * @param ray The ray.
+ * @param hit The closest hit of the ray in the partitioning, replaced if a light outside the
+ *            partitioning is closer.
+ * @returns The light that was hit, or null if none was.
+ */
+const Light* Scene::FindLight(const Ray& ray, HitRecord& hit) const
+{
+    const Light* light = nullptr;
+    if(hit.primitive && hit.primitive->GetMaterial())
+        light = hit.primitive->GetMaterial()->GetLight();
 
-    if(primT != -inf && (lightT == -inf || primT < lightT))
-    {
-        l = nullptr;
-        return { primT, p, l };
-    }
-    else if(lightT != -inf)
+    // Only the few lights outside the partitioning, like the environment, are checked one by one
+    for(auto l : unpartitionedLights)
     {
-        p = nullptr;
-        return { lightT, p, l };
+        auto t = l->Intersect(ray);
+        if(t != -inf && (hit.t == -inf || t <= hit.t))
+        {
+            hit = HitRecord();
+            hit.t = t;
+            light = l;
+        }
     }
-
-    p = nullptr;
-    l = nullptr;
-    return { -inf, p, l };
-};
+    return light;
+}
 
 /**
- * Randomly picks a light.
+ * Randomly picks a light, with a probability proportional to the power it emits.
  * 
- * @param r1 A uniformly random number in [0, 1].
- * @returns A pair of the picked light and the probability of having picked that light.
+ * @param r1 A uniformly random number in [0, 1).
+ * @returns A pair of the picked light and the probability of having picked that light, or of
+ *          null and 0 if the scene has no lights.
  */
 std::pair<Light*, double> Scene::PickLight(double r1) const
 {
-    auto p = 1.0/lights.size() + eps;
-    auto sum = 0.0;
+    auto [index, p] = lightTable.Sample(r1);
+    if(index < 0)
+        return { nullptr, 0 };
+    return { lights[index], p };
+}
+
+/**
+ * Picks a light for a point, with a probability proportional to an estimate of how much light
+ * the point gets from it.
+ * 
+ * @param info The intersection info of the point to light up.
+ * @param r A uniformly random number in [0, 1).
+ * @returns A pair of the picked light and the probability of having picked that light, or of
+ *          null and 0 if no light can light up the point.
+ */
+std::pair<Light*, double> Scene::PickLight(const IntersectionInfo& info, double r) const
+{
+    return lightTree.PickLight(info, r);
+}
+
+/**
+ * Returns the probability of picking a light for a point.
+ * 
+ * @param info The intersection info of the point to light up.
+ * @param light The light.
+ * @returns The probability of PickLight picking the light for the point.
+ */
+double Scene::GetLightProbability(const IntersectionInfo& info, const Light* light) const
+{
+    return lightTree.GetProbability(info, light);
+}
+
+/**
+ * Rebuilds the table and the tree that the lights are picked from, once all of them are added,
+ * and finds the lights whose geometry is not among the primitives.
+ */
+void Scene::UpdateLights()
+{
+    std::unordered_set<const Light*> partitionedLights;
+    for(auto primitive : primitives)
+        if(auto material = primitive->GetMaterial(); material && material->GetLight())
+            partitionedLights.insert(material->GetLight());
+    unpartitionedLights.clear();
     for(auto light : lights)
-    {
-        sum += p;
-        if(sum > r1)
-            return { light, p };
-    }
-    return { lights[0], 0 }; // Should never happen
+        if(!partitionedLights.count(light))
+            unpartitionedLights.push_back(light);
+
+    std::vector<double> powers;
+    for(auto light : lights)
+        powers.push_back((light->GetIntensity()*light->GetArea()).GetLuma());
+    lightTable.Build(powers);
+    lightTree.Build(lights);
 }
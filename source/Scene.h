@@ -13,7 +13,6 @@
 
 #include <string>
 #include <unordered_set>
-#include <Windows.h>
 #include "Renderer.h"
 #include "Camera.h"
 #include "CsgUnion.h"
@@ -21,6 +20,8 @@
 #include "ColorBuffer.h"
 #include "Bytestream.h"
 #include "Model.h"
+#include "AliasTable.h"
+#include "LightTree.h"
 
 #include "SpatialPartitioning.h"
 #include "CsgIntersection.h"
@@ -93,7 +94,10 @@ public:
     Scene();
     ~Scene();
 
-    void Load(Bytestream& b);
+    bool IsLoaded() const;
+    bool IsEmpty() const;
+
+    bool Load(Bytestream& b);
     void Save(Bytestream& b) const;
 
     void AddModel(Model*);
@@ -103,11 +107,16 @@ public:
     Camera* GetCamera() const;
 
     void SetPartitioning(SpatialPartitioning* partitioning);
+    const SpatialPartitioning* GetPartitioning() const;
 
     bool Intersect(const Ray&, double tmax) const;
-    std::tuple<double, const Primitive*, const Light*> Intersect(const Ray&) const;
+    std::tuple<HitRecord, const Light*> Intersect(const Ray&) const;
+    void Intersect(const Ray* rays, const double* tmax, int n, bool* occluded) const;
+    void Intersect(const Ray* rays, int n, HitRecord* hits, const Light** lights) const;
 
     std::pair<Light*, double> PickLight(double) const;
+    std::pair<Light*, double> PickLight(const IntersectionInfo& info, double r) const;
+    double GetLightProbability(const IntersectionInfo& info, const Light* light) const;
 
     BoundingBox GetBoundingBox();
 
@@ -115,14 +124,22 @@ public:
     friend class PrimitiveAdder;
     friend class Renderer;
 private:
+    void UpdateLights();
+    const Light* FindLight(const Ray& ray, HitRecord& hit) const;
+
     Camera* camera;
     BoundingBox boundingBox;
     bool calculatedBoundingBox;
+    bool loaded; // Whether the file of the scene was read without errors
 
     std::vector<Light*> lights;
+    std::vector<const Light*> unpartitionedLights; // The lights that rays must be intersected with besides the partitioning
+    AliasTable lightTable; // Picks the lights in proportion to their power
+    LightTree lightTree; // Picks the lights in proportion to how much they light up a point
     std::vector<Model*> models;
     std::vector<const Primitive*> primitives;
     std::unordered_set<Material*> materials;
+    std::string file; // The file that the scene was read from, unless something was added since
 
 protected:
     SpatialPartitioning* partitioning;
@@ -0,0 +1,465 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file SceneCache.cpp
+ * 
+ * Implementation of the binary caches of scene files. A cache starts with a header that describes
+ * the files it was made from, followed by sections with the contents of the scene, like its meshes
+ * and the partitionings built for it.
+ */
+
+#define NOMINMAX
+#include "SceneCache.h"
+#include "BVH.h"
+#include "KDTree.h"
+#include "QBVH.h"
+#include "SpatialPartitioning.h"
+#include "Vertex3d.h"
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <system_error>
+#include <tuple>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Tells cache files apart from other files, and caches of older layouts from the current one
+static const unsigned long long cacheMagic = 0x45484341434c4f50ull; // "POLCACHE"
+static const unsigned int cacheVersion = 3;
+
+/**
+ * Constructor. Maps the file into memory. A file that can't be mapped is left empty and counts
+ * as one that couldn't be opened, so that it isn't taken for an empty file.
+ * 
+ * @param fileName The name of the file to map.
+ */
+MappedFile::MappedFile(const std::string& fileName) : opened(false), data(nullptr), size(0)
+{
+#ifdef _WIN32
+    mapping = nullptr;
+    file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(file, &fileSize))
+        return;
+    if(fileSize.QuadPart == 0)
+    {
+        opened = true;
+        return;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!mapping)
+        return;
+    data = (const char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(data)
+    {
+        size = (size_t) fileSize.QuadPart;
+        opened = true;
+    }
+#else
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if(fd < 0)
+        return;
+
+    struct stat st;
+    if(fstat(fd, &st) == 0)
+    {
+        if(st.st_size == 0)
+            opened = true;
+        else
+        {
+            void* p = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(p != MAP_FAILED)
+            {
+                data = (const char*) p;
+                size = (size_t) st.st_size;
+                opened = true;
+            }
+        }
+    }
+    close(fd);
+#endif
+}
+
+/**
+ * Destructor. Unmaps the file.
+ */
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if(data)
+        UnmapViewOfFile(data);
+    if(mapping)
+        CloseHandle(mapping);
+    if(file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+#else
+    if(data)
+        munmap((void*) data, size);
+#endif
+}
+
+/**
+ * Checks if the file could be opened.
+ * 
+ * @returns True if the file exists and could be read, even if it is empty.
+ */
+bool MappedFile::IsOpen() const
+{
+    return opened;
+}
+
+/**
+ * Returns the contents of the file.
+ * 
+ * @returns A pointer to the first byte of the file, or null if it couldn't be mapped.
+ */
+const char* MappedFile::GetData() const
+{
+    return data;
+}
+
+/**
+ * Returns the size of the file.
+ * 
+ * @returns The number of bytes of the file, or 0 if it couldn't be mapped.
+ */
+size_t MappedFile::GetSize() const
+{
+    return size;
+}
+
+/**
+ * Appends a string to the cache, as its length followed by its characters.
+ * 
+ * @param s The string to append.
+ * @returns A reference to the writer.
+ */
+CacheWriter& CacheWriter::operator<<(const std::string& s)
+{
+    *this << (unsigned long long) s.size();
+    data.insert(data.end(), s.begin(), s.end());
+    return *this;
+}
+
+/**
+ * Starts a section of the cache. Everything written until the section is ended belongs to it.
+ */
+void CacheWriter::BeginSection()
+{
+    sectionStart = data.size();
+    *this << 0ull;
+}
+
+/**
+ * Ends the current section by filling in its size. Sections that nothing was written to are
+ * removed.
+ */
+void CacheWriter::EndSection()
+{
+    unsigned long long sectionSize = data.size() - sectionStart - sizeof(sectionSize);
+    if(!sectionSize)
+        data.resize(sectionStart);
+    else
+        std::memcpy(data.data() + sectionStart, &sectionSize, sizeof(sectionSize));
+}
+
+/**
+ * Writes the contents of the cache to a file. A new file is written under another name first and
+ * then renamed, so that no one reads it halfway written.
+ * 
+ * @param fileName The name of the file.
+ * @param append Whether to append to the end of an existing file rather than replace it.
+ * @returns True if the file was written.
+ */
+bool CacheWriter::SaveToFile(const std::string& fileName, bool append) const
+{
+    if(data.empty())
+        return true;
+
+    auto tmpName = append ? fileName : fileName + ".tmp";
+    {
+        std::ofstream file(tmpName, std::ios::out | std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+        if(!file.write(data.data(), (std::streamsize) data.size()))
+            return false;
+    }
+    if(append)
+        return true;
+
+    std::error_code ec;
+    std::filesystem::rename(tmpName, fileName, ec);
+    if(ec)
+        std::filesystem::remove(tmpName, ec);
+    return !ec;
+}
+
+/**
+ * Constructor.
+ * 
+ * @param begin The first byte to read.
+ * @param end The byte after the last byte to read.
+ */
+CacheReader::CacheReader(const char* begin, const char* end) : p(begin), end(end), fail(!begin)
+{
+}
+
+/**
+ * Reads a string from the cache.
+ * 
+ * @param s The string to read into.
+ * @returns A reference to the reader.
+ */
+CacheReader& CacheReader::operator>>(std::string& s)
+{
+    unsigned long long n = 0;
+    *this >> n;
+    if(fail || (unsigned long long) (end - p) < n)
+    {
+        fail = true;
+        return *this;
+    }
+    s.assign(p, p + n);
+    p += n;
+    return *this;
+}
+
+/**
+ * Moves on to the next section of the cache.
+ * 
+ * @param section A reader of the contents of the section.
+ * @returns True if there was another section.
+ */
+bool CacheReader::NextSection(CacheReader& section)
+{
+    unsigned long long sectionSize = 0;
+    if(p == end || !(*this >> sectionSize).IsGood() || (unsigned long long) (end - p) < sectionSize)
+        return false;
+
+    section = CacheReader(p, p + sectionSize);
+    p += sectionSize;
+    return true;
+}
+
+/**
+ * Checks that everything read so far was actually in the cache.
+ * 
+ * @returns True if no read went past the end of the cache.
+ */
+bool CacheReader::IsGood() const
+{
+    return !fail;
+}
+
+/**
+ * Returns the name of the cache of a scene file.
+ * 
+ * @param file The name of the scene file.
+ * @returns The name of its cache.
+ */
+std::string GetCacheFileName(const std::string& file)
+{
+    return file + ".cache";
+}
+
+/**
+ * Hashes the contents of a file, eight bytes at a time.
+ * 
+ * @param file The mapped file.
+ * @returns The hash.
+ */
+static unsigned long long HashFile(const MappedFile& file)
+{
+    const unsigned long long prime = 0x100000001b3ull;
+    unsigned long long hash = 0xcbf29ce484222325ull;
+
+    const char* p = file.GetData();
+    size_t n = file.GetSize();
+    for(; n >= 8; p += 8, n -= 8)
+    {
+        unsigned long long word;
+        std::memcpy(&word, p, 8);
+        hash = (hash ^ word)*prime;
+    }
+    for(; n; p++, n--)
+        hash = (hash ^ (unsigned char) *p)*prime;
+    return hash;
+}
+
+// What the cache remembers about each of the files it was made from
+class CacheSource
+{
+public:
+    /**
+     * Describes a file as it is now by its size and modification time.
+     * 
+     * @param name The name of the file.
+     * @returns False if the file can't be found.
+     */
+    bool Describe(const std::string& name)
+    {
+        std::error_code ec;
+        this->name = name;
+        size = std::filesystem::file_size(name, ec);
+        if(ec)
+            return false;
+        time = (long long) std::filesystem::last_write_time(name, ec).time_since_epoch().count();
+        return !ec;
+    }
+
+    /**
+     * Hashes the contents of the described file. Each version of a file is only read once per
+     * run, however many caches are checked against it.
+     * 
+     * @returns False if the file can't be read or has changed since it was described.
+     */
+    bool Hash()
+    {
+        static std::mutex mutex;
+        static std::map<std::tuple<std::string, unsigned long long, long long>, unsigned long long> hashes;
+
+        auto key = std::make_tuple(name, size, time);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(auto it = hashes.find(key); it != hashes.end())
+            {
+                hash = it->second;
+                return true;
+            }
+        }
+
+        MappedFile file(name);
+        if(!file.IsOpen() || file.GetSize() != size)
+            return false;
+        hash = HashFile(file);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        hashes[key] = hash;
+        return true;
+    }
+
+    std::string name;
+    unsigned long long size = 0;
+    long long time = 0; // The time of the last modification
+    unsigned long long hash = 0;
+};
+
+/**
+ * Returns the sizes of the structures that the cache holds arrays of, which tell caches written
+ * by builds that lay them out differently apart.
+ * 
+ * @returns The sizes of the structures.
+ */
+static std::vector<unsigned int> GetLayout()
+{
+    return { sizeof(Vertex3d), sizeof(KDNode), sizeof(BVHNode), sizeof(QBVHNode), sizeof(QBVHLeaf), sizeof(TriangleBlock) };
+}
+
+/**
+ * Writes the header of a cache, describing the files that the cache is made from.
+ * 
+ * @param writer The writer of the cache.
+ * @param sources The names of the files.
+ */
+void WriteCacheHeader(CacheWriter& writer, const std::vector<std::string>& sources)
+{
+    writer << cacheMagic << cacheVersion << GetLayout() << (unsigned int) sources.size();
+    for(auto& name : sources)
+    {
+        CacheSource source;
+        if(source.Describe(name))
+            source.Hash();
+        writer << source.name << source.size << source.time << source.hash;
+    }
+}
+
+/**
+ * Reads the header of a cache and checks that it was written by a build that lays out the
+ * structures the same way, and that the files it was made from are the same as when it was
+ * written. The files are only hashed if their sizes or modification times have changed, so that
+ * touching a file doesn't throw its cache away.
+ * 
+ * @param reader The reader of the cache.
+ * @returns True if the cache is up to date.
+ */
+bool ReadCacheHeader(CacheReader& reader)
+{
+    unsigned long long magic = 0;
+    unsigned int version = 0, nSources = 0;
+    std::vector<unsigned int> layout;
+    reader >> magic >> version;
+    if(!reader.IsGood() || magic != cacheMagic || version != cacheVersion)
+        return false;
+    reader >> layout >> nSources;
+    if(!reader.IsGood() || layout != GetLayout())
+        return false;
+
+    for(unsigned int i = 0; i < nSources; i++)
+    {
+        CacheSource cached, current;
+        reader >> cached.name >> cached.size >> cached.time >> cached.hash;
+        if(!reader.IsGood() || !current.Describe(cached.name))
+            return false;
+        if(current.size == cached.size && current.time == cached.time)
+            continue;
+        if(current.size != cached.size || !current.Hash() || current.hash != cached.hash)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Loads a partitioning from the cache of the scene file that its primitives came from.
+ * 
+ * @param file The name of the scene file.
+ * @param partitioning The partitioning to load.
+ * @param primitives The primitives of the scene, in the order they were in when it was built.
+ * @returns True if a partitioning of the same kind was found in the cache and loaded.
+ */
+bool ReadPartitioningCache(const std::string& file, SpatialPartitioning& partitioning, const std::vector<const Primitive*>& primitives)
+{
+    MappedFile cache(GetCacheFileName(file));
+    CacheReader reader(cache.GetData(), cache.GetData() + cache.GetSize());
+    if(!ReadCacheHeader(reader))
+        return false;
+
+    for(CacheReader section(nullptr, nullptr); reader.NextSection(section);)
+        if(partitioning.Load(section, primitives))
+            return true;
+    return false;
+}
+
+/**
+ * Adds a built partitioning to the cache of the scene file that its primitives came from, if the
+ * cache is still up to date.
+ * 
+ * @param file The name of the scene file.
+ * @param partitioning The partitioning to save.
+ */
+void WritePartitioningCache(const std::string& file, const SpatialPartitioning& partitioning)
+{
+    auto cacheName = GetCacheFileName(file);
+    {
+        MappedFile cache(cacheName);
+        CacheReader reader(cache.GetData(), cache.GetData() + cache.GetSize());
+        if(!ReadCacheHeader(reader))
+            return;
+    }
+
+    CacheWriter writer;
+    writer.BeginSection();
+    partitioning.Save(writer);
+    writer.EndSection();
+    writer.SaveToFile(cacheName, true);
+}
@@ -0,0 +1,157 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file SceneCache.h
+ * 
+ * Declarations of the classes and functions that keep binary caches of scene files.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+class Primitive;
+class SpatialPartitioning;
+
+// A file mapped into memory for reading
+class MappedFile
+{
+public:
+    MappedFile(const std::string& fileName);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool IsOpen() const;
+    const char* GetData() const;
+    size_t GetSize() const;
+
+private:
+    bool opened; // Whether the file could be opened and mapped, even if it is empty
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#endif
+};
+
+// Builds the contents of a cache file in memory. Values are written as their bytes and vectors as
+// their size followed by all of their elements at once. The contents are divided into sections
+// that start with their size, so that a reader can skip the sections it isn't looking for
+class CacheWriter
+{
+public:
+    /**
+     * Appends a value to the cache.
+     * 
+     * @param t The value to append.
+     * @returns A reference to the writer.
+     */
+    template<typename T> CacheWriter& operator<<(const T& t)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        size_t n = data.size();
+        data.resize(n + sizeof(T));
+        std::memcpy(data.data() + n, &t, sizeof(T));
+        return *this;
+    }
+
+    /**
+     * Appends the size and the elements of a vector to the cache.
+     * 
+     * @param v The vector to append.
+     * @returns A reference to the writer.
+     */
+    template<typename T> CacheWriter& operator<<(const std::vector<T>& v)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        *this << (unsigned long long) v.size();
+        auto p = reinterpret_cast<const char*>(v.data());
+        data.insert(data.end(), p, p + v.size()*sizeof(T));
+        return *this;
+    }
+
+    CacheWriter& operator<<(const std::string& s);
+
+    void BeginSection();
+    void EndSection();
+
+    bool SaveToFile(const std::string& fileName, bool append) const;
+
+private:
+    std::vector<char> data;
+    size_t sectionStart = 0; // Where the size of the current section is written
+};
+
+// Reads the contents of a cache file written by a CacheWriter, straight from memory
+class CacheReader
+{
+public:
+    CacheReader(const char* begin, const char* end);
+
+    /**
+     * Reads a value from the cache.
+     * 
+     * @param t The variable to read into.
+     * @returns A reference to the reader.
+     */
+    template<typename T> CacheReader& operator>>(T& t)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if(fail || end - p < (std::ptrdiff_t) sizeof(T))
+        {
+            fail = true;
+            return *this;
+        }
+        std::memcpy(&t, p, sizeof(T));
+        p += sizeof(T);
+        return *this;
+    }
+
+    /**
+     * Reads the elements of a vector from the cache, copying all of them at once.
+     * 
+     * @param v The vector to read into.
+     * @returns A reference to the reader.
+     */
+    template<typename T> CacheReader& operator>>(std::vector<T>& v)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        unsigned long long n = 0;
+        *this >> n;
+        if(fail || (unsigned long long) (end - p)/sizeof(T) < n)
+        {
+            fail = true;
+            return *this;
+        }
+        v.resize(n);
+        std::memcpy(v.data(), p, n*sizeof(T));
+        p += n*sizeof(T);
+        return *this;
+    }
+
+    CacheReader& operator>>(std::string& s);
+
+    bool NextSection(CacheReader& section);
+    bool IsGood() const;
+
+private:
+    const char* p;
+    const char* end;
+    bool fail;
+};
+
+std::string GetCacheFileName(const std::string& file);
+
+void WriteCacheHeader(CacheWriter& writer, const std::vector<std::string>& sources);
+bool ReadCacheHeader(CacheReader& reader);
+
+bool ReadPartitioningCache(const std::string& file, SpatialPartitioning& partitioning, const std::vector<const Primitive*>& primitives);
+void WritePartitioningCache(const std::string& file, const SpatialPartitioning& partitioning);
@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file SpatialPartitioning.cpp
+ * 
+ * Implementation of the statistics shared by the spatial partitioning structures.
+ */
+
+#include "Ray.h"
+#include "SceneCache.h"
+#include "SpatialPartitioning.h"
+#include "Utils.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+/**
+ * Counts a leaf of the structure, and the leaf as a node.
+ * 
+ * @param nPrimitives The number of primitives in the leaf.
+ * @param depth The depth of the leaf.
+ */
+void PartitioningStatistics::AddLeaf(int nPrimitives, int depth)
+{
+    int bucket = 0;
+    while(nPrimitives >> bucket)
+        bucket++;
+    if((int) leafSizes.size() <= bucket)
+        leafSizes.resize(bucket + 1);
+    leafSizes[bucket]++;
+
+    nNodes++;
+    nLeaves++;
+    nEmptyLeaves += nPrimitives == 0;
+    maxDepth = std::max(maxDepth, depth);
+}
+
+/**
+ * Describes the statistics.
+ * 
+ * @returns The build time, the size, the SAH cost and the leaf size histogram.
+ */
+std::string PartitioningStatistics::ToString() const
+{
+    std::ostringstream s;
+    s << "built in " << buildTime << " s, " << nNodes << " nodes, " << nLeaves << " leaves ("
+      << nEmptyLeaves << " empty), depth " << maxDepth << ", " << memory/(1024.0*1024.0) << " MB, SAH cost "
+      << sahCost << "\n" << "Leaf sizes:";
+    for(int i = 0; i < (int) leafSizes.size(); i++)
+    {
+        s << " ";
+        if(i <= 1)
+            s << i;
+        else if(i == 2)
+            s << "2-3";
+        else
+            s << (1 << (i - 1)) << "-" << (1 << i) - 1;
+        s << ": " << leafSizes[i];
+    }
+    return s.str();
+}
+
+/**
+ * Saves the statistics to a cache.
+ * 
+ * @param writer The writer of the cache.
+ */
+void PartitioningStatistics::Save(CacheWriter& writer) const
+{
+    writer << buildTime << nNodes << nLeaves << nEmptyLeaves << maxDepth << leafSizes << sahCost << memory;
+}
+
+/**
+ * Loads the statistics from a cache.
+ * 
+ * @param reader The reader of the cache.
+ */
+void PartitioningStatistics::Load(CacheReader& reader)
+{
+    reader >> buildTime >> nNodes >> nLeaves >> nEmptyLeaves >> maxDepth >> leafSizes >> sahCost >> memory;
+}
+
+/**
+ * Intersects a batch of rays with the structure, each between zero and infinity. Structures that
+ * can trace rays together override this, the default traces them one by one.
+ * 
+ * @param rays The rays to intersect with.
+ * @param n The number of rays.
+ * @param hits The closest hit of each ray, with a distance of -inf if no intersection happened.
+ */
+void SpatialPartitioning::Intersect(const Ray* rays, int n, HitRecord* hits) const
+{
+    for(int i = 0; i < n; i++)
+        hits[i] = Intersect(rays[i], 0, inf);
+}
+
+/**
+ * Checks a batch of rays for anything blocking them, each between zero and its own distance.
+ * Structures that can trace rays together override this, the default traces them one by one.
+ * 
+ * @param rays The rays to check.
+ * @param tmax The greatest distance along each ray to find intersections.
+ * @param n The number of rays.
+ * @param occluded Whether each ray is blocked.
+ */
+void SpatialPartitioning::Occluded(const Ray* rays, const double* tmax, int n, bool* occluded) const
+{
+    for(int i = 0; i < n; i++)
+        occluded[i] = Occluded(rays[i], 0, tmax[i]);
+}
+
+/**
+ * Saves the built structure to a cache, so that it can be loaded instead of built the next time
+ * the scene is read. Structures that aren't worth caching save nothing.
+ * 
+ * @param writer The writer of the cache.
+ */
+void SpatialPartitioning::Save(CacheWriter& writer) const
+{
+}
+
+/**
+ * Loads a structure saved to a cache.
+ * 
+ * @param reader The reader of the section of the cache that the structure was saved to.
+ * @param primitives The primitives that the structure was built for.
+ * @returns True if the section held a structure of this kind, built for as many primitives.
+ */
+bool SpatialPartitioning::Load(CacheReader& reader, const std::vector<const Primitive*>& primitives)
+{
+    return false;
+}
+
+/**
+ * Checks if a group of rays can be traced together as a packet, which requires that their
+ * directions have the same signs so that they see the children of every node in the same order.
+ * Zero directions count by their sign bit, like the reciprocals of the directions do.
+ * 
+ * @param rays The rays to check.
+ * @param n The number of rays.
+ * @returns True if the rays agree on the signs of their directions.
+ */
+bool SpatialPartitioning::IsCoherent(const Ray* rays, int n)
+{
+    auto sign = [](double d) { return d > 0 ? 2 : std::signbit(d) ? 0 : 1; };
+    for(int u = 0; u < 3; u++)
+        for(int i = 1; i < n; i++)
+            if(sign(rays[i].direction[u]) != sign(rays[0].direction[u]))
+                return false;
+    return true;
+}
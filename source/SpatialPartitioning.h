@@ -9,14 +9,52 @@
 
 #pragma once
 
+#include "HitRecord.h"
+#include <string>
 #include <vector>
 
+class CacheReader;
+class CacheWriter;
 class Ray;
 class Primitive;
 
+// Statistics of a built partitioning, for comparing builders and structures
+class PartitioningStatistics
+{
+public:
+    void AddLeaf(int nPrimitives, int depth);
+    std::string ToString() const;
+
+    void Save(CacheWriter& writer) const;
+    void Load(CacheReader& reader);
+
+    double buildTime = 0;
+    int nNodes = 0, nLeaves = 0, nEmptyLeaves = 0, maxDepth = 0;
+    std::vector<int> leafSizes; // Histogram over the primitive counts of the leaves, in powers of two
+    double sahCost = 0; // The expected cost of a ray hitting the structure, in primitive intersections
+    size_t memory = 0; // The size of the structure in bytes
+};
+
 class SpatialPartitioning
 {
 public:
     virtual void Build(const std::vector<const Primitive*>&) = 0;
-    virtual std::tuple<double, const Primitive*> Intersect(const Ray& ray, double tmin, double tmax, bool returnPrimitive) const = 0;
+    virtual HitRecord Intersect(const Ray& ray, double tmin, double tmax) const = 0;
+    virtual bool Occluded(const Ray& ray, double tmin, double tmax) const = 0;
+
+    virtual void Intersect(const Ray* rays, int n, HitRecord* hits) const;
+    virtual void Occluded(const Ray* rays, const double* tmax, int n, bool* occluded) const;
+
+    /**
+     * Describes the structure built by the last call to Build, if the implementation keeps track of it.
+     *
+     * @returns A human readable summary of the structure.
+     */
+    virtual std::string GetStatistics() const { return ""; }
+
+    virtual void Save(CacheWriter& writer) const;
+    virtual bool Load(CacheReader& reader, const std::vector<const Primitive*>& primitives);
+
+protected:
+    static bool IsCoherent(const Ray* rays, int n);
 };
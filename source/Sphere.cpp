@@ -71,14 +71,12 @@ double Sphere::Intersect(const Ray& ray) const
  * Generates information about the intersection of a ray hitting a sphere.
  * 
  * @param ray The ray that hit the sphere.
+ * @param hit Where the ray hit the sphere.
  * @param info The intersection info to fill.
- * @returns True if the sphere was actually hit.
  */
-bool Sphere::GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const
+void Sphere::GenerateIntersectionInfo(const Ray& ray, const HitRecord& hit, IntersectionInfo& info) const
 {
-    double t = IntersectSphere(position, radius, ray);
-    if(t < 0)
-        return false;
+    double t = hit.t;
 
     info.direction = ray.direction;
     info.material = material;
@@ -110,7 +108,6 @@ bool Sphere::GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) co
     info.texpos.y = vcoord;
 
     info.geometricnormal = info.normal;
-    return true;
 }
 
 /**
@@ -30,7 +30,7 @@ public:
     BoundingBox GetBoundingBox() const;
 
     double Intersect(const Ray& ray) const;
-    bool GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const;
+    void GenerateIntersectionInfo(const Ray& ray, const HitRecord& hit, IntersectionInfo& info) const;
 
     void Save(Bytestream& stream) const;
     void Load(Bytestream& stream);
@@ -10,6 +10,7 @@
 #include "Bytestream.h"
 #include "EmissiveMaterial.h"
 #include "GeometricRoutines.h"
+#include "LightTree.h"
 #include "Scene.h"
 #include "SphereLight.h"
 #include "Utils.h"
@@ -100,7 +101,7 @@ std::tuple<Ray, Color, Normal, AreaPdf, AnglePdf> SphereLight::SampleRay(Randomi
 
     double r1 = rnd.GetDouble(0, 1), r2 = rnd.GetDouble(0, 1);
     ray.direction = SampleHemisphereCos(r1, r2, normal);
-    double anglePdf = abs(ray.direction*normal)/pi;
+    double anglePdf = std::abs(ray.direction*normal)/pi;
     double areaPdf = 1/GetArea();
 
     return { ray, Color::Identity*pi, normal, areaPdf, anglePdf };
@@ -150,6 +151,20 @@ double SphereLight::GetArea() const
     return 4*pi*radius_*radius_;
 }
 
+/**
+ * Gets the bounds of the light, which has normals in every direction.
+ * 
+ * @param bounds The bounds of the light.
+ * @returns True, since the light can always be bounded.
+ */
+bool SphereLight::GetBounds(LightBounds& bounds) const
+{
+    Vector3d extent(radius_ + 2*eps, radius_ + 2*eps, radius_ + 2*eps);
+    BoundingBox box(position_ - extent, position_ + extent);
+    bounds = LightBounds(box, Vector3d(0, 0, 1), -1, 0, (intensity*GetArea()).GetLuma());
+    return true;
+}
+
 void SphereLight::AddToScene(Scene* scn)
 {
     Sphere* s = new Sphere(position_, Vector3d(0, 1, 0), 
@@ -190,8 +205,8 @@ std::tuple<Color, Point> SphereLight::NextEventEstimation(const Renderer* render
     {
         if(renderer->TraceShadowRay(lightRay, (1-1e-6)*d))
         {
-            double cosphi = abs(normal*toLight);
-            double costheta = abs(toLight*lightNormal);
+            double cosphi = std::abs(normal*toLight);
+            double costheta = std::abs(toLight*lightNormal);
             Color c;
             c = info.material->BRDF(info, toLight, component)*costheta*cosphi*intensity*GetArea()/(2*d*d);
             return { c, lightPoint };
@@ -34,6 +34,7 @@ public:
     std::tuple<Color, Point> NextEventEstimation(const Renderer* renderer, const IntersectionInfo& info, Randomizer& rnd, int component) const;
 
     double GetArea() const;
+    bool GetBounds(LightBounds& bounds) const;
     void AddToScene(Scene*);
 
     void Save(Bytestream& s) const;
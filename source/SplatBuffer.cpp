@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file SplatBuffer.cpp
+ * 
+ * Implementation of the SplatBuffer class that holds the light path contributions of a
+ * rendering.
+ */
+
+#include "SplatBuffer.h"
+#include "Bytestream.h"
+
+/**
+ * Constructor.
+ * 
+ * @param width The width of the image.
+ * @param height The height of the image.
+ */
+SplatBuffer::SplatBuffer(int width, int height) : buffer(3*width*height), nPaths(0), 
+    width(width), height(height)
+{
+}
+
+/**
+ * Constructor. Loads the buffer from a bytestream, leaving it empty if the stream ends before
+ * the size of the buffer.
+ * 
+ * @param b The bytestream to load from.
+ */
+SplatBuffer::SplatBuffer(Bytestream& b) : nPaths(0), width(0), height(0)
+{
+    long long n = 0;
+    b >> width >> height >> n;
+    if(!b.IsGood() || width <= 0 || height <= 0)
+    {
+        width = height = 0;
+        return;
+    }
+    nPaths = n;
+    buffer = std::vector<std::atomic<double>>(3*width*height);
+    for(auto& c : buffer)
+    {
+        double d;
+        b >> d;
+        c = d;
+    }
+}
+
+/**
+ * Adds a light path contribution to a pixel. Safe to call from several threads at once.
+ * 
+ * @param x The x coordinate of the pixel.
+ * @param y The y coordinate of the pixel.
+ * @param c The contribution.
+ */
+void SplatBuffer::AddColor(int x, int y, const Color& c)
+{
+    auto p = &buffer[3*(y*width + x)];
+    p[0].fetch_add(c.r, std::memory_order_relaxed);
+    p[1].fetch_add(c.g, std::memory_order_relaxed);
+    p[2].fetch_add(c.b, std::memory_order_relaxed);
+}
+
+/**
+ * Records that a number of light paths have been traced. The paths count regardless of whether 
+ * they contributed anything to the buffer.
+ * 
+ * @param n The number of light paths.
+ */
+void SplatBuffer::AddPaths(long long n)
+{
+    nPaths.fetch_add(n, std::memory_order_relaxed);
+}
+
+/**
+ * Returns the estimate of the light path contributions to a pixel.
+ * 
+ * @param x The x coordinate of the pixel.
+ * @param y The y coordinate of the pixel.
+ * @returns The sum of the contributions divided by the number of passes traced so far.
+ */
+Color SplatBuffer::GetEstimate(int x, int y) const
+{
+    long long n = nPaths.load(std::memory_order_relaxed);
+    if(!n)
+        return Color::Black;
+
+    auto p = &buffer[3*(y*width + x)];
+    double passes = double(n)/(width*height);
+    return Color(p[0].load(std::memory_order_relaxed), p[1].load(std::memory_order_relaxed), 
+                 p[2].load(std::memory_order_relaxed))/passes;
+}
+
+/**
+ * Returns the memory taken up by the buffer.
+ * 
+ * @returns The size of the buffer in bytes.
+ */
+std::size_t SplatBuffer::GetMemoryUsage() const
+{
+    return buffer.size()*sizeof(std::atomic<double>);
+}
+
+/**
+ * Returns the width of the buffer.
+ * 
+ * @returns The width of the image in pixels.
+ */
+int SplatBuffer::GetWidth() const
+{
+    return width;
+}
+
+/**
+ * Returns the height of the buffer.
+ * 
+ * @returns The height of the image in pixels.
+ */
+int SplatBuffer::GetHeight() const
+{
+    return height;
+}
+
+/**
+ * Saves the buffer to a bytestream.
+ * 
+ * @param b The bytestream to save to.
+ */
+void SplatBuffer::Save(Bytestream& b) const
+{
+    b << width << height << nPaths.load();
+    for(auto& c : buffer)
+        b << c.load();
+}
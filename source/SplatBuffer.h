@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file SplatBuffer.h
+ * 
+ * Declaration of the SplatBuffer class.
+ */
+
+#pragma once
+
+#include "Color.h"
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+class Bytestream;
+
+// Accumulates the contributions of light paths, which may land on any pixel, from any number of
+// threads at once. A contribution is scaled as if it were part of a pass of one light path per
+// pixel, and the sum is turned into an estimate by the number of light paths actually traced
+class SplatBuffer
+{
+public:
+    SplatBuffer(int width, int height);
+    SplatBuffer(Bytestream& b);
+
+    void AddColor(int x, int y, const Color& c);
+    void AddPaths(long long n);
+    Color GetEstimate(int x, int y) const;
+    std::size_t GetMemoryUsage() const;
+    int GetWidth() const;
+    int GetHeight() const;
+
+    void Save(Bytestream& b) const;
+
+private:
+    std::vector<std::atomic<double>> buffer;
+    std::atomic<long long> nPaths;
+    int width, height;
+};
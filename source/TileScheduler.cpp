@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file TileScheduler.cpp
+ * 
+ * Implementation of the TileScheduler class that distributes the tiles of a rendering among
+ * its threads.
+ */
+
+#include "TileScheduler.h"
+#include <algorithm>
+
+/**
+ * Constructor. Splits the image into tiles and deals them out in contiguous runs to the queues
+ * of the workers, so that each worker starts out on a part of the image of its own.
+ * 
+ * @param xres The width of the image.
+ * @param yres The height of the image.
+ * @param tileSize The width and height of the tiles (except the ones at the right and bottom).
+ * @param nWorkers The number of workers that will request tiles.
+ * @param completedPasses Returns the number of passes over a tile that have already been 
+ *                        completed, which is where the passes of the tile continue from.
+ * @param maxPasses The number of passes after which a tile is finished, or 0 for no limit.
+ */
+TileScheduler::TileScheduler(int xres, int yres, int tileSize, int nWorkers, 
+                             const std::function<unsigned int(const Tile&)>& completedPasses, 
+                             unsigned int maxPasses) : queues(nWorkers), nQueued(0), cancelled(false), nConverged(0), maxPasses(maxPasses)
+{
+    for(int y = 0; y < yres; y += tileSize)
+        for(int x = 0; x < xres; x += tileSize)
+            tiles.push_back({ x, y, std::min(x + tileSize, xres), std::min(y + tileSize, yres) });
+
+    int nTiles = int(tiles.size());
+    passes = std::vector<std::atomic<unsigned int>>(tiles.size());
+    nRemaining = 0;
+    for(int i = 0; i < nTiles; i++)
+    {
+        passes[i] = completedPasses(tiles[i]);
+        if(maxPasses && passes[i] >= maxPasses)
+            continue;
+        queues[std::size_t(i)*nWorkers/nTiles].tiles.push_back(i);
+        nRemaining++;
+    }
+}
+
+/**
+ * Hands out a tile to a worker, stealing one from another worker if its own queue is empty. If
+ * every tile that is left is being worked on by some other worker, this waits until one of them
+ * is queued again.
+ * 
+ * @param worker The index of the worker.
+ * @returns The index of the tile to render, or -1 if every tile is done or the scheduler has been
+ *          cancelled.
+ */
+int TileScheduler::Next(int worker)
+{
+    while(true)
+    {
+        // The count is read before looking for a tile, so that a tile queued after the search
+        // came up empty ends the wait rather than being missed
+        unsigned long long queued;
+        {
+            std::lock_guard<std::mutex> lock(waitMutex);
+            if(cancelled || IsDone())
+                return -1;
+            queued = nQueued;
+        }
+
+        int tile = Take(worker);
+        if(tile >= 0)
+            return tile;
+
+        std::unique_lock<std::mutex> lock(waitMutex);
+        tileQueued.wait(lock, [&] { return nQueued != queued || cancelled || IsDone(); });
+    }
+}
+
+/**
+ * Takes a tile from the queue of a worker, or from the queue of another worker if its own is
+ * empty.
+ * 
+ * @param worker The index of the worker.
+ * @returns The index of the tile, or -1 if every queue is empty.
+ */
+int TileScheduler::Take(int worker)
+{
+    int nWorkers = int(queues.size());
+    for(int i = 0; i < nWorkers; i++)
+    {
+        auto& queue = queues[(worker + i)%nWorkers];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(queue.tiles.empty())
+            continue;
+
+        int tile;
+        if(i == 0)
+        {
+            tile = queue.tiles.front();
+            queue.tiles.pop_front();
+        }
+        else
+        {
+            tile = queue.tiles.back();
+            queue.tiles.pop_back();
+        }
+        return tile;
+    }
+    return -1;
+}
+
+/**
+ * Records that a worker has completed a pass over a tile and queues the tile up for its next pass,
+ * unless it has received all its passes or has converged.
+ * 
+ * @param worker The index of the worker.
+ * @param tile The index of the tile.
+ * @param converged True if the tile needs no more samples.
+ */
+void TileScheduler::Finish(int worker, int tile, bool converged)
+{
+    if(converged)
+        nConverged++;
+    if(++passes[tile] == maxPasses || converged)
+    {
+        if(--nRemaining == 0)
+        {
+            std::lock_guard<std::mutex> lock(waitMutex);
+            tileQueued.notify_all();
+        }
+        return;
+    }
+
+    {
+        auto& queue = queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tiles.push_back(tile);
+    }
+    {
+        std::lock_guard<std::mutex> lock(waitMutex);
+        nQueued++;
+    }
+    tileQueued.notify_one();
+}
+
+/**
+ * Wakes up the workers waiting for a tile and hands out no more tiles, for when the rendering is
+ * stopped.
+ */
+void TileScheduler::Cancel()
+{
+    std::lock_guard<std::mutex> lock(waitMutex);
+    cancelled = true;
+    tileQueued.notify_all();
+}
+
+/**
+ * Returns true if every tile has received its passes.
+ * 
+ * @returns True if there is nothing left to render.
+ */
+bool TileScheduler::IsDone() const
+{
+    return nRemaining == 0;
+}
+
+/**
+ * Returns true if every tile has converged, as opposed to having run out of passes.
+ * 
+ * @returns True if all tiles have converged.
+ */
+bool TileScheduler::IsConverged() const
+{
+    return nConverged == int(tiles.size());
+}
+
+/**
+ * Returns the number of passes that have been completed over a tile.
+ * 
+ * @param tile The index of the tile.
+ * @returns The number of completed passes.
+ */
+unsigned int TileScheduler::GetPasses(int tile) const
+{
+    return passes[tile];
+}
+
+/**
+ * Returns the number of passes that have been completed over the entire image.
+ * 
+ * @returns The smallest number of passes completed over any tile.
+ */
+unsigned int TileScheduler::GetCompletedPasses() const
+{
+    unsigned int minPasses = passes.empty() ? 0 : passes[0].load();
+    for(auto& p : passes)
+        minPasses = std::min(minPasses, p.load());
+    return minPasses;
+}
+
+/**
+ * Returns the average number of passes that have been completed over a pixel of the image.
+ * 
+ * @returns The number of passes over each tile weighed by the number of pixels in it.
+ */
+double TileScheduler::GetAveragePasses() const
+{
+    double sum = 0, nPixels = 0;
+    for(std::size_t i = 0; i < tiles.size(); i++)
+    {
+        double area = double(tiles[i].x1 - tiles[i].x0)*(tiles[i].y1 - tiles[i].y0);
+        sum += area*passes[i];
+        nPixels += area;
+    }
+    return nPixels ? sum/nPixels : 0;
+}
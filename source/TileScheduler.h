@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file TileScheduler.h
+ * 
+ * Declaration of the TileScheduler class.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// A rectangle of the image, from (x0, y0) up to but not including (x1, y1)
+class Tile
+{
+public:
+    int x0, y0, x1, y1;
+};
+
+// Hands out the tiles of an image to a number of workers, one pass over a tile at a time. Each
+// worker takes tiles from the front of its own queue and, when that runs dry, steals from the
+// back of the queues of the others. A tile is in at most one queue at a time and goes back into
+// a queue only after its pass is done, so no tile is ever rendered by two workers at once. Tiles
+// leave for good once they have received their passes or have converged. Workers that find no
+// tile in any queue sleep until one is queued again
+class TileScheduler
+{
+public:
+    TileScheduler(int xres, int yres, int tileSize, int nWorkers, 
+                  const std::function<unsigned int(const Tile&)>& completedPasses, unsigned int maxPasses);
+
+    int Next(int worker);
+    void Finish(int worker, int tile, bool converged);
+    void Cancel();
+    bool IsDone() const;
+    bool IsConverged() const;
+    unsigned int GetPasses(int tile) const;
+    unsigned int GetCompletedPasses() const;
+    double GetAveragePasses() const;
+
+    std::vector<Tile> tiles;
+
+private:
+    class Queue
+    {
+    public:
+        std::mutex mutex;
+        std::deque<int> tiles;
+    };
+
+    int Take(int worker);
+
+    std::vector<Queue> queues;
+    std::mutex waitMutex;
+    std::condition_variable tileQueued; // Signaled when a tile is queued, and when all are done
+    unsigned long long nQueued; // The number of times a tile has been queued, guarded by waitMutex
+    bool cancelled; // Guarded by waitMutex
+    std::vector<std::atomic<unsigned int>> passes;
+    std::atomic<int> nRemaining, nConverged;
+    unsigned int maxPasses;
+};
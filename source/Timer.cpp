@@ -14,7 +14,6 @@
  */
 Timer::Timer()
 {
-    QueryPerformanceFrequency(&m_ticksPerSecond);
     Reset();
 }
 
@@ -30,7 +29,7 @@ Timer::~Timer()
  */
 void Timer::Reset()
 {
-    QueryPerformanceCounter(&m_startTick);
+    m_startTick = std::chrono::steady_clock::now();
 }
 
 /**
@@ -38,7 +37,6 @@ void Timer::Reset()
  */
 double Timer::GetTime() const
 {
-    LARGE_INTEGER thisTick;
-    QueryPerformanceCounter(&thisTick);
-    return (thisTick.QuadPart - m_startTick.QuadPart)/(double)m_ticksPerSecond.QuadPart;
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - m_startTick;
+    return dt.count();
 }
\ No newline at end of file
@@ -9,9 +9,7 @@
 
 #pragma once
 
-#define WIN32_MEAN_AND_LEAN
-#define NOMINMAX
-#include <windows.h>
+#include <chrono>
 
 class Timer
 {
@@ -23,7 +21,5 @@ public:
     double GetTime() const;
 
 private:
-    LARGE_INTEGER m_ticksPerSecond;
-    LARGE_INTEGER m_startTick;
-    LARGE_INTEGER m_dt;
+    std::chrono::steady_clock::time_point m_startTick;
 };
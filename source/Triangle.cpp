@@ -65,18 +65,42 @@ double Triangle::Intersect(const Ray& ray) const
 }
 
 /**
- * Generates information about the intersection of a ray hitting a triangle.
+ * Intersects the triangle with a ray, recording the barycentric coordinates of the hit.
  * 
- * @param clipbox The bounding box that we remove part of the triangle from.
- * @returns A pair indicating whether anything remains of the triangle, and the bounding box of
- *          the clipped resulting mesh triangle.
+ * @param ray The ray to intersect with.
+ * @returns The hit, with a distance of -inf if the triangle wasn't hit.
  */
-bool Triangle::GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const
+HitRecord Triangle::IntersectHit(const Ray& ray) const
 {
     auto [t, u, v] = IntersectTriangle(v0.pos, v1.pos, v2.pos, ray);
-    if(t < 0)
-        return false;
-    
+    return { t, u, v, this, -1 };
+}
+
+/**
+ * Returns the corners of the triangle.
+ * 
+ * @param p0 The first corner.
+ * @param p1 The second corner.
+ * @param p2 The third corner.
+ * @returns True, since this is a triangle.
+ */
+bool Triangle::GetVertices(Vector3d& p0, Vector3d& p1, Vector3d& p2) const
+{
+    p0 = v0.pos, p1 = v1.pos, p2 = v2.pos;
+    return true;
+}
+
+/**
+ * Generates information about the intersection of a ray hitting a triangle.
+ * 
+ * @param ray The ray that hit the triangle.
+ * @param hit Where the ray hit the triangle.
+ * @param info The intersection info to fill.
+ */
+void Triangle::GenerateIntersectionInfo(const Ray& ray, const HitRecord& hit, IntersectionInfo& info) const
+{
+    double u = hit.u, v = hit.v;
+
     info.direction = ray.direction;
 
     Vector3d E1 = v1.pos-v0.pos;
@@ -90,8 +114,6 @@ bool Triangle::GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info)
 
     info.position = v0.pos + u*E1 + v*E2 + (info.geometricnormal*info.direction < 0 ? info.geometricnormal*eps : -info.geometricnormal*eps);
     info.material = material;
-
-    return true;
 }
 
 /**
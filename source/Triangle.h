@@ -11,7 +11,7 @@
 
 #include "Ray.h"
 #include "Primitive.h"
-#include "Boundingbox.h"
+#include "BoundingBox.h"
 #include "Model.h"
 #include "Vertex3d.h"
 
@@ -31,7 +31,9 @@ public:
     std::tuple<bool, BoundingBox> GetClippedBoundingBox(const BoundingBox& clipbox) const;
     
     double Intersect(const Ray& ray) const;
-    bool GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const;
+    HitRecord IntersectHit(const Ray& ray) const;
+    void GenerateIntersectionInfo(const Ray& ray, const HitRecord& hit, IntersectionInfo& info) const;
+    bool GetVertices(Vector3d& p0, Vector3d& p1, Vector3d& p2) const;
 
     void Save(Bytestream& stream) const;
     void Load(Bytestream& stream);
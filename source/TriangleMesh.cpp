@@ -20,33 +20,21 @@
 #include <numeric>
 #include <unordered_map>
 
-/**
- * Destructor.
- */
-MeshVertex::~MeshVertex()
-{
-}
-
 /** 
  * Constructor.
  */
-MeshTriangle::MeshTriangle()
+MeshTriangle::MeshTriangle() : mesh(nullptr), index(0)
 {
 }
 
 /**
- * Constructor, creates a mesh triangle from three vectors
+ * Constructor, creates a handle to a triangle of a mesh.
  * 
- * @param a The first vector.
- * @param b The second vector.
- * @param c The third vector.
+ * @param mesh The mesh that holds the triangle.
+ * @param index The index of the triangle in the mesh.
  */
-MeshTriangle::MeshTriangle(const Vector3d& a, const Vector3d& b, const Vector3d& c)
+MeshTriangle::MeshTriangle(const TriangleMesh* mesh, int index) : mesh(mesh), index(index)
 {
-    v0 = new MeshVertex(a);
-    v1 = new MeshVertex(b);
-    v2 = new MeshVertex(c);
-    v0->normal = v1->normal = v2->normal = (v1->pos-v0->pos)^(v2->pos-v0->pos);
 }
 
 /**
@@ -54,9 +42,17 @@ MeshTriangle::MeshTriangle(const Vector3d& a, const Vector3d& b, const Vector3d&
  */
 MeshTriangle::~MeshTriangle()
 {
-    delete v0;
-    delete v1;
-    delete v2;
+}
+
+/**
+ * Returns one of the vertices of the triangle.
+ * 
+ * @param corner The corner of the triangle, 0, 1 or 2.
+ * @returns The vertex at that corner.
+ */
+const Vertex3d& MeshTriangle::GetVertex(int corner) const
+{
+    return mesh->vertices[mesh->indices[3*index + corner]];
 }
 
 /**
@@ -66,7 +62,8 @@ MeshTriangle::~MeshTriangle()
  */
 Vector3d MeshTriangle::GetNormal() const
 {
-    Vector3d normal = (v1->pos-v0->pos)^(v2->pos-v0->pos);
+    const TriangleRecord& r = mesh->records[index];
+    Vector3d normal = r.e1^r.e2;
     normal.Normalize();
     return normal;
 }
@@ -76,20 +73,10 @@ Vector3d MeshTriangle::GetNormal() const
  * 
  * @returns The area of the mesh triangle.
  */
-double MeshTriangle::GetArea()
-{
-    return std::abs(((v1->pos-v0->pos)^(v2->pos-v0->pos)).Length())/2;
-}
-
-/**
- * Constructor, creates a mesh triangle from three mesh vertices.
- * 
- * @param v0 The first mesh vertex.
- * @param v1 The second mesh vertex.
- * @param v2 The third mesh vertex.
- */
-MeshTriangle::MeshTriangle(MeshVertex* v0, MeshVertex* v1, MeshVertex* v2) : v0(v0), v1(v1), v2(v2)
+double MeshTriangle::GetArea() const
 {
+    const TriangleRecord& r = mesh->records[index];
+    return std::abs((r.e1^r.e2).Length())/2;
 }
 
 /**
@@ -101,39 +88,100 @@ MeshTriangle::MeshTriangle(MeshVertex* v0, MeshVertex* v1, MeshVertex* v2) : v0(
  */
 double MeshTriangle::Intersect(const Ray& ray) const
 {
-    auto [t, u, v] = IntersectTriangle(v0->pos, v1->pos, v2->pos, ray);
+    const TriangleRecord& r = mesh->records[index];
+    auto [t, u, v] = IntersectTriangleEdges(r.v0, r.e1, r.e2, ray);
     return t;
 }
 
+/**
+ * Intersects the MeshTriangle with a ray, recording the barycentric coordinates of the hit.
+ * 
+ * @param ray The ray to intersect with.
+ * @returns The hit, with a distance of -inf if the triangle wasn't hit.
+ */
+HitRecord MeshTriangle::IntersectHit(const Ray& ray) const
+{
+    const TriangleRecord& r = mesh->records[index];
+    auto [t, u, v] = IntersectTriangleEdges(r.v0, r.e1, r.e2, ray);
+    return { t, u, v, this, -1 };
+}
+
+/**
+ * Intersects the MeshTriangle with some of the rays of a packet, testing the whole packet at once.
+ * 
+ * @param packet The packet of rays.
+ * @param mask The rays of the packet to intersect with, as bits.
+ * @param t The distance along each of the rays that the triangle was hit, or -inf if it wasn't
+ *          hit, left alone for the other rays.
+ */
+void MeshTriangle::Intersect(const RayPacket& packet, unsigned int mask, double* t) const
+{
+    const TriangleRecord& r = mesh->records[index];
+    double ts[RayPacket::size], u[RayPacket::size], v[RayPacket::size];
+    IntersectTriangleEdges(r.v0, r.e1, r.e2, packet, ts, u, v);
+    for(int i = 0; i < packet.n; i++)
+        if(mask >> i & 1)
+            t[i] = ts[i];
+}
+
+/**
+ * Intersects the MeshTriangle with some of the rays of a packet, testing the whole packet at once.
+ * 
+ * @param packet The packet of rays.
+ * @param mask The rays of the packet to intersect with, as bits.
+ * @param hits The hit of each of the rays, with a distance of -inf if the triangle wasn't hit,
+ *             left alone for the other rays.
+ */
+void MeshTriangle::IntersectHit(const RayPacket& packet, unsigned int mask, HitRecord* hits) const
+{
+    const TriangleRecord& r = mesh->records[index];
+    double t[RayPacket::size], u[RayPacket::size], v[RayPacket::size];
+    IntersectTriangleEdges(r.v0, r.e1, r.e2, packet, t, u, v);
+    for(int i = 0; i < packet.n; i++)
+        if(mask >> i & 1)
+            hits[i] = { t[i], u[i], v[i], this, -1 };
+}
+
+/**
+ * Returns the corners of the triangle.
+ * 
+ * @param p0 The first corner.
+ * @param p1 The second corner.
+ * @param p2 The third corner.
+ * @returns True, since this is a triangle.
+ */
+bool MeshTriangle::GetVertices(Vector3d& p0, Vector3d& p1, Vector3d& p2) const
+{
+    p0 = GetVertex(0).pos, p1 = GetVertex(1).pos, p2 = GetVertex(2).pos;
+    return true;
+}
+
 
 /**
  * Generates information about the intersection of a ray hitting a mesh triangle.
  * 
  * @param ray The ray that hit the triangle.
+ * @param hit Where the ray hit the triangle.
  * @param info The intersection info to fill.
- * @returns Whether the triangle was hit.
  */
-bool MeshTriangle::GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const
+void MeshTriangle::GenerateIntersectionInfo(const Ray& ray, const HitRecord& hit, IntersectionInfo& info) const
 {
-    auto [t, u, v] = IntersectTriangle(v0->pos, v1->pos, v2->pos, ray);
-    if(t < 0)
-        return false;
+    const TriangleRecord& r = mesh->records[index];
+    double u = hit.u, v = hit.v;
 
-    Vector3d E1 = v1->pos-v0->pos, E2 = v2->pos-v0->pos;
+    const Vertex3d& v0 = GetVertex(0), &v1 = GetVertex(1), &v2 = GetVertex(2);
 
     info.direction = ray.direction;
-    info.normal = u*(v1->normal-v0->normal) + v*(v2->normal-v0->normal) + v0->normal;
+    info.normal = u*(v1.normal-v0.normal) + v*(v2.normal-v0.normal) + v0.normal;
 
     info.geometricnormal = GetNormal();
     info.normal.Normalize();
 
     auto posnorm = (info.geometricnormal*info.direction < 0 ? info.geometricnormal*eps : -info.geometricnormal*eps);
-    info.position = v0->pos + u*E1 + v*E2 + posnorm;
+    info.position = r.v0 + u*r.e1 + v*r.e2 + posnorm;
     info.texpos.x = u;
     info.texpos.y = v;
     info.material = material;
-
-    return true;
 }
 
 /**
@@ -144,8 +192,9 @@ bool MeshTriangle::GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& in
  */
 TriangleMesh::TriangleMesh(const std::string& fileName, Material* mat)
 {
-    auto [mesh, meshLights] = ReadFromFile(fileName, mat);
+    auto [loaded, mesh, meshLights] = ReadFromFile(fileName, mat);
     *this = *mesh;
+    delete mesh;
 }
 
 /**
@@ -155,6 +204,35 @@ TriangleMesh::TriangleMesh()
 {
 }
 
+/**
+ * Copy constructor.
+ * 
+ * @param mesh The mesh to copy.
+ */
+TriangleMesh::TriangleMesh(const TriangleMesh& mesh)
+{
+    *this = mesh;
+}
+
+/**
+ * Copy assignment operator. The triangles of the copy refer to the copy rather than to the
+ * original mesh.
+ * 
+ * @param mesh The mesh to copy.
+ * @returns This mesh.
+ */
+TriangleMesh& TriangleMesh::operator=(const TriangleMesh& mesh)
+{
+    vertices = mesh.vertices;
+    indices = mesh.indices;
+    records = mesh.records;
+    triangles = mesh.triangles;
+    materials = mesh.materials;
+    for(auto& t : triangles)
+        t.mesh = this;
+    return *this;
+}
+
 /**
  * Destructor.
  */
@@ -167,11 +245,12 @@ TriangleMesh::~TriangleMesh()
  */
 BoundingBox MeshTriangle::GetBoundingBox() const
 {
+    const Vector3d& p0 = GetVertex(0).pos, &p1 = GetVertex(1).pos, &p2 = GetVertex(2).pos;
     BoundingBox b;
     for(int i = 0; i < 3; i++)
     {
-        b.c1[i] = min(v0->pos[i], v1->pos[i], v2->pos[i]);
-        b.c2[i] = max(v0->pos[i], v1->pos[i], v2->pos[i]);
+        b.c1[i] = min(p0[i], p1[i], p2[i]);
+        b.c2[i] = max(p0[i], p1[i], p2[i]);
     }
     return b;
 }
@@ -187,7 +266,7 @@ BoundingBox MeshTriangle::GetBoundingBox() const
  */
 std::tuple<bool, BoundingBox> MeshTriangle::GetClippedBoundingBox(const BoundingBox& clipbox) const
 {
-    std::vector<Vector3d> points = { v0->pos, v1->pos, v2->pos };
+    std::vector<Vector3d> points = { GetVertex(0).pos, GetVertex(1).pos, GetVertex(2).pos };
 
     for(int i = 0; i < 3; i++)
     {
@@ -220,7 +299,56 @@ std::tuple<bool, BoundingBox> MeshTriangle::GetClippedBoundingBox(const Bounding
 void TriangleMesh::AddToScene(Scene& scene)
 {
     for(auto& t : triangles)
-        Scene::PrimitiveAdder::AddPrimitive(scene, t);
+        Scene::PrimitiveAdder::AddPrimitive(scene, &t);
+}
+
+/**
+ * Adds a vertex to the mesh.
+ * 
+ * @param vertex The vertex to add.
+ * @returns The index of the vertex.
+ */
+int TriangleMesh::AddVertex(const Vertex3d& vertex)
+{
+    vertices.push_back(vertex);
+    return (int) vertices.size() - 1;
+}
+
+/**
+ * Adds a triangle to the mesh. Since the triangles are stored contiguously, this should not be
+ * done after the triangles have been handed out to a scene.
+ * 
+ * @param v0 The index of the first vertex.
+ * @param v1 The index of the second vertex.
+ * @param v2 The index of the third vertex.
+ * @param material The material of the triangle.
+ * @returns The index of the triangle.
+ */
+int TriangleMesh::AddTriangle(int v0, int v1, int v2, Material* material)
+{
+    int index = (int) triangles.size();
+    indices.insert(indices.end(), { v0, v1, v2 });
+
+    const Vector3d& p0 = vertices[v0].pos;
+    records.push_back({ p0, vertices[v1].pos - p0, vertices[v2].pos - p0 });
+
+    triangles.emplace_back(this, index);
+    triangles.back().SetMaterial(material);
+    return index;
+}
+
+/**
+ * Recalculates the intersection records of the triangles from the vertices, which needs to be
+ * done after the vertex positions or the triangle indices have been changed.
+ */
+void TriangleMesh::UpdateTriangles()
+{
+    for(int i = 0; i < (int) triangles.size(); i++)
+    {
+        const Vector3d& p0 = vertices[indices[3*i]].pos;
+        records[i] = { p0, vertices[indices[3*i+1]].pos - p0, vertices[indices[3*i+2]].pos - p0 };
+        triangles[i].mesh = this;
+    }
 }
 
 /**
@@ -237,12 +365,13 @@ void TriangleMesh::Transform(const Matrix3d& m)
         m(0,1)*m(1,2)-m(0,2)*m(1,1),m(0,2)*m(1,0)-m(0,0)*m(1,2),m(0,0)*m(1,1)-m(0,1)*m(1,0),0,
         0,0,0,1);
 
-    for(auto& v : points)
+    for(auto& v : vertices)
     {
-        v->pos = m*v->pos;
-        v->normal = nm*v->normal;
-        v->normal.Normalize();
+        v.pos = m*v.pos;
+        v.normal = nm*v.normal;
+        v.normal.Normalize();
     }
+    UpdateTriangles();
 }
 
 /**
@@ -252,12 +381,11 @@ void TriangleMesh::Transform(const Matrix3d& m)
  */
 void TriangleMesh::Save(Bytestream& stream) const
 {
-    std::unordered_map<Vertex3d*, unsigned int> vertexMemToIndex;
     std::unordered_map<Material*, unsigned int> materialMemToIndex;
 
     stream << (unsigned char)ID_TRIANGLEMESH; 
     stream << materials.size();
-    stream << points.size();
+    stream << vertices.size();
     stream << triangles.size();
 
     for(unsigned int i = 0; i < materials.size(); i++)
@@ -265,21 +393,17 @@ void TriangleMesh::Save(Bytestream& stream) const
         materials[i]->Save(stream);
         materialMemToIndex[materials[i]] = i;
     }
-    for(unsigned int i = 0; i < points.size(); i++)
+    for(auto& v : vertices)
     {
-        Vertex3d* v = points[i];
-        stream << v->pos.x << v->pos.y << v->pos.z
-               << v->normal.x << v->normal.y << v->normal.z
-               << v->texpos.x << v->texpos.y;
-        vertexMemToIndex[v] = i;
+        stream << v.pos.x << v.pos.y << v.pos.z
+               << v.normal.x << v.normal.y << v.normal.z
+               << v.texpos.x << v.texpos.y;
     }
-    for(auto it = triangles.begin(); it < triangles.end(); it++)
+    for(unsigned int i = 0; i < triangles.size(); i++)
     {
-        MeshTriangle* v = *it;
-
-        stream << vertexMemToIndex[v->v0] 
-               << vertexMemToIndex[v->v1] << vertexMemToIndex[v->v2];
-        stream << materialMemToIndex[v->GetMaterial()];
+        stream << (unsigned int) indices[3*i] 
+               << (unsigned int) indices[3*i+1] << (unsigned int) indices[3*i+2];
+        stream << materialMemToIndex[triangles[i].GetMaterial()];
     }
 }
 
@@ -293,7 +417,7 @@ void TriangleMesh::Load(Bytestream& stream)
     size_t nMats, nPoints, nTriangles;
     stream >> nMats >> nPoints >> nTriangles;
 
-    materials.clear(); points.clear(); triangles.clear();
+    materials.clear(); vertices.clear(); indices.clear(); records.clear(); triangles.clear();
 
     for(unsigned int i = 0; i < nMats; i++)
     {
@@ -304,22 +428,23 @@ void TriangleMesh::Load(Bytestream& stream)
         mat->Load(stream);
         materials.push_back(mat);
     }
+    vertices.reserve(nPoints);
     for(unsigned int i = 0; i < nPoints; i++)
     {
-        Vertex3d* v = new Vertex3d;
-        stream >> v->pos.x >> v->pos.y >> v->pos.z 
-               >> v->normal.x >> v->normal.y >> v->normal.z 
-               >> v->texpos.x >> v->texpos.y;
-        points.push_back(static_cast<MeshVertex*>(v));
+        Vertex3d v;
+        stream >> v.pos.x >> v.pos.y >> v.pos.z 
+               >> v.normal.x >> v.normal.y >> v.normal.z 
+               >> v.texpos.x >> v.texpos.y;
+        vertices.push_back(v);
     }
+    indices.reserve(3*nTriangles);
+    records.reserve(nTriangles);
+    triangles.reserve(nTriangles);
     for(unsigned int i = 0; i < nTriangles; i++)
     {
-        MeshTriangle* v = new MeshTriangle;
         unsigned int n1, n2, n3, m;
         stream >> n1 >> n2 >> n3;
-        v->v0 = points[n1]; v->v1 = points[n2]; v->v2 = points[n3];
         stream >> m;
-        v->SetMaterial(materials[m]);
-        triangles.push_back(v);
+        AddTriangle(n1, n2, n3, materials[m]);
     }
 }
\ No newline at end of file
@@ -17,24 +17,15 @@
 #include "Model.h"
 #include "Vertex3d.h"
 
-class MeshTriangle;
 class TriangleMesh;
 class Matrix3d;
 
-class MeshVertex : public Vertex3d
-{
-public:
-    using Vertex3d::Vertex3d;
-    ~MeshVertex();
-
-    std::vector<MeshTriangle*> triangles;
-};
-
+// A triangle of a triangle mesh, referring to its vertices and intersection data by its index in
+// the mesh rather than holding them itself
 class MeshTriangle : public Primitive
 {
 public:
-    MeshTriangle(MeshVertex* _v0, MeshVertex* _v1, MeshVertex* _v2);
-    MeshTriangle(const Vector3d&, const Vector3d&, const Vector3d&);
+    MeshTriangle(const TriangleMesh* mesh, int index);
     MeshTriangle();
     ~MeshTriangle();
 
@@ -42,14 +33,27 @@ public:
     BoundingBox GetBoundingBox() const;
 
     double Intersect(const Ray& ray) const;
-    bool GenerateIntersectionInfo(const Ray& ray, IntersectionInfo& info) const;
+    void Intersect(const RayPacket& packet, unsigned int mask, double* t) const;
+    HitRecord IntersectHit(const Ray& ray) const;
+    void IntersectHit(const RayPacket& packet, unsigned int mask, HitRecord* hits) const;
+    void GenerateIntersectionInfo(const Ray& ray, const HitRecord& hit, IntersectionInfo& info) const;
+    bool GetVertices(Vector3d& p0, Vector3d& p1, Vector3d& p2) const;
 
-    double GetArea();
+    double GetArea() const;
     Vector3d GetNormal() const;
 
-    Vertex3d* v0, *v1, *v2;
+    const Vertex3d& GetVertex(int corner) const;
+
+    const TriangleMesh* mesh;
+    int index;
 };
 
+// The data needed to intersect a triangle, a corner and the two edges going out from it
+class TriangleRecord
+{
+public:
+    Vector3d v0, e1, e2;
+};
 
 class TriangleMesh : public Model
 {
@@ -57,17 +61,26 @@ class TriangleMesh : public Model
 public:
     TriangleMesh();
     TriangleMesh(const std::string&, Material*);
+    TriangleMesh(const TriangleMesh&);
     ~TriangleMesh();
 
+    TriangleMesh& operator=(const TriangleMesh&);
+
     void AddToScene(Scene& scene);
 
+    int AddVertex(const Vertex3d& vertex);
+    int AddTriangle(int v0, int v1, int v2, Material* material);
+    void UpdateTriangles();
+
     void Transform(const Matrix3d& m);
 
     void Save(Bytestream& stream) const;
     void Load(Bytestream& stream);
 
 //protected:
-    std::vector<MeshTriangle*> triangles;
-    std::vector<Vertex3d*> points;
+    std::vector<Vertex3d> vertices;
+    std::vector<int> indices; // Three vertex indices per triangle
+    std::vector<TriangleRecord> records;
+    std::vector<MeshTriangle> triangles;
     std::vector<Material*> materials;
 };
@@ -207,8 +207,8 @@ std::tuple<Color, Point> UniformEnvironmentLight::NextEventEstimation(const Rend
 
     if(renderer->TraceShadowRay(lightRay, d))
     {
-        double cosphi = abs(info.normal*toLight);
-        double costheta = abs(toLight*lightNormal);
+        double cosphi = std::abs(info.normal*toLight);
+        double costheta = std::abs(toLight*lightNormal);
         Material* mat = info.material;
         Color c = mat->BRDF(info, toLight, component)*costheta*cosphi*intensity*GetArea()/(d*d);
         return { c, lightPoint };
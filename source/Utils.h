@@ -10,6 +10,8 @@
 #pragma once
 
 #define NOMINMAX
+#include <algorithm>
+#include <limits>
 #include <string>
 #include <vector>
 
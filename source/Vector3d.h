@@ -4,46 +4,46 @@
  * 
  * @file Vector3d.h
  * 
- * Declaration of the Vector3d class.
+ * Declaration and implementation of the Vector3d and Vector2d classes for vector arithmetic. They
+ * are defined here so that every operation can be inlined, and they are trivially copyable.
  */
 
 #pragma once
 
 #include <cmath>
 #include <sstream>
+#include <utility>
 
 class Matrix3d;
 
 class Vector3d
 {
 public:
-    Vector3d(double x, double y, double z);
-    ~Vector3d();
-    Vector3d();
+    constexpr Vector3d(double x, double y, double z);
+    Vector3d() = default;
 
-    Vector3d& operator=(const Vector3d&);
-    Vector3d operator+(const Vector3d&) const;
-    Vector3d operator-(const Vector3d&) const;
-    Vector3d operator-() const;
+    constexpr Vector3d operator+(const Vector3d&) const;
+    constexpr Vector3d operator-(const Vector3d&) const;
+    constexpr Vector3d operator-() const;
 
-    Vector3d operator+=(const Vector3d& v);
-    Vector3d operator-=(const Vector3d& v);
+    constexpr Vector3d operator+=(const Vector3d& v);
+    constexpr Vector3d operator-=(const Vector3d& v);
 
     Vector3d operator*=(const Matrix3d& m);
-    bool operator!() const;
-    bool operator!=(const Vector3d&) const;
-    bool operator==(const Vector3d&) const;
-    double operator*(const Vector3d&) const;
-    Vector3d operator^(const Vector3d&)	const;
-    Vector3d operator/(double) const;
-    Vector3d operator/=(double);
-    Vector3d operator*=(double);
-    Vector3d operator*(double) const;
-    double& operator[](int);
-    double operator[](int) const;
-    
+    constexpr bool operator!() const;
+    constexpr bool operator!=(const Vector3d&) const;
+    constexpr bool operator==(const Vector3d&) const;
+    constexpr double operator*(const Vector3d&) const;
+    constexpr Vector3d operator^(const Vector3d&) const;
+    constexpr Vector3d operator/(double) const;
+    constexpr Vector3d operator/=(double);
+    constexpr Vector3d operator*=(double);
+    constexpr Vector3d operator*(double) const;
+    constexpr double& operator[](int);
+    constexpr double operator[](int) const;
+
     double Length() const;
-    double Length2() const;
+    constexpr double Length2() const;
     void Normalize();
     Vector3d Normalized() const;
     bool IsValid() const;
@@ -54,18 +54,16 @@ public:
 class Vector2d
 {
 public:
-    Vector2d(double x, double y);
-    ~Vector2d();
-    Vector2d();
+    constexpr Vector2d(double x, double y);
+    Vector2d() = default;
 
-    Vector2d& operator=(const Vector2d&);
-    Vector2d operator+(const Vector2d&) const;
-    Vector2d operator-(const Vector2d&) const;
-    Vector2d operator*(double) const;
-    double operator^(const Vector2d&) const;
-    bool operator<(const Vector2d&) const;
+    constexpr Vector2d operator+(const Vector2d&) const;
+    constexpr Vector2d operator-(const Vector2d&) const;
+    constexpr Vector2d operator*(double) const;
+    constexpr double operator^(const Vector2d&) const;
+    constexpr bool operator<(const Vector2d&) const;
 
-    double operator*(const Vector2d&) const;
+    constexpr double operator*(const Vector2d&) const;
 
     double Length() const;
     void Normalize();
@@ -74,6 +72,399 @@ public:
     double x, y;
 };
 
-Vector3d operator*(double t, const Vector3d& v);
-Vector2d operator*(double t, const Vector2d& v);
+constexpr Vector3d operator*(double t, const Vector3d& v);
+constexpr Vector2d operator*(double t, const Vector2d& v);
 std::ostream& operator<<(std::ostream& str, const Vector3d& v);
+
+/**
+ * Constructor.
+ * 
+ * @param x x
+ * @param y y
+ * @param z z
+ */
+constexpr Vector3d::Vector3d(double x, double y, double z) : x(x), y(y), z(z)
+{
+}
+
+/**
+ * Adds a given vector to the vector.
+ * 
+ * @param v The vector to add.
+ * @returns The vector sum.
+ */
+constexpr Vector3d Vector3d::operator+=(const Vector3d& v)
+{
+    x += v.x;
+    y += v.y;
+    z += v.z;
+    return *this;
+}
+
+/**
+ * Subtracts the vector by the given vector.
+ * 
+ * @param v The vector to subtract.
+ * @returns The vector difference.
+ */
+constexpr Vector3d Vector3d::operator-=(const Vector3d& v)
+{
+    x -= v.x;
+    y -= v.y;
+    z -= v.z;
+    return *this;
+}
+
+/**
+ * Vector/scalar division.
+ * 
+ * @param f The scalar to divide by.
+ * @returns The quotient.
+ */
+constexpr Vector3d Vector3d::operator/(double f) const
+{
+    return Vector3d(x/f, y/f, z/f);
+}
+
+/**
+ * Vector addition.
+ * 
+ * @param v The vector to add.
+ * @returns The vector sum.
+ */
+constexpr Vector3d Vector3d::operator+(const Vector3d& v) const
+{
+    return Vector3d(x+v.x, y+v.y, z+v.z);
+}
+
+/**
+ * Vector subtraction.
+ * 
+ * @param v The vector to subtract.
+ * @returns The vector difference.
+ */
+constexpr Vector3d Vector3d::operator-(const Vector3d& v) const
+{
+    return Vector3d(x-v.x, y-v.y, z-v.z);
+}
+
+/**
+ * Scalar product.
+ * 
+ * @param v The vector to form the scalar product with.
+ * @returns The scalar product.
+ */
+constexpr double Vector3d::operator*(const Vector3d& v) const
+{
+    return x*v.x + y*v.y + z*v.z;
+}
+
+/**
+ * Vector product.
+ * 
+ * @param v The vector to form the product with.
+ * @returns The vector product.
+ */
+constexpr Vector3d Vector3d::operator^(const Vector3d& v) const
+{
+    return Vector3d(y*v.z-z*v.y, z*v.x-x*v.z, x*v.y-y*v.x);
+}
+
+/**
+ * Returns the norm of the vector.
+ */
+inline double Vector3d::Length() const
+{
+    return std::sqrt(x*x + y*y + z*z);
+}
+
+/**
+ * Normalizes the vector.
+ */
+inline void Vector3d::Normalize()
+{
+    double l = Length();
+
+    x /= l;
+    y /= l;
+    z /= l;
+}
+
+/**
+ * Returns the normalized vector.
+ * 
+ * @returns The normalized vector.
+ */
+inline Vector3d Vector3d::Normalized() const
+{
+    double l = Length();
+    return { x/l, y/l, z/l };
+}
+
+/**
+ * Scalar/vector multiplication.
+ * 
+ * @param t The scalar to multiply by.
+ * @returns The product.
+ */
+constexpr Vector3d Vector3d::operator*(double t) const
+{
+    return Vector3d(t*x, t*y, t*z);
+}
+
+/**
+ * Divides the vector by a scalar.
+ * 
+ * @param t The scalar to divide by.
+ * @returns The quotient.
+ */
+constexpr Vector3d Vector3d::operator/=(double t)
+{
+    x/= t;
+    y/= t;
+    z/= t;
+    return *this;
+}
+
+/**
+ * Multiplies the vector with a scalar.
+ * 
+ * @param t The scalar to multiply by.
+ * @returns The product.
+ */
+constexpr Vector3d Vector3d::operator*=(double t)
+{
+    x*= t;
+    y*= t;
+    z*= t;
+    return *this;
+}
+
+/**
+ * Vector negation.
+ * 
+ * @returns The opposite vector.
+ */
+constexpr Vector3d Vector3d::operator-() const
+{
+    return Vector3d(-x, -y, -z);
+}
+
+/**
+ * Returns true if the vector is the null vector.
+ * 
+ * @returns True if the vector is all zeroes.
+ */
+constexpr bool Vector3d::operator!() const
+{
+    return x == 0 && y == 0 && z == 0;
+}
+
+/**
+ * Returns a reference to a component of the vector.
+ * 
+ * @param t The component to return (x=0, y=1, z=2).
+ * @returns A reference to the result.
+ */
+constexpr double& Vector3d::operator[](int t)
+{
+    return (&x)[t];
+}
+
+/**
+ * Returns a component of the vector.
+ * 
+ * @param t The component to return (x=0, y=1, z=2).
+ * @returns The value of the component.
+ */
+constexpr double Vector3d::operator[](int t) const
+{
+    return (&x)[t];
+}
+
+/**
+ * Sanity checking.
+ * 
+ * @returns True if all components are finite.
+ */
+inline bool Vector3d::IsValid() const
+{
+    return std::isfinite(x) && std::isfinite(y) && std::isfinite(z);
+}
+
+/**
+ * Equality testing.
+ * 
+ * @param v The vector to test for equality.
+ * @returns True if at all vector components are equal.
+ */
+constexpr bool Vector3d::operator==(const Vector3d& v) const
+{
+    return v.x == x && v.y == y && v.z == z;
+}
+
+/**
+ * Inequality testing.
+ * 
+ * @param v The vector to test for inequality.
+ * @returns True if at least one vector component is unequal.
+ */
+constexpr bool Vector3d::operator!=(const Vector3d& v) const
+{
+    return v.x != x || v.y != y || v.z != z;
+}
+
+/**
+ * Length squared.
+ * 
+ * @returns The squared length of the vector.
+ */
+constexpr double Vector3d::Length2() const
+{
+    return x*x + y*y + z*z;
+}
+
+/**
+ * Scalar multiplication of a vector.
+ * 
+ * @param t The real number to scale with.
+ * @param v The vector to scale.
+ * @returns The value of the vector multiplied with the scalar.
+ */
+constexpr Vector3d operator*(double t, const Vector3d& v)
+{
+    return Vector3d(t*v.x, t*v.y, t*v.z);
+}
+
+/**
+ * Outputs the vector to an ostream.
+ * 
+ * @param s The ostream to stream to.
+ * @param v The vector to output.
+ * @returns A reference to the ostream.
+ */
+inline std::ostream& operator<<(std::ostream& s, const Vector3d& v)
+{
+    return(s << "(" << v.x << "," << v.y << "," << v.z << ")");
+}
+
+/**
+ * Constructor.
+ * 
+ * @param x x
+ * @param y y
+ */
+constexpr Vector2d::Vector2d(double x, double y) : x(x), y(y)
+{
+}
+
+/**
+ * Vector addition.
+ * 
+ * @param v The vector to add.
+ * @returns The vector sum.
+ */
+constexpr Vector2d Vector2d::operator+(const Vector2d& v) const
+{
+    return Vector2d(x+v.x, y+v.y);
+}
+
+/**
+ * Vector subtraction.
+ * 
+ * @param v The vector to subtract.
+ * @returns The vector difference.
+ */
+constexpr Vector2d Vector2d::operator-(const Vector2d& v) const
+{
+    return Vector2d(x-v.x, y-v.y);
+}
+
+/**
+ * Scalar product.
+ * 
+ * @param v The other vector to form the scalar product with.
+ * @returns The scalar product.
+ */
+constexpr double Vector2d::operator*(const Vector2d& v) const
+{
+    return x*v.x + y*v.y;
+}
+
+/**
+ * Returns the length of the vector.
+ * 
+ * @returns The euclidean norm of the vector.
+ */
+inline double Vector2d::Length() const
+{
+    return std::sqrt(x*x + y*y);
+}
+
+/**
+ * Returns the 2d "vector product" of the two vectors, same as the 3d vector product if we let
+ * z = 0 and then return the value of the z component of the vector product.
+ * 
+ * @param v The vector on the right side of the vector product.
+ * @returns The vector product.
+ */
+constexpr double Vector2d::operator^(const Vector2d& v) const
+{
+    return x*v.y - y*v.x;
+}
+
+/**
+ * Compares two vectors component-wise, with the x component as the primary and y as the
+ * secondary comparison.
+ * 
+ * @returns True if this vector is smaller than the other.
+ */
+constexpr bool Vector2d::operator<(const Vector2d& v) const
+{
+    return std::make_pair(x, y) < std::make_pair(v.x, v.y);
+}
+
+/**
+ * Normalizes the vector.
+ */
+inline void Vector2d::Normalize()
+{
+    double l = Length();
+
+    x /= l;
+    y /= l;
+}
+
+/**
+ * Returns the normalized vector.
+ * 
+ * @returns The normalized vector.
+ */
+inline Vector2d Vector2d::Normalized() const
+{
+    double l = Length();
+    return { x/l, y/l };
+}
+
+/**
+ * Scalar multiplication of a vector.
+ * 
+ * @param t The scalar to multiply with.
+ * @returns The product.
+ */
+constexpr Vector2d Vector2d::operator*(double t) const
+{
+    return Vector2d(t*x, t*y);
+}
+
+/**
+ * Scalar multiplication of a vector.
+ * 
+ * @param t The scalar to multiply with.
+ * @param v The vector to multiply with.
+ * @returns The result.
+ */
+constexpr Vector2d operator*(double t, const Vector2d& v)
+{
+    return Vector2d(t*v.x, t*v.y);
+}
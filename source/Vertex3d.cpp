@@ -7,7 +7,7 @@
  * Implementation of the Vertex3d class.
  */
 
-#include "vertex3d.h"
+#include "Vertex3d.h"
 
 /**
  * Constructor.
@@ -35,10 +35,3 @@ Vertex3d::Vertex3d(const Vector3d& pos, const Vector3d& normal, const Vector2d&
 Vertex3d::Vertex3d(const Vector3d& v) : pos(v), normal(0, 0, 0)
 {
 }
-
-/**
- * Destructor.
- */
-Vertex3d::~Vertex3d()
-{
-}
@@ -0,0 +1,302 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file WavefrontPathTracer.cpp
+ * 
+ * Implementation of the WavefrontPathTracer class.
+ */
+
+#include "Bytestream.h"
+#include "Primitive.h"
+#include "Sample.h"
+#include "WavefrontPathTracer.h"
+#include <algorithm>
+
+// The paths of the tile that the thread is rendering, kept between tiles so that their arrays are
+// only allocated once per thread
+static thread_local PathStates storage;
+
+// The path whose next event estimation is being calculated, whose shadow ray is put aside for the
+// shadow stage rather than traced right away, or -1 outside of next event estimation
+static thread_local int shadowPath = -1;
+static thread_local bool tracedShadowRay = false;
+
+/**
+ * Makes room for a number of paths.
+ * 
+ * @param n The number of paths.
+ */
+void PathStates::Resize(int n)
+{
+    rays.resize(n);
+    hits.resize(n);
+    hitLights.resize(n);
+    infos.resize(n);
+    pathColors.resize(n);
+    finalColors.resize(n);
+    shadowRays.resize(n);
+    shadowDistances.resize(n);
+    shadowColors.resize(n);
+    randomStates.resize(n);
+    sampledLight.resize(n);
+    active.reserve(n);
+    shaded.reserve(n);
+    shadowed.reserve(n);
+}
+
+/**
+ * Constructor.
+ * 
+ * @param scene The scene that we render.
+ */
+WavefrontPathTracer::WavefrontPathTracer(std::shared_ptr<Scene> scene) : Renderer(scene)
+{
+}
+
+/**
+ * Destructor.
+ */
+WavefrontPathTracer::~WavefrontPathTracer()
+{
+}
+
+/**
+ * Calculates one sample per pixel for a tile of the image.
+ * 
+ * @param cam The camera from whose perspective we render.
+ * @param colBuf The color buffer of the size of the tile that we dump pixel contributions into.
+ * @param splats The buffer for light path contributions, which the path tracer has none of.
+ * @param x0 The x coordinate of the upper left pixel of the tile in the image.
+ * @param y0 The y coordinate of the upper left pixel of the tile in the image.
+ * @param pass The number of passes over the tile before this one.
+ */
+void WavefrontPathTracer::RenderTile(Camera& cam, ColorBuffer& colBuf, SplatBuffer& splats, int x0, int y0, unsigned int pass)
+{
+    int xres = colBuf.GetXRes();
+    int yres = colBuf.GetYRes();
+    if(stopping)
+        return;
+
+    PathStates& paths = storage;
+    Generate(paths, cam, x0, y0, xres, yres, pass);
+    while(!paths.active.empty())
+    {
+        Extend(paths);
+        Shade(paths);
+        Shadow(paths);
+    }
+
+    for(int y = 0; y < yres; y++)
+        for(int x = 0; x < xres; x++)
+            colBuf.SetPixel(x, y, paths.finalColors[y*xres + x]);
+}
+
+/**
+ * Starts the paths of all pixels of the tile with rays from the camera.
+ * 
+ * @param paths The paths of the tile.
+ * @param cam The camera.
+ * @param x0 The x coordinate of the upper left pixel of the tile in the image.
+ * @param y0 The y coordinate of the upper left pixel of the tile in the image.
+ * @param xres The width of the tile.
+ * @param yres The height of the tile.
+ * @param pass The number of passes over the tile before this one.
+ */
+void WavefrontPathTracer::Generate(PathStates& paths, Camera& cam, int x0, int y0, int xres, int yres, unsigned int pass)
+{
+    paths.Resize(xres*yres);
+    paths.active.clear();
+
+    for(int y = 0; y < yres; y++)
+    {
+        for(int x = 0; x < xres; x++)
+        {
+            int i = y*xres + x;
+            m_random.Seed((y0 + y)*cam.GetXRes() + x0 + x, pass);
+
+            double r[4];
+            m_random.GetDoubles(r, 4, 0, 1);
+            paths.rays[i] = cam.GetRayFromPixel(x0 + x, y0 + y, r[0], r[1], r[2], r[3]);
+            paths.infos[i] = IntersectionInfo();
+            paths.pathColors[i] = Color::Identity;
+            paths.finalColors[i] = Color::Black;
+            paths.sampledLight[i] = false;
+            paths.randomStates[i] = m_random.GetState();
+            paths.active.push_back(i);
+        }
+    }
+}
+
+/**
+ * Intersects the rays of all paths that are still going with the scene.
+ * 
+ * @param paths The paths of the tile.
+ */
+void WavefrontPathTracer::Extend(PathStates& paths) const
+{
+    // The rays are gathered in pixel order, so that the scene can trace neighbouring rays together
+    Ray rays[batchSize];
+    HitRecord hits[batchSize];
+    const Light* lights[batchSize];
+    for(int b = 0; b < (int) paths.active.size(); b += batchSize)
+    {
+        int n = std::min(batchSize, (int) paths.active.size() - b);
+        for(int j = 0; j < n; j++)
+            rays[j] = paths.rays[paths.active[b + j]];
+        scene->Intersect(rays, n, hits, lights);
+        for(int j = 0; j < n; j++)
+        {
+            paths.hits[paths.active[b + j]] = hits[j];
+            paths.hitLights[paths.active[b + j]] = lights[j];
+        }
+    }
+}
+
+/**
+ * Shades the hits of all paths that are still going, picking their next directions and lights
+ * to sample. The paths are shaded grouped by material. Paths that missed the scene, hit a light or
+ * lost the Russian roulette end here.
+ * 
+ * @param paths The paths of the tile.
+ */
+void WavefrontPathTracer::Shade(PathStates& paths)
+{
+    paths.shaded.clear();
+    for(int i : paths.active)
+    {
+        const HitRecord& hit = paths.hits[i];
+        if(hit.t < 0)
+            continue;
+
+        IntersectionInfo& info = paths.infos[i];
+        if(hit.primitive)
+            hit.primitive->GenerateIntersectionInfo(paths.rays[i], hit, info);
+        else
+            paths.hitLights[i]->GenerateIntersectionInfo(paths.rays[i], info);
+
+        // Randomly interesected a light source
+        if(auto hitLight = info.material->GetLight())
+        {
+            // Unless we already sampled the lights with next event estimation
+            if(!paths.sampledLight[i] && info.normal*info.direction < 0)
+                paths.finalColors[i] += paths.pathColors[i]*hitLight->GetIntensity();
+            continue;
+        }
+        paths.shaded.push_back(i);
+    }
+
+    std::sort(paths.shaded.begin(), paths.shaded.end(), [&paths](int a, int b)
+    {
+        return std::less<const Material*>()(paths.infos[a].material, paths.infos[b].material);
+    });
+
+    paths.active.clear();
+    paths.shadowed.clear();
+    for(int i : paths.shaded)
+    {
+        const IntersectionInfo& info = paths.infos[i];
+        m_random.SetState(paths.randomStates[i]);
+
+        auto sample = info.material->GetSample(info, m_random, false);
+        if(sample.specular) // Next event estimation would be zero since BRDF is an impulse function
+            paths.sampledLight[i] = false;
+        else
+        {
+            auto [light, lightWeight] = scene->PickLight(info, m_random.GetDouble(0.0, 1.0));
+            if(light)
+            {
+                shadowPath = i;
+                tracedShadowRay = false;
+                auto [color, lightPoint] = light->NextEventEstimation(this, info, m_random, sample.component);
+                shadowPath = -1;
+
+                if(color && tracedShadowRay)
+                {
+                    paths.shadowColors[i] = paths.pathColors[i]*color/lightWeight;
+                    paths.shadowed.push_back(i);
+                }
+                else
+                    paths.finalColors[i] += paths.pathColors[i]*color/lightWeight;
+            }
+            paths.sampledLight[i] = true;
+        }
+        paths.pathColors[i] *= sample.color/0.7;
+        paths.rays[i] = sample.outRay;
+
+        if(m_random.GetDouble(0, 1) < 0.7)
+            paths.active.push_back(i);
+        paths.randomStates[i] = m_random.GetState();
+    }
+
+    // Back in pixel order, where neighbouring rays go through the same parts of the scene
+    std::sort(paths.active.begin(), paths.active.end());
+}
+
+/**
+ * Traces the shadow rays put aside during shading and adds the light of those that reach their
+ * lights.
+ * 
+ * @param paths The paths of the tile.
+ */
+void WavefrontPathTracer::Shadow(PathStates& paths) const
+{
+    // Shading left the shadow rays in material order, pixel order keeps the batches together
+    std::sort(paths.shadowed.begin(), paths.shadowed.end());
+
+    Ray rays[batchSize];
+    double distances[batchSize];
+    bool occluded[batchSize];
+    for(int b = 0; b < (int) paths.shadowed.size(); b += batchSize)
+    {
+        int n = std::min(batchSize, (int) paths.shadowed.size() - b);
+        for(int j = 0; j < n; j++)
+        {
+            rays[j] = paths.shadowRays[paths.shadowed[b + j]];
+            distances[j] = paths.shadowDistances[paths.shadowed[b + j]];
+        }
+        scene->Intersect(rays, distances, n, occluded);
+        for(int j = 0; j < n; j++)
+            if(!occluded[j])
+                paths.finalColors[paths.shadowed[b + j]] += paths.shadowColors[paths.shadowed[b + j]];
+    }
+}
+
+/**
+ * Puts the shadow ray of the next event estimation of a path aside for the shadow stage, or
+ * traces it right away when called outside of next event estimation. The light is taken to be
+ * visible until the shadow stage finds out otherwise.
+ * 
+ * @param ray The shadow ray.
+ * @param tmax The distance to the light.
+ * @returns True, unless the ray is traced right away and something is in the way.
+ */
+bool WavefrontPathTracer::TraceShadowRay(const Ray& ray, double tmax) const
+{
+    if(shadowPath < 0 || tracedShadowRay)
+        return Renderer::TraceShadowRay(ray, tmax);
+
+    storage.shadowRays[shadowPath] = ray;
+    storage.shadowDistances[shadowPath] = tmax;
+    tracedShadowRay = true;
+    return true;
+}
+
+/**
+ * Saves information about the renderer to a bytestream.
+ * 
+ * @param stream The bytestream to stream to.
+ */
+void WavefrontPathTracer::Save(Bytestream& stream) const
+{
+    stream << ID_WAVEFRONTPATHTRACER;
+}
+
+/**
+ * Loads the renderer from a bytestream.
+ * 
+ * @param stream The bytestream to stream from.
+ */
+void WavefrontPathTracer::Load(Bytestream& stream)
+{
+}
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2022 Peter Otrebus-Larsson (otrebus@gmail.com)
+ * Distributed under GNU GPL v3. For full terms see the LICENSE file.
+ * 
+ * @file WavefrontPathTracer.h
+ * 
+ * Declaration of the WavefrontPathTracer class and helpers.
+ */
+
+#pragma once
+
+#include "HitRecord.h"
+#include "IntersectionInfo.h"
+#include "Randomizer.h"
+#include "Ray.h"
+#include "Renderer.h"
+#include <vector>
+
+// The paths of a tile as arrays of each of their parts, where path i belongs to pixel i of the
+// tile. The queues hold the indices of the paths that are still going, that are to be shaded and
+// that wait for their shadow rays
+class PathStates
+{
+public:
+    void Resize(int n);
+
+    std::vector<Ray> rays;
+    std::vector<HitRecord> hits;
+    std::vector<const Light*> hitLights; // The lights hit outside the partitioning
+    std::vector<IntersectionInfo> infos;
+    std::vector<Color> pathColors, finalColors;
+    std::vector<Ray> shadowRays;
+    std::vector<double> shadowDistances;
+    std::vector<Color> shadowColors; // What the shadow ray brings if nothing is in the way
+    std::vector<RandomizerState> randomStates;
+    std::vector<bool> sampledLight;
+
+    std::vector<int> active, shaded, shadowed;
+};
+
+// A path tracer that follows the paths of all pixels of a tile together, one bounce at a time.
+// Each bounce is done in stages that go through all paths: extending them by intersecting their
+// rays with the scene, shading the hits grouped by material and tracing the shadow rays of the
+// next event estimations. Each path draws the same numbers as in PathTracer, so the images are
+// the same
+class WavefrontPathTracer : public Renderer
+{
+public:
+    WavefrontPathTracer(std::shared_ptr<Scene> scene);
+    ~WavefrontPathTracer();
+
+    void RenderTile(Camera& cam, ColorBuffer& colBuf, SplatBuffer& splats, int x0, int y0, unsigned int pass);
+    bool TraceShadowRay(const Ray& ray, double tmax) const;
+
+    void Save(Bytestream& stream) const;
+    void Load(Bytestream& stream);
+
+private:
+    static constexpr int batchSize = 64; // The number of rays handed to the scene at a time
+
+    void Generate(PathStates& paths, Camera& cam, int x0, int y0, int xres, int yres, unsigned int pass);
+    void Extend(PathStates& paths) const;
+    void Shade(PathStates& paths);
+    void Shadow(PathStates& paths) const;
+};